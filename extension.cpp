@@ -35,6 +35,14 @@
 #include <vector>
 #include <unordered_map>
 #include <cstdint>
+#include <type_traits>
+#include <algorithm>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <list>
+#include <memory>
 
 using namespace std::literals::string_literals;
 
@@ -113,6 +121,7 @@ class IStaticPropMgrServer *staticpropmgr = nullptr;
 #include <variant_t.h>
 #include <shared/predictioncopy.h>
 #include <tier1/utldict.h>
+#include <tier1/KeyValues.h>
 #include <tier1/utlvector.h>
 #include <CDetour/detours.h>
 
@@ -338,6 +347,10 @@ int m_flSimulationTimeOffset = -1;
 int m_angAbsRotationOffset = -1;
 int m_angRotationOffset = -1;
 int m_bloodColorOffset = -1;
+#if SOURCE_ENGINE == SE_TF2
+int m_bPlayingMannVsMachineOffset = -1;
+int m_bTruceActiveOffset = -1;
+#endif
 int m_CollisionGroupOffset = -1;
 
 int m_bSequenceFinishedOffset = -1;
@@ -2074,6 +2087,9 @@ enum
 	TF_TEAM_COUNT
 };
 
+#define TF_TEAM_PVE_INVADERS_GIANTS 4
+#define TF_TEAM_HALLOWEEN 5
+
 enum TFNavAttributeType
 {
 	TF_NAV_INVALID						= 0x00000000,
@@ -3313,12 +3329,7 @@ CNavArea **CNavArea::m_openList = NULL;
 CNavArea **CNavArea::m_openListTail = NULL;
 uint32 *CNavArea::s_nCurrVisTestCounter = NULL;
 
-#if SOURCE_ENGINE == SE_TF2
-CNavArea *CNavMesh::GetNearestNavArea( const Vector &pos, bool anyZ, float maxDist, bool checkLOS, bool checkGround, int team ) const
-{
-	return call_mfunc<CNavArea *, CNavMesh, const Vector &, bool, float, bool, bool, int>(this, CNavMeshGetNearestNavArea, pos, anyZ, maxDist, checkLOS, checkGround, team);
-}
-#elif SOURCE_ENGINE == SE_LEFT4DEAD2
+#if SOURCE_ENGINE == SE_LEFT4DEAD2
 CNavArea *CNavMesh::GetNearestNavArea( const Vector &pos, bool anyZ, float maxDist, bool checkLOS, bool checkGround, bool unk ) const
 {
 	return call_mfunc<CNavArea *, CNavMesh, const Vector &, bool, float, bool, bool, bool>(this, CNavMeshGetNearestNavArea, pos, anyZ, maxDist, checkLOS, checkGround, unk);
@@ -3482,28 +3493,6 @@ CNavArea *CNavMesh::GetNavAreaByID( unsigned int id ) const
 	return NULL;
 }
 
-bool CNavMesh::GetSimpleGroundHeight( const Vector &pos, float *height, Vector *normal ) const
-{
-	Vector to;
-	to.x = pos.x;
-	to.y = pos.y;
-	to.z = pos.z - 9999.9f;
-
-	trace_t result;
-
-	UTIL_TraceLine( pos, to, MASK_NPCSOLID_BRUSHONLY, NULL, COLLISION_GROUP_NONE, &result );
-
-	if (result.startsolid)
-		return false;
-
-	*height = result.endpos.z;
-
-	if (normal)
-		*normal = result.plane.normal;
-
-	return true;
-}
-
 unsigned int CNavMesh::GetPlace( const Vector &pos ) const
 {
 	CNavArea *area = GetNearestNavArea( pos, true, 10000.0f, false, false, TEAM_ANY );
@@ -3535,11 +3524,6 @@ Place CNavMesh::NameToPlace( const char *name ) const
 	return UNDEFINED_PLACE;
 }
 
-bool CNavMesh::GetGroundHeight( const Vector &pos, float *height, Vector *normal ) const
-{
-	return call_mfunc<bool, CNavMesh, const Vector &, float *, Vector *>(this, CNavMeshGetGroundHeight, pos, height, normal);
-}
-
 #if SOURCE_ENGINE == SE_TF2
 template< typename CostFunctor >
 bool NavAreaBuildPath_real( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea, float maxPathLength, int teamID, bool ignoreNavBlockers )
@@ -3554,6 +3538,7 @@ bool NavAreaBuildPath_real( CNavArea *startArea, CNavArea *goalArea, const Vecto
 }
 #endif
 
+
 class CBaseCombatWeapon;
 class Path;
 struct animevent_t;
@@ -11719,2156 +11704,9597 @@ public:
 	virtual CNavArea *operator() ( CNavArea *currentGoal, CNavArea *newArea ) const = 0;
 };
 
-enum SegmentType
+/**
+ * IPathCost whose result only depends on the edge being crossed.
+ * operator() adds fromArea->GetCostSoFar() like every other IPathCost,
+ * NavSearchContext calls EdgeCost directly and adds its own cost so far so the areas are never read.
+ */
+class NativePathCost : public IPathCost
 {
-	ON_GROUND,
-	DROP_DOWN,
-	CLIMB_UP,
-	JUMP_OVER_GAP,
-	PATH_LADDER_UP,
-	PATH_LADDER_DOWN,
-	
-	NUM_SEGMENT_TYPES
+public:
+	// cost of moving from fromArea into area, negative if it can't be used
+	virtual float EdgeCost( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length ) const = 0;
+
+	// identifies every functor that would return the same costs, false if results can't be shared through NavPathCache
+	virtual bool GetCacheProfile( uint64_t &profile ) const { return false; }
+
+	// EdgeCost is never below the connection length times this, 0 if there is no such bound (keeps NavLandmarks out of its searches)
+	virtual float GetMinCostScale( void ) const { return 0.0f; }
+
+	float operator()( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length ) const override
+	{
+		float cost = EdgeCost( area, fromArea, ladder, elevator, length );
+		if ( cost < 0.0f || fromArea == NULL )
+			return cost;
+
+		return cost + fromArea->GetCostSoFar();
+	}
 };
 
-struct Segment
+// one area of a search result, id is kept so the area can be checked against the mesh after the search
+struct NavAreaChainLink
 {
-	CNavArea *area;									// the area along the path
-	NavTraverseType how;							// how to enter this area from the previous one
-	Vector pos;										// our movement goal position at this point in the path
-	const CNavLadder *ladder;						// if "how" refers to a ladder, this is it
-	
-	SegmentType type;								// how to traverse this segment of the path
-	Vector forward;									// unit vector along segment
-	float length;									// length of this segment
-	float distanceFromStart;						// distance of this node from the start of the path
-	float curvature;								// how much the path 'curves' at this point in the XY plane (0 = none, 1 = 180 degree doubleback)
-
-	Vector m_portalCenter;							// position of center of 'portal' between previous area and this area
-	float m_portalHalfWidth;						// half width of 'portal'
+	CNavArea *area;
+	unsigned int id;
+	NavTraverseType how;
 };
 
-ConVar path_compute_debug("path_compute_debug", "0");
-#if SOURCE_ENGINE == SE_LEFT4DEAD2
-ConVar path_compute_manual("path_compute_manual", "0");
-#endif
+// false if an area of a reused chain got blocked for teamID or mover can't go there anymore
+bool NavAreaChainIsPassable( const std::vector< NavAreaChainLink > &chain, int teamID, ILocomotion *mover )
+{
+	for ( const NavAreaChainLink &link : chain )
+	{
+		if ( link.area->IsBlocked( teamID ) )
+			return false;
 
-class Path
+		if ( mover && !mover->IsAreaTraversable( link.area ) )
+			return false;
+	}
+
+	return true;
+}
+
+// bumped whenever the nav mesh may have been replaced, anything derived from an older generation is thrown away
+unsigned int g_NavMeshGeneration = 0;
+
+// every connection NavSearchContext::BuildPath can follow out of area, with the length its cost is based on
+template< typename Func >
+void NavForEachConnection( CNavArea *area, Func func )
 {
-public:
-	virtual ~Path() = 0;
-	
-	static Path *create()
+	for ( int dir = 0; dir < NUM_DIRECTIONS; ++dir )
 	{
-		Path *bytes = (Path *)calloc(1, sizeof(Path));
-		call_mfunc<void>(bytes, PathCTOR);
-		return bytes;
+		const NavConnectVector *floorList = area->GetAdjacentAreas( (NavDirType)dir );
+		for ( int i = 0; i < floorList->Count(); ++i )
+		{
+			const NavConnect &floorConnect = floorList->Element( i );
+			float length = floorConnect.length > 0.0f ? floorConnect.length : ( floorConnect.area->GetCenter() - area->GetCenter() ).Length();
+			func( floorConnect.area, length );
+		}
 	}
-	
-	using SegmentType = ::SegmentType;
 
-	// @todo Allow custom Segment classes for different kinds of paths	
-	using Segment = ::Segment;
+	const NavLadderConnectVector *ladderList = area->GetLadders( CNavLadder::LADDER_UP );
+	for ( int i = 0; i < ladderList->Count(); ++i )
+	{
+		const CNavLadder *ladder = ladderList->Element( i ).ladder;
+		if ( ladder->m_topForwardArea )
+			func( ladder->m_topForwardArea, ladder->m_length );
+		if ( ladder->m_topLeftArea )
+			func( ladder->m_topLeftArea, ladder->m_length );
+		if ( ladder->m_topRightArea )
+			func( ladder->m_topRightArea, ladder->m_length );
+	}
 
-	virtual float GetLength( void ) const = 0;						// return length of path from start to finish
-	virtual const Vector &GetPosition( float distanceFromStart, const Segment *start = NULL ) const = 0;	// return a position on the path at the given distance from the path start
-	virtual const Vector &GetClosestPosition( const Vector &pos, const Segment *start = NULL, float alongLimit = 0.0f ) const = 0;		// return the closest point on the path to the given position
+	ladderList = area->GetLadders( CNavLadder::LADDER_DOWN );
+	for ( int i = 0; i < ladderList->Count(); ++i )
+	{
+		const CNavLadder *ladder = ladderList->Element( i ).ladder;
+		if ( ladder->m_bottomArea )
+			func( ladder->m_bottomArea, ladder->m_length );
+	}
 
-	virtual const Vector &GetStartPosition( void ) const = 0;	// return the position where this path starts
-	virtual const Vector &GetEndPosition( void ) const = 0;		// return the position where this path ends
-	virtual CBaseCombatCharacter *GetSubject( void ) const = 0;	// return the actor this path leads to, or NULL if there is no subject
+	if ( area->GetElevator() )
+	{
+		const NavConnectVector &elevatorAreas = area->GetElevatorAreas();
+		for ( int i = 0; i < elevatorAreas.Count(); ++i )
+		{
+			func( elevatorAreas[ i ].area, ( elevatorAreas[ i ].area->GetCenter() - area->GetCenter() ).Length() );
+		}
+	}
+}
 
-#if SOURCE_ENGINE == SE_LEFT4DEAD2
-	virtual void SetSubject( CBaseEntity * ) = 0;
+#ifdef PLATFORM_POSIX
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
 #endif
-	
-	virtual const Path::Segment *GetCurrentGoal( void ) const = 0;	// return current goal along the path we are trying to reach
 
-	virtual float GetAge( void ) const = 0;					// return "age" of this path (time since it was built)
+ConVar nav_derived_cache("nav_derived_cache", "1", FCVAR_NONE, "keep tables derived from the nav mesh in maps/<map>.nbx and load them on later map starts instead of rebuilding");
 
-	enum SeekType
-	{
-		SEEK_ENTIRE_PATH,			// search the entire path length
-		SEEK_AHEAD,					// search from current cursor position forward toward end of path
-		SEEK_BEHIND					// search from current cursor position backward toward path start
-	};
-	virtual void MoveCursorToClosestPosition( const Vector &pos, SeekType type = SEEK_ENTIRE_PATH, float alongLimit = 0.0f ) const = 0;		// Set cursor position to closest point on path to given position
-	
-	enum MoveCursorType
+/**
+ * Versioned sidecar file next to the map's .nav holding tables that are slow to derive from it.
+ * The header carries a hash of the .nav file, if the mesh was regenerated or edited the file is ignored and
+ * replaced on the next store. Each section is keyed by its type and a hash of whatever else the table depends on
+ * (landmark count, func_nav_* state), so a map alternating between a few of those keeps all of them.
+ *
+ * Sections are mapped read-only and handed out in place, tables keep the mapping alive while they point into it.
+ * Game thread only, the tables themselves are what worker threads read.
+ */
+class NavDerivedCache
+{
+public:
+	enum
 	{
-		PATH_ABSOLUTE_DISTANCE,
-		PATH_RELATIVE_DISTANCE
+		SECTION_LANDMARKS = 1,
 	};
-	virtual void MoveCursorToStart( void ) = 0;				// set seek cursor to start of path
-	virtual void MoveCursorToEnd( void ) = 0;				// set seek cursor to end of path
-	virtual void MoveCursor( float value, MoveCursorType type = PATH_ABSOLUTE_DISTANCE ) = 0;	// change seek cursor position
-	virtual float GetCursorPosition( void ) const = 0;		// return position of seek cursor (distance along path)
 
-	struct Data
+	// read-only view of a whole file
+	class mapping_t
 	{
-		Vector pos;										// the position along the path
-		Vector forward;									// unit vector along path direction
-		float curvature;								// how much the path 'curves' at this point in the XY plane (0 = none, 1 = 180 degree doubleback)
-		const Segment *segmentPrior;					// the segment just before this position
-	};
-	virtual const Data &GetCursorData( void ) const = 0;	// return path state at the current cursor position
+	public:
+		~mapping_t()
+		{
+		#ifdef PLATFORM_POSIX
+			if ( m_data )
+				munmap( (void *)m_data, m_size );
+		#endif
+		}
 
-	virtual bool IsValid( void ) const = 0;
-	virtual void Invalidate( void ) = 0;					// make path invalid (clear it)
+		// NULL if the file doesn't exist or is empty
+		static std::shared_ptr< const mapping_t > Open( const char *path )
+		{
+			std::shared_ptr< mapping_t > file( new mapping_t );
 
-	virtual void Draw( const Path::Segment *start = NULL ) const = 0;	// draw the path for debugging
-	virtual void DrawInterpolated( float from, float to ) = 0;	// draw the path for debugging - MODIFIES cursor position
+		#ifdef PLATFORM_POSIX
+			int fd = open( path, O_RDONLY );
+			if ( fd == -1 )
+				return NULL;
 
-	virtual const Segment *FirstSegment( void ) const = 0;	// return first segment of path
-	virtual const Segment *NextSegment( const Segment *currentSegment ) const = 0;	// return next segment of path, given current one
-	virtual const Segment *PriorSegment( const Segment *currentSegment ) const = 0;	// return previous segment of path, given current one
-	virtual const Segment *LastSegment( void ) const = 0;	// return last segment of path
+			struct stat info;
+			if ( fstat( fd, &info ) == 0 && info.st_size > 0 )
+			{
+				void *data = mmap( NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+				if ( data != MAP_FAILED )
+				{
+					file->m_data = (const uint8_t *)data;
+					file->m_size = (size_t)info.st_size;
+				}
+			}
 
-	enum ResultType
-	{
-		COMPLETE_PATH,
-		PARTIAL_PATH,
-		NO_PATH
+			// the mapping stays valid after the descriptor is gone
+			close( fd );
+		#else
+			// no mapping here, read it whole
+			FILE *fp = fopen( path, "rb" );
+			if ( !fp )
+				return NULL;
+
+			uint8_t buffer[ 16384 ];
+			size_t read;
+			while ( ( read = fread( buffer, 1, sizeof( buffer ), fp ) ) > 0 )
+			{
+				file->m_buffer.insert( file->m_buffer.end(), buffer, buffer + read );
+			}
+
+			fclose( fp );
+
+			file->m_data = file->m_buffer.data();
+			file->m_size = file->m_buffer.size();
+		#endif
+
+			if ( !file->m_data || file->m_size == 0 )
+				return NULL;
+
+			return file;
+		}
+
+		const uint8_t *GetData( void ) const { return m_data; }
+		size_t GetSize( void ) const { return m_size; }
+
+	private:
+		mapping_t() {}
+
+		const uint8_t *m_data = NULL;
+		size_t m_size = 0;
+	#ifndef PLATFORM_POSIX
+		std::vector< uint8_t > m_buffer;
+	#endif
 	};
-	virtual void OnPathChanged( INextBot *bot, ResultType result ) = 0;		// invoked when the path is (re)computed (path is valid at the time of this call)
 
-	virtual void Copy( INextBot *bot, const Path &path ) = 0;	// Replace this path with the given path's data
-	
-	virtual bool ComputeWithOpenGoal( INextBot *bot, const IPathCost &costFunc, const IPathOpenGoalSelector &goalSelector, float maxSearchRadius = 0.0f ) = 0;
-	
-	virtual void ComputeAreaCrossing( INextBot *bot, const CNavArea *from, const Vector &fromPos, const CNavArea *to, NavDirType dir, Vector *crossPos ) = 0;
-	
-	enum { MAX_PATH_SEGMENTS = 256 };
-	
-	Segment m_path[ MAX_PATH_SEGMENTS ];
-	int m_segmentCount;
-	
-	mutable Vector m_pathPos;								// used by GetPosition()
-	mutable Vector m_closePos;								// used by GetClosestPosition()
+	typedef std::shared_ptr< const mapping_t > file_t;
 
-	mutable float m_cursorPos;					// current cursor position (distance along path)
-	mutable Data m_cursorData;					// used by GetCursorData()
-	mutable bool m_isCursorDataDirty;
+	// FNV-1a, chain calls through hash to cover several inputs
+	static uint64_t Hash( const void *data, size_t size, uint64_t hash = 0xCBF29CE484222325ull )
+	{
+		const uint8_t *bytes = (const uint8_t *)data;
+		for ( size_t i = 0; i < size; ++i )
+		{
+			hash ^= bytes[ i ];
+			hash *= 0x100000001B3ull;
+		}
 
-	IntervalTimer m_ageTimer;					// how old is this path?
-	
-	CHandle< CBaseCombatCharacter > m_subject;	// the subject this path leads to
-	
-	enum { MAX_ADJ_AREAS = 64 };
+		return hash;
+	}
 
-	struct AdjInfo
+	bool IsEnabled( void ) const { return nav_derived_cache.GetBool(); }
+
+	// drop the mapping and forget the map, tables still pointing into the file keep it mapped
+	void Invalidate( void )
 	{
-		CNavArea *area;
-		CNavLadder *ladder;
-		NavTraverseType how;		
-	};
+		m_file.reset();
+		m_prepared = false;
+		m_hasNav = false;
+	}
 
-	AdjInfo m_adjAreaVector[ MAX_ADJ_AREAS ];
-	int m_adjAreaIndex;
-	
-	template <typename CostFunctor>
-	bool Compute(INextBot *bot, CBaseCombatCharacter *subject, CostFunctor &costFunc, float maxPathLength, bool includeGoalIfPathFails = true)
+	/**
+	 * Section of the given type and key for the current .nav, exactly size bytes and 8 byte aligned.
+	 * NULL if there is none, file is set to the mapping the section lives in otherwise.
+	 */
+	const void *Find( uint32_t type, uint64_t key, size_t size, file_t &file )
 	{
-#if SOURCE_ENGINE == SE_LEFT4DEAD2
-		if(path_compute_manual.GetBool() || path_compute_debug.GetBool()) {
-#endif
-		Invalidate();
-		
-		m_subject = subject;
-		
-		const Vector &start = bot->GetPosition();
-		
-		CNavArea *startArea = bot->GetEntity()->GetLastKnownArea();
-		if ( !startArea )
+		if ( !Prepare() || !m_file )
+			return NULL;
+
+		const header_t *header = (const header_t *)m_file->GetData();
+		const section_t *sections = (const section_t *)( header + 1 );
+		for ( uint32_t i = 0; i < header->sectionCount; ++i )
 		{
-			OnPathChanged( bot, NO_PATH );
-			if(path_compute_debug.GetBool()) {
-				DevMsg("%f: Path->Compute #%i failed: bot has no last known area\n", gpGlobals->curtime, subject->entindex());
+			if ( sections[ i ].type == type && sections[ i ].key == key && sections[ i ].size == size )
+			{
+				file = m_file;
+				return m_file->GetData() + sections[ i ].offset;
 			}
-			return false;
 		}
 
-		CNavArea *subjectArea = subject->GetLastKnownArea();
-		if ( !subjectArea )
+		return NULL;
+	}
+
+	// add the section, replacing one with the same type and key, and rewrite the file
+	void Store( uint32_t type, uint64_t key, const void *data, size_t size )
+	{
+		if ( !Prepare() )
+			return;
+
+		// keep what the old file had for this mesh, newest last so the oldest go first when there are too many
+		std::vector< std::pair< section_t, const void * > > kept;
+		if ( m_file )
 		{
-			OnPathChanged( bot, NO_PATH );
-			if(path_compute_debug.GetBool()) {
-				DevMsg("%f: Path->Compute #%i failed: subject has no last known area\n", gpGlobals->curtime, subject->entindex());
+			const header_t *header = (const header_t *)m_file->GetData();
+			const section_t *sections = (const section_t *)( header + 1 );
+			for ( uint32_t i = 0; i < header->sectionCount; ++i )
+			{
+				if ( sections[ i ].type != type || sections[ i ].key != key )
+					kept.emplace_back( sections[ i ], m_file->GetData() + sections[ i ].offset );
 			}
-			return false;
 		}
 
-		Vector subjectPos = subject->GetAbsOrigin();
-		
-		// if we are already in the subject area, build trivial path
-		if ( startArea == subjectArea )
-		{
-			BuildTrivialPath( bot, subjectPos );
-			return true;
-		}
+		section_t added = { type, 0, key, 0, size };
+		kept.emplace_back( added, data );
 
-		//
-		// Compute shortest path to subject
-		//
-		CNavArea *closestArea = NULL;
-#if SOURCE_ENGINE == SE_LEFT4DEAD2
-		bool pathResult = NavAreaBuildPath_real( startArea, subjectArea, &start, &subjectPos, costFunc, &closestArea, maxPathLength, bot->GetEntity()->GetTeamNumber(), false );
-#elif SOURCE_ENGINE == SE_TF2
-		bool pathResult = NavAreaBuildPath_real( startArea, subjectArea, &subjectPos, costFunc, &closestArea, maxPathLength, bot->GetEntity()->GetTeamNumber(), false );
-#endif
-		if(path_compute_debug.GetBool()) {
-			DevMsg("%f: Path->Compute #%i built: %i\n", gpGlobals->curtime, subject->entindex(), pathResult);
-		}
-		
-		// Failed?
-		if ( closestArea == NULL ) {
-			if(path_compute_debug.GetBool()) {
-				DevMsg("%f: Path->Compute #%i failed: no closest area\n", gpGlobals->curtime, subject->entindex());
-			}
-			return false;
-		}
+		if ( kept.size() > MAX_SECTIONS )
+			kept.erase( kept.begin(), kept.end() - MAX_SECTIONS );
 
-		//
-		// Build actual path by following parent links back from goal area
-		//
+		header_t header;
+		header.magic = FILE_MAGIC;
+		header.version = FILE_VERSION;
+		header.navHash = m_navHash;
+		header.navSize = m_navSize;
+		header.sectionCount = (uint32_t)kept.size();
+		header.unused = 0;
 
-		// get count
-		int count = 0;
-		CNavArea *area = nullptr;
-		for( area = closestArea; area; area = area->GetParent() )
+		uint64_t offset = sizeof( header_t ) + kept.size() * sizeof( section_t );
+		for ( std::pair< section_t, const void * > &section : kept )
 		{
-			++count;
-			
-			if ( area == startArea )
-			{
-				// startArea can be re-evaluated during the pathfind and given a parent...
-				break;
-			}
-			if ( count >= MAX_PATH_SEGMENTS-1 ) // save room for endpoint
-				break;
+			offset = Align( offset );
+			section.first.offset = offset;
+			offset += section.first.size;
 		}
-		
-		if ( count == 1 )
+
+		// written beside it and renamed over, a table mapping the old file keeps reading the old contents
+		std::string temp = m_path + ".tmp";
+		FILE *fp = fopen( temp.c_str(), "wb" );
+		if ( !fp )
 		{
-			BuildTrivialPath( bot, subjectPos );
-			return pathResult;
+			DevMsg( "nav_derived_cache: couldn't write %s\n", temp.c_str() );
+			return;
 		}
 
-		// assemble path
-		m_segmentCount = count;
-		for( area = closestArea; count && area; area = area->GetParent() )
+		bool ok = fwrite( &header, sizeof( header ), 1, fp ) == 1;
+		for ( const std::pair< section_t, const void * > &section : kept )
 		{
-			--count;
-			m_path[ count ].area = area;
-			m_path[ count ].how = area->GetParentHow();
-			m_path[ count ].type = ON_GROUND;
+			ok = ok && fwrite( &section.first, sizeof( section_t ), 1, fp ) == 1;
 		}
 
-		if ( pathResult || includeGoalIfPathFails )
+		static const uint8_t padding[ 8 ] = {};
+		uint64_t written = sizeof( header_t ) + kept.size() * sizeof( section_t );
+		for ( const std::pair< section_t, const void * > &section : kept )
 		{
-			// append actual subject position
-			m_path[ m_segmentCount ].area = closestArea;
-			m_path[ m_segmentCount ].pos = subjectPos;
-			m_path[ m_segmentCount ].ladder = NULL;
-			m_path[ m_segmentCount ].how = NUM_TRAVERSE_TYPES;
-			m_path[ m_segmentCount ].type = ON_GROUND;
-			++m_segmentCount;
+			ok = ok && fwrite( padding, 1, section.first.offset - written, fp ) == section.first.offset - written;
+			ok = ok && fwrite( section.second, 1, section.first.size, fp ) == section.first.size;
+			written = section.first.offset + section.first.size;
 		}
-				
-		// compute path positions
-		if ( ComputePathDetails( bot, start ) == false )
+
+		ok = fclose( fp ) == 0 && ok;
+
+	#ifndef PLATFORM_POSIX
+		remove( m_path.c_str() );
+	#endif
+
+		if ( !ok || rename( temp.c_str(), m_path.c_str() ) != 0 )
 		{
-			Invalidate();
-			OnPathChanged( bot, NO_PATH );
-			return false;
+			DevMsg( "nav_derived_cache: couldn't write %s\n", m_path.c_str() );
+			remove( temp.c_str() );
+			return;
 		}
 
-		// remove redundant nodes and clean up path
-		Optimize( bot );
-		
-		PostProcess();
+		m_file = OpenSidecar( m_path.c_str() );
+	}
 
-		OnPathChanged( bot, pathResult ? COMPLETE_PATH : PARTIAL_PATH );
+private:
+	enum
+	{
+		FILE_MAGIC = 0x3158424E, // "NBX1" when read back in the same byte order
+		FILE_VERSION = 1, // bump whenever a section's layout or the way its table is built changes
+		MAX_SECTIONS = 8,
+	};
 
-		return pathResult;
-#if SOURCE_ENGINE == SE_LEFT4DEAD2
-		} else {
-			return call_mfunc<bool, Path, INextBot *, CBaseCombatCharacter *, CostFunctor &, float>(this, PathComputeEntity, bot, subject, costFunc, maxPathLength);
+	struct header_t
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t navHash;
+		uint64_t navSize;
+		uint32_t sectionCount;
+		uint32_t unused;
+	};
+
+	struct section_t
+	{
+		uint32_t type;
+		uint32_t unused;
+		uint64_t key;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	static uint64_t Align( uint64_t offset ) { return ( offset + 7 ) & ~(uint64_t)7; }
+
+	// mapping of path if it's a sidecar for the current .nav with every section inside it, NULL otherwise
+	file_t OpenSidecar( const char *path ) const
+	{
+		file_t file = mapping_t::Open( path );
+		if ( !file || file->GetSize() < sizeof( header_t ) )
+			return NULL;
+
+		const header_t *header = (const header_t *)file->GetData();
+		if ( header->magic != FILE_MAGIC || header->version != FILE_VERSION )
+			return NULL;
+
+		if ( header->navHash != m_navHash || header->navSize != m_navSize )
+			return NULL;
+
+		if ( header->sectionCount > MAX_SECTIONS || file->GetSize() < sizeof( header_t ) + header->sectionCount * sizeof( section_t ) )
+			return NULL;
+
+		const section_t *sections = (const section_t *)( header + 1 );
+		for ( uint32_t i = 0; i < header->sectionCount; ++i )
+		{
+			if ( sections[ i ].offset != Align( sections[ i ].offset ) || sections[ i ].offset > file->GetSize() || sections[ i ].size > file->GetSize() - sections[ i ].offset )
+				return NULL;
 		}
-#endif
+
+		return file;
 	}
-	
-	template <typename CostFunctor>
-	bool Compute(INextBot *bot, const Vector &goal, CostFunctor &costFunc, float maxPathLength, bool includeGoalIfPathFails = true)
+
+	// once per mesh, hash the .nav and map the sidecar if it belongs to it
+	bool Prepare( void )
 	{
-#if SOURCE_ENGINE == SE_LEFT4DEAD2
-		if(path_compute_manual.GetBool() || path_compute_debug.GetBool()) {
-#endif
+		if ( !IsEnabled() )
+			return false;
+
+		if ( m_prepared && m_generation == g_NavMeshGeneration )
+			return m_hasNav;
+
 		Invalidate();
-		
-		const Vector &start = bot->GetPosition();
-		
-		CNavArea *startArea = bot->GetEntity()->GetLastKnownArea();
-		if ( !startArea )
-		{
-			OnPathChanged( bot, NO_PATH );
-			if(path_compute_debug.GetBool()) {
-				DevMsg("%f: Path->Compute [%f, %f, %f] failed: bot has no last known area\n", gpGlobals->curtime, goal.x, goal.y, goal.z);
-			}
+		m_prepared = true;
+		m_generation = g_NavMeshGeneration;
+
+		const char *map = STRING( gpGlobals->mapname );
+		if ( !map || !*map )
 			return false;
-		}
 
-		// check line-of-sight to the goal position when finding it's nav area
-		const float maxDistanceToArea = 200.0f;
-		CNavArea *goalArea = TheNavMesh->GetNearestNavArea( goal, true, maxDistanceToArea, true, false, bot->GetEntity()->GetTeamNumber() );
+		char path[ PLATFORM_MAX_PATH ];
+		smutils->BuildPath( Path_Game, path, sizeof( path ), "maps/%s.nav", map );
 
-		// if we are already in the goal area, build trivial path
-		if ( startArea == goalArea )
+		// packed into the bsp or somewhere else the filesystem finds it, nothing to key on
+		file_t nav = mapping_t::Open( path );
+		if ( !nav )
+			return false;
+
+		m_navHash = Hash( nav->GetData(), nav->GetSize() );
+		m_navSize = nav->GetSize();
+		m_hasNav = true;
+
+		smutils->BuildPath( Path_Game, path, sizeof( path ), "maps/%s.nbx", map );
+		m_path = path;
+		m_file = OpenSidecar( path );
+		return true;
+	}
+
+	file_t m_file;
+	std::string m_path;
+	uint64_t m_navHash = 0;
+	uint64_t m_navSize = 0;
+	unsigned int m_generation = 0;
+	bool m_prepared = false;
+	bool m_hasNav = false;
+};
+
+NavDerivedCache g_NavDerivedCache;
+
+#if SOURCE_ENGINE == SE_TF2
+/**
+ * Areas func_nav_avoid/prefer currently give a cost multiplier, in TheNavAreas order.
+ * Enable/Disable inputs change NAV_MESH_FUNC_COST without anything to hook, so the set is scanned again at most once
+ * per tick when asked for and GetVersion changes whenever it differs. Game thread only.
+ */
+class NavFuncCostAreas
+{
+public:
+	void Clear( void )
+	{
+		m_areas.clear();
+		m_tick = -1;
+		++m_version;
+	}
+
+	const std::vector< CNavArea * > &Areas( void )
+	{
+		Refresh();
+		return m_areas;
+	}
+
+	unsigned int GetVersion( void )
+	{
+		Refresh();
+		return m_version;
+	}
+
+private:
+	void Refresh( void )
+	{
+		if ( m_generation == g_NavMeshGeneration && m_tick == gpGlobals->tickcount )
+			return;
+
+		if ( m_generation != g_NavMeshGeneration )
 		{
-			BuildTrivialPath( bot, goal );
-			return true;
+			m_generation = g_NavMeshGeneration;
+			Clear();
 		}
 
-		// make sure path end position is on the ground
-		Vector pathEndPosition = goal;
-		if ( goalArea )
+		m_tick = gpGlobals->tickcount;
+
+		std::vector< CNavArea * > areas;
+		for ( int i = 0; i < TheNavAreas->Count(); ++i )
 		{
-			pathEndPosition.z = goalArea->GetZ( pathEndPosition );
+			CNavArea *area = (*TheNavAreas)[ i ];
+			if ( area->HasAttributes( NAV_MESH_FUNC_COST ) )
+				areas.push_back( area );
 		}
-		else
+
+		if ( areas != m_areas )
 		{
-			TheNavMesh->GetGroundHeight( pathEndPosition, &pathEndPosition.z );
+			m_areas.swap( areas );
+			++m_version;
 		}
+	}
 
-		//
-		// Compute shortest path to goal
-		//
-		CNavArea *closestArea = NULL;
-#if SOURCE_ENGINE == SE_LEFT4DEAD2
-		bool pathResult = NavAreaBuildPath_real( startArea, goalArea, &start, &goal, costFunc, &closestArea, maxPathLength, bot->GetEntity()->GetTeamNumber(), false );
-#elif SOURCE_ENGINE == SE_TF2
-		bool pathResult = NavAreaBuildPath_real( startArea, goalArea, &goal, costFunc, &closestArea, maxPathLength, bot->GetEntity()->GetTeamNumber(), false );
+	std::vector< CNavArea * > m_areas;
+	unsigned int m_version = 0;
+	unsigned int m_generation = 0;
+	int m_tick = -1;
+};
+
+NavFuncCostAreas g_NavFuncCostAreas;
 #endif
-		if(path_compute_debug.GetBool()) {
-			DevMsg("%f: Path->Compute [%f, %f, %f] built: %i\n", gpGlobals->curtime, goal.x, goal.y, goal.z, pathResult);
-		}
-		
-		// Failed?
-		if ( closestArea == NULL ) {
-			if(path_compute_debug.GetBool()) {
-				DevMsg("%f: Path->Compute [%f, %f, %f] failed: no closest area\n", gpGlobals->curtime, goal.x, goal.y, goal.z);
-			}
-			return false;
-		}
 
-		//
-		// Build actual path by following parent links back from goal area
-		//
+ConVar path_alt_landmarks("path_alt_landmarks", "8", FCVAR_NONE, "landmark areas used to estimate remaining distance in path searches, 0 only uses the straight line distance", true, 0.0f, true, 16.0f);
 
-		// get count
-		int count = 0;
-		CNavArea *area = nullptr;
-		for( area = closestArea; area; area = area->GetParent() )
+/**
+ * Landmark (ALT) distance tables.
+ * With the shortest distances from and to a few landmark areas, the triangle inequality gives a lower bound on the
+ * distance between any two areas that is much tighter than the straight line once walls and floors are in the way.
+ * Distances follow the connection lengths, so they only bound functors that report a GetMinCostScale.
+ *
+ * Tables are never modified after they are built, searches hold a snapshot so worker threads can keep reading
+ * while the game thread replaces it. Built when the map starts, tables built before for the same .nav and func_nav_* state
+ * are mapped from NavDerivedCache instead. When func_nav_avoid/prefer change which areas have a cost the table is
+ * dropped and rebuilt on a thread of its own, searches use the straight line until it's done.
+ * Only tables for the func_nav_* state the map started with are written to NavDerivedCache.
+ */
+class NavLandmarks
+{
+public:
+	enum { MAX_LANDMARKS = 16 };
+
+	// landmark distances of the goal area, read once per search
+	struct goal_t
+	{
+		int count;
+		float from[ MAX_LANDMARKS ];
+		float to[ MAX_LANDMARKS ];
+	};
+
+	class table_t
+	{
+	public:
+		bool PrepareGoal( const CNavArea *goalArea, goal_t &goal ) const
 		{
-			++count;
+			unsigned int id = goalArea->GetID();
+			if ( id >= m_rows )
+				return false;
 
-			if ( area == startArea )
+			goal.count = m_count;
+			for ( int i = 0; i < m_count; ++i )
 			{
-				// startArea can be re-evaluated during the pathfind and given a parent...
-				break;
+				goal.from[ i ] = HalfToFloat( m_from[ id * m_count + i ] );
+				goal.to[ i ] = HalfToFloat( m_to[ id * m_count + i ] );
 			}
-			if ( count >= MAX_PATH_SEGMENTS-1 ) // save room for endpoint
-				break;
+
+			return true;
 		}
-		
-		if ( count == 1 )
+
+		// lower bound on the distance from area to the goal
+		float Estimate( const CNavArea *area, const goal_t &goal ) const
 		{
-			BuildTrivialPath( bot, goal );
-			return pathResult;
+			unsigned int id = area->GetID();
+			if ( id >= m_rows )
+				return 0.0f;
+
+			const uint16_t *from = &m_from[ id * m_count ];
+			const uint16_t *to = &m_to[ id * m_count ];
+
+			float best = 0.0f;
+			for ( int i = 0; i < goal.count; ++i )
+			{
+				// unreachable pairs say nothing, each difference gives back what rounding both halves could have added
+				float landmarkToArea = HalfToFloat( from[ i ] );
+				if ( landmarkToArea != FLT_MAX && goal.from[ i ] != FLT_MAX )
+					best = MAX( best, goal.from[ i ] - landmarkToArea - HALF_EPSILON * ( goal.from[ i ] + landmarkToArea ) );
+
+				float areaToLandmark = HalfToFloat( to[ i ] );
+				if ( areaToLandmark != FLT_MAX && goal.to[ i ] != FLT_MAX )
+					best = MAX( best, areaToLandmark - goal.to[ i ] - HALF_EPSILON * ( areaToLandmark + goal.to[ i ] ) );
+			}
+
+			return best;
 		}
 
-		// assemble path
-		m_segmentCount = count;
-		for( area = closestArea; count && area; area = area->GetParent() )
+		// lower bound on the distance from origin to area, origin filled by PrepareGoal
+		float EstimateFrom( const goal_t &origin, const CNavArea *area ) const
 		{
-			--count;
-			m_path[ count ].area = area;
-			m_path[ count ].how = area->GetParentHow();
-			m_path[ count ].type = ON_GROUND;
+			unsigned int id = area->GetID();
+			if ( id >= m_rows )
+				return 0.0f;
+
+			const uint16_t *from = &m_from[ id * m_count ];
+			const uint16_t *to = &m_to[ id * m_count ];
+
+			float best = 0.0f;
+			for ( int i = 0; i < origin.count; ++i )
+			{
+				float landmarkToArea = HalfToFloat( from[ i ] );
+				if ( landmarkToArea != FLT_MAX && origin.from[ i ] != FLT_MAX )
+					best = MAX( best, landmarkToArea - origin.from[ i ] - HALF_EPSILON * ( landmarkToArea + origin.from[ i ] ) );
+
+				float areaToLandmark = HalfToFloat( to[ i ] );
+				if ( areaToLandmark != FLT_MAX && origin.to[ i ] != FLT_MAX )
+					best = MAX( best, origin.to[ i ] - areaToLandmark - HALF_EPSILON * ( origin.to[ i ] + areaToLandmark ) );
+			}
+
+			return best;
 		}
 
-		if ( pathResult || includeGoalIfPathFails )
+	private:
+		friend class NavLandmarks;
+
+		// 11 bit mantissa, distances are stored divided by HALF_SCALE so the largest maps fit under 65504
+		static constexpr float HALF_EPSILON = 1.0f / 2048.0f;
+		static constexpr float HALF_SCALE = 16.0f;
+
+		static uint16_t FloatToHalf( float value )
 		{
-			// append actual goal position
-			m_path[ m_segmentCount ].area = closestArea;
-			m_path[ m_segmentCount ].pos = pathEndPosition;
-			m_path[ m_segmentCount ].ladder = NULL;
-			m_path[ m_segmentCount ].how = NUM_TRAVERSE_TYPES;
-			m_path[ m_segmentCount ].type = ON_GROUND;
-			++m_segmentCount;
+			value /= HALF_SCALE;
+			if ( !( value < 65504.0f ) )
+				return 0x7C00;
+
+			uint32_t bits;
+			memcpy( &bits, &value, sizeof( bits ) );
+
+			int exponent = (int)( ( bits >> 23 ) & 0xFF ) - 127 + 15;
+			uint32_t mantissa = bits & 0x7FFFFF;
+
+			// distances this small don't matter for an estimate, flush them
+			if ( exponent <= 0 )
+				return 0;
+
+			// round to nearest
+			uint32_t half = ( (uint32_t)exponent << 10 ) | ( mantissa >> 13 );
+			if ( mantissa & 0x1000 )
+				++half;
+
+			return half >= 0x7C00 ? 0x7BFF : (uint16_t)half;
 		}
-				
-		// compute path positions
-		if ( ComputePathDetails( bot, start ) == false )
+
+		static float HalfToFloat( uint16_t half )
 		{
-			Invalidate();
-			OnPathChanged( bot, NO_PATH );
-			if(path_compute_debug.GetBool()) {
-				DevMsg("%f: Path->Compute [%f, %f, %f] failed: compute details failed\n", gpGlobals->curtime, goal.x, goal.y, goal.z);
-			}
-			return false;
+			if ( half >= 0x7C00 )
+				return FLT_MAX;
+			if ( half == 0 )
+				return 0.0f;
+
+			uint32_t bits = ( (uint32_t)( ( half >> 10 ) - 15 + 127 ) << 23 ) | ( (uint32_t)( half & 0x3FF ) << 13 );
+
+			float value;
+			memcpy( &value, &bits, sizeof( value ) );
+			return value * HALF_SCALE;
 		}
 
-		// remove redundant nodes and clean up path
-		Optimize( bot );
-		
-		PostProcess();
+		// [ id * m_count + landmark ], distance from the landmark to the area and from the area to the landmark
+		const uint16_t *m_from = NULL;
+		const uint16_t *m_to = NULL;
+		unsigned int m_rows = 0;
+		int m_count = 0;
 
-		OnPathChanged( bot, pathResult ? COMPLETE_PATH : PARTIAL_PATH );
+		// what m_from and m_to point into, both halves of a fresh build or the cache file they were mapped from
+		std::vector< uint16_t > m_built;
+		NavDerivedCache::file_t m_file;
+	};
 
-		return pathResult;
-#if SOURCE_ENGINE == SE_LEFT4DEAD2
-		} else {
-			return call_mfunc<bool, Path, INextBot *, const Vector &, CostFunctor &, float>(this, PathComputeVector, bot, goal, costFunc, maxPathLength);
-		}
-#endif
+	typedef std::shared_ptr< const table_t > snapshot_t;
+
+	bool IsEnabled( void ) const { return path_alt_landmarks.GetInt() > 0; }
+
+	~NavLandmarks()
+	{
+		Cancel();
 	}
-	
-	bool ComputePathDetails( INextBot *bot, const Vector &start )
+
+	void Invalidate( void )
 	{
-		return call_mfunc<bool, Path, INextBot *, const Vector &>(this, PathComputePathDetails, bot, start);
+		Cancel();
+		m_built = false;
+
+		std::lock_guard< std::mutex > lock( m_mutex );
+		m_table.reset();
 	}
-	
-	bool BuildTrivialPath( INextBot *bot, const Vector &goal )
+
+	// game thread only, rebuild if the mesh, the landmark count or the NAV_MESH_FUNC_COST areas changed since the last build
+	bool EnsureBuilt( void )
 	{
-		return call_mfunc<bool, Path, INextBot *, const Vector &>(this, PathBuildTrivialPath, bot, goal);
+		if ( !IsEnabled() || !TheNavMesh->IsLoaded() )
+		{
+			if ( m_built )
+				Invalidate();
+
+			return false;
+		}
+
+		const bool sameMesh = ( m_built && m_generation == g_NavMeshGeneration && m_areaCount == TheNavAreas->Count() && m_count == path_alt_landmarks.GetInt() );
+
+	#if SOURCE_ENGINE == SE_TF2
+		// func_nav_avoid/prefer Enable/Disable inputs don't create or destroy anything
+		if ( sameMesh && m_funcCostVersion != g_NavFuncCostAreas.GetVersion() )
+		{
+			Build( true );
+			return true;
+		}
+	#endif
+
+		if ( sameMesh )
+			return true;
+
+		Build( false );
+		return true;
 	}
-	
-	int FindNextOccludedNode( INextBot *bot, int anchorIndex )
+
+	// NULL when there is no table for the current mesh
+	snapshot_t Snapshot( void )
 	{
-		return call_mfunc<int, Path, INextBot *, int>(this, PathFindNextOccludedNode, bot, anchorIndex);
+		std::lock_guard< std::mutex > lock( m_mutex );
+		return m_table;
 	}
-	
-	void Optimize( INextBot *bot )
+
+private:
+	typedef std::vector< std::vector< std::pair< int, float > > > graph_t;
+
+	static void Distances( const graph_t &graph, int source, std::vector< float > &dist )
 	{
-		if(!path_expensive_optimize.GetBool())
-			return;
-		
-		if (m_segmentCount < 3)
-			return;
+		dist.assign( graph.size(), FLT_MAX );
 
-		int anchor = 0;
+		using entry_t = std::pair< float, int >;
+		std::vector< entry_t > heap;
 
-		while( anchor < m_segmentCount )
+		dist[ source ] = 0.0f;
+		heap.emplace_back( 0.0f, source );
+
+		while ( !heap.empty() )
 		{
-			int occluded = FindNextOccludedNode( bot, anchor );
-			int nextAnchor = occluded-1;
+			std::pop_heap( heap.begin(), heap.end(), std::greater< entry_t >() );
+			entry_t top = heap.back();
+			heap.pop_back();
 
-			if (nextAnchor > anchor)
+			if ( top.first > dist[ top.second ] )
+				continue;
+
+			for ( const std::pair< int, float > &edge : graph[ top.second ] )
 			{
-				// remove redundant nodes between anchor and nextAnchor
-				int removeCount = nextAnchor - anchor - 1;
-				if (removeCount > 0)
+				float newDist = top.first + edge.second;
+				if ( newDist < dist[ edge.first ] )
 				{
-					for( int i=nextAnchor; i<m_segmentCount; ++i )
-					{
-						m_path[i-removeCount] = m_path[i];
-					}
-					m_segmentCount -= removeCount;
+					dist[ edge.first ] = newDist;
+					heap.emplace_back( newDist, edge.first );
+					std::push_heap( heap.begin(), heap.end(), std::greater< entry_t >() );
 				}
 			}
+		}
+	}
 
-			++anchor;
+	// -1 once every reachable area is a landmark
+	static int Farthest( const std::vector< float > &dist )
+	{
+		int best = -1;
+		float bestDist = 0.0f;
+		for ( int i = 0; i < (int)dist.size(); ++i )
+		{
+			if ( dist[ i ] != FLT_MAX && dist[ i ] > bestDist )
+			{
+				bestDist = dist[ i ];
+				best = i;
+			}
 		}
+
+		return best;
 	}
 
-	void PostProcess()
+	// everything a build needs, the graph is over indices into TheNavAreas so it can be walked off the game thread
+	struct build_t
 	{
-		call_mfunc<void>(this, PathPostProcess);
+		std::shared_ptr< table_t > table;
+		graph_t forward;
+		graph_t reverse;
+		std::vector< unsigned int > ids;	// area ID of every index
+	};
+
+	bool IsCancelled( void )
+	{
+		std::lock_guard< std::mutex > lock( m_mutex );
+		return m_cancel;
 	}
-	
-	void AssemblePrecomputedPath( INextBot *bot, const Vector &goal, CNavArea *endArea )
+
+	// stop a build running on its own thread, its table is thrown away
+	void Cancel( void )
 	{
-		const Vector &start = bot->GetPosition();
+		if ( !m_thread.joinable() )
+			return;
 
-		// get count
-		int count = 0;
-		CNavArea *area;
-		for( area = endArea; area; area = area->GetParent() )
 		{
-			++count;
+			std::lock_guard< std::mutex > lock( m_mutex );
+			m_cancel = true;
 		}
 
-		// save room for endpoint
-		if ( count > MAX_PATH_SEGMENTS-1 )
+		m_thread.join();
+		m_cancel = false;
+	}
+
+	/**
+	 * Game thread only. Replaces the table with a new one for the current mesh and func_nav_* state.
+	 * With background the table is dropped right away and the distances are worked out on m_thread.
+	 */
+	void Build( bool background )
+	{
+		Cancel();
+
+		m_built = true;
+		m_count = path_alt_landmarks.GetInt();
+		m_areaCount = TheNavAreas->Count();
+		if ( m_generation != g_NavMeshGeneration )
 		{
-			count = MAX_PATH_SEGMENTS-1;
+			m_generation = g_NavMeshGeneration;
+		#if SOURCE_ENGINE == SE_TF2
+			m_mapStartFuncCostVersion = g_NavFuncCostAreas.GetVersion();
+		#endif
 		}
-		else if ( count == 0 )
+
+		unsigned int maxID = 0;
+		for ( int i = 0; i < m_areaCount; ++i )
 		{
-			return;
+			maxID = MAX( maxID, (*TheNavAreas)[ i ]->GetID() );
 		}
 
-		if ( count == 1 )
+		std::shared_ptr< build_t > build = std::make_shared< build_t >();
+		std::shared_ptr< table_t > &table = build->table;
+		table = std::make_shared< table_t >();
+		table->m_rows = maxID + 1;
+		table->m_count = m_count;
+
+		size_t cells = (size_t)table->m_rows * m_count;
+		size_t size = cells * 2 * sizeof( uint16_t );
+
+		// everything the distances depend on that isn't in the .nav
+		bool store = true;
+		uint64_t key = NavDerivedCache::Hash( &m_count, sizeof( m_count ) );
+		key = NavDerivedCache::Hash( &maxID, sizeof( maxID ), key );
+	#if SOURCE_ENGINE == SE_TF2
+		m_funcCostVersion = g_NavFuncCostAreas.GetVersion();
+		for ( CNavArea *area : g_NavFuncCostAreas.Areas() )
 		{
-			BuildTrivialPath( bot, goal );
+			unsigned int id = area->GetID();
+			key = NavDerivedCache::Hash( &id, sizeof( id ), key );
+		}
+
+		// a func_nav_avoid/prefer toggled since the map started, the next one likely flips it back
+		store = ( m_funcCostVersion == m_mapStartFuncCostVersion );
+	#endif
+
+		const void *cached = g_NavDerivedCache.Find( NavDerivedCache::SECTION_LANDMARKS, key, size, table->m_file );
+		if ( cached )
+		{
+			table->m_from = (const uint16_t *)cached;
+			table->m_to = table->m_from + cells;
+
+			std::lock_guard< std::mutex > lock( m_mutex );
+			m_table = table;
 			return;
 		}
 
-		// assemble path
-		m_segmentCount = count;
-		for( area = endArea; count && area; area = area->GetParent() )
+		table->m_built.assign( cells * 2, 0x7C00 );
+		table->m_from = table->m_built.data();
+		table->m_to = table->m_from + cells;
+
+		// graph over indices into TheNavAreas, blocked areas stay in since blocking only makes real paths longer
+		std::vector< int > index( maxID + 1, -1 );
+		build->ids.resize( m_areaCount );
+		for ( int i = 0; i < m_areaCount; ++i )
 		{
-			--count;
-			m_path[ count ].area = area;
-			m_path[ count ].how = area->GetParentHow();
-			m_path[ count ].type = ON_GROUND;
+			build->ids[ i ] = (*TheNavAreas)[ i ]->GetID();
+			index[ build->ids[ i ] ] = i;
 		}
 
-		// append actual goal position
-		m_path[ m_segmentCount ].area = endArea;
-		m_path[ m_segmentCount ].pos = goal;
-		m_path[ m_segmentCount ].ladder = NULL;
-		m_path[ m_segmentCount ].how = NUM_TRAVERSE_TYPES;
-		m_path[ m_segmentCount ].type = ON_GROUND;
-		++m_segmentCount;
+		build->forward.resize( m_areaCount );
+		build->reverse.resize( m_areaCount );
+		for ( int i = 0; i < m_areaCount; ++i )
+		{
+			NavForEachConnection( (*TheNavAreas)[ i ], [&]( CNavArea *newArea, float length ) {
+			#if SOURCE_ENGINE == SE_TF2
+				// func_nav_prefer can scale entering these below length
+				if ( newArea->HasAttributes( NAV_MESH_FUNC_COST ) )
+					length = 0.0f;
+			#endif
+				int other = index[ newArea->GetID() ];
+				build->forward[ i ].emplace_back( other, length );
+				build->reverse[ other ].emplace_back( i, length );
+			} );
+		}
 
-		// compute path positions
-		if ( ComputePathDetails( bot, start ) == false )
+		if ( background )
 		{
-			Invalidate();
-			OnPathChanged( bot, NO_PATH );
+			// the old distances may overestimate now
+			{
+				std::lock_guard< std::mutex > lock( m_mutex );
+				m_table.reset();
+			}
+
+			m_thread = std::thread( [this, build]() {
+				if ( !ComputeDistances( *build ) )
+					return;
+
+				std::lock_guard< std::mutex > lock( m_mutex );
+				if ( !m_cancel )
+					m_table = build->table;
+			} );
 			return;
 		}
 
-		// remove redundant nodes and clean up path
-		Optimize( bot );
+		ComputeDistances( *build );
 
-		PostProcess();
+		if ( store )
+			g_NavDerivedCache.Store( NavDerivedCache::SECTION_LANDMARKS, key, table->m_built.data(), size );
 
-		OnPathChanged( bot, COMPLETE_PATH );
+		std::lock_guard< std::mutex > lock( m_mutex );
+		m_table = table;
 	}
-};
-
-DETOUR_DECL_MEMBER1(PathOptimize, void, INextBot *, bot)
-{
-	((Path *)this)->Optimize(bot);
-}
 
-class NextBotTraceFilterOnlyActors : public CTraceFilterSimple
-{
-public:
-	NextBotTraceFilterOnlyActors( const IHandleEntity *passentity, int collisionGroup )
-		: CTraceFilterSimple( passentity, collisionGroup )
+	// fills build.table, false if it was cancelled on the way
+	bool ComputeDistances( build_t &build )
 	{
-	}
+		const int areaCount = (int)build.ids.size();
+		const int count = build.table->m_count;
+		const size_t cells = (size_t)build.table->m_rows * count;
+		uint16_t *fromTable = build.table->m_built.data();
+		uint16_t *toTable = fromTable + cells;
 
-	virtual TraceType_t	GetTraceType() const override
-	{
-		return TRACE_ENTITIES_ONLY;
-	}
+		// farthest point selection, every landmark is the area farthest from the ones picked before it
+		std::vector< float > nearest;
+		std::vector< float > dist;
+		int landmark = -1;
 
-	virtual bool ShouldHitEntity( IHandleEntity *pServerEntity, int contentsMask ) override
-	{
-		if ( CTraceFilterSimple::ShouldHitEntity( pServerEntity, contentsMask ) )
+		if ( areaCount > 0 )
 		{
-			CBaseEntity *entity = EntityFromEntityHandle( pServerEntity );
+			Distances( build.forward, 0, nearest );
+			landmark = Farthest( nearest );
+		}
 
-#if SOURCE_ENGINE == SE_LEFT4DEAD2
-			CBasePlayer *player = entity->GetPlayer();
-			if ( player && player->IsGhost() )
+		for ( int n = 0; n < count && landmark != -1; ++n )
+		{
+			if ( IsCancelled() )
 				return false;
-#endif
 
-			return ( entity->MyNextBotPointer() || entity->IsPlayer() );
+			Distances( build.forward, landmark, dist );
+			for ( int i = 0; i < areaCount; ++i )
+			{
+				fromTable[ build.ids[ i ] * count + n ] = table_t::FloatToHalf( dist[ i ] );
+				nearest[ i ] = MIN( nearest[ i ], dist[ i ] );
+			}
+
+			Distances( build.reverse, landmark, dist );
+			for ( int i = 0; i < areaCount; ++i )
+			{
+				toTable[ build.ids[ i ] * count + n ] = table_t::FloatToHalf( dist[ i ] );
+			}
+
+			landmark = Farthest( nearest );
 		}
-		return false;
+
+		return true;
 	}
+
+	std::mutex m_mutex;
+	snapshot_t m_table;
+	std::thread m_thread;
+	bool m_cancel = false;	// under m_mutex
+	bool m_built = false;
+	unsigned int m_generation = 0;
+	int m_areaCount = 0;
+	int m_count = 0;
+#if SOURCE_ENGINE == SE_TF2
+	unsigned int m_funcCostVersion = 0;
+	unsigned int m_mapStartFuncCostVersion = 0;
+#endif
 };
 
-bool CGameTrace::DidHitWorld() const
-{
-	return m_pEnt && gamehelpers->EntityToBCompatRef(m_pEnt) == 0;
-}
+NavLandmarks g_NavLandmarks;
 
-bool CGameTrace::DidHitNonWorldEntity() const
+/**
+ * Structure of arrays copy of the nav mesh by area ID: the area, its center and extent, and every connection
+ * NavSearchContext::BuildPath follows in compressed rows, from both ends since searches that run backwards from
+ * the goal need the incoming side and the areas only keep it for one-way connections.
+ * Connections carry what BuildPath hands the cost functor plus the height change the cost functors look up.
+ *
+ * Tables are never modified after they are built, searches and cost functors hold a snapshot so worker threads can
+ * keep reading while the game thread replaces it. Rebuilt when the mesh changes, blocked state and attributes
+ * change at runtime and are read from the areas.
+ */
+class NavConnectionGraph
 {
-	return m_pEnt != NULL && !DidHitWorld();
-}
+public:
+	// a connection with what BuildPath would hand the cost functor for it, area is the other end
+	struct edge_t
+	{
+		CNavArea *area;
+		const CNavLadder *ladder;
+		const CFuncElevator *elevator;
+		float length;
+		float heightChange;		// ComputeAdjacentConnectionHeightChange from the from area into the to area
+		NavTraverseType how;
+	};
 
-struct pathfollower_vars_t
-{
-	virtual ~pathfollower_vars_t() {}
+	// the connections of one area, next to each other
+	struct range_t
+	{
+		const edge_t *first;
+		const edge_t *last;
 
-	virtual void dtor(PathFollower *bytes)
+		const edge_t *begin( void ) const { return first; }
+		const edge_t *end( void ) const { return last; }
+		size_t size( void ) const { return last - first; }
+		const edge_t &operator[]( size_t index ) const { return first[ index ]; }
+	};
+
+	class table_t
 	{
-		for(int id : hookids) {
-			SH_REMOVE_HOOK_ID(id);
+	public:
+		// one past the highest area ID
+		size_t GetIDCount( void ) const { return m_areas.size(); }
+
+		// false if area isn't the one this table has for its ID
+		bool Contains( const CNavArea *area ) const
+		{
+			return area->GetID() < m_areas.size() && m_areas[ area->GetID() ] == area;
 		}
-	}
 
-	bool allowfacing = true;
+		// NULL for IDs no area has
+		CNavArea *GetArea( unsigned int id ) const { return m_areas[ id ]; }
+		const Vector &GetCenter( unsigned int id ) const { return m_centers[ id ]; }
+		const Extent &GetExtent( unsigned int id ) const { return m_extents[ id ]; }
 
-	std::vector<int> hookids{};
-};
+		// how is always the way from the edge's from area into its to area
+		range_t Outgoing( unsigned int id ) const { return range_t{ m_outgoing.data() + m_outOffsets[ id ], m_outgoing.data() + m_outOffsets[ id+1 ] }; }
+		range_t Incoming( unsigned int id ) const { return range_t{ m_incoming.data() + m_inOffsets[ id ], m_incoming.data() + m_inOffsets[ id+1 ] }; }
 
-using pathfollower_var_map_t = std::unordered_map<PathFollower *, unsigned char *>;
-pathfollower_var_map_t pathfollower_var_map{};
+		// ComputeAdjacentConnectionHeightChange, computed if the table doesn't have the connection
+		float GetHeightChange( const CNavArea *from, const CNavArea *to ) const
+		{
+			if ( Contains( from ) )
+			{
+				for ( const edge_t &edge : Outgoing( from->GetID() ) )
+				{
+					if ( edge.area == to )
+						return edge.heightChange;
+				}
+			}
 
-class PathFollower : public Path
-{
-public:
-	virtual void Update( INextBot *bot ) = 0;			// move bot along path
-	virtual void SetMinLookAheadDistance( float value ) = 0;		// minimum range movement goal must be along path
-	virtual CBaseEntity *GetHindrance( void ) const = 0;			// returns entity that is hindering our progress along the path
-	virtual bool IsDiscontinuityAhead( INextBot *bot, Path::SegmentType type, float range = -1.0f ) const = 0;	// return true if there is a the given discontinuity ahead in the path within the given range (-1 = entire remaining path)
+			return from->ComputeAdjacentConnectionHeightChange( to );
+		}
 
-	const Path::Segment *m_goal;					// our current goal along the path
-	float m_minLookAheadRange;
+	private:
+		friend class NavConnectionGraph;
 
-	//bool IsOnStairs( INextBot *bot ) const;		// return true if bot is standing on a stairway
-	bool m_isOnStairs;
+		std::vector< CNavArea * > m_areas;
+		std::vector< Vector > m_centers;
+		std::vector< Extent > m_extents;
+		std::vector< unsigned int > m_outOffsets;	// GetIDCount()+1, the row of id is [ m_outOffsets[ id ], m_outOffsets[ id+1 ] )
+		std::vector< unsigned int > m_inOffsets;
+		std::vector< edge_t > m_outgoing;
+		std::vector< edge_t > m_incoming;
+	};
 
-	CountdownTimer m_avoidTimer;					// do avoid check more often if we recently avoided
+	typedef std::shared_ptr< const table_t > snapshot_t;
 
-	CountdownTimer m_waitTimer;						// for waiting for a blocker to move off our path
-	CHandle< CBaseEntity > m_hindrance;
-	
-	// debug display data for avoid volumes
-	bool m_didAvoidCheck;
-	Vector m_leftFrom;
-	Vector m_leftTo;
-	bool m_isLeftClear;
-	Vector m_rightFrom;
-	Vector m_rightTo;
-	bool m_isRightClear;
-	Vector m_hullMin, m_hullMax;
+	void Invalidate( void )
+	{
+		std::lock_guard< std::mutex > lock( m_mutex );
+		m_table.reset();
+		m_areaCount = 0;
+	}
 
-#if SOURCE_ENGINE == SE_TF2
-	float m_goalTolerance;
-#elif SOURCE_ENGINE == SE_LEFT4DEAD2
-	char pad1[16];
-#endif
+	// game thread only, GetVersion changes every time this rebuilds
+	void EnsureBuilt( void )
+	{
+		if ( m_table && m_generation == g_NavMeshGeneration && m_areaCount == TheNavAreas->Count() )
+			return;
 
-	using vars_t = pathfollower_vars_t;
+		m_generation = g_NavMeshGeneration;
+		m_areaCount = TheNavAreas->Count();
+		++m_version;
 
-	template <typename T = PathFollower>
-	static unsigned char *vars_ptr(PathFollower *ptr)
-	{ return (((unsigned char *)ptr) + sizeof(T)); }
-	template <typename C = PathFollower, typename T = vars_t>
-	static T &getvars(PathFollower *ptr)
-	{ return *(T *)vars_ptr<C>(ptr); }
+		std::shared_ptr< table_t > table = std::make_shared< table_t >();
+		Build( *table );
 
-	unsigned char *vars_ptr()
-	{
-		pathfollower_var_map_t::iterator it{pathfollower_var_map.find(this)};
-		if(it == pathfollower_var_map.end()) {
-			return nullptr;
-		}
-		return it->second;
+		std::lock_guard< std::mutex > lock( m_mutex );
+		m_table = table;
 	}
 
-	vars_t &getvars()
-	{ return *(vars_t *)vars_ptr(); }
-
-	template <typename T>
-	static void call_dtor()
+	// NULL before the first EnsureBuilt
+	snapshot_t Snapshot( void )
 	{
-		PathFollower *base = META_IFACEPTR(PathFollower);
-		T *bytes{(T *)base};
-
-		typename T::vars_t &vars{PathFollower::getvars<T, typename T::vars_t>(bytes)};
-
-		vars.dtor(bytes);
-
-		vars.~vars_t();
-
-		pathfollower_var_map_t::iterator it{pathfollower_var_map.find(base)};
-		if(it != pathfollower_var_map.end()) {
-			pathfollower_var_map.erase(it);
-		}
-
-		RETURN_META(MRES_HANDLED);
+		std::lock_guard< std::mutex > lock( m_mutex );
+		return m_table;
 	}
 
-	template <typename C = PathFollower, typename T = vars_t>
-	static C *create(void *ctor)
-	{
-		C *bytes = (C *)calloc(1, sizeof(C) + sizeof(T));
-		call_mfunc<void>(bytes, ctor);
-		pathfollower_var_map.emplace(bytes, PathFollower::vars_ptr<C>(bytes));
-		new (PathFollower::vars_ptr<C>(bytes)) T{};
-		PathFollower::getvars<C, T>(bytes).hookids.emplace_back(SH_ADD_MANUALHOOK(GenericDtor, bytes, SH_STATIC(PathFollower::call_dtor<C>), false));
-		return bytes;
-	}
+	unsigned int GetVersion( void ) const { return m_version; }
 
-	template <typename C = PathFollower, typename T = vars_t>
-	static C *create()
-	{
-		return create<C, T>(PathFollowerCTOR);
-	}
+	// the current table, game thread only and after EnsureBuilt
+	size_t GetIDCount( void ) const { return m_table->GetIDCount(); }
+	range_t Incoming( unsigned int id ) const { return m_table->Incoming( id ); }
+	range_t Outgoing( unsigned int id ) const { return m_table->Outgoing( id ); }
 
-	void CallUpdate(INextBot *bot)
+private:
+	struct link_t
 	{
-		g_bInPathFollowerFaceTowards = true;
-		ILocomotion *loc{bot->GetLocomotionInterface()};
-		bool disable_facing = !getvars().allowfacing;
-		if(disable_facing) {
-			g_bFaceTowardsDisabled = true;
-		}
-		Update(bot);
-		if(disable_facing) {
-			g_bFaceTowardsDisabled = false;
-		}
-		g_bInPathFollowerFaceTowards = false;
-	}
+		unsigned int from;
+		unsigned int to;
+		edge_t edge;		// area is the to area
+	};
 
-#if SOURCE_ENGINE == SE_TF2
-	void SetGoalTolerance(float val)
-	{
-		m_goalTolerance = val;
-	}
-	
-	float GetGoalTolerance()
-	{
-		return m_goalTolerance;
-	}
-#endif
-	
-	float GetMinLookAheadDistance()
+	static void AddLink( std::vector< link_t > &links, CNavArea *from, CNavArea *to, const CNavLadder *ladder, const CFuncElevator *elevator, float length, NavTraverseType how )
 	{
-		return m_minLookAheadRange;
+		links.push_back( link_t{ from->GetID(), to->GetID(), edge_t{ to, ladder, elevator, length, from->ComputeAdjacentConnectionHeightChange( to ), how } } );
 	}
-	
-	bool IsAtGoal( INextBot *bot ) const
-	{
-		ILocomotion *mover = bot->GetLocomotionInterface();
-		IBody *body = bot->GetBodyInterface();
-
-		//
-		// m_goal is the node we are moving toward along the path
-		// current is the node just behind us
-		//
-		const Segment *current = PriorSegment( m_goal );
-		Vector toGoal = m_goal->pos - mover->GetFeet();
 
-	// 	if ( m_goal->type == JUMP_OVER_GAP && !mover->IsOnGround() )
-	// 	{
-	// 		// jumping over a gap, don't skip ahead until we land
-	// 		return false;
-	// 	}
+	// the same connections in the same order as BuildPath walks them
+	static void Build( table_t &table )
+	{
+		const int areaCount = TheNavAreas->Count();
 
-		if ( current == NULL )
+		unsigned int maxID = 0;
+		for ( int i = 0; i < areaCount; ++i )
 		{
-			// passed goal
-			return true;
+			maxID = MAX( maxID, (*TheNavAreas)[ i ]->GetID() );
 		}
-		else if ( m_goal->type == DROP_DOWN )
+
+		const size_t count = areaCount > 0 ? maxID + 1 : 0;
+		table.m_areas.assign( count, NULL );
+		table.m_centers.assign( count, vec3_origin );
+		table.m_extents.resize( count );
+
+		std::vector< link_t > links;
+		for ( int i = 0; i < areaCount; ++i )
 		{
-			// m_goal is the top of the drop-down, and the following segment is the landing point
-			const Segment *landing = NextSegment( m_goal );
+			CNavArea *area = (*TheNavAreas)[ i ];
+			table.m_areas[ area->GetID() ] = area;
+			table.m_centers[ area->GetID() ] = area->GetCenter();
+			area->GetExtent( &table.m_extents[ area->GetID() ] );
 
-			if ( landing == NULL )
+			for ( int dir = 0; dir < NUM_DIRECTIONS; ++dir )
 			{
-				// passed goal or corrupt path
-				return true;
-			}		
-			else
-			{
-				// did we reach the ground
-				if ( mover->GetFeet().z - landing->pos.z < mover->GetStepHeight() )
+				const NavConnectVector *floorList = area->GetAdjacentAreas( (NavDirType)dir );
+				for ( int j = 0; j < floorList->Count(); ++j )
 				{
-					// reached goal
-					return true;
+					const NavConnect &floorConnect = floorList->Element( j );
+					if ( floorConnect.area != area )
+						AddLink( links, area, floorConnect.area, NULL, NULL, floorConnect.length, (NavTraverseType)dir );
 				}
 			}
-					
-			/// @todo: it is possible to fall into a bad place and get stuck - should move back onto the path
-			
-		}
-		else if ( m_goal->type == CLIMB_UP )
-		{
-			// once jump is started, assume it is successful, since
-			// nav mesh may be substantially off from actual ground height at landing
-			const Segment *landing = NextSegment( m_goal );
 
-			if ( landing == NULL )
+			const NavLadderConnectVector *ladderList = area->GetLadders( CNavLadder::LADDER_UP );
+			for ( int j = 0; j < ladderList->Count(); ++j )
 			{
-				// passed goal or corrupt path
-				return true;
-			}		
-			else if ( /*!mover->IsOnGround() && */ mover->GetFeet().z > m_goal->pos.z + mover->GetStepHeight() )
+				const CNavLadder *ladder = ladderList->Element( j ).ladder;
+
+				// do not use BEHIND connection, as its very hard to get to when going up a ladder
+				CNavArea *tops[] = { ladder->m_topForwardArea, ladder->m_topLeftArea, ladder->m_topRightArea };
+				for ( CNavArea *top : tops )
+				{
+					if ( top && top != area )
+						AddLink( links, area, top, ladder, NULL, -1.0f, GO_LADDER_UP );
+				}
+			}
+
+			ladderList = area->GetLadders( CNavLadder::LADDER_DOWN );
+			for ( int j = 0; j < ladderList->Count(); ++j )
 			{
-				// we're off the ground, presumably climbing - assume we reached the goal
-				return true;
+				const CNavLadder *ladder = ladderList->Element( j ).ladder;
+				if ( ladder->m_bottomArea && ladder->m_bottomArea != area )
+					AddLink( links, area, ladder->m_bottomArea, ladder, NULL, -1.0f, GO_LADDER_DOWN );
 			}
-			/* This breaks infected climbing up holes in the ceiling - they can get within 2D range of m_goal before finding a ledge to climb up to
-			else if ( mover->IsOnGround() )
+
+			const CFuncElevator *elevator = area->GetElevator();
+			if ( elevator )
 			{
-				// proximity check
-				// Z delta can be anything, since we may be climbing over a tall fence, a physics prop, etc.
-				const float rangeTolerance = 10.0f;
-				if ( toGoal.AsVector2D().IsLengthLessThan( rangeTolerance ) )
+				const NavConnectVector &elevatorAreas = area->GetElevatorAreas();
+				for ( int j = 0; j < elevatorAreas.Count(); ++j )
 				{
-					// reached goal
-					return true;
+					CNavArea *newArea = elevatorAreas[ j ].area;
+					if ( newArea != area )
+						AddLink( links, area, newArea, NULL, elevator, -1.0f, newArea->GetCenter().z > area->GetCenter().z ? GO_ELEVATOR_UP : GO_ELEVATOR_DOWN );
 				}
 			}
-			*/
 		}
-		else
+
+		// counting sort into rows, stable so every row keeps the walking order
+		table.m_outOffsets.assign( count + 1, 0 );
+		table.m_inOffsets.assign( count + 1, 0 );
+		for ( const link_t &link : links )
 		{
-			const Segment *next = NextSegment( m_goal );
+			++table.m_outOffsets[ link.from + 1 ];
+			++table.m_inOffsets[ link.to + 1 ];
+		}
 
-			if ( next )
-			{
-				// because mover may be off the path, check if it crossed the plane of the goal
-				// check against average of current and next forward vectors
-				Vector2D dividingPlane;
+		for ( size_t id = 0; id < count; ++id )
+		{
+			table.m_outOffsets[ id+1 ] += table.m_outOffsets[ id ];
+			table.m_inOffsets[ id+1 ] += table.m_inOffsets[ id ];
+		}
 
-				if ( current->ladder )
-				{
-					dividingPlane = m_goal->forward.AsVector2D();
-				}
-				else
-				{
-					dividingPlane = current->forward.AsVector2D() + m_goal->forward.AsVector2D();
-				}
+		table.m_outgoing.resize( links.size() );
+		table.m_incoming.resize( links.size() );
 
-				if ( DotProduct2D( toGoal.AsVector2D(), dividingPlane ) < 0.0001f &&
-					abs( toGoal.z ) < body->GetStandHullHeight() )
-				{	
-					// only skip higher Z goal if next goal is directly reachable
-					// can't use this for positions below us because we need to be able
-					// to climb over random objects along our path that we can't actually
-					// move *through*
-					if ( toGoal.z < mover->GetStepHeight() && ( mover->IsPotentiallyTraversable( mover->GetFeet(), next->pos ) && !mover->HasPotentialGap( mover->GetFeet(), next->pos ) ) )
-					{
-						// passed goal
-						return true;
-					}
-				}
-			}
+		std::vector< unsigned int > outNext( table.m_outOffsets.begin(), table.m_outOffsets.end() - ( count > 0 ? 1 : 0 ) );
+		std::vector< unsigned int > inNext( table.m_inOffsets.begin(), table.m_inOffsets.end() - ( count > 0 ? 1 : 0 ) );
+		for ( const link_t &link : links )
+		{
+			table.m_outgoing[ outNext[ link.from ]++ ] = link.edge;
 
-#if SOURCE_ENGINE == SE_TF2
-			// proximity check
-			// Z delta can be anything, since we may be climbing over a tall fence, a physics prop, etc.
-			if ( toGoal.AsVector2D().IsLengthLessThan( m_goalTolerance ) )
-			{
-				// reached goal
-				return true;
-			}
-#endif
+			edge_t incoming = link.edge;
+			incoming.area = table.m_areas[ link.from ];
+			table.m_incoming[ inNext[ link.to ]++ ] = incoming;
 		}
+	}
 
-		return false;	
+	std::mutex m_mutex;
+	snapshot_t m_table;
+	unsigned int m_generation = 0;
+	int m_areaCount = 0;
+	unsigned int m_version = 0;
+};
+
+NavConnectionGraph g_NavConnectionGraph;
+
+/**
+ * Search state (open/closed, parent, costs) kept outside of CNavArea in a table indexed by area ID.
+ * Every context owns its own open heap so separate contexts can search at the same time,
+ * off the game thread too as long as the nav mesh isn't being modified.
+ *
+ * Plain IPathCost functors and plugin callbacks read the area fields (GetCostSoFar, GetParent),
+ * so a write-through context mirrors its state into the areas as well. That one is game thread only.
+ */
+class NavSearchContext
+{
+public:
+	NavSearchContext( bool writeThrough = false )
+		: m_writeThrough( writeThrough )
+	{
 	}
 
-	void AdjustSpeed( INextBot *bot )
+	// start a new search, stale entries are told apart by the marker so nothing is cleared
+	void Reset( void )
 	{
-		ILocomotion *mover = bot->GetLocomotionInterface();
+		m_heap.clear();
+		m_touched.clear();
+		m_skipped.clear();
+		m_seq = 0;
+		m_reached = NULL;
+		m_paused = false;
 
-		// if we're coming up on a gap jump, or we're in the air, use maximum speed
-		if ( ( m_goal && m_goal->type == JUMP_OVER_GAP ) || !mover->IsOnGround() )
+		if ( ++m_marker == 0 )
 		{
-			mover->SetDesiredSpeed( mover->GetRunSpeed() );
-			return;
+			for( areastate_t &state : m_state )
+			{
+				state.marker = 0;
+			}
+
+			m_marker = 1;
 		}
+	}
 
-		MoveCursorToClosestPosition( bot->GetPosition() );
-		const Path::Data &data = GetCursorData();
-		
-		// speed based on curvature
-		mover->SetDesiredSpeed( mover->GetRunSpeed() + fabs( data.curvature ) * ( mover->GetWalkSpeed() - mover->GetRunSpeed() ) );
+	bool IsWriteThrough( void ) const { return m_writeThrough; }
+
+	bool IsMarked( const CNavArea *area ) const { return ( Flags( area ) & STATE_MARKED ) != 0; }
+	bool IsOpen( const CNavArea *area ) const { return ( Flags( area ) & STATE_OPEN ) != 0; }
+	bool IsClosed( const CNavArea *area ) const { return ( Flags( area ) & STATE_CLOSED ) != 0; }
+
+	CNavArea *GetParent( const CNavArea *area ) const { const areastate_t *state = Find( area ); return state ? state->parent : NULL; }
+	NavTraverseType GetParentHow( const CNavArea *area ) const { const areastate_t *state = Find( area ); return state ? state->how : NUM_TRAVERSE_TYPES; }
+	float GetTotalCost( const CNavArea *area ) const { const areastate_t *state = Find( area ); return state ? state->totalCost : 0.0f; }
+	float GetCostSoFar( const CNavArea *area ) const { const areastate_t *state = Find( area ); return state ? state->costSoFar : 0.0f; }
+	float GetPathLengthSoFar( const CNavArea *area ) const { const areastate_t *state = Find( area ); return state ? state->lengthSoFar : 0.0f; }
+
+	void Mark( CNavArea *area ) { Touch( area ).flags |= STATE_MARKED; }
+
+	void SetParent( CNavArea *area, CNavArea *parent, NavTraverseType how = NUM_TRAVERSE_TYPES )
+	{
+		areastate_t &state = Touch( area );
+		state.parent = parent;
+		state.how = how;
+
+		if ( m_writeThrough )
+			area->SetParent( parent, how );
 	}
-};
 
-DETOUR_DECL_MEMBER1(AdjustSpeed, void, INextBot *, bot)
-{
-	((PathFollower *)this)->AdjustSpeed(bot);
-}
+	void SetTotalCost( CNavArea *area, float value )
+	{
+		Touch( area ).totalCost = value;
 
-void PathFollower::Update( INextBot *bot )
-{
-	static int vtableindex = -1;
-	if(vtableindex == -1) {
-		vtableindex = vfunc_index(&PathFollower::Update);
+		if ( m_writeThrough )
+			area->SetTotalCost( value );
 	}
 
-	g_bInPathFollowerFaceTowards = true;
-	call_vfunc<void, PathFollower, INextBot *>(this, vtableindex, bot);
-	g_bInPathFollowerFaceTowards = false;
-}
+	void SetCostSoFar( CNavArea *area, float value )
+	{
+		Touch( area ).costSoFar = value;
 
-SH_DECL_HOOK0_void(Path, Invalidate, SH_NOATTRIB, 0);
+		if ( m_writeThrough )
+			area->SetCostSoFar( value );
+	}
 
-class DirectChasePath;
+	void SetPathLengthSoFar( CNavArea *area, float value )
+	{
+		Touch( area ).lengthSoFar = value;
 
-class ChasePath : public PathFollower
-{
-public:
-	enum SubjectChaseType
+		if ( m_writeThrough )
+			area->SetPathLengthSoFar( value );
+	}
+
+	bool IsOpenListEmpty( void ) const { return m_heap.empty(); }
+
+	// keyed on the area's current total cost, equal costs pop in insertion order
+	void AddToOpenList( CNavArea *area )
 	{
-		LEAD_SUBJECT,
-		DONT_LEAD_SUBJECT
-	};
-	
-	CountdownTimer m_failTimer;							// throttle re-pathing if last path attempt failed
-	CountdownTimer m_throttleTimer;						// require a minimum time between re-paths
-	CountdownTimer m_lifetimeTimer;
-	EHANDLE m_lastPathSubject;							// the subject used to compute the current/last path
-	SubjectChaseType m_chaseHow;
+		areastate_t &state = Touch( area );
+		if ( state.flags & STATE_OPEN )
+			return;
 
-	struct vars_t;
+		// unlike closing this doesn't mark, CollectSurroundingAreas relies on that
+		state.flags |= STATE_OPEN;
+		state.flags &= ~STATE_CLOSED;
 
-	using IsRepathNeeded_t = bool (ChasePath::*)( vars_t &, INextBot *, CBaseEntity * );
-	using Update_t = void (ChasePath::*)( vars_t &, INextBot *, CBaseEntity *, const IPathCost &, Vector * );
-	
-	struct vars_t : public PathFollower::vars_t
+		int pos = (int)m_heap.size();
+		m_heap.push_back( heapnode_t{ state.totalCost, m_seq++, area } );
+		SiftUp( pos );
+	}
+
+	void UpdateOnOpenList( CNavArea *area )
 	{
-		float radius = 500.0f;
-		float maxlen = 0.0f;
-		float life = 0.0f;
-		float tolerancerate = 0.33f;
-		float mintolerance = 0.0f;
-		float repathtime = 0.5f;
-		
-		IsRepathNeeded_t pIsRepathNeeded = nullptr;
-		Update_t pUpdate = nullptr;
-
-		void dtor(PathFollower *base) override
-		{
-			PathFollower::vars_t::dtor(base);
+		const areastate_t *state = Find( area );
+		if ( !state || !( state->flags & STATE_OPEN ) )
+			return;
 
-			ChasePath *bytes{(ChasePath *)base};
-			bytes->dtor();
-		}
-	};
+		int pos = state->heapPos;
+		float oldKey = m_heap[ pos ].key;
+		m_heap[ pos ].key = state->totalCost;
 
-	vars_t &getvars()
-	{ return *(vars_t *)vars_ptr(); }
-	
-	void ctor(SubjectChaseType chaseHow)
-	{
-		new (&m_failTimer) CountdownTimer();
-		new (&m_throttleTimer) CountdownTimer();
-		new (&m_lifetimeTimer) CountdownTimer();
-		new (&m_lastPathSubject) EHANDLE();
-		
-		m_failTimer.Invalidate();
-		m_throttleTimer.Invalidate();
-		m_lifetimeTimer.Invalidate();
-		m_lastPathSubject = NULL;
-		m_chaseHow = chaseHow;
+		if ( state->totalCost < oldKey )
+			SiftUp( pos );
+		else
+			SiftDown( pos );
 	}
 
-	void dtor()
+	CNavArea *PopOpenList( void )
 	{
-		m_failTimer.~CountdownTimer();
-		m_throttleTimer.~CountdownTimer();
-		m_lifetimeTimer.~CountdownTimer();
-		m_lastPathSubject.~EHANDLE();
-	}
+		if ( m_heap.empty() )
+			return NULL;
 
-	template <typename C = ChasePath, typename T = vars_t>
-	static C *create(SubjectChaseType chaseHow)
-	{
-		static_assert(std::is_base_of<ChasePath, C>::value, "");
-		C *bytes = (C *)PathFollower::create<C, T>();
-		bytes->ctor(chaseHow);
-		T &vars{PathFollower::getvars<C, T>(bytes)};
-		vars.hookids.emplace_back(SH_ADD_HOOK(Path, Invalidate, bytes, SH_MEMBER(bytes, &C::HookInvalidate), true));
-		vars.pIsRepathNeeded = static_cast<IsRepathNeeded_t>(&C::IsRepathNeeded);
-		vars.pUpdate = static_cast<Update_t>(&C::Update);
-		return bytes;
+		CNavArea *area = m_heap.front().area;
+		m_state[ area->GetID() ].flags &= ~STATE_OPEN;
+
+		heapnode_t last = m_heap.back();
+		m_heap.pop_back();
+
+		if ( !m_heap.empty() )
+		{
+			m_heap.front() = last;
+			SiftDown( 0 );
+		}
+
+		return area;
 	}
 
-	void HookInvalidate()
+	void AddToClosedList( CNavArea *area )
 	{
-		m_throttleTimer.Invalidate();
-		m_lifetimeTimer.Invalidate();
-		
-		RETURN_META(MRES_HANDLED);
+		areastate_t &state = Touch( area );
+		state.flags |= ( STATE_CLOSED|STATE_MARKED );
+		state.flags &= ~STATE_OPEN;
 	}
 
-	Vector PredictSubjectPosition( vars_t &vars, INextBot *bot, CBaseEntity *subject )
+	// same as ISearchSurroundingAreasFunctor::IncludeInSearch
+	void IncludeInSearch( CNavArea *area, CNavArea *priorArea )
 	{
-		ILocomotion *mover = bot->GetLocomotionInterface();
+		if ( area == NULL )
+			return;
 
-		const Vector &subjectPos = subject->GetAbsOrigin();
+		if ( IsMarked( area ) )
+			return;
 
-		Vector to = subjectPos - bot->GetPosition();
-		to.z = 0.0f;
-		float flRangeSq = to.LengthSqr();
+		Mark( area );
+		SetTotalCost( area, 0.0f );
+		SetParent( area, priorArea );
 
-		// don't lead if subject is very far away
-		float flLeadRadiusSq = vars.radius;
-		flLeadRadiusSq *= flLeadRadiusSq;
-		if ( flRangeSq > flLeadRadiusSq )
-			return subjectPos;
+		// compute approximate travel distance from start area of search
+		if ( priorArea )
+		{
+			float distAlong = GetCostSoFar( priorArea );
+			distAlong += ( area->GetCenter() - priorArea->GetCenter() ).Length();
+			SetCostSoFar( area, distAlong );
+		}
+		else
+		{
+			SetCostSoFar( area, 0.0f );
+		}
 
-		// Normalize in place
-		float range = sqrt( flRangeSq );
-		to /= ( range + 0.0001f );	// avoid divide by zero
+		AddToOpenList( area );
+	}
 
-		// estimate time to reach subject, assuming maximum speed
-		float leadTime = 0.5f + ( range / ( mover->GetRunSpeed() + 0.0001f ) );
-		
-		// estimate amount to lead the subject	
-		Vector lead = leadTime * subject->GetAbsVelocity();
-		lead.z = 0.0f;
+	template< typename CostFunctor >
+	float EvaluateCost( CostFunctor &costFunc, CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length )
+	{
+		return EvaluateCost( costFunc, area, fromArea, ladder, elevator, length, typename std::is_base_of< NativePathCost, CostFunctor >::type{} );
+	}
 
-		if ( DotProduct( to, lead ) < 0.0f )
-		{
-			// the subject is moving towards us - only pay attention 
-			// to his perpendicular velocity for leading
-			Vector2D to2D = to.AsVector2D();
-			to2D.NormalizeInPlace();
+	/**
+	 * NavAreaBuildPath on this context.
+	 * Follow the result with GetParent/GetParentHow from closestArea.
+	 */
+	template< typename CostFunctor >
+	bool BuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false );
 
-			Vector2D perp( -to2D.y, to2D.x );
+	// true if the last BuildPath slice ran out of time, call ResumeSlicedPath to go on
+	bool IsPaused( void ) const { return m_paused; }
 
-			float enemyGroundSpeed = lead.x * perp.x + lead.y * perp.y;
+	/**
+	 * Search for goalArea again from where the last BuildPath/ContinuePath left off, the open areas are
+	 * re-estimated for the new goal. Costs must come from the same functor, searches with a max path length can't be continued.
+	 * Doesn't track a closest area, run BuildPath if this fails.
+	 */
+	template< typename CostFunctor >
+	bool ContinuePath( CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, int teamID = TEAM_ANY, bool ignoreNavBlockers = false );
 
-			lead.x = enemyGroundSpeed * perp.x;
-			lead.y = enemyGroundSpeed * perp.y;
-		}
+	/**
+	 * Make newRoot, a closed area of the last search, the root of the search tree.
+	 * The areas below it keep their costs (shifted so newRoot is at 0) since a shortest path to them went through it,
+	 * everything else is dropped. Kept closed areas next to dropped ones are opened again so ContinuePath expands past them.
+	 */
+	void Reroot( CNavArea *newRoot );
 
-		// compute our desired destination
-		Vector pathTarget = subjectPos + lead;
+	/**
+	 * Keep the following searches inside two regions, regions is indexed by area ID and areas
+	 * in any other region are never expanded into. Stays set until ClearRegion.
+	 */
+	void SetRegion( const std::vector< int > *regions, int first, int second )
+	{
+		m_regions = regions;
+		m_regionFirst = first;
+		m_regionSecond = second;
+	}
 
-		// validate this destination
+	void ClearRegion( void ) { m_regions = NULL; }
 
-		// don't lead through walls
-		if ( lead.LengthSqr() > 36.0f )
+	// follow the parents from endArea back to startArea, chain is filled start first and keeps the last maxCount areas
+	void CollectChain( CNavArea *startArea, CNavArea *endArea, int maxCount, std::vector< NavAreaChainLink > &chain ) const
+	{
+		chain.clear();
+
+		for( CNavArea *area = endArea; area; area = GetParent( area ) )
 		{
-			float fraction;
-			if ( !mover->IsPotentiallyTraversable( subjectPos, pathTarget, ILocomotion::TraverseWhenType::IMMEDIATELY, &fraction ) )
+			chain.push_back( NavAreaChainLink{ area, area->GetID(), GetParentHow( area ) } );
+
+			if ( area == startArea )
 			{
-				// tried to lead through an unwalkable area - clip to walkable space
-				pathTarget = subjectPos + fraction * ( pathTarget - subjectPos );
+				// startArea can be re-evaluated during the pathfind and given a parent...
+				break;
 			}
+			if ( (int)chain.size() >= maxCount )
+				break;
 		}
 
-		// don't lead over cliffs
-		CNavArea *leadArea = NULL;
+		std::reverse( chain.begin(), chain.end() );
+	}
 
-	#if 0
-		CBaseCombatCharacter *pBCC = subject->MyCombatCharacterPointer();
-		if ( pBCC && CloseEnough( pathTarget, subjectPos, 3.0 ) )
-		{
-			pathTarget = subjectPos;
-			leadArea = pBCC->GetLastKnownArea(); // can return null?
-		}
-		else
-		{
-			struct CacheEntry_t
-			{
-				CacheEntry_t() : pArea(NULL) {}
-				Vector target;
-				CNavArea *pArea;
-			};
+private:
+	template< typename CostFunctor >
+	float EvaluateCost( CostFunctor &costFunc, CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length, std::true_type )
+	{
+		float cost = costFunc.EdgeCost( area, fromArea, ladder, elevator, length );
+		if ( cost < 0.0f || fromArea == NULL )
+			return cost;
 
-			static int iServer;
-			static CacheEntry_t cache[4];
-			static int iNext;
-			int i;
+		return cost + GetCostSoFar( fromArea );
+	}
 
-			bool bFound = false;
-			if ( iServer != gpGlobals->serverCount )
-			{
-				for ( i = 0; i < ARRAYSIZE(cache); i++ )
-				{
-					cache[i].pArea = NULL;
-				}
-				iServer = gpGlobals->serverCount;
-			}
-			else
-			{
-				for ( i = 0; i < ARRAYSIZE(cache); i++ )
-				{
-					if ( cache[i].pArea && CloseEnough( cache[i].target, pathTarget, 2.0 ) )
-					{
-						pathTarget = cache[i].target;
-						leadArea = cache[i].pArea;
-						bFound = true;
-						break;
-					}
-				}
-			}
+	template< typename CostFunctor >
+	float EvaluateCost( CostFunctor &costFunc, CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length, std::false_type )
+	{
+		return costFunc( area, fromArea, ladder, elevator, length );
+	}
 
-			if ( !bFound )
-			{
-				leadArea = TheNavMesh->GetNearestNavArea( pathTarget, GETNAVAREA_CHECK_GROUND, 10000.0f );
-				if ( leadArea )
-				{
-					cache[iNext].target = pathTarget;
-					cache[iNext].pArea = leadArea;
-					iNext = ( iNext + 1 ) % ARRAYSIZE( cache );
-				}
-			}
-		}
-	#else
-		leadArea = TheNavMesh->GetNearestNavArea( pathTarget, GETNAVAREA_CHECK_GROUND, 10000.0f );
-	#endif
+	static float GetMinCostScale( const IPathCost &costFunc ) { return 0.0f; }
+	static float GetMinCostScale( const NativePathCost &costFunc ) { return costFunc.GetMinCostScale(); }
+
+	// remaining cost toward one goal, the straight line raised to the landmark bound where it applies
+	struct estimate_t
+	{
+		Vector goalPos;
+		NavLandmarks::snapshot_t landmarks;
+		NavLandmarks::goal_t landmarkGoal;
+		float landmarkScale;
+	};
 
+	template< typename CostFunctor >
+	static void InitEstimate( estimate_t &estimate, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc )
+	{
+		estimate.goalPos = ( goalPos ) ? *goalPos : goalArea->GetCenter();
 
-		if ( !leadArea || leadArea->GetZ( pathTarget.x, pathTarget.y ) < pathTarget.z - mover->GetMaxJumpHeight() )
-		{
-			// would fall off a cliff
-			return subjectPos;		
-		}
-		
-		/** This needs more thought - it is preventing bots from using dropdowns
-		if ( mover->HasPotentialGap( subjectPos, pathTarget, &fraction ) )
+		// landmark distances only bound the way to an area, and only for functors that can't go below them
+		estimate.landmarkScale = ( goalArea ) ? GetMinCostScale( costFunc ) : 0.0f;
+		if ( estimate.landmarkScale > 0.0f )
 		{
-			// tried to lead over a cliff - clip to safe region
-			pathTarget = subjectPos + fraction * ( pathTarget - subjectPos );
+			estimate.landmarks = g_NavLandmarks.Snapshot();
+			if ( estimate.landmarks && !estimate.landmarks->PrepareGoal( goalArea, estimate.landmarkGoal ) )
+				estimate.landmarks.reset();
 		}
-		*/
-		
-		return pathTarget;
 	}
 
-	bool IsRepathNeeded( vars_t &vars, INextBot *bot, CBaseEntity *subject )
+	static float EstimateRemaining( const estimate_t &estimate, const CNavArea *area, float dist )
 	{
-		// the closer we get, the more accurate our path needs to be
-		Vector to = subject->GetAbsOrigin() - bot->GetPosition();
-
-		float tolerance = vars.mintolerance + vars.tolerancerate * to.Length();
+		if ( estimate.landmarks )
+			return MAX( dist, estimate.landmarkScale * estimate.landmarks->Estimate( area, estimate.landmarkGoal ) );
 
-		return ( subject->GetAbsOrigin() - GetEndPosition() ).IsLengthGreaterThan( tolerance );
+		return dist;
 	}
 
-	void RefreshPath( vars_t &vars, INextBot *bot, CBaseEntity *subject, const IPathCost &cost, Vector *pPredictedSubjectPos )
-	{
-		ILocomotion *mover = bot->GetLocomotionInterface();
+public:
+	// everything a BuildPath needs to carry on in a later frame, the open list itself stays in the context
+	struct slice_t
+	{
+		CNavArea *goalArea = NULL;
+		Vector goalPos;
+		bool hasGoalPos = false;
+		float maxPathLength = 0.0f;
+		int teamID = TEAM_ANY;
+		bool ignoreNavBlockers = false;
+		CNavArea *closestArea = NULL;
+		float closestAreaDist = FLT_MAX;
+		estimate_t estimate;
+	};
 
-		// don't change our path if we're on a ladder
-		if ( IsValid() && mover->IsUsingLadder() )
-		{
-			if ( bot->IsDebugging( NEXTBOT_PATH ) )
-			{
-				static float lastprint = 0.0f;
-				if(lastprint <= gpGlobals->curtime) {
-					DevMsg( "%3.2f: bot(#%d) ChasePath::RefreshPath failed. Bot is on a ladder.\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
-					lastprint = gpGlobals->curtime + 2.0f;
-				}
-			}
+	/**
+	 * BuildPath that gives up once Plat_FloatTime passes deadline (0 for no limit), IsPaused tells if it did.
+	 * slice.closestArea is the closest area so far. Nothing else may use the context until the search is done.
+	 */
+	template< typename CostFunctor >
+	bool BeginSlicedPath( slice_t &slice, CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, float maxPathLength, int teamID, bool ignoreNavBlockers, double deadline );
 
-			// don't allow repath until a moment AFTER we have left the ladder
-			m_throttleTimer.Start( 1.0f );
+	// run a paused search for another slice, same rules as BeginSlicedPath
+	template< typename CostFunctor >
+	bool ResumeSlicedPath( slice_t &slice, CostFunctor &costFunc, double deadline );
 
-			return;
-		}
+private:
+	enum { SLICE_CHECK_INTERVAL = 32 };
 
-		if ( subject == NULL )
-		{
-			if ( bot->IsDebugging( NEXTBOT_PATH ) )
-			{
-				static float lastprint = 0.0f;
-				if(lastprint <= gpGlobals->curtime) {
-					DevMsg( "%3.2f: bot(#%d) CasePath::RefreshPath failed. No subject.\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
-					lastprint = gpGlobals->curtime + 2.0f;
-				}
-			}
-			return;
-		}
+	// the A* loop shared by BuildPath and ContinuePath, runs off whatever is on the open list
+	template< typename CostFunctor >
+	bool RunSearch( CNavArea *goalArea, const Vector *goalPos, const estimate_t &estimate, CostFunctor &costFunc, CNavArea **closestArea, float &closestAreaDist, float maxPathLength, int teamID, bool ignoreNavBlockers, double deadline = 0.0 );
 
-		if ( !m_failTimer.IsElapsed() )
-		{
-	 		if ( bot->IsDebugging( NEXTBOT_PATH ) )
-	 		{
-				static float lastprint = 0.0f;
-				if(lastprint <= gpGlobals->curtime) {
-					DevMsg( "%3.2f: bot(#%d) ChasePath::RefreshPath failed. Fail timer not elapsed.\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
-					lastprint = gpGlobals->curtime + 2.0f;
-				}
-	 		}
-			return;
-		}
+	enum
+	{
+		STATE_MARKED = (1 << 0),
+		STATE_OPEN = (1 << 1),
+		STATE_CLOSED = (1 << 2),
+	};
 
-		// if our path subject changed, repath immediately
-		if ( subject != m_lastPathSubject )
-		{
-			if ( bot->IsDebugging( NEXTBOT_PATH ) )
-			{
-				static float lastprint = 0.0f;
-				if(lastprint <= gpGlobals->curtime) {
-					DevMsg( "%3.2f: bot(#%d) Chase path subject changed (from %p (#%d) to %p (#%d)).\n", gpGlobals->curtime, bot->GetEntity()->entindex(), m_lastPathSubject.Get(), m_lastPathSubject.Get() ? m_lastPathSubject.Get()->entindex() : -1, subject, subject ? subject->entindex() : -1 );
-					lastprint = gpGlobals->curtime + 2.0f;
-				}
-			}
+	struct areastate_t
+	{
+		unsigned int marker;
+		unsigned int flags;
+		int heapPos;
+		NavTraverseType how;
+		CNavArea *parent;
+		float totalCost;
+		float costSoFar;
+		float lengthSoFar;
+	};
 
-			Invalidate();
+	struct heapnode_t
+	{
+		float key;
+		unsigned int seq;
+		CNavArea *area;
+	};
 
-			// new subject, fresh attempt
-			m_failTimer.Invalidate();
-		}
+	enum { ARITY = 4 };
 
-		if ( IsValid() && !m_throttleTimer.IsElapsed() )
+	const areastate_t *Find( const CNavArea *area ) const
+	{
+		unsigned int id = area->GetID();
+		if ( id >= m_state.size() || m_state[ id ].marker != m_marker )
+			return NULL;
+
+		return &m_state[ id ];
+	}
+
+	bool IsInRegion( const CNavArea *area ) const
+	{
+		if ( m_regions == NULL )
+			return true;
+
+		unsigned int id = area->GetID();
+		int region = ( id < m_regions->size() ) ? (*m_regions)[ id ] : -1;
+		return region == m_regionFirst || region == m_regionSecond;
+	}
+
+	unsigned int Flags( const CNavArea *area ) const
+	{
+		const areastate_t *state = Find( area );
+		return state ? state->flags : 0;
+	}
+
+	areastate_t &Touch( CNavArea *area )
+	{
+		unsigned int id = area->GetID();
+		if ( id >= m_state.size() )
+			m_state.resize( id + 1, areastate_t{} );
+
+		areastate_t &state = m_state[ id ];
+		if ( state.marker != m_marker )
 		{
-			// require a minimum time between repaths, as long as we have a path to follow
-	 		if ( bot->IsDebugging( NEXTBOT_PATH ) )
-	 		{
-				static float lastprint = 0.0f;
-				if(lastprint <= gpGlobals->curtime) {
-					DevMsg( "%3.2f: bot(#%d) ChasePath::RefreshPath failed. Rate throttled.\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
-					lastprint = gpGlobals->curtime + 2.0f;
-				}
-	 		}
-			return;
+			m_touched.push_back( area );
+
+			state.marker = m_marker;
+			state.flags = 0;
+			state.heapPos = -1;
+			state.how = NUM_TRAVERSE_TYPES;
+			state.parent = NULL;
+			state.totalCost = 0.0f;
+			state.costSoFar = 0.0f;
+			state.lengthSoFar = 0.0f;
 		}
 
-		if ( IsValid() && m_lifetimeTimer.HasStarted() && m_lifetimeTimer.IsElapsed() )
+		return state;
+	}
+
+	static bool Less( const heapnode_t &a, const heapnode_t &b )
+	{
+		if ( a.key != b.key )
+			return a.key < b.key;
+
+		return a.seq < b.seq;
+	}
+
+	void Place( const heapnode_t &node, int pos )
+	{
+		m_heap[ pos ] = node;
+		m_state[ node.area->GetID() ].heapPos = pos;
+	}
+
+	void SiftUp( int pos )
+	{
+		heapnode_t node = m_heap[ pos ];
+
+		while ( pos > 0 )
 		{
-			// this path's lifetime has elapsed
-			Invalidate();
+			int parent = ( pos - 1 ) / ARITY;
+			if ( !Less( node, m_heap[ parent ] ) )
+				break;
+
+			Place( m_heap[ parent ], pos );
+			pos = parent;
 		}
 
-		if ( !IsValid() || (this->*vars.pIsRepathNeeded)( vars, bot, subject ) )
+		Place( node, pos );
+	}
+
+	void SiftDown( int pos )
+	{
+		int count = (int)m_heap.size();
+		heapnode_t node = m_heap[ pos ];
+
+		while ( true )
 		{
-			// the situation has changed - try a new path
-			bool isPath;
-			Vector pathTarget = subject->GetAbsOrigin();
+			int first = pos * ARITY + 1;
+			if ( first >= count )
+				break;
 
-			if ( m_chaseHow == LEAD_SUBJECT )
-			{
-				pathTarget = pPredictedSubjectPos ? *pPredictedSubjectPos : PredictSubjectPosition( vars, bot, subject );
-				isPath = Compute( bot, pathTarget, cost, vars.maxlen );
-			}
-			else if ( subject->MyCombatCharacterPointer() && subject->MyCombatCharacterPointer()->GetLastKnownArea() )
-			{
-				isPath = Compute( bot, subject->MyCombatCharacterPointer(), cost, vars.maxlen );
-			}
-			else
+			int best = first;
+			int end = MIN( first + ARITY, count );
+			for ( int child = first + 1; child < end; ++child )
 			{
-				isPath = Compute( bot, pathTarget, cost, vars.maxlen );
+				if ( Less( m_heap[ child ], m_heap[ best ] ) )
+					best = child;
 			}
 
-			if ( isPath )
-			{
-				if ( bot->IsDebugging( NEXTBOT_PATH ) )
-				{
-					const float size = 20.0f;			
-					NDebugOverlay::VertArrow( bot->GetPosition() + Vector( 0, 0, size ), bot->GetPosition(), size, 255, RandomInt( 0, 200 ), 255, 255, true, 30.0f );
-
-					static float lastprint = 0.0f;
-					if(lastprint <= gpGlobals->curtime) {
-						DevMsg( "%3.2f: bot(#%d) REPATH\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
-						lastprint = gpGlobals->curtime + 2.0f;
-					}
-				}
+			if ( !Less( m_heap[ best ], node ) )
+				break;
 
-				m_lastPathSubject = subject;
+			Place( m_heap[ best ], pos );
+			pos = best;
+		}
 
-				m_throttleTimer.Start( vars.repathtime );
+		Place( node, pos );
+	}
 
-				// track the lifetime of this new path
-				float lifetime = vars.life;
-				if ( lifetime > 0.0f )
-				{
-					m_lifetimeTimer.Start( lifetime );
-				}
-				else
-				{
-					m_lifetimeTimer.Invalidate();
-				}
-			}
-			else
-			{
-				// can't reach subject - throttle retry based on range to subject
-				float failtime = 0.005f * ( bot->GetRangeTo( subject ) );
-				
-				m_failTimer.Start( failtime );
-				
-				// allow bot to react to path failure
-				bot->OnMoveToFailure( this, FAIL_NO_PATH_EXISTS );
+	struct kept_t
+	{
+		CNavArea *area;
+		areastate_t state;
+	};
 
-				if ( bot->IsDebugging( NEXTBOT_PATH ) )
-				{
-					const float size = 20.0f;	
-					const float dT = 90.0f;		
-					int c = RandomInt( 0, 100 );
-					NDebugOverlay::VertArrow( bot->GetPosition() + Vector( 0, 0, size ), bot->GetPosition(), size, 255, c, c, 255, true, dT );
-					NDebugOverlay::HorzArrow( bot->GetPosition(), pathTarget, 5.0f, 255, c, c, 255, true, dT );
+	std::vector< areastate_t > m_state;
+	std::vector< heapnode_t > m_heap;
+	std::vector< CNavArea * > m_touched;	// every area with state in this search
+	std::vector< CNavArea * > m_skipped;	// popped while blocked, ContinuePath gives them another look
+	std::vector< unsigned char > m_below;	// Reroot scratch, all 0 between calls
+	std::vector< CNavArea * > m_walked;
+	std::vector< kept_t > m_kept;
+	std::vector< CNavArea * > m_reopen;
+	unsigned int m_marker = 1;
+	unsigned int m_seq = 0;
+	CNavArea *m_reached = NULL;
+	unsigned int m_expanded = 0;
+	bool m_paused = false;
+	bool m_writeThrough;
+	const std::vector< int > *m_regions = NULL;
+	int m_regionFirst = -1;
+	int m_regionSecond = -1;
+	NavConnectionGraph::snapshot_t m_graph;	// taken when a search begins, NULL if none was built
+};
 
-					static float lastprint = 0.0f;
-					if(lastprint <= gpGlobals->curtime) {
-						DevMsg( "%3.2f: bot(#%d) REPATH FAILED %f\n", gpGlobals->curtime, bot->GetEntity()->entindex(), failtime );
-						lastprint = gpGlobals->curtime + 2.0f;
-					}
-				}
+template< typename CostFunctor >
+bool NavSearchContext::BuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea, float maxPathLength, int teamID, bool ignoreNavBlockers )
+{
+	slice_t slice;
+	bool result = BeginSlicedPath( slice, startArea, goalArea, goalPos, costFunc, maxPathLength, teamID, ignoreNavBlockers, 0.0 );
 
-				Invalidate();
-			}
-		}
-	}
-	
-	float GetLeadRadius( void ) 
-	{ 
-		return getvars().radius; // 1000.0f; 
+	if ( closestArea )
+	{
+		*closestArea = slice.closestArea;
 	}
 
-	float GetMaxPathLength( void )
+	return result;
+}
+
+template< typename CostFunctor >
+bool NavSearchContext::BeginSlicedPath( slice_t &slice, CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, float maxPathLength, int teamID, bool ignoreNavBlockers, double deadline )
+{
+	// start search
+	Reset();
+	m_graph = g_NavConnectionGraph.Snapshot();
+
+	slice.closestArea = startArea;
+
+	if ( startArea == NULL )
+		return false;
+
+	SetParent( startArea, NULL );
+
+	if ( goalArea != NULL && goalArea->IsBlocked( teamID, ignoreNavBlockers ) )
+		goalArea = NULL;
+
+	if ( goalArea == NULL && goalPos == NULL )
+		return false;
+
+	// if we are already in the goal area, build trivial path
+	if ( startArea == goalArea )
 	{
-		// no limit
-		return getvars().maxlen;
+		return true;
 	}
 
-	float GetLifetime( void )
+	slice.goalArea = goalArea;
+	slice.hasGoalPos = ( goalPos != NULL );
+	slice.goalPos = ( goalPos ) ? *goalPos : vec3_origin;
+	slice.maxPathLength = maxPathLength;
+	slice.teamID = teamID;
+	slice.ignoreNavBlockers = ignoreNavBlockers;
+
+	// determine actual goal position
+	InitEstimate( slice.estimate, goalArea, goalPos, costFunc );
+
+	// compute estimate of path length
+	SetTotalCost( startArea, ( startArea->GetCenter() - slice.estimate.goalPos ).Length() );
+
+	float initCost = EvaluateCost( costFunc, startArea, NULL, NULL, NULL, -1.0f );
+	if ( initCost < 0.0f )
+		return false;
+	SetCostSoFar( startArea, initCost );
+	SetPathLengthSoFar( startArea, 0.0f );
+
+	AddToOpenList( startArea );
+
+	// keep track of the area we visit that is closest to the goal
+	slice.closestAreaDist = GetTotalCost( startArea );
+
+	return ResumeSlicedPath( slice, costFunc, deadline );
+}
+
+template< typename CostFunctor >
+bool NavSearchContext::ResumeSlicedPath( slice_t &slice, CostFunctor &costFunc, double deadline )
+{
+	m_paused = false;
+
+	return RunSearch( slice.goalArea, slice.hasGoalPos ? &slice.goalPos : NULL, slice.estimate, costFunc, &slice.closestArea, slice.closestAreaDist, slice.maxPathLength, slice.teamID, slice.ignoreNavBlockers, deadline );
+}
+
+template< typename CostFunctor >
+bool NavSearchContext::ContinuePath( CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, int teamID, bool ignoreNavBlockers )
+{
+	if ( goalArea == NULL || goalArea->IsBlocked( teamID, ignoreNavBlockers ) )
+		return false;
+
+	// its cost is already final
+	if ( IsClosed( goalArea ) )
+		return true;
+
+	if ( m_reached && Find( m_reached ) && !IsOpen( m_reached ) && !IsClosed( m_reached ) )
+		AddToOpenList( m_reached );
+
+	m_reached = NULL;
+
+	// blocked then, they may not be anymore, RunSearch drops them again if they still are
+	for ( CNavArea *area : m_skipped )
 	{
-		// infinite duration
-		return getvars().life;
+		if ( Find( area ) && !IsOpen( area ) && !IsClosed( area ) )
+			AddToOpenList( area );
 	}
 
-	void Update( vars_t &vars, INextBot *bot, CBaseEntity *subject, const IPathCost &cost, Vector *pPredictedSubjectPos )
+	m_skipped.clear();
+
+	estimate_t estimate;
+	InitEstimate( estimate, goalArea, goalPos, costFunc );
+
+	for ( heapnode_t &node : m_heap )
 	{
-		// maintain the path to the subject
-		RefreshPath( vars, bot, subject, cost, pPredictedSubjectPos );
+		float dist = ( node.area->GetCenter() - estimate.goalPos ).Length();
+		SetTotalCost( node.area, GetCostSoFar( node.area ) + EstimateRemaining( estimate, node.area, dist ) );
+		node.key = GetTotalCost( node.area );
+	}
 
-		// move along the path towards the subject
-		PathFollower::CallUpdate( bot );
+	for ( int pos = (int)m_heap.size() / ARITY; pos >= 0; --pos )
+	{
+		if ( pos < (int)m_heap.size() )
+			SiftDown( pos );
 	}
-};
 
-SH_DECL_HOOK6_void(Path, ComputeAreaCrossing, SH_NOATTRIB, 0, INextBot *, const CNavArea *, const Vector &, const CNavArea *, NavDirType, Vector *);
+	float closestAreaDist = FLT_MAX;
+	return RunSearch( goalArea, goalPos, estimate, costFunc, NULL, closestAreaDist, 0.0f, teamID, ignoreNavBlockers );
+}
 
-class DirectChasePath : public ChasePath
+void NavSearchContext::Reroot( CNavArea *newRoot )
 {
-public:
-	using ComputeAreaCrossing_t = void (DirectChasePath::*)( INextBot *bot, const CNavArea *, const Vector &, const CNavArea *, NavDirType, Vector * );
+	// 1 below newRoot, 2 not, filled in along every parent chain walked
+	if ( m_below.size() < m_state.size() )
+		m_below.resize( m_state.size(), 0 );
 
-	struct vars_t : public ChasePath::vars_t
-	{
-		ComputeAreaCrossing_t pComputeAreaCrossing = nullptr;
+	m_kept.clear();
 
-		void dtor(PathFollower *base) override
+	// only the areas this search touched have state, every parent chain stays among them.
+	// areas that were popped without being closed (the goal, blocked areas) still have a cost and come back as open
+	for ( CNavArea *area : m_touched )
+	{
+		unsigned char result = 2;
+		m_walked.clear();
+		for ( CNavArea *up = area; up; up = GetParent( up ) )
 		{
-			ChasePath::vars_t::dtor(base);
+			if ( m_below[ up->GetID() ] )
+			{
+				result = m_below[ up->GetID() ];
+				break;
+			}
 
-			DirectChasePath *bytes{(DirectChasePath *)base};
-			bytes->dtor();
+			m_walked.push_back( up );
+
+			if ( up == newRoot )
+			{
+				result = 1;
+				break;
+			}
 		}
-	};
 
-	vars_t &getvars()
-	{ return *(vars_t *)vars_ptr(); }
+		for ( CNavArea *up : m_walked )
+		{
+			m_below[ up->GetID() ] = result;
+		}
 
-	void dtor()
+		if ( result == 1 )
+			m_kept.push_back( kept_t{ area, *Find( area ) } );
+	}
+
+	for ( CNavArea *area : m_touched )
 	{
-		
+		m_below[ area->GetID() ] = 0;
 	}
 
-	template <typename C = DirectChasePath, typename T = vars_t>
-	static C *create(SubjectChaseType chaseHow)
+	const float costOffset = GetCostSoFar( newRoot );
+	const float lengthOffset = GetPathLengthSoFar( newRoot );
+
+	Reset();
+
+	for ( const kept_t &k : m_kept )
 	{
-		C *bytes = (C *)ChasePath::create<C, T>(chaseHow);
-		T &vars{PathFollower::getvars<C, T>(bytes)};
-		vars.hookids.emplace_back(SH_ADD_HOOK(Path, ComputeAreaCrossing, bytes, SH_MEMBER(bytes, &C::HookComputeAreaCrossing), false));
-		vars.pComputeAreaCrossing = func_to_func<ComputeAreaCrossing_t>(&C::DoComputeAreaCrossing);
-		return bytes;
+		areastate_t &state = Touch( k.area );
+		state.flags = k.state.flags & ( STATE_MARKED|STATE_CLOSED );
+		state.parent = ( k.area == newRoot ) ? NULL : k.state.parent;
+		state.how = ( k.area == newRoot ) ? NUM_TRAVERSE_TYPES : k.state.how;
+		state.costSoFar = k.state.costSoFar - costOffset;
+		state.lengthSoFar = k.state.lengthSoFar - lengthOffset;
+		state.totalCost = state.costSoFar;
 	}
 
-	void Update( ChasePath::vars_t &vars, INextBot *me, CBaseEntity *victim, const IPathCost &pathCost, Vector *pPredictedSubjectPos = NULL )	// update path to chase target and move bot along path
+	// ContinuePath re-keys everything on the open list
+	m_reopen.clear();
+	for ( const kept_t &k : m_kept )
 	{
-		Assert( !pPredictedSubjectPos );
-		bool bComputedPredictedPosition;
-		Vector vecPredictedPosition;
-		if ( !DirectChase( vars, &bComputedPredictedPosition, &vecPredictedPosition, me, victim ) )
+		if ( !( k.state.flags & STATE_CLOSED ) )
 		{
-			// path around obstacles to reach our victim
-			ChasePath::Update( vars, me, victim, pathCost, bComputedPredictedPosition ? &vecPredictedPosition : NULL );
+			m_reopen.push_back( k.area );
+			continue;
 		}
-		NotifyVictim( me, victim );
+
+		bool edge = false;
+		NavForEachConnection( k.area, [&]( CNavArea *newArea, float length ) {
+			edge |= !IsClosed( newArea );
+		} );
+
+		if ( edge )
+			m_reopen.push_back( k.area );
 	}
 
-	bool IsRepathNeeded( ChasePath::vars_t &vars, INextBot *bot, CBaseEntity *subject )			// return true if situation has changed enough to warrant recomputing the current path
+	for ( CNavArea *area : m_reopen )
 	{
-		if ( ChasePath::IsRepathNeeded( vars, bot, subject ) )
-		{
-			return true;
-		}
-
-		return bot->GetLocomotionInterface()->IsStuck() && bot->GetLocomotionInterface()->GetStuckDuration() > 2.0f;
-	}
-	
-	void NotifyVictim( INextBot *me, CBaseEntity *victim )
-	{
-		CBaseCombatCharacter *pBCCVictim = victim->MyCombatCharacterPointer();
-		if ( !pBCCVictim )
-			return;
-		
-		pBCCVictim->OnPursuedBy( me );
+		AddToOpenList( area );
 	}
-	
-	bool DirectChase( ChasePath::vars_t &vars, bool *pPredictedPositionComputed, Vector *pPredictedPos, INextBot *me, CBaseEntity *victim )		// if there is nothing between us and our victim, run directly at them
-	{
-		*pPredictedPositionComputed = false;
+}
 
-		ILocomotion *mover = me->GetLocomotionInterface();
+template< typename CostFunctor >
+bool NavSearchContext::RunSearch( CNavArea *goalArea, const Vector *goalPos, const estimate_t &estimate, CostFunctor &costFunc, CNavArea **closestArea, float &closestAreaDist, float maxPathLength, int teamID, bool ignoreNavBlockers, double deadline )
+{
+	const bool bHaveMaxPathLength = ( maxPathLength > 0.0f );
 
-		if ( me->IsImmobile() || mover->IsScrambling() )
+	// do A* search
+	while( !IsOpenListEmpty() )
+	{
+		// out of time, everything is left on the open list for ResumeSlicedPath
+		if ( deadline > 0.0 && ( ++m_expanded % SLICE_CHECK_INTERVAL ) == 0 && Plat_FloatTime() >= deadline )
 		{
+			m_paused = true;
 			return false;
 		}
 
-		if ( IsDiscontinuityAhead( me, CLIMB_UP ) )
-		{
-			return false;
-		}
+		// get next area to check
+		CNavArea *area = PopOpenList();
 
-		if ( IsDiscontinuityAhead( me, JUMP_OVER_GAP ) )
+		// don't consider blocked areas
+		if ( area->IsBlocked( teamID, ignoreNavBlockers ) )
 		{
-			return false;
+			m_skipped.push_back( area );
+			continue;
 		}
 
-		Vector leadVictimPos = PredictSubjectPosition( vars, me, victim );
+		// check if we have found the goal area or position
+		if ( area == goalArea || ( goalArea == NULL && goalPos && area->Contains( *goalPos ) ) )
+		{
+			if ( closestArea )
+			{
+				*closestArea = area;
+			}
 
-		// Don't want to have to compute the predicted position twice.
-		*pPredictedPositionComputed = true;
-		*pPredictedPos = leadVictimPos;
+			// popped but never expanded, ContinuePath puts it back
+			m_reached = area;
 
-		if ( !mover->IsPotentiallyTraversable( mover->GetFeet(), leadVictimPos  ) )
-		{
-			return false;
+			return true;
 		}
 
-		// the way is clear - move directly towards our victim
-		g_bInPathFollowerFaceTowards = true;
-		bool disable_facing = !vars.allowfacing;
-		if(!disable_facing) {
-			mover->FaceTowards( leadVictimPos );
-		}
-		g_bInPathFollowerFaceTowards = false;
+		CNavArea *areaParent = GetParent( area );
+		const float areaCostSoFar = GetCostSoFar( area );
+		const float areaLengthSoFar = GetPathLengthSoFar( area );
 
-		mover->Approach( leadVictimPos );
+		// one connection out of area
+		auto relax = [&]( CNavArea *newArea, NavTraverseType how, const CNavLadder *ladder, const CFuncElevator *elevator, float length )
+		{
+			// don't backtrack
+			if ( newArea == areaParent )
+				return;
+			if ( newArea == area ) // self neighbor?
+				return;
 
-		me->GetBodyInterface()->AimHeadTowards( victim );
+			// don't consider blocked areas
+			if ( newArea->IsBlocked( teamID, ignoreNavBlockers ) )
+				return;
 
-		// old path is no longer useful since we've moved off of it
-		Invalidate();
+			if ( !IsInRegion( newArea ) )
+				return;
 
-		return true;
-	}
-	
-	void DoComputeAreaCrossing( INextBot *bot, const CNavArea *from, const Vector &fromPos, const CNavArea *to, NavDirType dir, Vector *crossPos )
-	{
-		Vector center;
-		float halfWidth;
-		from->ComputePortal( to, dir, &center, &halfWidth );
+			float newCostSoFar = EvaluateCost( costFunc, newArea, area, ladder, elevator, length );
 
-		*crossPos = center;
-	}
-	
-	void HookComputeAreaCrossing( INextBot *bot, const CNavArea *from, const Vector &fromPos, const CNavArea *to, NavDirType dir, Vector *crossPos )
-	{
-		(this->*getvars().pComputeAreaCrossing)(bot, from, fromPos, to, dir, crossPos);
-		RETURN_META(MRES_SUPERCEDE);
-	}
-};
+			// NaNs really mess this function up causing tough to track down hangs
+			if ( IS_NAN( newCostSoFar ) )
+				newCostSoFar = 1e30f;
 
-#if SOURCE_ENGINE == SE_LEFT4DEAD2
-class InfectedChasePath : public DirectChasePath
-{
-public:
-	template <typename C = InfectedChasePath, typename T = vars_t>
-	static C *create(SubjectChaseType chaseHow)
-	{
-		C *bytes = (C *)DirectChasePath::create<C, T>(chaseHow);
-		return bytes;
-	}
-	
-	void DoComputeAreaCrossing( INextBot *bot, const CNavArea *from, const Vector &fromPos, const CNavArea *to, NavDirType dir, Vector *crossPos )
-	{
-		call_mfunc<void, InfectedChasePath, INextBot *, const CNavArea *, const Vector &, const CNavArea *, NavDirType, Vector *>(this, InfectedChasePathComputeAreaCrossing, bot, from, fromPos, to, dir, crossPos);
-	}
-};
-#endif
+			// check if cost functor says this area is a dead-end
+			if ( newCostSoFar < 0.0f )
+				return;
 
-class RetreatPathBuilder
-{
-public:
-	RetreatPathBuilder( INextBot *me, CBaseEntity *threat, float retreatRange = 500.0f )
-	{
-		m_me = me;
-		m_mover = me->GetLocomotionInterface();
-		
-		m_threat = threat;
-		m_retreatRange = retreatRange;
-	}
+			// Make sure that any jump to a new area incurs some pathfinding
+			// cost, to avoid us spinning our wheels over 0-cost nodes
+			if ( newCostSoFar < areaCostSoFar + 1e-4f )
+			{
+				newCostSoFar = areaCostSoFar + 1e-4f;
+			}
 
-	CNavArea *ComputePath( void )
-	{
-		if ( m_mover == NULL )
-			return NULL;
-		
-		CNavArea *startArea = m_me->GetEntity()->GetLastKnownArea();
+			if ( bHaveMaxPathLength )
+			{
+				// keep track of path length so far
+				float deltaLengthSq = ( newArea->GetCenter() - area->GetCenter() ).LengthSqr();
+				float newLengthSoFar = areaLengthSoFar + FastSqrt( deltaLengthSq );
+				if ( newLengthSoFar > maxPathLength )
+					return;
 
-		if ( startArea == NULL )
-			return NULL;
+				SetPathLengthSoFar( newArea, newLengthSoFar );
+			}
 
-		CNavArea *retreatFromArea = TheNavMesh->GetNearestNavArea( m_threat, GETNAVAREA_CHECK_GROUND, 10000.0f );
-		if ( retreatFromArea == NULL )
-			return NULL;
+			if ( ( IsOpen( newArea ) || IsClosed( newArea ) ) && GetCostSoFar( newArea ) <= newCostSoFar )
+			{
+				// this is a worse path - skip it
+				return;
+			}
 
-		startArea->SetParent( NULL );
+			// compute estimate of distance left to go
+			float distSq = ( newArea->GetCenter() - estimate.goalPos ).LengthSqr();
+			float newDistRemaining = ( distSq > 0.0f ) ? FastSqrt( distSq ) : 0.0f;
+			float newCostRemaining = EstimateRemaining( estimate, newArea, newDistRemaining );
 
-		// start search
-#if 1
-		CNavArea::ClearSearchLists();
-#endif
+			// track closest area to goal in case path fails
+			if ( closestArea && newDistRemaining < closestAreaDist )
+			{
+				*closestArea = newArea;
+				closestAreaDist = newDistRemaining;
+			}
 
-		float initCost = Cost( startArea, NULL, NULL );
-		if ( initCost < 0.0f )
-			return NULL;
+			SetCostSoFar( newArea, newCostSoFar );
+			SetTotalCost( newArea, newCostSoFar + newCostRemaining );
 
-		int teamID = m_me->GetEntity()->GetTeamNumber();
+			if ( IsOpen( newArea ) )
+			{
+				// area already on open list, decrease its key
+				UpdateOnOpenList( newArea );
+			}
+			else
+			{
+				AddToOpenList( newArea );
+			}
 
-		startArea->SetTotalCost( initCost );
+			SetParent( newArea, area, how );
+		};
 
-#if 1
-		startArea->AddToOpenList();
-#endif
-		
-		// keep track of the area farthest away from the threat
-		CNavArea *farthestArea = NULL;
-		float farthestRange = 0.0f;
+		// the snapshot has the same connections in the same order without chasing the per direction lists
+		if ( m_graph && m_graph->Contains( area ) )
+		{
+			for ( const NavConnectionGraph::edge_t &edge : m_graph->Outgoing( area->GetID() ) )
+			{
+				relax( edge.area, edge.how, edge.ladder, edge.elevator, edge.length );
+			}
 
-		//
-		// Dijkstra's algorithm (since we don't know our goal).
-		// Build a path as far away from the retreat area as possible.
-		// Minimize total path length and danger.
-		// Maximize distance to threat of end of path.
-		//
-#if 1
-		while( !CNavArea::IsOpenListEmpty() )
+			AddToClosedList( area );
+			continue;
+		}
+
+		// search adjacent areas
+		enum SearchType
 		{
-			// get next area to check
-			CNavArea *area = CNavArea::PopOpenList();
+			SEARCH_FLOOR, SEARCH_LADDERS, SEARCH_ELEVATORS
+		};
+		SearchType searchWhere = SEARCH_FLOOR;
+		int searchIndex = 0;
 
-			area->AddToClosedList();
+		int dir = NORTH;
+		const NavConnectVector *floorList = area->GetAdjacentAreas( NORTH );
 
-			// don't consider blocked areas
-			if ( area->IsBlocked( teamID ) )
-				continue;
+		bool ladderUp = true;
+		const NavLadderConnectVector *ladderList = NULL;
+		enum { AHEAD = 0, LEFT, RIGHT, BEHIND, NUM_TOP_DIRECTIONS };
+		int ladderTopDir = AHEAD;
+		float length = -1.0f;
 
-			// build adjacent area array
-			CollectAdjacentAreas( area );
-			
-			// search adjacent areas
-			for( int i=0; i<m_adjAreaIndex; ++i )
+
+		while( true )
+		{
+			CNavArea *newArea = NULL;
+			NavTraverseType how;
+			const CNavLadder *ladder = NULL;
+			const CFuncElevator *elevator = NULL;
+
+			//
+			// Get next adjacent area - either on floor or via ladder
+			//
+			if ( searchWhere == SEARCH_FLOOR )
 			{
-				CNavArea *newArea = m_adjAreaVector[ i ].area;
-				
-				// only visit each area once
-				if ( newArea->IsClosed() )
-					continue;
-				
-				// don't consider blocked areas
-				if ( newArea->IsBlocked( teamID ) )
-					continue;
+				// if exhausted adjacent connections in current direction, begin checking next direction
+				if ( searchIndex >= floorList->Count() )
+				{
+					++dir;
+
+					if ( dir == NUM_DIRECTIONS )
+					{
+						// checked all directions on floor - check ladders next
+						searchWhere = SEARCH_LADDERS;
+
+						ladderList = area->GetLadders( CNavLadder::LADDER_UP );
+						searchIndex = 0;
+						ladderTopDir = AHEAD;
+					}
+					else
+					{
+						// start next direction
+						floorList = area->GetAdjacentAreas( (NavDirType)dir );
+						searchIndex = 0;
+					}
 
-				// don't use this area if it is out of range
-				if ( ( newArea->GetCenter() - m_me->GetPosition() ).IsLengthGreaterThan( m_retreatRange ) )
-					continue;
-				
-				// determine cost of traversing this area
-				float newCost = Cost( newArea, area, m_adjAreaVector[ i ].ladder );
-				
-				// don't use adjacent area if cost functor says it is a dead-end
-				if ( newCost < 0.0f )
 					continue;
-					
-				if ( newArea->IsOpen() && newArea->GetTotalCost() <= newCost )
+				}
+
+				const NavConnect &floorConnect = floorList->Element( searchIndex );
+				newArea = floorConnect.area;
+				length = floorConnect.length;
+				how = (NavTraverseType)dir;
+				++searchIndex;
+			}
+			else if ( searchWhere == SEARCH_LADDERS )
+			{
+				if ( searchIndex >= ladderList->Count() )
 				{
-					// we have already visited this area, and it has a better path
+					if ( !ladderUp )
+					{
+						// checked both ladder directions - check elevators next
+						searchWhere = SEARCH_ELEVATORS;
+						searchIndex = 0;
+						ladder = NULL;
+					}
+					else
+					{
+						// check down ladders
+						ladderUp = false;
+						ladderList = area->GetLadders( CNavLadder::LADDER_DOWN );
+						searchIndex = 0;
+					}
 					continue;
 				}
-				else
-				{
-					// whether this area has been visited or not, we now have a better path
-					newArea->SetParent( area, m_adjAreaVector[ i ].how );
-					newArea->SetTotalCost( newCost );
 
-					// use 'cost so far' to hold cumulative cost
-					newArea->SetCostSoFar( newCost );
+				if ( ladderUp )
+				{
+					ladder = ladderList->Element( searchIndex ).ladder;
 
-					// tricky bit here - relying on OpenList being sorted by cost
-					if ( newArea->IsOpen() )
+					// do not use BEHIND connection, as its very hard to get to when going up a ladder
+					if ( ladderTopDir == AHEAD )
 					{
-						// area already on open list, update the list order to keep costs sorted
-						newArea->UpdateOnOpenList();
+						newArea = ladder->m_topForwardArea;
 					}
-					else
+					else if ( ladderTopDir == LEFT )
 					{
-						newArea->AddToOpenList();
+						newArea = ladder->m_topLeftArea;
 					}
-
-					// keep track of area farthest from threat
-					float threatRange = ( newArea->GetCenter() - m_threat->GetAbsOrigin() ).Length();
-					if ( threatRange > farthestRange )
+					else if ( ladderTopDir == RIGHT )
 					{
-						farthestArea = newArea;
-						farthestRange = threatRange;
+						newArea = ladder->m_topRightArea;
 					}
+					else
+					{
+						++searchIndex;
+						ladderTopDir = AHEAD;
+						continue;
+					}
+
+					how = GO_LADDER_UP;
+					++ladderTopDir;
 				}
+				else
+				{
+					newArea = ladderList->Element( searchIndex ).ladder->m_bottomArea;
+					how = GO_LADDER_DOWN;
+					ladder = ladderList->Element( searchIndex ).ladder;
+					++searchIndex;
+				}
+
+				if ( newArea == NULL )
+					continue;
+
+				length = -1.0f;
+			}
+			else // if ( searchWhere == SEARCH_ELEVATORS )
+			{
+				const NavConnectVector &elevatorAreas = area->GetElevatorAreas();
+
+				elevator = area->GetElevator();
+
+				if ( elevator == NULL || searchIndex >= elevatorAreas.Count() )
+				{
+					// done searching connected areas
+					elevator = NULL;
+					break;
+				}
+
+				newArea = elevatorAreas[ searchIndex++ ].area;
+				if ( newArea->GetCenter().z > area->GetCenter().z )
+				{
+					how = GO_ELEVATOR_UP;
+				}
+				else
+				{
+					how = GO_ELEVATOR_DOWN;
+				}
+
+				length = -1.0f;
 			}
+
+			relax( newArea, how, ladder, elevator, length );
 		}
-#endif
 
-		return farthestArea;
+		// we have searched this area
+		AddToClosedList( area );
 	}
 
+	return false;
+}
 
-	/**
-	 * Build a vector of adjacent areas reachable from the given area
-	 */
-	void CollectAdjacentAreas( CNavArea *area )
-	{
-		m_adjAreaIndex = 0;			
+// game thread context, writes through to the areas for plugin callbacks and IPathCost functors
+NavSearchContext g_NavSearchContext{ true };
 
-		const NavConnectVector &adjNorth = *area->GetAdjacentAreas( NORTH );		
-		FOR_EACH_VEC( adjNorth, it )
-		{
-			if ( m_adjAreaIndex >= MAX_ADJ_AREAS )
-				break;
+ConVar path_cache_size("path_cache_size", "128", FCVAR_NONE, "routes kept by the shared path cache, 0 disables it");
+ConVar path_cache_max_age("path_cache_max_age", "1.0", FCVAR_NONE, "seconds a cached route can be reused for");
 
-			m_adjAreaVector[ m_adjAreaIndex ].area = adjNorth[ it ].area;
-			m_adjAreaVector[ m_adjAreaIndex ].how = GO_NORTH;
-			m_adjAreaVector[ m_adjAreaIndex ].ladder = NULL;
-			++m_adjAreaIndex;
-		}
+/**
+ * Bounded LRU of searched area chains shared by every Path::Compute whose cost functor has a cache profile.
+ * Keyed on start area, goal area, team, cost profile and max path length.
+ * Hits are checked against the mesh before use, an entry with a removed, blocked or non traversable area is dropped.
+ * Costs that change without touching the areas (combat intensity) are covered by path_cache_max_age, functors fold the
+ * func_nav_cost multipliers that apply to their bot into the profile.
+ * Game thread only.
+ */
+class NavPathCache
+{
+public:
+	struct key_t
+	{
+		unsigned int startID;
+		unsigned int goalID;
+		int team;
+		float maxPathLength;
+		uint64_t profile;
 
-		const NavConnectVector &adjSouth = *area->GetAdjacentAreas( SOUTH );		
-		FOR_EACH_VEC( adjSouth, it )
+		bool operator==( const key_t &other ) const
 		{
-			if ( m_adjAreaIndex >= MAX_ADJ_AREAS )
-				break;
-
-			m_adjAreaVector[ m_adjAreaIndex ].area = adjSouth[ it ].area;
-			m_adjAreaVector[ m_adjAreaIndex ].how = GO_SOUTH;
-			m_adjAreaVector[ m_adjAreaIndex ].ladder = NULL;
-			++m_adjAreaIndex;
+			return startID == other.startID && goalID == other.goalID && team == other.team && maxPathLength == other.maxPathLength && profile == other.profile;
 		}
+	};
 
-		const NavConnectVector &adjWest = *area->GetAdjacentAreas( WEST );		
-		FOR_EACH_VEC( adjWest, it )
-		{
-			if ( m_adjAreaIndex >= MAX_ADJ_AREAS )
-				break;
+	bool IsEnabled( void ) const { return path_cache_size.GetInt() > 0; }
 
-			m_adjAreaVector[ m_adjAreaIndex ].area = adjWest[ it ].area;
-			m_adjAreaVector[ m_adjAreaIndex ].how = GO_WEST;
-			m_adjAreaVector[ m_adjAreaIndex ].ladder = NULL;
-			++m_adjAreaIndex;
+	template< typename CostFunctor >
+	bool MakeKey( const CostFunctor &costFunc, CNavArea *startArea, CNavArea *goalArea, int team, float maxPathLength, key_t &key ) const
+	{
+		if ( !IsEnabled() )
+			return false;
+
+		uint64_t profile = 0;
+		if ( !GetProfile( costFunc, profile ) )
+			return false;
+
+		key = key_t{ startArea->GetID(), goalArea->GetID(), team, maxPathLength, profile };
+		return true;
+	}
+
+	// chain and pathResult are only written on a hit
+	bool Lookup( const key_t &key, ILocomotion *mover, std::vector< NavAreaChainLink > &chain, bool &pathResult )
+	{
+		entrymap_t::iterator it = m_map.find( key );
+		if ( it == m_map.end() )
+		{
+			++m_misses;
+			return false;
 		}
 
-		const NavConnectVector &adjEast = *area->GetAdjacentAreas( EAST );	
-		FOR_EACH_VEC( adjEast, it )
+		entrylist_t::iterator entry = it->second;
+		if ( !IsEntryValid( *entry, mover ) )
 		{
-			if ( m_adjAreaIndex >= MAX_ADJ_AREAS )
-				break;
+			m_lru.erase( entry );
+			m_map.erase( it );
+			++m_stale;
+			++m_misses;
+			return false;
+		}
 
-			m_adjAreaVector[ m_adjAreaIndex ].area = adjEast[ it ].area;
-			m_adjAreaVector[ m_adjAreaIndex ].how = GO_EAST;
-			m_adjAreaVector[ m_adjAreaIndex ].ladder = NULL;
-			++m_adjAreaIndex;
+		// most recently used goes to the front
+		m_lru.splice( m_lru.begin(), m_lru, entry );
+
+		chain = entry->chain;
+		pathResult = entry->pathResult;
+		++m_hits;
+		return true;
+	}
+
+	void Store( const key_t &key, const std::vector< NavAreaChainLink > &chain, bool pathResult )
+	{
+		size_t limit = (size_t)MAX( path_cache_size.GetInt(), 0 );
+		if ( limit == 0 || chain.empty() )
+			return;
+
+		entrymap_t::iterator it = m_map.find( key );
+		if ( it != m_map.end() )
+		{
+			m_lru.erase( it->second );
+			m_map.erase( it );
 		}
 
-		const NavLadderConnectVector &adjUpLadder = *area->GetLadders( CNavLadder::LADDER_UP );
-		FOR_EACH_VEC( adjUpLadder, it )
+		m_lru.push_front( entry_t{ key, chain, pathResult, gpGlobals->curtime } );
+		m_map.emplace( key, m_lru.begin() );
+
+		while ( m_lru.size() > limit )
 		{
-			CNavLadder *ladder = adjUpLadder[ it ].ladder;
+			m_map.erase( m_lru.back().key );
+			m_lru.pop_back();
+		}
+	}
 
-			if ( ladder->m_topForwardArea && m_adjAreaIndex < MAX_ADJ_AREAS )
-			{
-				m_adjAreaVector[ m_adjAreaIndex ].area = ladder->m_topForwardArea;
-				m_adjAreaVector[ m_adjAreaIndex ].how = GO_LADDER_UP;
-				m_adjAreaVector[ m_adjAreaIndex ].ladder = ladder;
-				++m_adjAreaIndex;
-			}
+	void Clear( void )
+	{
+		m_lru.clear();
+		m_map.clear();
+	}
 
-			if ( ladder->m_topLeftArea && m_adjAreaIndex < MAX_ADJ_AREAS )
-			{
-				m_adjAreaVector[ m_adjAreaIndex ].area = ladder->m_topLeftArea;
-				m_adjAreaVector[ m_adjAreaIndex ].how = GO_LADDER_UP;
-				m_adjAreaVector[ m_adjAreaIndex ].ladder = ladder;
-				++m_adjAreaIndex;
-			}
+	void ResetStats( void )
+	{
+		m_hits = 0;
+		m_misses = 0;
+		m_stale = 0;
+	}
 
-			if ( ladder->m_topRightArea && m_adjAreaIndex < MAX_ADJ_AREAS )
-			{
-				m_adjAreaVector[ m_adjAreaIndex ].area = ladder->m_topRightArea;
-				m_adjAreaVector[ m_adjAreaIndex ].how = GO_LADDER_UP;
-				m_adjAreaVector[ m_adjAreaIndex ].ladder = ladder;
-				++m_adjAreaIndex;
-			}
+	unsigned int GetHits( void ) const { return m_hits; }
+	unsigned int GetMisses( void ) const { return m_misses; }
+	unsigned int GetStale( void ) const { return m_stale; }
+	unsigned int GetCount( void ) const { return (unsigned int)m_lru.size(); }
+
+private:
+	struct keyhash_t
+	{
+		size_t operator()( const key_t &key ) const
+		{
+			uint64_t hash = key.profile;
+			hash = hash * 31 + key.startID;
+			hash = hash * 31 + key.goalID;
+			hash = hash * 31 + (unsigned int)key.team;
+			hash = hash * 31 + std::hash< float >{}( key.maxPathLength );
+			return (size_t)( hash ^ ( hash >> 32 ) );
 		}
+	};
 
-		const NavLadderConnectVector &adjDownLadder = *area->GetLadders( CNavLadder::LADDER_DOWN );
-		FOR_EACH_VEC( adjDownLadder, it )
+	struct entry_t
+	{
+		key_t key;
+		std::vector< NavAreaChainLink > chain;
+		bool pathResult;
+		float time;
+	};
+
+	using entrylist_t = std::list< entry_t >;
+	using entrymap_t = std::unordered_map< key_t, entrylist_t::iterator, keyhash_t >;
+
+	static bool GetProfile( const IPathCost &costFunc, uint64_t &profile ) { return false; }
+	static bool GetProfile( const NativePathCost &costFunc, uint64_t &profile ) { return costFunc.GetCacheProfile( profile ); }
+
+	bool IsEntryValid( const entry_t &entry, ILocomotion *mover ) const
+	{
+		if ( gpGlobals->curtime - entry.time > path_cache_max_age.GetFloat() )
+			return false;
+
+		for ( const NavAreaChainLink &link : entry.chain )
 		{
-			CNavLadder *ladder = adjDownLadder[ it ].ladder;
+			if ( TheNavMesh->GetNavAreaByID( link.id ) != link.area )
+				return false;
 
-			if ( m_adjAreaIndex >= MAX_ADJ_AREAS )
-				break;
+			if ( link.area->IsBlocked( entry.key.team ) )
+				return false;
 
-			if ( ladder->m_bottomArea )
-			{
-				m_adjAreaVector[ m_adjAreaIndex ].area = ladder->m_bottomArea;
-				m_adjAreaVector[ m_adjAreaIndex ].how = GO_LADDER_DOWN;
-				m_adjAreaVector[ m_adjAreaIndex ].ladder = ladder;
-				++m_adjAreaIndex;
-			}
+			if ( mover && !mover->IsAreaTraversable( link.area ) )
+				return false;
 		}
+
+		return true;
 	}
-	
+
+	entrylist_t m_lru;
+	entrymap_t m_map;
+	unsigned int m_hits = 0;
+	unsigned int m_misses = 0;
+	unsigned int m_stale = 0;
+};
+
+NavPathCache g_NavPathCache;
+
+ConVar path_hpa_cluster_size("path_hpa_cluster_size", "1024", FCVAR_NONE, "grid cell size used to cluster areas for hierarchical path searches, 0 makes them run a full search");
+
+/**
+ * Abstract graph for hierarchical (HPA*) searches.
+ * Areas are clustered by the grid cell their center falls in. Areas with a connection into another cluster are the
+ * abstract nodes, they are linked to each other by those connections and by the shortest distance inside their cluster.
+ * A search runs A* on the abstract graph by distance, then refines every leg with the real cost functor.
+ * Built when the map starts, or on first use if the mesh changed since. Game thread only.
+ */
+class NavHierarchy
+{
+public:
+	bool IsEnabled( void ) const { return path_hpa_cluster_size.GetFloat() > 0.0f; }
+
+	void Invalidate( void )
+	{
+		m_built = false;
+	}
+
+	// rebuild if the mesh or the cluster size changed since the last build
+	bool EnsureBuilt( void )
+	{
+		if ( !IsEnabled() || !TheNavMesh->IsLoaded() )
+			return false;
+
+		if ( m_built && m_generation == g_NavMeshGeneration && m_areaCount == TheNavAreas->Count() && m_cellSize == path_hpa_cluster_size.GetFloat() )
+			return true;
+
+		Build();
+		return true;
+	}
+
 	/**
-	 * Cost minimizes path length traveled thus far and "danger" (proximity to threat(s))
+	 * Search from startArea to goalArea through the abstract graph.
+	 * Returns false if it couldn't be used (same cluster, no abstract route, a leg failed to refine),
+	 * callers should run a full search then.
 	 */
-	float Cost( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder )
+	template< typename CostFunctor >
+	bool BuildPath( NavSearchContext &ctx, CNavArea *startArea, CNavArea *goalArea, CostFunctor &costFunc, int teamID, int maxCount, std::vector< NavAreaChainLink > &chain );
+
+private:
+	struct edge_t
 	{
-		// check if we can use this area
-		if ( !m_mover->IsAreaTraversable( area ) )
+		int node;
+		float cost;
+	};
+
+	struct node_t
+	{
+		CNavArea *area;
+		int cluster;
+		std::vector< edge_t > edges;
+	};
+
+	int ClusterOf( const CNavArea *area ) const
+	{
+		unsigned int id = area->GetID();
+		return id < m_areaCluster.size() ? m_areaCluster[ id ] : -1;
+	}
+
+	int NodeOf( const CNavArea *area ) const
+	{
+		unsigned int id = area->GetID();
+		return id < m_areaNode.size() ? m_areaNode[ id ] : -1;
+	}
+
+	// Dijkstra by distance that doesn't leave cluster, stops early once stopAt is settled
+	void ClusterDistances( CNavArea *from, int cluster, CNavArea *stopAt = NULL )
+	{
+		if ( ++m_distMarker == 0 )
 		{
-			return -1.0f;
+			std::fill( m_distStamp.begin(), m_distStamp.end(), 0 );
+			m_distMarker = 1;
 		}
 
-		int teamID = m_me->GetEntity()->GetTeamNumber();
-		if ( area->IsBlocked( teamID ) )
+		using entry_t = std::pair< float, CNavArea * >;
+		std::vector< entry_t > heap;
+
+		SetDist( from, 0.0f );
+		heap.emplace_back( 0.0f, from );
+
+		while ( !heap.empty() )
 		{
-			return -1.0f;
+			std::pop_heap( heap.begin(), heap.end(), std::greater< entry_t >() );
+			entry_t top = heap.back();
+			heap.pop_back();
+
+			if ( top.first > GetDist( top.second ) )
+				continue;
+
+			if ( top.second == stopAt )
+				return;
+
+			NavForEachConnection( top.second, [&]( CNavArea *newArea, float length ) {
+				if ( ClusterOf( newArea ) != cluster )
+					return;
+
+				float newDist = top.first + length;
+				if ( newDist < GetDist( newArea ) )
+				{
+					SetDist( newArea, newDist );
+					heap.emplace_back( newDist, newArea );
+					std::push_heap( heap.begin(), heap.end(), std::greater< entry_t >() );
+				}
+			} );
 		}
-		
-		const float debugDeltaT = 3.0f;
+	}
 
-		float cost;
+	float GetDist( const CNavArea *area ) const
+	{
+		unsigned int id = area->GetID();
+		return m_distStamp[ id ] == m_distMarker ? m_dist[ id ] : FLT_MAX;
+	}
 
-		const float maxThreatRange = 500.0f;
-		const float dangerDensity = 1000.0f;
+	void SetDist( const CNavArea *area, float dist )
+	{
+		unsigned int id = area->GetID();
+		m_distStamp[ id ] = m_distMarker;
+		m_dist[ id ] = dist;
+	}
 
-		if ( fromArea == NULL )
+	void Build( void )
+	{
+		m_built = true;
+		m_generation = g_NavMeshGeneration;
+		m_areaCount = TheNavAreas->Count();
+		m_cellSize = path_hpa_cluster_size.GetFloat();
+
+		m_nodes.clear();
+		m_clusterNodes.clear();
+
+		unsigned int maxID = 0;
+		for ( int i = 0; i < m_areaCount; ++i )
 		{
-			cost = 0.0f;
-		
-			/*if ( area->Contains( m_threat->GetAbsOrigin() ) )
-			{
-				// maximum danger - threat is in the area with us
-				cost += 10.0f * dangerDensity;
-				
-				if ( m_me->IsDebugging( NEXTBOT_PATH ) )
+			maxID = MAX( maxID, (*TheNavAreas)[ i ]->GetID() );
+		}
+
+		m_areaCluster.assign( maxID + 1, -1 );
+		m_areaNode.assign( maxID + 1, -1 );
+		m_dist.assign( maxID + 1, 0.0f );
+		m_distStamp.assign( maxID + 1, 0 );
+		m_distMarker = 0;
+
+		// cluster by grid cell
+		std::unordered_map< uint64_t, int > cells;
+		for ( int i = 0; i < m_areaCount; ++i )
+		{
+			CNavArea *area = (*TheNavAreas)[ i ];
+			const Vector &center = area->GetCenter();
+			uint64_t x = (uint32_t)(int)floorf( center.x / m_cellSize );
+			uint64_t y = (uint32_t)(int)floorf( center.y / m_cellSize );
+
+			std::unordered_map< uint64_t, int >::iterator it = cells.emplace( ( x << 32 ) | y, (int)cells.size() ).first;
+			m_areaCluster[ area->GetID() ] = it->second;
+		}
+
+		m_clusterNodes.resize( cells.size() );
+
+		// both ends of every connection between two clusters are nodes, one way drops included
+		std::vector< bool > border( maxID + 1, false );
+		for ( int i = 0; i < m_areaCount; ++i )
+		{
+			CNavArea *area = (*TheNavAreas)[ i ];
+			int cluster = ClusterOf( area );
+
+			NavForEachConnection( area, [&]( CNavArea *newArea, float length ) {
+				if ( ClusterOf( newArea ) != cluster )
 				{
-					area->DrawFilled( 255, 0, 0, 128 );
+					border[ area->GetID() ] = true;
+					border[ newArea->GetID() ] = true;
 				}
-			}
-			else*/
+			} );
+		}
+
+		for ( int i = 0; i < m_areaCount; ++i )
+		{
+			CNavArea *area = (*TheNavAreas)[ i ];
+			if ( !border[ area->GetID() ] )
+				continue;
+
+			int cluster = ClusterOf( area );
+
+			m_areaNode[ area->GetID() ] = (int)m_nodes.size();
+			m_clusterNodes[ cluster ].push_back( (int)m_nodes.size() );
+			m_nodes.push_back( node_t{ area, cluster, {} } );
+		}
+
+		for ( int n = 0; n < (int)m_nodes.size(); ++n )
+		{
+			node_t &node = m_nodes[ n ];
+
+			// connections into other clusters
+			NavForEachConnection( node.area, [&]( CNavArea *newArea, float length ) {
+				if ( ClusterOf( newArea ) != node.cluster )
+					node.edges.push_back( edge_t{ NodeOf( newArea ), length } );
+			} );
+
+			// shortest distance to the other nodes of the cluster
+			ClusterDistances( node.area, node.cluster );
+
+			for ( int other : m_clusterNodes[ node.cluster ] )
 			{
-				// danger proportional to range to us
-				float rangeToThreat = ( m_threat->GetAbsOrigin() - m_me->GetPosition() ).Length();
+				if ( other == n )
+					continue;
 
-				if ( rangeToThreat < maxThreatRange )
-				{
-					cost += dangerDensity * ( 1.0f - ( rangeToThreat / maxThreatRange ) );
+				float dist = GetDist( m_nodes[ other ].area );
+				if ( dist != FLT_MAX )
+					node.edges.push_back( edge_t{ other, dist } );
+			}
+		}
+	}
 
-					if ( m_me->IsDebugging( NEXTBOT_PATH ) )
-					{
-						NDebugOverlay::Line( m_me->GetPosition(), m_threat->GetAbsOrigin(), 255, 0, 0, true, debugDeltaT );
-					}
-				}				
+	std::vector< node_t > m_nodes;
+	std::vector< std::vector< int > > m_clusterNodes;
+	std::vector< int > m_areaCluster;
+	std::vector< int > m_areaNode;
+	std::vector< float > m_dist;
+	std::vector< unsigned int > m_distStamp;
+	unsigned int m_distMarker = 0;
+	unsigned int m_generation = 0;
+	int m_areaCount = 0;
+	float m_cellSize = 0.0f;
+	bool m_built = false;
+};
+
+template< typename CostFunctor >
+bool NavHierarchy::BuildPath( NavSearchContext &ctx, CNavArea *startArea, CNavArea *goalArea, CostFunctor &costFunc, int teamID, int maxCount, std::vector< NavAreaChainLink > &chain )
+{
+	if ( !EnsureBuilt() )
+		return false;
+
+	int startCluster = ClusterOf( startArea );
+	int goalCluster = ClusterOf( goalArea );
+	if ( startCluster == -1 || goalCluster == -1 || startCluster == goalCluster )
+		return false;
+
+	// the start and goal areas join the abstract graph as two extra nodes
+	const int nodeCount = (int)m_nodes.size();
+	const int startNode = nodeCount;
+	const int goalNode = nodeCount + 1;
+
+	std::vector< edge_t > startEdges;
+	ClusterDistances( startArea, startCluster );
+	for ( int other : m_clusterNodes[ startCluster ] )
+	{
+		float dist = GetDist( m_nodes[ other ].area );
+		if ( dist != FLT_MAX )
+			startEdges.push_back( edge_t{ other, dist } );
+	}
+
+	// cost from each goal cluster node to the goal area, FLT_MAX if it can't get there
+	std::unordered_map< int, float > goalDist;
+	for ( int other : m_clusterNodes[ goalCluster ] )
+	{
+		ClusterDistances( m_nodes[ other ].area, goalCluster, goalArea );
+		float dist = GetDist( goalArea );
+		if ( dist != FLT_MAX )
+			goalDist.emplace( other, dist );
+	}
+
+	if ( startEdges.empty() || goalDist.empty() )
+		return false;
+
+	const Vector &goalPos = goalArea->GetCenter();
+
+	std::vector< float > costSoFar( nodeCount + 2, FLT_MAX );
+	std::vector< int > parent( nodeCount + 2, -1 );
+	std::vector< bool > closed( nodeCount + 2, false );
+
+	using entry_t = std::pair< float, int >;
+	std::vector< entry_t > heap;
+
+	auto relax = [&]( int from, int to, float cost ) {
+		float newCost = costSoFar[ from ] + cost;
+		if ( closed[ to ] || newCost >= costSoFar[ to ] )
+			return;
+
+		costSoFar[ to ] = newCost;
+		parent[ to ] = from;
+
+		float remaining = ( to == goalNode ) ? 0.0f : ( m_nodes[ to ].area->GetCenter() - goalPos ).Length();
+		heap.emplace_back( newCost + remaining, to );
+		std::push_heap( heap.begin(), heap.end(), std::greater< entry_t >() );
+	};
+
+	costSoFar[ startNode ] = 0.0f;
+	for ( const edge_t &edge : startEdges )
+	{
+		if ( !m_nodes[ edge.node ].area->IsBlocked( teamID ) )
+			relax( startNode, edge.node, edge.cost );
+	}
+	closed[ startNode ] = true;
+
+	while ( !heap.empty() )
+	{
+		std::pop_heap( heap.begin(), heap.end(), std::greater< entry_t >() );
+		int node = heap.back().second;
+		heap.pop_back();
+
+		if ( closed[ node ] )
+			continue;
+
+		closed[ node ] = true;
+
+		if ( node == goalNode )
+			break;
+
+		std::unordered_map< int, float >::const_iterator it = goalDist.find( node );
+		if ( it != goalDist.cend() )
+			relax( node, goalNode, it->second );
+
+		for ( const edge_t &edge : m_nodes[ node ].edges )
+		{
+			if ( !m_nodes[ edge.node ].area->IsBlocked( teamID ) )
+				relax( node, edge.node, edge.cost );
+		}
+	}
+
+	if ( !closed[ goalNode ] )
+		return false;
+
+	// waypoints from start to goal
+	std::vector< CNavArea * > waypoints;
+	for ( int node = goalNode; node != -1; node = parent[ node ] )
+	{
+		if ( node == goalNode )
+			waypoints.push_back( goalArea );
+		else if ( node == startNode )
+			waypoints.push_back( startArea );
+		else
+			waypoints.push_back( m_nodes[ node ].area );
+	}
+
+	std::reverse( waypoints.begin(), waypoints.end() );
+
+	// refine every leg with the real costs, each search stays in the one or two clusters the leg joins
+	std::vector< NavAreaChainLink > full;
+	std::vector< NavAreaChainLink > leg;
+
+	for ( size_t i = 1; i < waypoints.size(); ++i )
+	{
+		CNavArea *closestArea = NULL;
+		ctx.SetRegion( &m_areaCluster, ClusterOf( waypoints[ i - 1 ] ), ClusterOf( waypoints[ i ] ) );
+		bool legResult = ctx.BuildPath( waypoints[ i - 1 ], waypoints[ i ], NULL, costFunc, &closestArea, 0.0f, teamID, false );
+		ctx.ClearRegion();
+
+		// the rest of the legs are skipped, the caller's full search takes over
+		if ( !legResult )
+			return false;
+
+		ctx.CollectChain( waypoints[ i - 1 ], closestArea, INT_MAX, leg );
+
+		// the first area of a leg is the last one of the previous leg
+		full.insert( full.end(), full.empty() ? leg.begin() : leg.begin() + 1, leg.end() );
+	}
+
+	// same as a full search, keep the end closest to the goal
+	if ( (int)full.size() > maxCount )
+		full.erase( full.begin(), full.end() - maxCount );
+
+	chain = std::move( full );
+	return true;
+}
+
+NavHierarchy g_NavHierarchy;
+
+ConVar path_incremental_max_age("path_incremental_max_age", "3.0", FCVAR_NONE, "seconds a ChasePath keeps repairing the same search tree across repaths, 0 searches from scratch every time");
+
+class NavIncrementalSearch;
+
+/**
+ * The contexts NavIncrementalSearch trees are kept in. A context holds state for every area ID,
+ * so chasers share a few of them and the one used longest ago goes to the next chaser that needs one,
+ * its old owner starts a new tree on its next repath.
+ * Game thread only.
+ */
+class NavIncrementalContextPool
+{
+public:
+	enum { MAX_CONTEXTS = 8 };
+
+	// the context owner was last given under slot, NULL if it has been handed on since
+	NavSearchContext *Find( const NavIncrementalSearch *owner, int slot )
+	{
+		if ( slot < 0 || slot >= MAX_CONTEXTS || m_slots[ slot ].owner != owner )
+			return NULL;
+
+		m_slots[ slot ].lastUsed = ++m_useCount;
+		return m_slots[ slot ].ctx.get();
+	}
+
+	int Acquire( const NavIncrementalSearch *owner )
+	{
+		int best = 0;
+		for ( int slot = 1; slot < MAX_CONTEXTS; ++slot )
+		{
+			if ( m_slots[ slot ].lastUsed < m_slots[ best ].lastUsed )
+				best = slot;
+		}
+
+		slot_t &free = m_slots[ best ];
+		if ( !free.ctx )
+			free.ctx.reset( new NavSearchContext() );
+
+		free.owner = owner;
+		free.lastUsed = ++m_useCount;
+		return best;
+	}
+
+	void Release( const NavIncrementalSearch *owner, int slot )
+	{
+		if ( slot < 0 || slot >= MAX_CONTEXTS || m_slots[ slot ].owner != owner )
+			return;
+
+		m_slots[ slot ].owner = NULL;
+		m_slots[ slot ].lastUsed = 0;
+	}
+
+	// frees the contexts, every tree starts over
+	void Clear( void )
+	{
+		for ( slot_t &slot : m_slots )
+		{
+			slot.ctx.reset();
+			slot.owner = NULL;
+			slot.lastUsed = 0;
+		}
+	}
+
+private:
+	struct slot_t
+	{
+		std::unique_ptr< NavSearchContext > ctx;
+		const NavIncrementalSearch *owner = NULL;
+		uint64_t lastUsed = 0;
+	};
+
+	slot_t m_slots[ MAX_CONTEXTS ];
+	uint64_t m_useCount = 0;
+};
+
+NavIncrementalContextPool g_NavIncrementalContexts;
+
+/**
+ * Search tree kept between the repaths of one ChasePath.
+ * The tree is rooted at the bot, so a moved subject only changes the estimates of the open areas and
+ * a bot that moved along its path re-roots it at its new area (NavSearchContext::Reroot).
+ * Edge costs aren't tracked, the tree starts over after path_incremental_max_age or when the
+ * profile, team or mesh changes, the bot left it, the repaired path crosses a blocked area,
+ * or its context was handed to another chaser (NavIncrementalContextPool).
+ * Game thread only.
+ */
+class NavIncrementalSearch
+{
+public:
+	~NavIncrementalSearch()
+	{
+		g_NavIncrementalContexts.Release( this, m_slot );
+	}
+
+	static const NativePathCost *AsNative( const NativePathCost &costFunc ) { return &costFunc; }
+	static const NativePathCost *AsNative( const IPathCost &costFunc ) { return dynamic_cast< const NativePathCost * >( &costFunc ); }
+
+	void Clear( void )
+	{
+		m_valid = false;
+	}
+
+	/**
+	 * Search from startArea to goalArea, repairing the last tree if it can be used. chain keeps the last maxCount areas.
+	 * Returns false without touching chain if costFunc has no cache profile, callers run a normal search then.
+	 */
+	bool BuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector &goalPos, const NativePathCost &costFunc, int teamID, ILocomotion *mover, int maxCount, std::vector< NavAreaChainLink > &chain, bool &pathResult )
+	{
+		uint64_t profile;
+		if ( !costFunc.GetCacheProfile( profile ) )
+			return false;
+
+		NavSearchContext *ctx = g_NavIncrementalContexts.Find( this, m_slot );
+		if ( ctx && IsReusable( *ctx, startArea, profile, teamID ) )
+		{
+			if ( startArea != m_root )
+			{
+				ctx->Reroot( startArea );
+				m_root = startArea;
+			}
+
+			if ( ctx->ContinuePath( goalArea, &goalPos, costFunc, teamID ) )
+			{
+				ctx->CollectChain( startArea, goalArea, maxCount, chain );
+
+				if ( NavAreaChainIsPassable( chain, teamID, mover ) )
+				{
+					pathResult = true;
+					return true;
+				}
+			}
+		}
+
+		if ( ctx == NULL )
+		{
+			m_slot = g_NavIncrementalContexts.Acquire( this );
+			ctx = g_NavIncrementalContexts.Find( this, m_slot );
+		}
+
+		CNavArea *closestArea = NULL;
+		pathResult = ctx->BuildPath( startArea, goalArea, &goalPos, costFunc, &closestArea, 0.0f, teamID, false );
+
+		m_valid = true;
+		m_root = startArea;
+		m_profile = profile;
+		m_team = teamID;
+		m_generation = g_NavMeshGeneration;
+		m_time = gpGlobals->curtime;
+
+		chain.clear();
+		if ( closestArea )
+			ctx->CollectChain( startArea, closestArea, maxCount, chain );
+
+		return true;
+	}
+
+private:
+	bool IsReusable( const NavSearchContext &ctx, CNavArea *startArea, uint64_t profile, int teamID ) const
+	{
+		if ( !m_valid || m_profile != profile || m_team != teamID || m_generation != g_NavMeshGeneration )
+			return false;
+
+		if ( gpGlobals->curtime - m_time > path_incremental_max_age.GetFloat() )
+			return false;
+
+		// only a closed area has a final cost to re-root on
+		return startArea == m_root || ctx.IsClosed( startArea );
+	}
+
+	int m_slot = -1;
+	CNavArea *m_root = NULL;
+	uint64_t m_profile = 0;
+	int m_team = TEAM_ANY;
+	unsigned int m_generation = 0;
+	float m_time = 0.0f;
+	bool m_valid = false;
+};
+
+ConVar path_reachability("path_reachability", "1", FCVAR_NONE, "check goals against the connectivity index before searching, goals that can't be reached go straight to the closest area that can");
+
+/**
+ * Which areas each team can get to at all, ignoring costs.
+ * The connections between areas that aren't blocked for the team are split into strongly connected components,
+ * each component keeps a bitset of the components it leads to, so a goal can be ruled out without a search.
+ * A team's index is rebuilt when the mesh changes or any area's blocked state for the team flips,
+ * that is looked at once per tick and only for teams that are asked about.
+ * Game thread only.
+ */
+class NavReachability
+{
+public:
+	enum { MAX_CLOSURE_COMPONENTS = 4096 };	// 2 MB per team, more than that and only same-component goals are known
+
+	void Clear( void )
+	{
+		m_teams.clear();
+	}
+
+	// false only if every way from from to to goes through an area that is blocked for teamID, from included
+	bool CanReach( CNavArea *from, CNavArea *to, int teamID )
+	{
+		if ( from == to )
+			return true;
+
+		const team_t &team = Update( teamID );
+		if ( from->GetID() >= team.component.size() || to->GetID() >= team.component.size() )
+			return true;
+
+		return Reaches( team, team.component[ from->GetID() ], team.component[ to->GetID() ] );
+	}
+
+	// the area from can reach that is closest to pos, from itself if it's blocked
+	CNavArea *GetClosestReachable( CNavArea *from, const Vector &pos, int teamID )
+	{
+		const team_t &team = Update( teamID );
+		if ( from->GetID() >= team.component.size() )
+			return from;
+
+		const int fromComponent = team.component[ from->GetID() ];
+		if ( fromComponent < 0 )
+			return from;
+
+		CNavArea *closest = from;
+		float closestDistSq = ( from->GetCenter() - pos ).LengthSqr();
+
+		// the components are by ID like the snapshot they were built from
+		const NavConnectionGraph::snapshot_t graph = g_NavConnectionGraph.Snapshot();
+		for ( unsigned int id = 0; id < team.component.size(); ++id )
+		{
+			if ( !Reaches( team, fromComponent, team.component[ id ] ) )
+				continue;
+
+			float distSq = ( graph->GetCenter( id ) - pos ).LengthSqr();
+			if ( distSq < closestDistSq )
+			{
+				closest = graph->GetArea( id );
+				closestDistSq = distSq;
+			}
+		}
+
+		return closest;
+	}
+
+private:
+	struct team_t
+	{
+		std::vector< int > component;			// by area ID, -1 if blocked
+		std::vector< unsigned char > blocked;	// by area ID, the state component was built for
+		std::vector< uint64_t > reach;			// words bitsets of the components each one leads to, empty if there are too many
+		int words = 0;
+		unsigned int version = 0;
+		int tick = -1;
+	};
+
+	static bool Reaches( const team_t &team, int from, int to )
+	{
+		if ( from < 0 || to < 0 )
+			return false;
+
+		if ( from == to || team.reach.empty() )
+			return true;
+
+		return ( team.reach[ (size_t)from * team.words + to / 64 ] >> ( to % 64 ) ) & 1;
+	}
+
+	const team_t &Update( int teamID )
+	{
+		g_NavConnectionGraph.EnsureBuilt();
+
+		team_t &team = m_teams[ teamID ];
+		if ( team.version == g_NavConnectionGraph.GetVersion() && team.tick == gpGlobals->tickcount )
+			return team;
+
+		bool changed = ( team.version != g_NavConnectionGraph.GetVersion() );
+		team.tick = gpGlobals->tickcount;
+
+		for ( int i = 0; i < TheNavAreas->Count() && !changed; ++i )
+		{
+			CNavArea *area = (*TheNavAreas)[ i ];
+			changed = ( area->IsBlocked( teamID ) != ( team.blocked[ area->GetID() ] != 0 ) );
+		}
+
+		if ( changed )
+			Build( team, teamID );
+
+		return team;
+	}
+
+	// Tarjan's algorithm without recursion, components come out sinks first so the bitsets can be filled in the same order
+	void Build( team_t &team, int teamID )
+	{
+		const NavConnectionGraph &graph = g_NavConnectionGraph;
+		const size_t count = graph.GetIDCount();
+
+		team.version = graph.GetVersion();
+		team.blocked.assign( count, 1 );
+		team.component.assign( count, -1 );
+		team.reach.clear();
+
+		for ( int i = 0; i < TheNavAreas->Count(); ++i )
+		{
+			CNavArea *area = (*TheNavAreas)[ i ];
+			team.blocked[ area->GetID() ] = area->IsBlocked( teamID );
+		}
+
+		struct frame_t
+		{
+			unsigned int id;
+			size_t edge;
+		};
+
+		std::vector< int > index( count, -1 );
+		std::vector< int > lowLink( count, 0 );
+		std::vector< unsigned int > stack;
+		std::vector< frame_t > frames;
+		int nextIndex = 0;
+		int components = 0;
+
+		for ( unsigned int root = 0; root < count; ++root )
+		{
+			if ( team.blocked[ root ] || index[ root ] >= 0 )
+				continue;
+
+			frames.push_back( frame_t{ root, 0 } );
+			index[ root ] = lowLink[ root ] = nextIndex++;
+			stack.push_back( root );
+
+			while ( !frames.empty() )
+			{
+				frame_t &frame = frames.back();
+				const unsigned int id = frame.id;
+				const NavConnectionGraph::range_t edges = graph.Outgoing( id );
+
+				if ( frame.edge < edges.size() )
+				{
+					const unsigned int to = edges[ frame.edge++ ].area->GetID();
+					if ( team.blocked[ to ] )
+						continue;
+
+					if ( index[ to ] < 0 )
+					{
+						index[ to ] = lowLink[ to ] = nextIndex++;
+						stack.push_back( to );
+						frames.push_back( frame_t{ to, 0 } );
+					}
+					else if ( team.component[ to ] < 0 )
+					{
+						// still on the stack
+						lowLink[ id ] = MIN( lowLink[ id ], index[ to ] );
+					}
+					continue;
+				}
+
+				frames.pop_back();
+				if ( !frames.empty() )
+				{
+					const unsigned int parent = frames.back().id;
+					lowLink[ parent ] = MIN( lowLink[ parent ], lowLink[ id ] );
+				}
+
+				if ( lowLink[ id ] != index[ id ] )
+					continue;
+
+				unsigned int member;
+				do
+				{
+					member = stack.back();
+					stack.pop_back();
+					team.component[ member ] = components;
+				} while ( member != id );
+
+				++components;
+			}
+		}
+
+		if ( components > MAX_CLOSURE_COMPONENTS )
+		{
+			team.words = 0;
+			return;
+		}
+
+		team.words = ( components + 63 ) / 64;
+		team.reach.assign( (size_t)components * team.words, 0 );
+
+		std::vector< std::vector< unsigned int > > members( components );
+		for ( unsigned int id = 0; id < count; ++id )
+		{
+			if ( team.component[ id ] >= 0 )
+				members[ team.component[ id ] ].push_back( id );
+		}
+
+		// every component a connection leads out to came out earlier and is complete
+		for ( int c = 0; c < components; ++c )
+		{
+			uint64_t *reach = &team.reach[ (size_t)c * team.words ];
+			reach[ c / 64 ] |= (uint64_t)1 << ( c % 64 );
+
+			for ( unsigned int id : members[ c ] )
+			{
+				for ( const NavConnectionGraph::edge_t &edge : graph.Outgoing( id ) )
+				{
+					const int to = team.component[ edge.area->GetID() ];
+					if ( to < 0 || to == c )
+						continue;
+
+					const uint64_t *other = &team.reach[ (size_t)to * team.words ];
+					for ( int w = 0; w < team.words; ++w )
+					{
+						reach[ w ] |= other[ w ];
+					}
+				}
+			}
+		}
+	}
+
+	std::unordered_map< int, team_t > m_teams;
+};
+
+NavReachability g_NavReachability;
+
+ConVar nav_area_tree("nav_area_tree", "1", FCVAR_NONE, "answer GetNearestNavArea from the extension's bounding volume tree instead of the game's grid walk");
+
+/**
+ * Bounding volume tree over the extents of every area, for nearest area lookups.
+ * The game's GetNearestNavArea walks the grid in rings out to maxDist and looks at every area on the way,
+ * this visits nodes closest first and stops once no node can hold anything closer than what was found.
+ * Rebuilt when the mesh changes. Game thread only.
+ */
+class NavAreaTree
+{
+public:
+	enum { LEAF_SIZE = 4 };
+
+	void Invalidate( void )
+	{
+		m_built = false;
+	}
+
+	void EnsureBuilt( void )
+	{
+		if ( m_built && m_generation == g_NavMeshGeneration && m_areaCount == TheNavAreas->Count() )
+			return;
+
+		m_built = true;
+		m_generation = g_NavMeshGeneration;
+		m_areaCount = TheNavAreas->Count();
+
+		m_areas.clear();
+		m_extents.clear();
+		m_nodes.clear();
+
+		std::vector< item_t > items( m_areaCount );
+		for ( int i = 0; i < m_areaCount; ++i )
+		{
+			CNavArea *area = (*TheNavAreas)[ i ];
+			items[ i ].area = area;
+			area->GetExtent( &items[ i ].extent );
+			items[ i ].center = ( items[ i ].extent.lo + items[ i ].extent.hi ) * 0.5f;
+		}
+
+		if ( !items.empty() )
+			Build( items, 0, (int)items.size() );
+	}
+
+	/**
+	 * Same rules as the game's CNavMesh::GetNearestNavArea: distance from pos to the point of the area closest to
+	 * the ground below pos, blocked areas are skipped and checkLOS runs the same traces.
+	 * The game stops one ring after its first hit, this always returns the closest area within maxDist.
+	 */
+	CNavArea *GetNearest( const Vector &pos, float maxDist, bool checkLOS, bool checkGround, int team )
+	{
+		EnsureBuilt();
+		if ( m_nodes.empty() )
+			return NULL;
+
+		Vector source = pos;
+		if ( !TheNavMesh->GetGroundHeight( pos, &source.z ) )
+		{
+			if ( checkGround )
+				return NULL;
+
+			source.z = pos.z;
+		}
+		source.z += HalfHumanHeight;
+
+		CNavArea *close = NULL;
+		float closeDistSq = maxDist * maxDist;
+
+		bool haveSafePos = false;
+		Vector safePos;
+
+		m_heap.clear();
+		m_heap.push_back( heapnode_t{ DistSqToBox( pos, m_nodes[ 0 ].lo, m_nodes[ 0 ].hi ), 0 } );
+
+		while ( !m_heap.empty() )
+		{
+			std::pop_heap( m_heap.begin(), m_heap.end() );
+			const heapnode_t top = m_heap.back();
+			m_heap.pop_back();
+
+			if ( top.distSq >= closeDistSq )
+				break;
+
+			const node_t &node = m_nodes[ top.node ];
+			if ( node.count == 0 )
+			{
+				const int children[] = { top.node + 1, node.right };
+				for ( int child : children )
+				{
+					float distSq = DistSqToBox( pos, m_nodes[ child ].lo, m_nodes[ child ].hi );
+					if ( distSq < closeDistSq )
+					{
+						m_heap.push_back( heapnode_t{ distSq, child } );
+						std::push_heap( m_heap.begin(), m_heap.end() );
+					}
+				}
+				continue;
+			}
+
+			for ( int i = node.first; i < node.first + node.count; ++i )
+			{
+				if ( DistSqToBox( pos, m_extents[ i ].lo, m_extents[ i ].hi ) >= closeDistSq )
+					continue;
+
+				CNavArea *area = m_areas[ i ];
+				if ( area->IsBlocked( team ) )
+					continue;
+
+				Vector areaPos;
+				area->GetClosestPointOnArea( source, &areaPos );
+
+				float distSq = ( areaPos - pos ).LengthSqr();
+				if ( distSq >= closeDistSq )
+					continue;
+
+				if ( checkLOS )
+				{
+					trace_t result;
+
+					// make sure pos is not embedded in the world
+					if ( !haveSafePos )
+					{
+						UTIL_TraceLine( pos, pos + Vector( 0, 0, StepHeight ), MASK_NPCSOLID_BRUSHONLY, NULL, COLLISION_GROUP_NONE, &result );
+						safePos = result.startsolid ? result.endpos + Vector( 0, 0, 1.0f ) : pos;
+						haveSafePos = true;
+					}
+
+					// areas can be embedded in the ground a bit, don't trace up to safePos if it's within a step
+					if ( fabs( areaPos.z - safePos.z ) > StepHeight )
+					{
+						UTIL_TraceLine( areaPos + Vector( 0, 0, StepHeight ), Vector( areaPos.x, areaPos.y, safePos.z ), MASK_NPCSOLID_BRUSHONLY, NULL, COLLISION_GROUP_NONE, &result );
+						if ( result.fraction != 1.0f )
+							continue;
+					}
+
+					UTIL_TraceLine( safePos, Vector( areaPos.x, areaPos.y, safePos.z + StepHeight ), MASK_NPCSOLID_BRUSHONLY, NULL, COLLISION_GROUP_NONE, &result );
+					if ( result.fraction != 1.0f )
+						continue;
+				}
+
+				close = area;
+				closeDistSq = distSq;
+			}
+		}
+
+		return close;
+	}
+
+private:
+	struct item_t
+	{
+		CNavArea *area;
+		Extent extent;
+		Vector center;
+	};
+
+	// the left child follows its parent, count is 0 for inner nodes
+	struct node_t
+	{
+		Vector lo;
+		Vector hi;
+		int right;
+		int first;
+		int count;
+	};
+
+	struct heapnode_t
+	{
+		float distSq;
+		int node;
+
+		bool operator<( const heapnode_t &other ) const { return distSq > other.distSq; }
+	};
+
+	static float DistSqToBox( const Vector &pos, const Vector &lo, const Vector &hi )
+	{
+		float dx = MAX( MAX( lo.x - pos.x, pos.x - hi.x ), 0.0f );
+		float dy = MAX( MAX( lo.y - pos.y, pos.y - hi.y ), 0.0f );
+		float dz = MAX( MAX( lo.z - pos.z, pos.z - hi.z ), 0.0f );
+		return dx * dx + dy * dy + dz * dz;
+	}
+
+	// split at the median center along the longest side
+	int Build( std::vector< item_t > &items, int begin, int end )
+	{
+		const int index = (int)m_nodes.size();
+		m_nodes.push_back( node_t() );
+
+		Vector lo = items[ begin ].extent.lo;
+		Vector hi = items[ begin ].extent.hi;
+		Vector centerLo = items[ begin ].center;
+		Vector centerHi = items[ begin ].center;
+		for ( int i = begin + 1; i < end; ++i )
+		{
+			const item_t &item = items[ i ];
+			lo.x = MIN( lo.x, item.extent.lo.x ); lo.y = MIN( lo.y, item.extent.lo.y ); lo.z = MIN( lo.z, item.extent.lo.z );
+			hi.x = MAX( hi.x, item.extent.hi.x ); hi.y = MAX( hi.y, item.extent.hi.y ); hi.z = MAX( hi.z, item.extent.hi.z );
+			centerLo.x = MIN( centerLo.x, item.center.x ); centerLo.y = MIN( centerLo.y, item.center.y ); centerLo.z = MIN( centerLo.z, item.center.z );
+			centerHi.x = MAX( centerHi.x, item.center.x ); centerHi.y = MAX( centerHi.y, item.center.y ); centerHi.z = MAX( centerHi.z, item.center.z );
+		}
+
+		m_nodes[ index ].lo = lo;
+		m_nodes[ index ].hi = hi;
+
+		if ( end - begin <= LEAF_SIZE )
+		{
+			m_nodes[ index ].first = (int)m_areas.size();
+			m_nodes[ index ].count = end - begin;
+			for ( int i = begin; i < end; ++i )
+			{
+				m_areas.push_back( items[ i ].area );
+				m_extents.push_back( items[ i ].extent );
+			}
+			return index;
+		}
+
+		const Vector size = centerHi - centerLo;
+		const int axis = ( size.x >= size.y && size.x >= size.z ) ? 0 : ( size.y >= size.z ? 1 : 2 );
+		const int mid = ( begin + end ) / 2;
+		std::nth_element( items.begin() + begin, items.begin() + mid, items.begin() + end, [axis]( const item_t &a, const item_t &b ) {
+			return a.center[ axis ] < b.center[ axis ];
+		} );
+
+		Build( items, begin, mid );
+		const int right = Build( items, mid, end );
+
+		m_nodes[ index ].right = right;
+		m_nodes[ index ].first = 0;
+		m_nodes[ index ].count = 0;
+		return index;
+	}
+
+	std::vector< node_t > m_nodes;
+	std::vector< CNavArea * > m_areas;		// in leaf order
+	std::vector< Extent > m_extents;		// of m_areas
+	std::vector< heapnode_t > m_heap;
+	bool m_built = false;
+	unsigned int m_generation = 0;
+	int m_areaCount = 0;
+};
+
+NavAreaTree g_NavAreaTree;
+
+#if SOURCE_ENGINE == SE_TF2
+CNavArea *CNavMesh::GetNearestNavArea( const Vector &pos, bool anyZ, float maxDist, bool checkLOS, bool checkGround, int team ) const
+{
+	if ( !nav_area_tree.GetBool() )
+		return call_mfunc<CNavArea *, CNavMesh, const Vector &, bool, float, bool, bool, int>(this, CNavMeshGetNearestNavArea, pos, anyZ, maxDist, checkLOS, checkGround, team);
+
+	if ( !m_grid.Count() )
+		return NULL;
+
+	// quick check
+	if ( !checkLOS && !checkGround )
+	{
+		CNavArea *close = GetNavArea( pos );
+		if ( close )
+			return close;
+	}
+
+	return g_NavAreaTree.GetNearest( pos, maxDist, checkLOS, checkGround, team );
+}
+#endif
+
+ConVar nav_visibility_matrix("nav_visibility_matrix", "1", FCVAR_NONE, "answer CNavArea visibility queries from the extension's compressed matrix instead of the areas' visibility lists");
+
+/**
+ * Area to area visibility from the .nav flattened into two bit matrices by area ID, one for potentially visible
+ * and one for completely visible, each row read through the same ForAll*VisibleAreas the game uses so inherited
+ * visibility and overrides come out the same.
+ *
+ * Rows are sparse, only their non-zero 64 bit words are stored. A summary bit per word says which are there and
+ * the popcount of the summary bits below it is the word's index, so a pair test is a few loads. Team queries OR
+ * the rows of every living member's area into a dense row once per tick and test that.
+ * Game thread only, rebuilt when the mesh changes.
+ */
+class NavVisibilityMatrix
+{
+public:
+	void Invalidate( void )
+	{
+		m_built = false;
+	}
+
+	void EnsureBuilt( void )
+	{
+		if ( m_built && m_generation == g_NavMeshGeneration && m_areaCount == TheNavAreas->Count() )
+			return;
+
+		m_built = true;
+		m_generation = g_NavMeshGeneration;
+		m_areaCount = TheNavAreas->Count();
+
+		unsigned int maxID = 0;
+		for ( int i = 0; i < m_areaCount; ++i )
+		{
+			maxID = MAX( maxID, (*TheNavAreas)[ i ]->GetID() );
+		}
+
+		m_rows = m_areaCount > 0 ? maxID + 1 : 0;
+		m_wordCount = ( m_rows + 63 ) / 64;
+		m_summaryCount = ( m_wordCount + 63 ) / 64;
+
+		std::vector< uint64_t > row( m_wordCount, 0 );
+		for ( int kind = 0; kind < NUM_KINDS; ++kind )
+		{
+			matrix_t &matrix = m_matrix[ kind ];
+			matrix.summary.assign( (size_t)m_rows * m_summaryCount, 0 );
+			matrix.offset.assign( (size_t)m_rows * m_summaryCount, 0 );
+			matrix.words.clear();
+			matrix.teams.clear();
+
+			for ( int i = 0; i < m_areaCount; ++i )
+			{
+				CNavArea *area = (*TheNavAreas)[ i ];
+
+				auto collect = [&]( CNavArea *visible ) {
+					unsigned int id = visible->GetID();
+					row[ id >> 6 ] |= 1ull << ( id & 63 );
+					return true;
+				};
+
+				if ( kind == POTENTIALLY_VISIBLE )
+				{
+					area->ForAllPotentiallyVisibleAreas( collect );
+					if ( area->IsPotentiallyVisible( area ) )
+						collect( area );
+				}
+				else
+				{
+					area->ForAllCompletelyVisibleAreas( collect );
+					if ( area->IsCompletelyVisible( area ) )
+						collect( area );
+				}
+
+				Store( matrix, area->GetID(), row );
+			}
+		}
+	}
+
+	// would the game's IsPotentiallyVisible / IsCompletelyVisible say area can see other
+	bool IsVisible( const CNavArea *area, const CNavArea *other, bool completely )
+	{
+		if ( !area || !other )
+			return false;
+
+		EnsureBuilt();
+		return Test( m_matrix[ completely ? COMPLETELY_VISIBLE : POTENTIALLY_VISIBLE ], area->GetID(), other->GetID() );
+	}
+
+	// would the game's IsPotentiallyVisibleToTeam / IsCompletelyVisibleToTeam say a living member of team can see area
+	bool IsVisibleToTeam( const CNavArea *area, int team, bool completely )
+	{
+		if ( !area )
+			return false;
+
+		EnsureBuilt();
+
+		const std::vector< uint64_t > &row = TeamRow( m_matrix[ completely ? COMPLETELY_VISIBLE : POTENTIALLY_VISIBLE ], team );
+		unsigned int id = area->GetID();
+		return id < m_rows && ( ( row[ id >> 6 ] >> ( id & 63 ) ) & 1 ) != 0;
+	}
+
+private:
+	enum { POTENTIALLY_VISIBLE, COMPLETELY_VISIBLE, NUM_KINDS };
+
+	struct team_t
+	{
+		int tick = -1;
+		std::vector< uint64_t > row;
+	};
+
+	struct matrix_t
+	{
+		// [ row * m_summaryCount + word / 64 ], which words of the row are stored and where the first of them is
+		std::vector< uint64_t > summary;
+		std::vector< uint32_t > offset;
+		std::vector< uint64_t > words;
+
+		// union of the member rows by team, refreshed once per tick
+		std::unordered_map< int, team_t > teams;
+	};
+
+	static int Popcount( uint64_t bits )
+	{
+	#if defined( __GNUC__ ) || defined( __clang__ )
+		return __builtin_popcountll( bits );
+	#else
+		bits = bits - ( ( bits >> 1 ) & 0x5555555555555555ull );
+		bits = ( bits & 0x3333333333333333ull ) + ( ( bits >> 2 ) & 0x3333333333333333ull );
+		bits = ( bits + ( bits >> 4 ) ) & 0x0F0F0F0F0F0F0F0Full;
+		return (int)( ( bits * 0x0101010101010101ull ) >> 56 );
+	#endif
+	}
+
+	// append the non-zero words of row and clear it for the next one
+	void Store( matrix_t &matrix, unsigned int id, std::vector< uint64_t > &row )
+	{
+		for ( unsigned int s = 0; s < m_summaryCount; ++s )
+		{
+			size_t slot = (size_t)id * m_summaryCount + s;
+			matrix.offset[ slot ] = (uint32_t)matrix.words.size();
+
+			unsigned int last = MIN( ( s + 1 ) * 64, m_wordCount );
+			for ( unsigned int word = s * 64; word < last; ++word )
+			{
+				if ( row[ word ] )
+				{
+					matrix.summary[ slot ] |= 1ull << ( word & 63 );
+					matrix.words.push_back( row[ word ] );
+					row[ word ] = 0;
+				}
+			}
+		}
+	}
+
+	bool Test( const matrix_t &matrix, unsigned int row, unsigned int column ) const
+	{
+		if ( row >= m_rows || column >= m_rows )
+			return false;
+
+		unsigned int word = column >> 6;
+		size_t slot = (size_t)row * m_summaryCount + ( word >> 6 );
+
+		uint64_t bit = 1ull << ( word & 63 );
+		uint64_t summary = matrix.summary[ slot ];
+		if ( !( summary & bit ) )
+			return false;
+
+		return ( ( matrix.words[ matrix.offset[ slot ] + Popcount( summary & ( bit - 1 ) ) ] >> ( column & 63 ) ) & 1 ) != 0;
+	}
+
+	// OR every stored word of row into dense
+	void Merge( const matrix_t &matrix, unsigned int row, std::vector< uint64_t > &dense ) const
+	{
+		if ( row >= m_rows )
+			return;
+
+		for ( unsigned int s = 0; s < m_summaryCount; ++s )
+		{
+			size_t slot = (size_t)row * m_summaryCount + s;
+			const uint64_t *words = matrix.words.data() + matrix.offset[ slot ];
+
+			for ( uint64_t summary = matrix.summary[ slot ]; summary; summary &= summary - 1 )
+			{
+				dense[ s * 64 + Popcount( ( summary & ( ~summary + 1 ) ) - 1 ) ] |= *words++;
+			}
+		}
+	}
+
+	const std::vector< uint64_t > &TeamRow( matrix_t &matrix, int team )
+	{
+		team_t &entry = matrix.teams[ team ];
+		if ( entry.tick == gpGlobals->tickcount && entry.row.size() == m_wordCount )
+			return entry.row;
+
+		entry.tick = gpGlobals->tickcount;
+		entry.row.assign( m_wordCount, 0 );
+
+		int num = playerhelpers->GetMaxClients();
+		for ( int i = 1; i <= num; ++i )
+		{
+			IGamePlayer *gameplayer = playerhelpers->GetGamePlayer( i );
+			if ( !gameplayer || !gameplayer->IsInGame() )
+				continue;
+
+			CBaseEntity *player = gamehelpers->ReferenceToEntity( gameplayer->GetIndex() );
+			if ( !player || player->GetTeamNumber() != team || !player->IsAlive() )
+				continue;
+
+			CBaseCombatCharacter *combat = player->MyCombatCharacterPointer();
+			CNavArea *from = combat ? combat->GetLastKnownArea() : NULL;
+			if ( from )
+				Merge( matrix, from->GetID(), entry.row );
+		}
+
+		return entry.row;
+	}
+
+	matrix_t m_matrix[ NUM_KINDS ];
+	unsigned int m_rows = 0;
+	unsigned int m_wordCount = 0;
+	unsigned int m_summaryCount = 0;
+	bool m_built = false;
+	unsigned int m_generation = 0;
+	int m_areaCount = 0;
+};
+
+NavVisibilityMatrix g_NavVisibilityMatrix;
+
+ConVar nav_ground_heightfield("nav_ground_heightfield", "0", FCVAR_NONE, "answer CNavMesh ground height queries from floor heights sampled under each nav area instead of tracing every time");
+ConVar nav_ground_heightfield_spacing("nav_ground_heightfield_spacing", "16", FCVAR_NONE, "largest distance between the floor samples of an area, steps narrower than this can fall between them", true, 4.0f, false, 0.0f);
+
+/**
+ * Floor heights and normals sampled on a grid under each nav area, traced as queries first need them.
+ * A sample is a trace straight down from above the area, for any position in the column between where it started
+ * and what it hit, tracing from the position hits the same thing. Between samples the four around the position
+ * have to lie on one plane with the normal they hit and the height comes from that plane, anything else traces.
+ *
+ * func_, prop_ and obj_ entities are tracked while this is enabled since they can move, break or be filtered
+ * differently by the game's GetGroundHeight, columns under a solid one are never answered from samples.
+ * Static ones (no movement, no parent) are looked at once after they spawn, the non solid ones are dropped and the
+ * rest block the areas they are over until they are destroyed. Moving ones and obj_ buildings, which are carried
+ * around, have their box read once per tick and their columns are never sampled, so them moving doesn't drop fields.
+ * Game thread only, thrown away when the mesh changes.
+ */
+class NavGroundHeightfield
+{
+public:
+	bool IsEnabled( void ) const { return nav_ground_heightfield.GetBool(); }
+
+	void Clear( void )
+	{
+		m_fields.clear();
+		m_pending.clear();
+		m_static.clear();
+		m_moving.clear();
+	}
+
+	void Track( CBaseEntity *pEntity )
+	{
+		// entities created while disabled are picked up by TrackExisting once it is enabled again
+		if ( !IsEnabled() )
+		{
+			m_tracking = false;
+			return;
+		}
+
+		m_pending.push_back( gamehelpers->EntityToBCompatRef( pEntity ) );
+	}
+
+	void Untrack( CBaseEntity *pEntity )
+	{
+		cell_t ref = gamehelpers->EntityToBCompatRef( pEntity );
+
+		auto it = m_static.find( ref );
+		if ( it != m_static.end() )
+		{
+			Invalidate( it->second );
+			m_static.erase( it );
+		}
+
+		m_moving.erase( ref );
+		m_pending.erase( std::remove( m_pending.begin(), m_pending.end(), ref ), m_pending.end() );
+	}
+
+	/**
+	 * Ground height below pos from the samples, false if they can't tell and the caller has to trace.
+	 * ground picks GetGroundHeight's rules, which trace from half a human height above pos, over GetSimpleGroundHeight's.
+	 */
+	bool GetHeight( const Vector &pos, bool ground, float *height, Vector *normal )
+	{
+		if ( !IsEnabled() || !TheNavMesh->IsLoaded() )
+			return false;
+
+		Refresh();
+
+		CNavArea *area = TheNavMesh->GetNavArea( pos, 120.0f );
+		if ( !area )
+			return false;
+
+		field_t &field = GetField( area );
+
+		float fx = ( pos.x - field.extent.lo.x ) / field.stepX;
+		float fy = ( pos.y - field.extent.lo.y ) / field.stepY;
+		if ( fx < 0.0f || fy < 0.0f || fx > field.nx - 1 || fy > field.ny - 1 )
+			return false;
+
+		if ( IsBlocked( field, pos.x, pos.y ) )
+			return false;
+
+		int i = MIN( (int)fx, field.nx - 2 );
+		int j = MIN( (int)fy, field.ny - 2 );
+
+		const sample_t *origin = Sample( field, i, j );
+		if ( !origin || origin->normal.z < 0.1f )
+			return false;
+
+		const Vector &up = origin->normal;
+		for ( int corner = 1; corner < 4; ++corner )
+		{
+			int ci = i + ( corner & 1 );
+			int cj = j + ( corner >> 1 );
+
+			const sample_t *sample = Sample( field, ci, cj );
+			if ( !sample || DotProduct( sample->normal, up ) < PLANE_NORMAL_DOT )
+				return false;
+
+			float planeZ = origin->z - ( up.x * ( ci - i ) * field.stepX + up.y * ( cj - j ) * field.stepY ) / up.z;
+			if ( fabsf( sample->z - planeZ ) > PLANE_TOLERANCE )
+				return false;
+		}
+
+		float z = origin->z - ( up.x * ( pos.x - ( field.extent.lo.x + i * field.stepX ) ) + up.y * ( pos.y - ( field.extent.lo.y + j * field.stepY ) ) ) / up.z;
+
+		// the position has to be in the part of the column the samples traced through
+		if ( z > pos.z || ( ground ? pos.z + HalfHumanHeight + 1.0f : pos.z ) > field.top || pos.z - z > TRACE_DEPTH )
+			return false;
+
+		*height = z;
+		if ( normal )
+			*normal = up;
+
+		return true;
+	}
+
+private:
+	enum { SAMPLE_UNKNOWN, SAMPLE_VALID, SAMPLE_INVALID };
+
+	static constexpr float PLANE_NORMAL_DOT = 0.999f;
+	static constexpr float PLANE_TOLERANCE = 0.5f;
+	static constexpr float TRACE_DEPTH = 9999.9f;
+
+	struct sample_t
+	{
+		float z;
+		Vector normal;
+	};
+
+	struct field_t
+	{
+		Extent extent;
+		float top;						// where the samples are traced down from
+		float stepX, stepY;
+		int nx, ny;
+		std::vector< sample_t > samples;
+		std::vector< uint8_t > state;
+		std::vector< Extent > blockers;	// tracked entities over the area when it was created
+	};
+
+	struct moving_t
+	{
+		bool solid = false;
+		Extent box;
+	};
+
+	field_t &GetField( CNavArea *area )
+	{
+		auto it = m_fields.find( area->GetID() );
+		if ( it != m_fields.end() )
+			return it->second;
+
+		field_t &field = m_fields[ area->GetID() ];
+		area->GetExtent( &field.extent );
+		field.top = field.extent.hi.z + HalfHumanHeight * 2.0f + StepHeight;
+
+		float spacing = nav_ground_heightfield_spacing.GetFloat();
+		float sizeX = MAX( field.extent.hi.x - field.extent.lo.x, 1.0f );
+		float sizeY = MAX( field.extent.hi.y - field.extent.lo.y, 1.0f );
+		field.nx = (int)ceilf( sizeX / spacing ) + 1;
+		field.ny = (int)ceilf( sizeY / spacing ) + 1;
+		field.stepX = sizeX / ( field.nx - 1 );
+		field.stepY = sizeY / ( field.ny - 1 );
+
+		field.samples.resize( field.nx * field.ny );
+		field.state.assign( field.nx * field.ny, SAMPLE_UNKNOWN );
+
+		for ( const auto &entry : m_static )
+		{
+			if ( Overlaps( field, entry.second ) )
+				field.blockers.push_back( entry.second );
+		}
+
+		return field;
+	}
+
+	const sample_t *Sample( field_t &field, int i, int j )
+	{
+		int index = j * field.nx + i;
+		if ( field.state[ index ] == SAMPLE_UNKNOWN )
+		{
+			Vector from( field.extent.lo.x + i * field.stepX, field.extent.lo.y + j * field.stepY, field.top );
+
+			// the trace could hit what's moving, try again once it's gone
+			if ( IsUnderMoving( field, from.x, from.y ) )
+				return NULL;
+
+			field.state[ index ] = SAMPLE_INVALID;
+
+			if ( !IsUnderBox( field.blockers, from.x, from.y ) )
+			{
+				Vector to( from.x, from.y, from.z - TRACE_DEPTH );
+
+				trace_t result;
+				UTIL_TraceLine( from, to, MASK_NPCSOLID_BRUSHONLY, NULL, COLLISION_GROUP_NONE, &result );
+
+				if ( !result.startsolid && result.fraction < 1.0f )
+				{
+					field.samples[ index ].z = result.endpos.z;
+					field.samples[ index ].normal = result.plane.normal;
+					field.state[ index ] = SAMPLE_VALID;
+				}
+			}
+		}
+
+		return field.state[ index ] == SAMPLE_VALID ? &field.samples[ index ] : NULL;
+	}
+
+	static bool Overlaps( const field_t &field, const Extent &box )
+	{
+		return box.lo.x <= field.extent.hi.x && box.hi.x >= field.extent.lo.x &&
+			box.lo.y <= field.extent.hi.y && box.hi.y >= field.extent.lo.y &&
+			box.lo.z <= field.top;
+	}
+
+	static bool IsUnderBox( const std::vector< Extent > &boxes, float x, float y )
+	{
+		for ( const Extent &box : boxes )
+		{
+			if ( x >= box.lo.x && x <= box.hi.x && y >= box.lo.y && y <= box.hi.y )
+				return true;
+		}
+
+		return false;
+	}
+
+	bool IsUnderMoving( const field_t &field, float x, float y ) const
+	{
+		for ( const auto &entry : m_moving )
+		{
+			const Extent &box = entry.second.box;
+			if ( entry.second.solid && box.lo.z <= field.top && x >= box.lo.x && x <= box.hi.x && y >= box.lo.y && y <= box.hi.y )
+				return true;
+		}
+
+		return false;
+	}
+
+	bool IsBlocked( const field_t &field, float x, float y ) const
+	{
+		return IsUnderBox( field.blockers, x, y ) || IsUnderMoving( field, x, y );
+	}
+
+	// after a late load or being disabled for a while, creations weren't seen
+	void TrackExisting( void )
+	{
+		m_pending.clear();
+		m_static.clear();
+		m_moving.clear();
+		m_fields.clear();
+
+		for ( const char *pattern : { "func_*", "prop_*", "obj_*" } )
+		{
+			CBaseEntity *pEntity = NULL;
+			while ( ( pEntity = FindEntityByClassname( pEntity, pattern ) ) != NULL )
+			{
+				m_pending.push_back( gamehelpers->EntityToBCompatRef( pEntity ) );
+			}
+		}
+
+		m_tracking = true;
+	}
+
+	// drop every area box is over, they are sampled again with it as a blocker
+	void Invalidate( const Extent &box )
+	{
+		for ( auto it = m_fields.begin(); it != m_fields.end(); )
+		{
+			if ( Overlaps( it->second, box ) )
+				it = m_fields.erase( it );
+			else
+				++it;
+		}
+	}
+
+	// once per tick, sort out entities that spawned since and read where the moving ones are
+	void Refresh( void )
+	{
+		if ( m_generation != g_NavMeshGeneration )
+		{
+			m_fields.clear();
+			m_generation = g_NavMeshGeneration;
+		}
+
+		if ( m_tick == gpGlobals->tickcount )
+			return;
+
+		m_tick = gpGlobals->tickcount;
+
+		if ( !m_tracking )
+			TrackExisting();
+
+		for ( cell_t ref : m_pending )
+		{
+			CBaseEntity *pEntity = gamehelpers->ReferenceToEntity( ref );
+			if ( !pEntity )
+				continue;
+
+			if ( strncmp( pEntity->GetClassname(), "obj_", 4 ) == 0 || pEntity->GetMoveType() != MOVETYPE_NONE || pEntity->GetMoveParent() )
+			{
+				m_moving[ ref ] = moving_t{};
+			}
+			else if ( pEntity->IsSolid() )
+			{
+				Extent &box = m_static[ ref ];
+				pEntity->CollisionProp()->WorldSpaceAABB( &box.lo, &box.hi );
+
+				// fields made before it spawned don't have it as a blocker
+				Invalidate( box );
+			}
+		}
+
+		m_pending.clear();
+
+		for ( auto it = m_moving.begin(); it != m_moving.end(); )
+		{
+			CBaseEntity *pEntity = gamehelpers->ReferenceToEntity( it->first );
+			if ( !pEntity )
+			{
+				it = m_moving.erase( it );
+				continue;
+			}
+
+			it->second.solid = pEntity->IsSolid();
+			if ( it->second.solid )
+				pEntity->CollisionProp()->WorldSpaceAABB( &it->second.box.lo, &it->second.box.hi );
+
+			++it;
+		}
+	}
+
+	std::unordered_map< unsigned int, field_t > m_fields;
+	std::vector< cell_t > m_pending;
+	std::unordered_map< cell_t, Extent > m_static;
+	std::unordered_map< cell_t, moving_t > m_moving;
+	unsigned int m_generation = 0;
+	int m_tick = -1;
+	bool m_tracking = false;
+};
+
+NavGroundHeightfield g_NavGroundHeightfield;
+
+bool CNavMesh::GetSimpleGroundHeight( const Vector &pos, float *height, Vector *normal ) const
+{
+	if ( g_NavGroundHeightfield.GetHeight( pos, false, height, normal ) )
+		return true;
+
+	Vector to;
+	to.x = pos.x;
+	to.y = pos.y;
+	to.z = pos.z - 9999.9f;
+
+	trace_t result;
+
+	UTIL_TraceLine( pos, to, MASK_NPCSOLID_BRUSHONLY, NULL, COLLISION_GROUP_NONE, &result );
+
+	if (result.startsolid)
+		return false;
+
+	*height = result.endpos.z;
+
+	if (normal)
+		*normal = result.plane.normal;
+
+	return true;
+}
+
+bool CNavMesh::GetGroundHeight( const Vector &pos, float *height, Vector *normal ) const
+{
+	if ( g_NavGroundHeightfield.GetHeight( pos, true, height, normal ) )
+		return true;
+
+	return call_mfunc<bool, CNavMesh, const Vector &, float *, Vector *>(this, CNavMeshGetGroundHeight, pos, height, normal);
+}
+
+ConVar path_flow_field_count("path_flow_field_count", "16", FCVAR_NONE, "goal maps kept for PATH_SEARCH_FLOW_FIELD, 0 makes those searches run normally");
+ConVar path_flow_field_max_age("path_flow_field_max_age", "1.0", FCVAR_NONE, "seconds a goal map can be followed for");
+
+/**
+ * Goal maps (flow fields) shared by every bot heading to the same area with the same cost profile.
+ * A Dijkstra search backwards from the goal area leaves every settled area with the next area toward the goal,
+ * so a bot only has to walk the map. The search is lazy: it stops once the asking bot's area is settled and
+ * resumes from there for the next bot. A new goal area gets a new map, old ones age out.
+ * Game thread only.
+ */
+class NavFlowFields
+{
+public:
+	bool IsEnabled( void ) const { return path_flow_field_count.GetInt() > 0; }
+
+	void Clear( void )
+	{
+		m_fields.clear();
+	}
+
+	/**
+	 * Walk the goal map of goalArea from startArea, chain keeps the last maxCount areas.
+	 * Returns false if it couldn't be used (no cache profile, goal blocked, startArea can't reach it, the route went stale),
+	 * callers run a normal search then.
+	 */
+	bool BuildPath( CNavArea *startArea, CNavArea *goalArea, const NativePathCost &costFunc, int teamID, ILocomotion *mover, int maxCount, std::vector< NavAreaChainLink > &chain )
+	{
+		uint64_t profile;
+		if ( !IsEnabled() || !costFunc.GetCacheProfile( profile ) || goalArea->IsBlocked( teamID ) || startArea->IsBlocked( teamID ) )
+			return false;
+
+		EnsureGraph();
+
+		field_t *field = FindField( goalArea, profile, teamID );
+		if ( !Settle( *field, startArea, costFunc, teamID ) )
+			return false;
+
+		std::vector< NavAreaChainLink > route;
+		route.push_back( NavAreaChainLink{ startArea, startArea->GetID(), NUM_TRAVERSE_TYPES } );
+
+		for ( CNavArea *area = startArea; area != goalArea; )
+		{
+			unsigned int id = area->GetID();
+			area = field->next[ id ];
+			route.push_back( NavAreaChainLink{ area, area->GetID(), (NavTraverseType)field->how[ id ] } );
+		}
+
+		if ( !NavAreaChainIsPassable( route, teamID, mover ) )
+			return false;
+
+		// same as a full search, keep the end closest to the goal
+		if ( (int)route.size() > maxCount )
+			route.erase( route.begin(), route.end() - maxCount );
+
+		chain = std::move( route );
+		return true;
+	}
+
+private:
+	struct field_t
+	{
+		CNavArea *goalArea;
+		uint64_t profile;
+		int team;
+		float time;
+		std::vector< float > cost;
+		std::vector< CNavArea * > next;
+		std::vector< unsigned char > how;
+		std::vector< bool > settled;
+		std::vector< std::pair< float, CNavArea * > > heap;
+	};
+
+	// maps hold area pointers, drop them when the graph is rebuilt
+	void EnsureGraph( void )
+	{
+		g_NavConnectionGraph.EnsureBuilt();
+
+		if ( m_graphVersion != g_NavConnectionGraph.GetVersion() )
+		{
+			m_graphVersion = g_NavConnectionGraph.GetVersion();
+			m_fields.clear();
+		}
+	}
+
+	// the map for goalArea, a new one if there is none or it aged out
+	field_t *FindField( CNavArea *goalArea, uint64_t profile, int teamID )
+	{
+		for ( std::list< field_t >::iterator it = m_fields.begin(); it != m_fields.end(); ++it )
+		{
+			if ( it->goalArea != goalArea || it->profile != profile || it->team != teamID )
+				continue;
+
+			if ( gpGlobals->curtime - it->time > path_flow_field_max_age.GetFloat() )
+			{
+				m_fields.erase( it );
+				break;
+			}
+
+			// most recently used goes to the front
+			m_fields.splice( m_fields.begin(), m_fields, it );
+			return &m_fields.front();
+		}
+
+		m_fields.emplace_front();
+		while ( (int)m_fields.size() > path_flow_field_count.GetInt() )
+		{
+			m_fields.pop_back();
+		}
+
+		field_t &field = m_fields.front();
+		field.goalArea = goalArea;
+		field.profile = profile;
+		field.team = teamID;
+		field.time = gpGlobals->curtime;
+		const size_t count = g_NavConnectionGraph.GetIDCount();
+		field.cost.assign( count, FLT_MAX );
+		field.next.assign( count, NULL );
+		field.how.assign( count, NUM_TRAVERSE_TYPES );
+		field.settled.assign( count, false );
+
+		field.cost[ goalArea->GetID() ] = 0.0f;
+		field.heap.emplace_back( 0.0f, goalArea );
+
+		return &field;
+	}
+
+	// run the backwards search until startArea is settled, false if it can't reach the goal
+	bool Settle( field_t &field, CNavArea *startArea, const NativePathCost &costFunc, int teamID )
+	{
+		using entry_t = std::pair< float, CNavArea * >;
+
+		unsigned int startID = startArea->GetID();
+		if ( startID >= field.settled.size() )
+			return false;
+
+		while ( !field.settled[ startID ] )
+		{
+			if ( field.heap.empty() )
+				return false;
+
+			std::pop_heap( field.heap.begin(), field.heap.end(), std::greater< entry_t >() );
+			entry_t top = field.heap.back();
+			field.heap.pop_back();
+
+			unsigned int id = top.second->GetID();
+			if ( field.settled[ id ] || top.first > field.cost[ id ] )
+				continue;
+
+			field.settled[ id ] = true;
+
+			for ( const NavConnectionGraph::edge_t &edge : g_NavConnectionGraph.Incoming( id ) )
+			{
+				unsigned int fromID = edge.area->GetID();
+				if ( field.settled[ fromID ] || edge.area->IsBlocked( teamID ) )
+					continue;
+
+				float cost = costFunc.EdgeCost( top.second, edge.area, edge.ladder, edge.elevator, edge.length );
+
+				// NaNs really mess this function up causing tough to track down hangs
+				if ( IS_NAN( cost ) )
+					cost = 1e30f;
+
+				if ( cost < 0.0f )
+					continue;
+
+				// same minimum step as NavSearchContext::BuildPath
+				float newCost = top.first + MAX( cost, 1e-4f );
+				if ( newCost < field.cost[ fromID ] )
+				{
+					field.cost[ fromID ] = newCost;
+					field.next[ fromID ] = top.second;
+					field.how[ fromID ] = (unsigned char)edge.how;
+					field.heap.emplace_back( newCost, edge.area );
+					std::push_heap( field.heap.begin(), field.heap.end(), std::greater< entry_t >() );
+				}
+			}
+		}
+
+		return true;
+	}
+
+	std::list< field_t > m_fields;
+	unsigned int m_graphVersion = 0;
+};
+
+NavFlowFields g_NavFlowFields;
+
+/**
+ * A* from both ends at once for long point-to-point searches (PATH_SEARCH_BIDIRECTIONAL).
+ * The forward side follows the connections out of startArea, the backward side the connections into goalArea.
+ * Both are keyed with the average of the two estimates (straight line, raised to the NavLandmarks bound where it applies)
+ * so one bound covers both sides, the search stops once the best meeting found can't be beaten by anything left on either open list.
+ * Costs go through EdgeCost with the same rules as NavSearchContext::BuildPath.
+ * Game thread only.
+ */
+class NavBidirectionalSearch
+{
+public:
+	// false if it can't be used or goalArea can't be reached, callers run a normal search then
+	bool BuildPath( CNavArea *startArea, CNavArea *goalArea, const NativePathCost &costFunc, int teamID, int maxCount, std::vector< NavAreaChainLink > &chain )
+	{
+		if ( startArea == goalArea || goalArea->IsBlocked( teamID ) || startArea->IsBlocked( teamID ) )
+			return false;
+
+		g_NavConnectionGraph.EnsureBuilt();
+
+		const size_t count = g_NavConnectionGraph.GetIDCount();
+		if ( startArea->GetID() >= count || goalArea->GetID() >= count )
+			return false;
+
+		if ( ++m_marker == 0 )
+		{
+			for ( side_t &side : m_sides )
+			{
+				side.state.assign( side.state.size(), state_t{} );
+			}
+
+			m_marker = 1;
+		}
+
+		for ( side_t &side : m_sides )
+		{
+			if ( side.state.size() != count )
+				side.state.assign( count, state_t{} );
+
+			side.heap.clear();
+		}
+
+		m_startPos = startArea->GetCenter();
+		m_goalPos = goalArea->GetCenter();
+
+		// landmark distances only bound functors that can't go below them
+		m_landmarkScale = costFunc.GetMinCostScale();
+		m_landmarks.reset();
+		if ( m_landmarkScale > 0.0f )
+		{
+			m_landmarks = g_NavLandmarks.Snapshot();
+			if ( m_landmarks && ( !m_landmarks->PrepareGoal( goalArea, m_goalLandmarks ) || !m_landmarks->PrepareGoal( startArea, m_startLandmarks ) ) )
+				m_landmarks.reset();
+		}
+
+		m_best = FLT_MAX;
+		m_meet = NULL;
+
+		Open( FORWARD, startArea, NULL, NUM_TRAVERSE_TYPES, 0.0f );
+		Open( BACKWARD, goalArea, NULL, NUM_TRAVERSE_TYPES, 0.0f );
+
+		while ( true )
+		{
+			const heapentry_t *forward = Top( FORWARD );
+			const heapentry_t *backward = Top( BACKWARD );
+			if ( forward == NULL || backward == NULL )
+				break;
+
+			if ( forward->first + backward->first >= m_best )
+				break;
+
+			Expand( ( forward->first <= backward->first ) ? FORWARD : BACKWARD, costFunc, teamID );
+		}
+
+		m_landmarks.reset();
+
+		if ( m_meet == NULL )
+			return false;
+
+		std::vector< NavAreaChainLink > route;
+		for ( CNavArea *area = m_meet; area; area = m_sides[ FORWARD ].state[ area->GetID() ].link )
+		{
+			route.push_back( NavAreaChainLink{ area, area->GetID(), (NavTraverseType)m_sides[ FORWARD ].state[ area->GetID() ].how } );
+		}
+
+		std::reverse( route.begin(), route.end() );
+
+		for ( CNavArea *area = m_meet; area != goalArea; )
+		{
+			const state_t &state = m_sides[ BACKWARD ].state[ area->GetID() ];
+			area = state.link;
+			route.push_back( NavAreaChainLink{ area, area->GetID(), (NavTraverseType)state.how } );
+		}
+
+		// same as a full search, keep the end closest to the goal
+		if ( (int)route.size() > maxCount )
+			route.erase( route.begin(), route.end() - maxCount );
+
+		chain = std::move( route );
+		return true;
+	}
+
+private:
+	enum { FORWARD, BACKWARD, NUM_SIDES };
+
+	// link is the parent on the forward side and the next area toward the goal on the backward side
+	struct state_t
+	{
+		unsigned int marker;
+		float costSoFar;
+		float key;
+		CNavArea *link;
+		unsigned char how;
+	};
+
+	using heapentry_t = std::pair< float, CNavArea * >;
+
+	struct side_t
+	{
+		std::vector< state_t > state;
+		std::vector< heapentry_t > heap;
+	};
+
+	// half the difference of the estimates to both ends, added on the forward side and taken off on the backward side
+	float Potential( int side, const CNavArea *area ) const
+	{
+		const Vector &center = area->GetCenter();
+		float toGoal = ( center - m_goalPos ).Length();
+		float fromStart = ( center - m_startPos ).Length();
+
+		if ( m_landmarks )
+		{
+			toGoal = MAX( toGoal, m_landmarkScale * m_landmarks->Estimate( area, m_goalLandmarks ) );
+			fromStart = MAX( fromStart, m_landmarkScale * m_landmarks->EstimateFrom( m_startLandmarks, area ) );
+		}
+
+		float potential = 0.5f * ( toGoal - fromStart );
+		return ( side == FORWARD ) ? potential : -potential;
+	}
+
+	const state_t *Find( int side, const CNavArea *area ) const
+	{
+		const state_t &state = m_sides[ side ].state[ area->GetID() ];
+		return ( state.marker == m_marker ) ? &state : NULL;
+	}
+
+	// lower the cost of area on side if costSoFar beats it, entries it leaves on the heap go stale
+	bool Open( int side, CNavArea *area, CNavArea *link, NavTraverseType how, float costSoFar )
+	{
+		state_t &state = m_sides[ side ].state[ area->GetID() ];
+		if ( state.marker == m_marker && state.costSoFar <= costSoFar )
+			return false;
+
+		state.marker = m_marker;
+		state.costSoFar = costSoFar;
+		state.key = costSoFar + Potential( side, area );
+		state.link = link;
+		state.how = (unsigned char)how;
+
+		std::vector< heapentry_t > &heap = m_sides[ side ].heap;
+		heap.emplace_back( state.key, area );
+		std::push_heap( heap.begin(), heap.end(), std::greater< heapentry_t >() );
+
+		// meeting the other side gives a complete route
+		const state_t *other = Find( 1 - side, area );
+		if ( other && costSoFar + other->costSoFar < m_best )
+		{
+			m_best = costSoFar + other->costSoFar;
+			m_meet = area;
+		}
+
+		return true;
+	}
+
+	// the lowest live entry of side, NULL if its open list ran out
+	const heapentry_t *Top( int side )
+	{
+		std::vector< heapentry_t > &heap = m_sides[ side ].heap;
+		while ( !heap.empty() && heap.front().first > m_sides[ side ].state[ heap.front().second->GetID() ].key )
+		{
+			std::pop_heap( heap.begin(), heap.end(), std::greater< heapentry_t >() );
+			heap.pop_back();
+		}
+
+		return heap.empty() ? NULL : &heap.front();
+	}
+
+	void Expand( int side, const NativePathCost &costFunc, int teamID )
+	{
+		std::vector< heapentry_t > &heap = m_sides[ side ].heap;
+		std::pop_heap( heap.begin(), heap.end(), std::greater< heapentry_t >() );
+		CNavArea *area = heap.back().second;
+		heap.pop_back();
+
+		const unsigned int id = area->GetID();
+		const float areaCostSoFar = m_sides[ side ].state[ id ].costSoFar;
+		const NavConnectionGraph::range_t edges = ( side == FORWARD ) ? g_NavConnectionGraph.Outgoing( id ) : g_NavConnectionGraph.Incoming( id );
+
+		for ( const NavConnectionGraph::edge_t &edge : edges )
+		{
+			CNavArea *newArea = edge.area;
+
+			// don't consider blocked areas
+			if ( newArea->IsBlocked( teamID ) )
+				continue;
+
+			float cost = ( side == FORWARD ) ? costFunc.EdgeCost( newArea, area, edge.ladder, edge.elevator, edge.length )
+				: costFunc.EdgeCost( area, newArea, edge.ladder, edge.elevator, edge.length );
+
+			// NaNs really mess this function up causing tough to track down hangs
+			if ( IS_NAN( cost ) )
+				cost = 1e30f;
+
+			if ( cost < 0.0f )
+				continue;
+
+			// same minimum step as NavSearchContext::BuildPath
+			Open( side, newArea, area, edge.how, areaCostSoFar + MAX( cost, 1e-4f ) );
+		}
+	}
+
+	side_t m_sides[ NUM_SIDES ];
+	unsigned int m_marker = 0;
+	Vector m_startPos;
+	Vector m_goalPos;
+	NavLandmarks::snapshot_t m_landmarks;
+	NavLandmarks::goal_t m_startLandmarks;
+	NavLandmarks::goal_t m_goalLandmarks;
+	float m_landmarkScale = 0.0f;
+	float m_best = FLT_MAX;
+	CNavArea *m_meet = NULL;
+};
+
+NavBidirectionalSearch g_NavBidirectionalSearch;
+
+enum PathSearchMode
+{
+	PATH_SEARCH_FULL,			// A* over every area
+	PATH_SEARCH_HIERARCHICAL,	// A* over NavHierarchy then refined, falls back to a full search
+	PATH_SEARCH_FLOW_FIELD,		// follows the NavFlowFields goal map shared by everyone going to the goal area, falls back to a full search
+	PATH_SEARCH_BIDIRECTIONAL,	// NavBidirectionalSearch from both ends, falls back to a full search
+};
+
+enum PathComputeFlags
+{
+	PATH_COMPUTE_FUNNEL = (1 << 0),	// string-pull the floor segments through their portals, see Path::Funnel
+};
+
+/**
+ * SearchSurroundingAreas functor that runs on a NavSearchContext
+ * mirrors ISearchSurroundingAreasFunctor
+ */
+class INavSearchSurroundingAreasFunctor
+{
+public:
+	virtual ~INavSearchSurroundingAreasFunctor() { }
+
+	/**
+	 * Perform user-defined action on area.
+	 * Return 'false' to end the search (ie: you found what you were looking for)
+	 */
+	virtual bool operator() ( NavSearchContext &ctx, CNavArea *area, CNavArea *priorArea, float travelDistanceSoFar ) = 0;
+
+	// return true if 'adjArea' should be included in the ongoing search
+	virtual bool ShouldSearch( NavSearchContext &ctx, CNavArea *adjArea, CNavArea *currentArea, float travelDistanceSoFar )
+	{
+		return !adjArea->IsBlocked( TEAM_ANY );
+	}
+
+	/**
+	 * Collect adjacent areas to continue the search by calling ctx.IncludeInSearch on them
+	 */
+	virtual void IterateAdjacentAreas( NavSearchContext &ctx, CNavArea *area, CNavArea *priorArea, float travelDistanceSoFar )
+	{
+		// search adjacent outgoing connections
+		for( int dir=0; dir<NUM_DIRECTIONS; ++dir )
+		{
+			int count = area->GetAdjacentCount( (NavDirType)dir );
+			for( int i=0; i<count; ++i )
+			{
+				CNavArea *adjArea = area->GetAdjacentArea( (NavDirType)dir, i );
+
+				if ( ShouldSearch( ctx, adjArea, area, travelDistanceSoFar ) )
+				{
+					ctx.IncludeInSearch( adjArea, area );
+				}
+			}
+		}
+	}
+
+	// Invoked after the search has completed
+	virtual void PostSearch( NavSearchContext &ctx ) { }
+};
+
+void NavSearchSurroundingAreas( NavSearchContext &ctx, CNavArea *startArea, INavSearchSurroundingAreasFunctor &func, float travelDistanceLimit = -1.0f )
+{
+	if ( !startArea )
+		return;
+
+	ctx.Reset();
+
+	ctx.Mark( startArea );
+	ctx.SetTotalCost( startArea, 0.0f );
+	ctx.SetCostSoFar( startArea, 0.0f );
+	ctx.SetParent( startArea, NULL );
+	ctx.AddToOpenList( startArea );
+
+	while( !ctx.IsOpenListEmpty() )
+	{
+		// get next area to check
+		CNavArea *area = ctx.PopOpenList();
+
+		float costSoFar = ctx.GetCostSoFar( area );
+
+		if ( travelDistanceLimit > 0.0f && costSoFar > travelDistanceLimit )
+			continue;
+
+		CNavArea *parent = ctx.GetParent( area );
+
+		if ( func( ctx, area, parent, costSoFar ) )
+		{
+			func.IterateAdjacentAreas( ctx, area, parent, costSoFar );
+		}
+		else
+		{
+			// search aborted
+			break;
+		}
+	}
+
+	func.PostSearch( ctx );
+}
+
+// CollectSurroundingAreas on a NavSearchContext
+void NavCollectSurroundingAreas( NavSearchContext &ctx, CUtlVector< CNavArea * > *nearbyAreaVector, CNavArea *startArea, float travelDistanceLimit = 1500.0f, float maxStepUpLimit = StepHeight, float maxDropDownLimit = 100.0f )
+{
+	nearbyAreaVector->RemoveAll();
+
+	if ( !startArea )
+		return;
+
+	ctx.Reset();
+
+	const NavConnectionGraph::snapshot_t graph = g_NavConnectionGraph.Snapshot();
+
+	ctx.Mark( startArea );
+	ctx.SetTotalCost( startArea, 0.0f );
+	ctx.SetCostSoFar( startArea, 0.0f );
+	ctx.SetParent( startArea, NULL );
+	ctx.AddToOpenList( startArea );
+
+	while( !ctx.IsOpenListEmpty() )
+	{
+		// get next area to check
+		CNavArea *area = ctx.PopOpenList();
+
+		float costSoFar = ctx.GetCostSoFar( area );
+
+		if ( travelDistanceLimit > 0.0f && costSoFar > travelDistanceLimit )
+			continue;
+
+		CNavArea *parent = ctx.GetParent( area );
+		if ( parent )
+		{
+			float deltaZ = graph ? graph->GetHeightChange( parent, area ) : parent->ComputeAdjacentConnectionHeightChange( area );
+
+			if ( deltaZ > maxStepUpLimit )
+				continue;
+
+			if ( deltaZ < -maxDropDownLimit )
+				continue;
+		}
+
+		nearbyAreaVector->AddToTail( area );
+
+		// mark here to ensure all marked areas are also valid areas that are in the collection
+		ctx.Mark( area );
+
+		// floor connections come first in the snapshot's rows, in the same order
+		if ( graph && graph->Contains( area ) )
+		{
+			const Vector &center = graph->GetCenter( area->GetID() );
+			for ( const NavConnectionGraph::edge_t &edge : graph->Outgoing( area->GetID() ) )
+			{
+				if ( edge.how >= NUM_DIRECTIONS )
+					break;
+
+				CNavArea *adjArea = edge.area;
+				if ( adjArea->IsBlocked( TEAM_ANY ) || ctx.IsMarked( adjArea ) )
+					continue;
+
+				ctx.SetTotalCost( adjArea, 0.0f );
+				ctx.SetParent( adjArea, area );
+				ctx.SetCostSoFar( adjArea, costSoFar + ( graph->GetCenter( adjArea->GetID() ) - center ).Length() );
+				ctx.AddToOpenList( adjArea );
+			}
+			continue;
+		}
+
+		// search adjacent outgoing connections
+		for( int dir=0; dir<NUM_DIRECTIONS; ++dir )
+		{
+			int count = area->GetAdjacentCount( (NavDirType)dir );
+			for( int i=0; i<count; ++i )
+			{
+				CNavArea *adjArea = area->GetAdjacentArea( (NavDirType)dir, i );
+
+				if ( adjArea->IsBlocked( TEAM_ANY ) )
+				{
+					continue;
+				}
+
+				if ( !ctx.IsMarked( adjArea ) )
+				{
+					ctx.SetTotalCost( adjArea, 0.0f );
+					ctx.SetParent( adjArea, area );
+
+					// compute approximate travel distance from start area of search
+					float distAlong = costSoFar;
+					distAlong += ( adjArea->GetCenter() - area->GetCenter() ).Length();
+					ctx.SetCostSoFar( adjArea, distAlong );
+					ctx.AddToOpenList( adjArea );
+				}
+			}
+		}
+	}
+}
+
+// CTFNavArea attributes on tf2, TerrorNavArea spawn attributes on l4d2
+int NavGetGameAttributes( const CNavArea *area )
+{
+#if SOURCE_ENGINE == SE_TF2
+	return (int)static_cast< const CTFNavArea * >( area )->m_attributeFlags;
+#elif SOURCE_ENGINE == SE_LEFT4DEAD2
+	return (int)static_cast< const TerrorNavArea * >( area )->GetSpawnAttributes();
+#else
+	return 0;
+#endif
+}
+
+// how NavFilterSurroundingAreas treats areas blocked for its team
+enum NavSurroundingBlockedType
+{
+	SURROUNDING_BLOCKED_SKIP,		// don't enter or keep them, like CollectSurroundingAreas
+	SURROUNDING_BLOCKED_PASS,		// search through them but leave them out
+	SURROUNDING_BLOCKED_INCLUDE,	// treat them like any other area
+};
+
+// what NavFilterSurroundingAreas follows and keeps
+struct NavSurroundingFilter
+{
+	float travelDistanceLimit = 1500.0f;
+	float maxStepUpLimit = StepHeight;
+	float maxDropDownLimit = 100.0f;
+
+	// areas kept have every required bit and none of the forbidden ones
+	int requiredAttributes = 0;
+	int forbiddenAttributes = 0;
+
+	// CTFNavArea attributes on tf2, TerrorNavArea spawn attributes on l4d2
+	int requiredGameAttributes = 0;
+	int forbiddenGameAttributes = 0;
+
+	int teamID = TEAM_ANY;
+	NavSurroundingBlockedType blocked = SURROUNDING_BLOCKED_SKIP;
+
+	// 0 keeps everything within travelDistanceLimit
+	int maxCount = 0;
+
+	bool Keep( const CNavArea *area ) const
+	{
+		int attributes = area->GetAttributes();
+		if ( ( attributes & requiredAttributes ) != requiredAttributes || ( attributes & forbiddenAttributes ) )
+			return false;
+
+		int gameAttributes = NavGetGameAttributes( area );
+		if ( ( gameAttributes & requiredGameAttributes ) != requiredGameAttributes || ( gameAttributes & forbiddenGameAttributes ) )
+			return false;
+
+		return blocked == SURROUNDING_BLOCKED_INCLUDE || !area->IsBlocked( teamID );
+	}
+};
+
+/**
+ * CollectSurroundingAreas with the filtering done here instead of in plugin callbacks.
+ * Areas are settled by shortest travel distance between centers, so they come out nearest first, the distance
+ * limit is exact and maxCount keeps the closest matches. The step limits apply to each connection followed.
+ */
+void NavFilterSurroundingAreas( NavSearchContext &ctx, CUtlVector< CNavArea * > *nearbyAreaVector, CNavArea *startArea, const NavSurroundingFilter &filter )
+{
+	nearbyAreaVector->RemoveAll();
+
+	if ( !startArea )
+		return;
+
+	ctx.Reset();
+
+	const NavConnectionGraph::snapshot_t graph = g_NavConnectionGraph.Snapshot();
+
+	ctx.SetTotalCost( startArea, 0.0f );
+	ctx.SetCostSoFar( startArea, 0.0f );
+	ctx.SetParent( startArea, NULL );
+	ctx.AddToOpenList( startArea );
+
+	while( !ctx.IsOpenListEmpty() )
+	{
+		CNavArea *area = ctx.PopOpenList();
+
+		// settled
+		ctx.Mark( area );
+
+		if ( filter.Keep( area ) )
+		{
+			nearbyAreaVector->AddToTail( area );
+
+			if ( filter.maxCount > 0 && nearbyAreaVector->Count() >= filter.maxCount )
+				break;
+		}
+
+		float costSoFar = ctx.GetCostSoFar( area );
+
+		auto relax = [&]( CNavArea *adjArea, float length, float deltaZ ) {
+			if ( ctx.IsMarked( adjArea ) )
+				return;
+
+			if ( filter.blocked == SURROUNDING_BLOCKED_SKIP && adjArea->IsBlocked( filter.teamID ) )
+				return;
+
+			if ( deltaZ > filter.maxStepUpLimit || deltaZ < -filter.maxDropDownLimit )
+				return;
+
+			float distAlong = costSoFar + length;
+			if ( filter.travelDistanceLimit > 0.0f && distAlong > filter.travelDistanceLimit )
+				return;
+
+			if ( ctx.IsOpen( adjArea ) )
+			{
+				if ( distAlong >= ctx.GetCostSoFar( adjArea ) )
+					return;
+
+				ctx.SetParent( adjArea, area );
+				ctx.SetCostSoFar( adjArea, distAlong );
+				ctx.SetTotalCost( adjArea, distAlong );
+				ctx.UpdateOnOpenList( adjArea );
+				return;
+			}
+
+			ctx.SetParent( adjArea, area );
+			ctx.SetCostSoFar( adjArea, distAlong );
+			ctx.SetTotalCost( adjArea, distAlong );
+			ctx.AddToOpenList( adjArea );
+		};
+
+		// floor connections come first in the snapshot's rows
+		if ( graph && graph->Contains( area ) )
+		{
+			const Vector &center = graph->GetCenter( area->GetID() );
+			for ( const NavConnectionGraph::edge_t &edge : graph->Outgoing( area->GetID() ) )
+			{
+				if ( edge.how >= NUM_DIRECTIONS )
+					break;
+
+				relax( edge.area, ( graph->GetCenter( edge.area->GetID() ) - center ).Length(), edge.heightChange );
+			}
+			continue;
+		}
+
+		for( int dir=0; dir<NUM_DIRECTIONS; ++dir )
+		{
+			int count = area->GetAdjacentCount( (NavDirType)dir );
+			for( int i=0; i<count; ++i )
+			{
+				CNavArea *adjArea = area->GetAdjacentArea( (NavDirType)dir, i );
+				relax( adjArea, ( adjArea->GetCenter() - area->GetCenter() ).Length(), area->ComputeAdjacentConnectionHeightChange( adjArea ) );
+			}
+		}
+	}
+}
+
+ConVar nav_random_point_max_age("nav_random_point_max_age", "5.0", FCVAR_NONE, "seconds a random point table is used before it is rebuilt to pick up areas whose attributes changed");
+
+// which areas NavAreaSampler draws from, also what its tables are kept under
+struct NavAreaSampleFilter
+{
+	// areas kept have every required bit and none of the forbidden ones
+	int requiredAttributes = 0;
+	int forbiddenAttributes = 0;
+	int requiredGameAttributes = 0;
+	int forbiddenGameAttributes = 0;
+
+	int place = ANY_PLACE;
+
+	// radius 0 takes the whole mesh
+	Vector center = vec3_origin;
+	float radius = 0.0f;
+
+	bool operator==( const NavAreaSampleFilter &other ) const
+	{
+		return requiredAttributes == other.requiredAttributes && forbiddenAttributes == other.forbiddenAttributes &&
+			requiredGameAttributes == other.requiredGameAttributes && forbiddenGameAttributes == other.forbiddenGameAttributes &&
+			place == other.place && radius == other.radius && ( radius <= 0.0f || center == other.center );
+	}
+
+	bool Matches( const CNavArea *area ) const
+	{
+		int attributes = area->GetAttributes();
+		if ( ( attributes & requiredAttributes ) != requiredAttributes || ( attributes & forbiddenAttributes ) )
+			return false;
+
+		int gameAttributes = NavGetGameAttributes( area );
+		if ( ( gameAttributes & requiredGameAttributes ) != requiredGameAttributes || ( gameAttributes & forbiddenGameAttributes ) )
+			return false;
+
+		if ( place != ANY_PLACE && area->GetPlace() != (unsigned int)place )
+			return false;
+
+		if ( radius > 0.0f )
+		{
+			Extent extent;
+			area->GetExtent( &extent );
+
+			Vector close;
+			close.x = clamp( center.x, extent.lo.x, extent.hi.x );
+			close.y = clamp( center.y, extent.lo.y, extent.hi.y );
+			close.z = clamp( center.z, extent.lo.z, extent.hi.z );
+			if ( ( close - center ).LengthSqr() > radius * radius )
+				return false;
+		}
+
+		return true;
+	}
+};
+
+/**
+ * Random points spread evenly over the floor of the nav mesh rather than over its areas.
+ * Each filter gets an alias table of the areas it keeps weighted by their size, so picking an area is one random
+ * index and one coin flip whatever the mesh looks like. The table for every area and on tf2 the one for
+ * IsValidForWanderingPopulation are built at map start, others on first use and kept for nav_random_point_max_age.
+ *
+ * A center and radius snap the center to a grid cell about half the radius wide, the cell's table holds the areas
+ * within radius of anywhere in the cell and is shared by every query around a moving position that stays in it.
+ *
+ * The picked area is checked again against the filter and the team's blocked state and the point against the
+ * radius, a miss draws again. Rejecting that way keeps points uniform over what is left and never hands out an area
+ * whose attributes changed since the table was built. A disc too small for the cell or a filter most areas fail
+ * now falls back to a scan of the table. Game thread only.
+ */
+class NavAreaSampler
+{
+public:
+	enum { MAX_TABLES = 64, MAX_ATTEMPTS = 32 };
+
+	static constexpr float MIN_CELL_SIZE = 64.0f;
+
+	void Clear( void )
+	{
+		m_tables.clear();
+	}
+
+	void EnsureBuilt( void )
+	{
+		NavAreaSampleFilter all;
+		GetTable( all );
+
+	#if SOURCE_ENGINE == SE_TF2
+		NavAreaSampleFilter wandering;
+		wandering.forbiddenGameAttributes = TF_NAV_BLOCKED | TF_NAV_SPAWN_ROOM_RED | TF_NAV_SPAWN_ROOM_BLUE | TF_NAV_NO_SPAWNING | TF_NAV_RESCUE_CLOSET;
+		GetTable( wandering );
+	#endif
+	}
+
+	// NULL if no area passing filter and not blocked for teamID could be found
+	CNavArea *GetRandomPoint( const NavAreaSampleFilter &filter, int teamID, Vector *pos )
+	{
+		if ( !TheNavMesh->IsLoaded() )
+			return NULL;
+
+		NavAreaSampleFilter key = GetTableFilter( filter );
+
+		const table_t *table = &GetTable( key );
+		if ( table->areas.empty() )
+			return NULL;
+
+		CNavArea *area = Draw( *table, filter, teamID, pos );
+		if ( area )
+			return area;
+
+		// the table may have gone stale, try once more on a fresh one
+		if ( table->built != gpGlobals->curtime )
+		{
+			m_tables.erase( key );
+			table = &GetTable( key );
+
+			area = Draw( *table, filter, teamID, pos );
+			if ( area )
+				return area;
+		}
+
+		return Scan( *table, filter, teamID, pos );
+	}
+
+private:
+	struct table_t
+	{
+		std::vector< CNavArea * > areas;
+		std::vector< float > probability;	// of keeping the picked index instead of its alias
+		std::vector< int > alias;
+		float built;
+		unsigned int generation;
+	};
+
+	struct hash_t
+	{
+		size_t operator()( const NavAreaSampleFilter &filter ) const
+		{
+			int ints[] = { filter.requiredAttributes, filter.forbiddenAttributes, filter.requiredGameAttributes, filter.forbiddenGameAttributes, filter.place };
+			uint64_t hash = NavDerivedCache::Hash( ints, sizeof( ints ) );
+			if ( filter.radius > 0.0f )
+			{
+				float floats[] = { filter.center.x, filter.center.y, filter.center.z, filter.radius };
+				hash = NavDerivedCache::Hash( floats, sizeof( floats ), hash );
+			}
+
+			return (size_t)hash;
+		}
+	};
+
+	// what the table for filter is kept under, the center snapped to its cell and the radius grown to cover the cell
+	static NavAreaSampleFilter GetTableFilter( const NavAreaSampleFilter &filter )
+	{
+		NavAreaSampleFilter key = filter;
+		if ( key.radius <= 0.0f )
+		{
+			key.center = vec3_origin;
+			key.radius = 0.0f;
+			return key;
+		}
+
+		float cell = MAX( filter.radius * 0.5f, MIN_CELL_SIZE );
+		key.center.x = ( floorf( filter.center.x / cell ) + 0.5f ) * cell;
+		key.center.y = ( floorf( filter.center.y / cell ) + 0.5f ) * cell;
+		key.center.z = ( floorf( filter.center.z / cell ) + 0.5f ) * cell;
+		key.radius = filter.radius + cell * 0.8661f;	// half the cell's diagonal
+		return key;
+	}
+
+	const table_t &GetTable( const NavAreaSampleFilter &key )
+	{
+		auto it = m_tables.find( key );
+		if ( it != m_tables.end() && it->second.generation == g_NavMeshGeneration && gpGlobals->curtime - it->second.built < nav_random_point_max_age.GetFloat() )
+			return it->second;
+
+		// make room by dropping the oldest table
+		if ( it == m_tables.end() && m_tables.size() >= MAX_TABLES )
+		{
+			auto oldest = m_tables.begin();
+			for ( auto other = m_tables.begin(); other != m_tables.end(); ++other )
+			{
+				if ( other->second.built < oldest->second.built )
+					oldest = other;
+			}
+
+			m_tables.erase( oldest );
+		}
+
+		table_t &table = m_tables[ key ];
+		Build( key, table );
+		return table;
+	}
+
+	static CNavArea *Draw( const table_t &table, const NavAreaSampleFilter &filter, int teamID, Vector *pos )
+	{
+		for ( int attempt = 0; attempt < MAX_ATTEMPTS; ++attempt )
+		{
+			int index = RandomInt( 0, (int)table.areas.size() - 1 );
+			if ( RandomFloat( 0.0f, 1.0f ) >= table.probability[ index ] )
+				index = table.alias[ index ];
+
+			CNavArea *area = table.areas[ index ];
+			if ( !filter.Matches( area ) || area->IsBlocked( teamID ) )
+				continue;
+
+			Vector spot = area->GetRandomPoint();
+			if ( filter.radius > 0.0f && ( spot - filter.center ).LengthSqr() > filter.radius * filter.radius )
+				continue;
+
+			*pos = spot;
+			return area;
+		}
+
+		return NULL;
+	}
+
+	// every usable area of table weighted by its size, a point that keeps landing outside the disc is pulled into it
+	static CNavArea *Scan( const table_t &table, const NavAreaSampleFilter &filter, int teamID, Vector *pos )
+	{
+		std::vector< CNavArea * > usable;
+		std::vector< float > total;
+		float sum = 0.0f;
+		for ( CNavArea *area : table.areas )
+		{
+			if ( !filter.Matches( area ) || area->IsBlocked( teamID ) )
+				continue;
+
+			sum += area->GetSizeX() * area->GetSizeY();
+			usable.push_back( area );
+			total.push_back( sum );
+		}
+
+		if ( usable.empty() )
+			return NULL;
+
+		size_t index = std::upper_bound( total.begin(), total.end(), RandomFloat( 0.0f, sum ) ) - total.begin();
+		CNavArea *area = usable[ MIN( index, usable.size() - 1 ) ];
+
+		for ( int attempt = 0; attempt < MAX_ATTEMPTS; ++attempt )
+		{
+			Vector spot = area->GetRandomPoint();
+			if ( filter.radius <= 0.0f || ( spot - filter.center ).LengthSqr() <= filter.radius * filter.radius )
+			{
+				*pos = spot;
+				return area;
+			}
+		}
+
+		area->GetClosestPointOnArea( filter.center, pos );
+		return area;
+	}
+
+	// Vose's alias method over the size of every area filter keeps
+	static void Build( const NavAreaSampleFilter &filter, table_t &table )
+	{
+		table.areas.clear();
+		table.built = gpGlobals->curtime;
+		table.generation = g_NavMeshGeneration;
+
+		std::vector< float > weight;
+		double total = 0.0;
+		auto add = [&]( CNavArea *area ) -> bool {
+			float size = area->GetSizeX() * area->GetSizeY();
+			if ( size > 0.0f && filter.Matches( area ) )
+			{
+				table.areas.push_back( area );
+				weight.push_back( size );
+				total += size;
+			}
+
+			return true;
+		};
+
+		if ( filter.radius > 0.0f )
+		{
+			Extent extent;
+			extent.lo = filter.center - Vector( filter.radius, filter.radius, filter.radius );
+			extent.hi = filter.center + Vector( filter.radius, filter.radius, filter.radius );
+			TheNavMesh->ForAllAreasOverlappingExtent( add, extent );
+		}
+		else
+		{
+			for ( int i = 0; i < TheNavAreas->Count(); ++i )
+			{
+				add( (*TheNavAreas)[ i ] );
+			}
+		}
+
+		int count = (int)table.areas.size();
+		table.probability.resize( count );
+		table.alias.resize( count );
+
+		std::vector< int > small;
+		std::vector< int > large;
+		for ( int i = 0; i < count; ++i )
+		{
+			weight[ i ] = (float)( weight[ i ] * count / total );
+			( weight[ i ] < 1.0f ? small : large ).push_back( i );
+		}
+
+		while ( !small.empty() && !large.empty() )
+		{
+			int less = small.back();
+			small.pop_back();
+			int more = large.back();
+
+			table.probability[ less ] = weight[ less ];
+			table.alias[ less ] = more;
+
+			weight[ more ] = ( weight[ more ] + weight[ less ] ) - 1.0f;
+			if ( weight[ more ] < 1.0f )
+			{
+				large.pop_back();
+				small.push_back( more );
+			}
+		}
+
+		// what's left is 1 up to rounding
+		for ( int i : small )
+		{
+			table.probability[ i ] = 1.0f;
+			table.alias[ i ] = i;
+		}
+
+		for ( int i : large )
+		{
+			table.probability[ i ] = 1.0f;
+			table.alias[ i ] = i;
+		}
+	}
+
+	std::unordered_map< NavAreaSampleFilter, table_t, hash_t > m_tables;
+};
+
+NavAreaSampler g_NavAreaSampler;
+
+enum SegmentType
+{
+	ON_GROUND,
+	DROP_DOWN,
+	CLIMB_UP,
+	JUMP_OVER_GAP,
+	PATH_LADDER_UP,
+	PATH_LADDER_DOWN,
+	
+	NUM_SEGMENT_TYPES
+};
+
+struct Segment
+{
+	CNavArea *area;									// the area along the path
+	NavTraverseType how;							// how to enter this area from the previous one
+	Vector pos;										// our movement goal position at this point in the path
+	const CNavLadder *ladder;						// if "how" refers to a ladder, this is it
+	
+	SegmentType type;								// how to traverse this segment of the path
+	Vector forward;									// unit vector along segment
+	float length;									// length of this segment
+	float distanceFromStart;						// distance of this node from the start of the path
+	float curvature;								// how much the path 'curves' at this point in the XY plane (0 = none, 1 = 180 degree doubleback)
+
+	Vector m_portalCenter;							// position of center of 'portal' between previous area and this area
+	float m_portalHalfWidth;						// half width of 'portal'
+};
+
+ConVar path_compute_debug("path_compute_debug", "0");
+#if SOURCE_ENGINE == SE_LEFT4DEAD2
+ConVar path_compute_manual("path_compute_manual", "0");
+#endif
+
+class Path
+{
+public:
+	virtual ~Path() = 0;
+	
+	static Path *create()
+	{
+		Path *bytes = (Path *)calloc(1, sizeof(Path));
+		call_mfunc<void>(bytes, PathCTOR);
+		return bytes;
+	}
+	
+	using SegmentType = ::SegmentType;
+
+	// @todo Allow custom Segment classes for different kinds of paths	
+	using Segment = ::Segment;
+
+	virtual float GetLength( void ) const = 0;						// return length of path from start to finish
+	virtual const Vector &GetPosition( float distanceFromStart, const Segment *start = NULL ) const = 0;	// return a position on the path at the given distance from the path start
+	virtual const Vector &GetClosestPosition( const Vector &pos, const Segment *start = NULL, float alongLimit = 0.0f ) const = 0;		// return the closest point on the path to the given position
+
+	virtual const Vector &GetStartPosition( void ) const = 0;	// return the position where this path starts
+	virtual const Vector &GetEndPosition( void ) const = 0;		// return the position where this path ends
+	virtual CBaseCombatCharacter *GetSubject( void ) const = 0;	// return the actor this path leads to, or NULL if there is no subject
+
+#if SOURCE_ENGINE == SE_LEFT4DEAD2
+	virtual void SetSubject( CBaseEntity * ) = 0;
+#endif
+	
+	virtual const Path::Segment *GetCurrentGoal( void ) const = 0;	// return current goal along the path we are trying to reach
+
+	virtual float GetAge( void ) const = 0;					// return "age" of this path (time since it was built)
+
+	enum SeekType
+	{
+		SEEK_ENTIRE_PATH,			// search the entire path length
+		SEEK_AHEAD,					// search from current cursor position forward toward end of path
+		SEEK_BEHIND					// search from current cursor position backward toward path start
+	};
+	virtual void MoveCursorToClosestPosition( const Vector &pos, SeekType type = SEEK_ENTIRE_PATH, float alongLimit = 0.0f ) const = 0;		// Set cursor position to closest point on path to given position
+	
+	enum MoveCursorType
+	{
+		PATH_ABSOLUTE_DISTANCE,
+		PATH_RELATIVE_DISTANCE
+	};
+	virtual void MoveCursorToStart( void ) = 0;				// set seek cursor to start of path
+	virtual void MoveCursorToEnd( void ) = 0;				// set seek cursor to end of path
+	virtual void MoveCursor( float value, MoveCursorType type = PATH_ABSOLUTE_DISTANCE ) = 0;	// change seek cursor position
+	virtual float GetCursorPosition( void ) const = 0;		// return position of seek cursor (distance along path)
+
+	struct Data
+	{
+		Vector pos;										// the position along the path
+		Vector forward;									// unit vector along path direction
+		float curvature;								// how much the path 'curves' at this point in the XY plane (0 = none, 1 = 180 degree doubleback)
+		const Segment *segmentPrior;					// the segment just before this position
+	};
+	virtual const Data &GetCursorData( void ) const = 0;	// return path state at the current cursor position
+
+	virtual bool IsValid( void ) const = 0;
+	virtual void Invalidate( void ) = 0;					// make path invalid (clear it)
+
+	virtual void Draw( const Path::Segment *start = NULL ) const = 0;	// draw the path for debugging
+	virtual void DrawInterpolated( float from, float to ) = 0;	// draw the path for debugging - MODIFIES cursor position
+
+	virtual const Segment *FirstSegment( void ) const = 0;	// return first segment of path
+	virtual const Segment *NextSegment( const Segment *currentSegment ) const = 0;	// return next segment of path, given current one
+	virtual const Segment *PriorSegment( const Segment *currentSegment ) const = 0;	// return previous segment of path, given current one
+	virtual const Segment *LastSegment( void ) const = 0;	// return last segment of path
+
+	enum ResultType
+	{
+		COMPLETE_PATH,
+		PARTIAL_PATH,
+		NO_PATH
+	};
+	virtual void OnPathChanged( INextBot *bot, ResultType result ) = 0;		// invoked when the path is (re)computed (path is valid at the time of this call)
+
+	virtual void Copy( INextBot *bot, const Path &path ) = 0;	// Replace this path with the given path's data
+	
+	virtual bool ComputeWithOpenGoal( INextBot *bot, const IPathCost &costFunc, const IPathOpenGoalSelector &goalSelector, float maxSearchRadius = 0.0f ) = 0;
+	
+	virtual void ComputeAreaCrossing( INextBot *bot, const CNavArea *from, const Vector &fromPos, const CNavArea *to, NavDirType dir, Vector *crossPos ) = 0;
+	
+	enum { MAX_PATH_SEGMENTS = 256 };
+	
+	Segment m_path[ MAX_PATH_SEGMENTS ];
+	int m_segmentCount;
+	
+	mutable Vector m_pathPos;								// used by GetPosition()
+	mutable Vector m_closePos;								// used by GetClosestPosition()
+
+	mutable float m_cursorPos;					// current cursor position (distance along path)
+	mutable Data m_cursorData;					// used by GetCursorData()
+	mutable bool m_isCursorDataDirty;
+
+	IntervalTimer m_ageTimer;					// how old is this path?
+	
+	CHandle< CBaseCombatCharacter > m_subject;	// the subject this path leads to
+	
+	enum { MAX_ADJ_AREAS = 64 };
+
+	struct AdjInfo
+	{
+		CNavArea *area;
+		CNavLadder *ladder;
+		NavTraverseType how;		
+	};
+
+	AdjInfo m_adjAreaVector[ MAX_ADJ_AREAS ];
+	int m_adjAreaIndex;
+	
+	template <typename CostFunctor>
+	bool Compute(INextBot *bot, CBaseCombatCharacter *subject, CostFunctor &costFunc, float maxPathLength, bool includeGoalIfPathFails = true, PathSearchMode mode = PATH_SEARCH_FULL, NavIncrementalSearch *incremental = NULL, int computeFlags = 0)
+	{
+#if SOURCE_ENGINE == SE_LEFT4DEAD2
+		if(path_compute_manual.GetBool() || path_compute_debug.GetBool()) {
+#endif
+		Invalidate();
+		
+		m_subject = subject;
+		
+		CNavArea *startArea = bot->GetEntity()->GetLastKnownArea();
+		if ( !startArea )
+		{
+			OnPathChanged( bot, NO_PATH );
+			if(path_compute_debug.GetBool()) {
+				DevMsg("%f: Path->Compute #%i failed: bot has no last known area\n", gpGlobals->curtime, subject->entindex());
+			}
+			return false;
+		}
+
+		CNavArea *subjectArea = subject->GetLastKnownArea();
+		if ( !subjectArea )
+		{
+			OnPathChanged( bot, NO_PATH );
+			if(path_compute_debug.GetBool()) {
+				DevMsg("%f: Path->Compute #%i failed: subject has no last known area\n", gpGlobals->curtime, subject->entindex());
+			}
+			return false;
+		}
+
+		Vector subjectPos = subject->GetAbsOrigin();
+		
+		// if we are already in the subject area, build trivial path
+		if ( startArea == subjectArea )
+		{
+			BuildTrivialPath( bot, subjectPos );
+			return true;
+		}
+
+		//
+		// Compute shortest path to subject
+		//
+		std::vector< NavAreaChainLink > chain;
+		bool pathResult = SearchAreaChain( bot, startArea, subjectArea, subjectPos, costFunc, maxPathLength, mode, incremental, chain );
+		if(path_compute_debug.GetBool()) {
+			DevMsg("%f: Path->Compute #%i built: %i\n", gpGlobals->curtime, subject->entindex(), pathResult);
+		}
+		
+		// Failed?
+		if ( chain.empty() ) {
+			if(path_compute_debug.GetBool()) {
+				DevMsg("%f: Path->Compute #%i failed: no closest area\n", gpGlobals->curtime, subject->entindex());
+			}
+			return false;
+		}
+
+		//
+		// Build actual path from the area chain
+		//
+		return AssembleAreaChain( bot, chain, subjectPos, pathResult, includeGoalIfPathFails, computeFlags );
+#if SOURCE_ENGINE == SE_LEFT4DEAD2
+		} else {
+			return call_mfunc<bool, Path, INextBot *, CBaseCombatCharacter *, CostFunctor &, float>(this, PathComputeEntity, bot, subject, costFunc, maxPathLength);
+		}
+#endif
+	}
+	
+	template <typename CostFunctor>
+	bool Compute(INextBot *bot, const Vector &goal, CostFunctor &costFunc, float maxPathLength, bool includeGoalIfPathFails = true, PathSearchMode mode = PATH_SEARCH_FULL, NavIncrementalSearch *incremental = NULL, int computeFlags = 0)
+	{
+#if SOURCE_ENGINE == SE_LEFT4DEAD2
+		if(path_compute_manual.GetBool() || path_compute_debug.GetBool()) {
+#endif
+		Invalidate();
+		
+		CNavArea *startArea = bot->GetEntity()->GetLastKnownArea();
+		if ( !startArea )
+		{
+			OnPathChanged( bot, NO_PATH );
+			if(path_compute_debug.GetBool()) {
+				DevMsg("%f: Path->Compute [%f, %f, %f] failed: bot has no last known area\n", gpGlobals->curtime, goal.x, goal.y, goal.z);
+			}
+			return false;
+		}
+
+		// check line-of-sight to the goal position when finding it's nav area
+		const float maxDistanceToArea = 200.0f;
+		CNavArea *goalArea = TheNavMesh->GetNearestNavArea( goal, true, maxDistanceToArea, true, false, bot->GetEntity()->GetTeamNumber() );
+
+		// if we are already in the goal area, build trivial path
+		if ( startArea == goalArea )
+		{
+			BuildTrivialPath( bot, goal );
+			return true;
+		}
+
+		// make sure path end position is on the ground
+		Vector pathEndPosition = goal;
+		if ( goalArea )
+		{
+			pathEndPosition.z = goalArea->GetZ( pathEndPosition );
+		}
+		else
+		{
+			TheNavMesh->GetGroundHeight( pathEndPosition, &pathEndPosition.z );
+		}
+
+		//
+		// Compute shortest path to goal
+		//
+		std::vector< NavAreaChainLink > chain;
+		bool pathResult = SearchAreaChain( bot, startArea, goalArea, goal, costFunc, maxPathLength, mode, incremental, chain );
+		if(path_compute_debug.GetBool()) {
+			DevMsg("%f: Path->Compute [%f, %f, %f] built: %i\n", gpGlobals->curtime, goal.x, goal.y, goal.z, pathResult);
+		}
+		
+		// Failed?
+		if ( chain.empty() ) {
+			if(path_compute_debug.GetBool()) {
+				DevMsg("%f: Path->Compute [%f, %f, %f] failed: no closest area\n", gpGlobals->curtime, goal.x, goal.y, goal.z);
+			}
+			return false;
+		}
+
+		//
+		// Build actual path from the area chain
+		//
+		return AssembleAreaChain( bot, chain, pathEndPosition, pathResult, includeGoalIfPathFails, computeFlags );
+#if SOURCE_ENGINE == SE_LEFT4DEAD2
+		} else {
+			return call_mfunc<bool, Path, INextBot *, const Vector &, CostFunctor &, float>(this, PathComputeVector, bot, goal, costFunc, maxPathLength);
+		}
+#endif
+	}
+	
+	/**
+	 * Search half of Compute, tries NavPathCache, then the caller's NavIncrementalSearch or NavHierarchy if asked for, then a full search.
+	 * goalArea can be NULL to search for goalPos. chain is left empty if nothing was reached.
+	 */
+	template <typename CostFunctor>
+	bool SearchAreaChain( INextBot *bot, CNavArea *startArea, CNavArea *goalArea, const Vector &goalPos, CostFunctor &costFunc, float maxPathLength, PathSearchMode mode, NavIncrementalSearch *incremental, std::vector< NavAreaChainLink > &chain )
+	{
+		const int teamID = bot->GetEntity()->GetTeamNumber();
+		bool pathResult = false;
+
+		NavPathCache::key_t cacheKey;
+		const bool cacheable = goalArea && g_NavPathCache.MakeKey( costFunc, startArea, goalArea, teamID, maxPathLength, cacheKey );
+		if ( cacheable && g_NavPathCache.Lookup( cacheKey, bot->GetLocomotionInterface(), chain, pathResult ) )
+			return pathResult;
+
+		NavSearchContext &ctx = g_NavSearchContext;
+		g_NavConnectionGraph.EnsureBuilt();
+		g_NavLandmarks.EnsureBuilt();
+
+		// a search for a goal that can't be reached floods everything reachable before it gives up, go for the closest area instead
+		if ( goalArea && path_reachability.GetBool() && !g_NavReachability.CanReach( startArea, goalArea, teamID ) )
+		{
+			CNavArea *closestArea = g_NavReachability.GetClosestReachable( startArea, goalPos, teamID );
+			if ( closestArea == startArea )
+			{
+				chain.assign( 1, NavAreaChainLink{ startArea, startArea->GetID(), NUM_TRAVERSE_TYPES } );
+			}
+			else
+			{
+				SearchAreaChain( bot, startArea, closestArea, closestArea->GetCenter(), costFunc, maxPathLength, mode, incremental, chain );
+			}
+
+			if ( cacheable )
+				g_NavPathCache.Store( cacheKey, chain, false );
+
+			return false;
+		}
+
+		// goal maps and trees only hold searches without a length limit, their costs go through EdgeCost
+		const NativePathCost *nativeCost = ( goalArea && maxPathLength <= 0.0f ) ? NavIncrementalSearch::AsNative( costFunc ) : NULL;
+		if ( nativeCost && mode == PATH_SEARCH_FLOW_FIELD && g_NavFlowFields.BuildPath( startArea, goalArea, *nativeCost, teamID, bot->GetLocomotionInterface(), MAX_PATH_SEGMENTS-1, chain ) )
+		{
+			pathResult = true;
+		}
+		else if ( nativeCost && mode == PATH_SEARCH_BIDIRECTIONAL && g_NavBidirectionalSearch.BuildPath( startArea, goalArea, *nativeCost, teamID, MAX_PATH_SEGMENTS-1, chain ) )
+		{
+			pathResult = true;
+		}
+		else if ( nativeCost && incremental && incremental->BuildPath( startArea, goalArea, goalPos, *nativeCost, teamID, bot->GetLocomotionInterface(), MAX_PATH_SEGMENTS-1, chain, pathResult ) )
+		{
+			if ( chain.empty() )
+				return false;
+		}
+		// the abstract graph doesn't know about path length limits
+		else if ( mode == PATH_SEARCH_HIERARCHICAL && goalArea && maxPathLength <= 0.0f && g_NavHierarchy.BuildPath( ctx, startArea, goalArea, costFunc, teamID, MAX_PATH_SEGMENTS-1, chain ) )
+		{
+			pathResult = true;
+		}
+		else
+		{
+			CNavArea *closestArea = NULL;
+			pathResult = ctx.BuildPath( startArea, goalArea, &goalPos, costFunc, &closestArea, maxPathLength, teamID, false );
+
+			chain.clear();
+			if ( closestArea == NULL )
+				return false;
+
+			ctx.CollectChain( startArea, closestArea, MAX_PATH_SEGMENTS-1, chain ); // save room for endpoint
+		}
+
+		if ( cacheable )
+			g_NavPathCache.Store( cacheKey, chain, pathResult );
+
+		return pathResult;
+	}
+
+	bool ComputePathDetails( INextBot *bot, const Vector &start )
+	{
+		return call_mfunc<bool, Path, INextBot *, const Vector &>(this, PathComputePathDetails, bot, start);
+	}
+	
+	bool BuildTrivialPath( INextBot *bot, const Vector &goal )
+	{
+		return call_mfunc<bool, Path, INextBot *, const Vector &>(this, PathBuildTrivialPath, bot, goal);
+	}
+	
+	int FindNextOccludedNode( INextBot *bot, int anchorIndex )
+	{
+		return call_mfunc<int, Path, INextBot *, int>(this, PathFindNextOccludedNode, bot, anchorIndex);
+	}
+	
+	void Optimize( INextBot *bot )
+	{
+		if(!path_expensive_optimize.GetBool())
+			return;
+		
+		if (m_segmentCount < 3)
+			return;
+
+		int anchor = 0;
+
+		while( anchor < m_segmentCount )
+		{
+			int occluded = FindNextOccludedNode( bot, anchor );
+			int nextAnchor = occluded-1;
+
+			if (nextAnchor > anchor)
+			{
+				// remove redundant nodes between anchor and nextAnchor
+				int removeCount = nextAnchor - anchor - 1;
+				if (removeCount > 0)
+				{
+					for( int i=nextAnchor; i<m_segmentCount; ++i )
+					{
+						m_path[i-removeCount] = m_path[i];
+					}
+					m_segmentCount -= removeCount;
+				}
+			}
+
+			++anchor;
+		}
+	}
+
+	void PostProcess()
+	{
+		call_mfunc<void>(this, PathPostProcess);
+	}
+
+	// true if segment index enters a new area across a floor portal, the segments Funnel can move
+	bool IsPortalSegment( int index ) const
+	{
+		const Segment &seg = m_path[ index ];
+		return index > 0 && seg.how <= GO_WEST && seg.type == ON_GROUND && seg.area != m_path[ index-1 ].area;
+	}
+
+	/**
+	 * String-pull runs of floor segments through their portals (simple stupid funnel algorithm),
+	 * so the path cuts corners instead of visiting the point ComputePathDetails picked on each portal.
+	 * Portals are narrowed by half the bot's hull so it doesn't scrape the corners.
+	 * Segments that aren't plain floor crossings (ladders, drop downs, jumps) end a run and keep their position.
+	 */
+	void Funnel( INextBot *bot )
+	{
+		IBody *body = bot->GetBodyInterface();
+		const float margin = body ? body->GetHullWidth() / 2.0f : 0.0f;
+
+		std::vector< Vector2D > lefts;
+		std::vector< Vector2D > rights;
+
+		int runStart = 0;
+		while ( runStart < m_segmentCount-1 )
+		{
+			if ( !IsPortalSegment( runStart+1 ) )
+			{
+				++runStart;
+				continue;
+			}
+
+			// runStart is the fixed point before the run, runEnd the fixed point after it
+			int runEnd = runStart+1;
+			while ( runEnd+1 < m_segmentCount && IsPortalSegment( runEnd+1 ) )
+			{
+				++runEnd;
+			}
+
+			// the goal position is a fine end point, anything else keeps the last crossing where it is
+			if ( runEnd+1 < m_segmentCount && m_path[ runEnd+1 ].how == NUM_TRAVERSE_TYPES && m_path[ runEnd+1 ].type == ON_GROUND )
+			{
+				++runEnd;
+			}
+
+			if ( runEnd - runStart >= 2 )
+			{
+				lefts.clear();
+				rights.clear();
+				lefts.push_back( m_path[ runStart ].pos.AsVector2D() );
+				rights.push_back( m_path[ runStart ].pos.AsVector2D() );
+
+				for ( int i = runStart+1; i < runEnd; ++i )
+				{
+					const Segment &seg = m_path[ i ];
+
+					// NORTH/SOUTH portals run along x, EAST/WEST along y
+					Vector2D axis = ( seg.how == GO_NORTH || seg.how == GO_SOUTH ) ? Vector2D( 1.0f, 0.0f ) : Vector2D( 0.0f, 1.0f );
+					Vector2D travel = ( seg.how == GO_NORTH ) ? Vector2D( 0.0f, -1.0f ) : ( seg.how == GO_SOUTH ) ? Vector2D( 0.0f, 1.0f ) : ( seg.how == GO_EAST ) ? Vector2D( 1.0f, 0.0f ) : Vector2D( -1.0f, 0.0f );
+
+					float halfWidth = MAX( seg.m_portalHalfWidth - margin, 0.0f );
+					Vector2D a = seg.m_portalCenter.AsVector2D() - axis * halfWidth;
+					Vector2D b = seg.m_portalCenter.AsVector2D() + axis * halfWidth;
+
+					// left of the direction of travel
+					if ( travel.x * axis.y - travel.y * axis.x > 0.0f )
+					{
+						lefts.push_back( b );
+						rights.push_back( a );
+					}
+					else
+					{
+						lefts.push_back( a );
+						rights.push_back( b );
+					}
+				}
+
+				lefts.push_back( m_path[ runEnd ].pos.AsVector2D() );
+				rights.push_back( m_path[ runEnd ].pos.AsVector2D() );
+
+				PullString( runStart, lefts, rights );
+			}
+
+			runStart = runEnd;
+		}
+	}
+
+	// twice the signed area of abc, positive when c is to the right of ab
+	static float TriArea2( const Vector2D &a, const Vector2D &b, const Vector2D &c )
+	{
+		return ( c.x - a.x ) * ( b.y - a.y ) - ( b.x - a.x ) * ( c.y - a.y );
+	}
+
+	// run the funnel over portals (index 0 and the last one are the fixed ends) and move the segments from base on
+	void PullString( int base, const std::vector< Vector2D > &lefts, const std::vector< Vector2D > &rights )
+	{
+		const int count = (int)lefts.size();
+
+		// corners of the pulled string, with the portal each one sits on
+		std::vector< std::pair< Vector2D, int > > corners;
+
+		Vector2D apex = lefts[ 0 ];
+		Vector2D left = lefts[ 0 ];
+		Vector2D right = rights[ 0 ];
+		int apexIndex = 0, leftIndex = 0, rightIndex = 0;
+
+		corners.emplace_back( apex, 0 );
+
+		for ( int i = 1; i < count; ++i )
+		{
+			const Vector2D &newLeft = lefts[ i ];
+			const Vector2D &newRight = rights[ i ];
+
+			// tighten the right side
+			if ( TriArea2( apex, right, newRight ) <= 0.0f )
+			{
+				if ( apex == right || TriArea2( apex, left, newRight ) > 0.0f )
+				{
+					right = newRight;
+					rightIndex = i;
+				}
+				else
+				{
+					// right crossed over left, left is a corner
+					apex = left;
+					apexIndex = leftIndex;
+					corners.emplace_back( apex, apexIndex );
+
+					left = right = apex;
+					leftIndex = rightIndex = apexIndex;
+					i = apexIndex;
+					continue;
+				}
+			}
+
+			// tighten the left side
+			if ( TriArea2( apex, left, newLeft ) >= 0.0f )
+			{
+				if ( apex == left || TriArea2( apex, right, newLeft ) < 0.0f )
+				{
+					left = newLeft;
+					leftIndex = i;
+				}
+				else
+				{
+					// left crossed over right, right is a corner
+					apex = right;
+					apexIndex = rightIndex;
+					corners.emplace_back( apex, apexIndex );
+
+					left = right = apex;
+					leftIndex = rightIndex = apexIndex;
+					i = apexIndex;
+					continue;
+				}
+			}
+		}
+
+		corners.emplace_back( lefts[ count-1 ], count-1 );
+
+		// every portal between two corners is crossed by the straight line joining them
+		for ( size_t c = 0; c+1 < corners.size(); ++c )
+		{
+			const Vector2D &from = corners[ c ].first;
+			const Vector2D &to = corners[ c+1 ].first;
+
+			for ( int i = corners[ c ].second + 1; i <= corners[ c+1 ].second && i < count-1; ++i )
+			{
+				Segment &seg = m_path[ base + i ];
+
+				Vector2D pos;
+				if ( i == corners[ c+1 ].second )
+				{
+					pos = to;
+				}
+				else
+				{
+					// portals are axis aligned, solve for the fixed coordinate
+					bool alongX = ( seg.how == GO_NORTH || seg.how == GO_SOUTH );
+					float fromFixed = alongX ? from.y : from.x;
+					float toFixed = alongX ? to.y : to.x;
+					float portalFixed = alongX ? seg.m_portalCenter.y : seg.m_portalCenter.x;
+					float t = ( toFixed != fromFixed ) ? clamp( ( portalFixed - fromFixed ) / ( toFixed - fromFixed ), 0.0f, 1.0f ) : 0.0f;
+					pos = from + ( to - from ) * t;
+
+					// stay on the portal line and inside its narrowed width
+					pos.x = clamp( pos.x, MIN( lefts[ i ].x, rights[ i ].x ), MAX( lefts[ i ].x, rights[ i ].x ) );
+					pos.y = clamp( pos.y, MIN( lefts[ i ].y, rights[ i ].y ), MAX( lefts[ i ].y, rights[ i ].y ) );
+				}
+
+				seg.pos.x = pos.x;
+				seg.pos.y = pos.y;
+				seg.pos.z = m_path[ base + i - 1 ].area->GetZ( seg.pos );
+			}
+		}
+	}
+	
+	void AssemblePrecomputedPath( INextBot *bot, const Vector &goal, CNavArea *endArea, const NavSearchContext &ctx )
+	{
+		const Vector &start = bot->GetPosition();
+
+		// get count
+		int count = 0;
+		CNavArea *area;
+		for( area = endArea; area; area = ctx.GetParent( area ) )
+		{
+			++count;
+		}
+
+		// save room for endpoint
+		if ( count > MAX_PATH_SEGMENTS-1 )
+		{
+			count = MAX_PATH_SEGMENTS-1;
+		}
+		else if ( count == 0 )
+		{
+			return;
+		}
+
+		if ( count == 1 )
+		{
+			BuildTrivialPath( bot, goal );
+			return;
+		}
+
+		// assemble path
+		m_segmentCount = count;
+		for( area = endArea; count && area; area = ctx.GetParent( area ) )
+		{
+			--count;
+			m_path[ count ].area = area;
+			m_path[ count ].how = ctx.GetParentHow( area );
+			m_path[ count ].type = ON_GROUND;
+		}
+
+		// append actual goal position
+		m_path[ m_segmentCount ].area = endArea;
+		m_path[ m_segmentCount ].pos = goal;
+		m_path[ m_segmentCount ].ladder = NULL;
+		m_path[ m_segmentCount ].how = NUM_TRAVERSE_TYPES;
+		m_path[ m_segmentCount ].type = ON_GROUND;
+		++m_segmentCount;
+
+		// compute path positions
+		if ( ComputePathDetails( bot, start ) == false )
+		{
+			Invalidate();
+			OnPathChanged( bot, NO_PATH );
+			return;
+		}
+
+		// remove redundant nodes and clean up path
+		Optimize( bot );
+
+		PostProcess();
+
+		OnPathChanged( bot, COMPLETE_PATH );
+	}
+
+	/**
+	 * Second half of Compute, builds the segments from a searched, cached or worker thread area chain.
+	 * chain goes from the start area to the closest area found, at most MAX_PATH_SEGMENTS-1 long.
+	 */
+	bool AssembleAreaChain( INextBot *bot, const std::vector< NavAreaChainLink > &chain, const Vector &pathEndPosition, bool pathResult, bool includeGoalIfPathFails, int computeFlags = 0 )
+	{
+		const Vector &start = bot->GetPosition();
+
+		// Failed?
+		if ( chain.empty() )
+			return false;
+
+		if ( chain.size() == 1 )
+		{
+			BuildTrivialPath( bot, pathEndPosition );
+			return pathResult;
+		}
+
+		// assemble path
+		m_segmentCount = (int)chain.size();
+		for( int i = 0; i < m_segmentCount; ++i )
+		{
+			m_path[ i ].area = chain[ i ].area;
+			m_path[ i ].how = chain[ i ].how;
+			m_path[ i ].type = ON_GROUND;
+		}
+
+		if ( pathResult || includeGoalIfPathFails )
+		{
+			// append actual goal position
+			m_path[ m_segmentCount ].area = chain.back().area;
+			m_path[ m_segmentCount ].pos = pathEndPosition;
+			m_path[ m_segmentCount ].ladder = NULL;
+			m_path[ m_segmentCount ].how = NUM_TRAVERSE_TYPES;
+			m_path[ m_segmentCount ].type = ON_GROUND;
+			++m_segmentCount;
+		}
+
+		// compute path positions
+		if ( ComputePathDetails( bot, start ) == false )
+		{
+			Invalidate();
+			OnPathChanged( bot, NO_PATH );
+			return false;
+		}
+
+		if ( computeFlags & PATH_COMPUTE_FUNNEL )
+			Funnel( bot );
+
+		// remove redundant nodes and clean up path
+		Optimize( bot );
+
+		PostProcess();
+
+		OnPathChanged( bot, pathResult ? COMPLETE_PATH : PARTIAL_PATH );
+
+		return pathResult;
+	}
+};
+
+/**
+ * Free lists of segment blocks for PackedPath, sized in powers of two from 8 to MAX_PATH_SEGMENTS.
+ * Game thread only.
+ */
+template< typename T >
+class PackedPathPool
+{
+public:
+	enum { MIN_BLOCK = 8, NUM_CLASSES = 6, MAX_FREE_BLOCKS = 64 };
+
+	~PackedPathPool()
+	{
+		for ( std::vector< T * > &list : m_free )
+		{
+			for ( T *block : list )
+			{
+				delete[] block;
+			}
+		}
+	}
+
+	// size of the block Alloc hands out for count segments
+	static int BlockSize( int count )
+	{
+		int size = MIN_BLOCK;
+		while ( size < count )
+		{
+			size <<= 1;
+		}
+		return size;
+	}
+
+	T *Alloc( int count )
+	{
+		int size = BlockSize( count );
+		std::vector< T * > &list = m_free[ SizeClass( size ) ];
+		if ( list.empty() )
+			return new T[ size ];
+
+		T *block = list.back();
+		list.pop_back();
+		return block;
+	}
+
+	void Free( T *block, int count )
+	{
+		if ( !block )
+			return;
+
+		std::vector< T * > &list = m_free[ SizeClass( BlockSize( count ) ) ];
+		if ( (int)list.size() >= MAX_FREE_BLOCKS )
+		{
+			delete[] block;
+			return;
+		}
+
+		list.push_back( block );
+	}
+
+private:
+	static int SizeClass( int size )
+	{
+		int sizeClass = 0;
+		for ( size /= MIN_BLOCK; size > 1; size >>= 1 )
+		{
+			++sizeClass;
+		}
+		return sizeClass;
+	}
+
+	std::vector< T * > m_free[ NUM_CLASSES ];
+};
+
+/**
+ * Right-sized copy of a Path for plugins that keep paths around without following them every tick.
+ * A Path always carries MAX_PATH_SEGMENTS full segments, this keeps only the segments the path has,
+ * quantized to 40 bytes each in a pooled block. Areas are kept by ID, so a path packed on an older
+ * nav mesh can't be read back.
+ * The segments live in an immutable body that Share hands to other packed paths, Pack gives this one a new body
+ * and leaves the others on the old one. Sync only unpacks into a path that doesn't hold the body yet,
+ * so a squad following a shared route keeps its goal and cursor until the route changes.
+ * Game thread only.
+ */
+class PackedPath
+{
+public:
+	PackedPath() = default;
+	PackedPath( const PackedPath & ) = delete;
+	PackedPath &operator=( const PackedPath & ) = delete;
+
+	void Clear( void )
+	{
+		m_body.reset();
+	}
+
+	// use other's segments, nothing is copied
+	void Share( const PackedPath &other )
+	{
+		m_body = other.m_body;
+	}
+
+	// replace the contents with path's segments
+	void Pack( const Path &path )
+	{
+		std::shared_ptr< body_t > body = std::make_shared< body_t >();
+		body->serial = ++s_serial;
+		body->generation = g_NavMeshGeneration;
+		body->ageTimer = path.m_ageTimer;
+		body->subject = path.m_subject;
+
+		m_body = body;
+
+		if ( !path.IsValid() )
+			return;
+
+		body->count = path.m_segmentCount;
+		body->segments = s_pool.Alloc( body->count );
+
+		for ( int i = 0; i < body->count; ++i )
+		{
+			const Segment &seg = path.m_path[ i ];
+			packed_segment_t &packed = body->segments[ i ];
+
+			packed.pos = seg.pos;
+			packed.portalCenter = seg.m_portalCenter;
+			packed.distanceFromStart = seg.distanceFromStart;
+			packed.areaID = seg.area ? seg.area->GetID() : 0;
+			packed.portalHalfWidth = (unsigned short)clamp( seg.m_portalHalfWidth * PORTAL_SCALE + 0.5f, 0.0f, 65535.0f );
+			packed.curvature = (signed char)clamp( seg.curvature * CURVATURE_SCALE, -CURVATURE_SCALE, CURVATURE_SCALE );
+			packed.how = (unsigned char)seg.how;
+			packed.type = (unsigned char)seg.type;
+			packed.ladder = NO_LADDER;
+
+			if ( seg.ladder )
+			{
+				std::vector< const CNavLadder * >::iterator it = std::find( body->ladders.begin(), body->ladders.end(), seg.ladder );
+				packed.ladder = (unsigned char)( it - body->ladders.begin() );
+				if ( it == body->ladders.end() )
+					body->ladders.push_back( seg.ladder );
+			}
+		}
+	}
+
+	// false if the nav mesh changed since Pack
+	bool IsReadable( void ) const
+	{
+		return !m_body || m_body->generation == g_NavMeshGeneration;
+	}
+
+	int GetSegmentCount( void ) const { return m_body ? m_body->count : 0; }
+
+	float GetLength( void ) const
+	{
+		return GetSegmentCount() > 0 ? m_body->segments[ m_body->count-1 ].distanceFromStart : 0.0f;
+	}
+
+	/**
+	 * Expand segment index into seg, forward and length come from the next segment's position like Path::PostProcess.
+	 * Returns false if an area is gone.
+	 */
+	bool Unpack( int index, Segment &seg ) const
+	{
+		const packed_segment_t *segments = m_body->segments;
+		const packed_segment_t &packed = segments[ index ];
+
+		seg.area = TheNavMesh->GetNavAreaByID( packed.areaID );
+		if ( !seg.area )
+			return false;
+
+		seg.how = (NavTraverseType)packed.how;
+		seg.pos = packed.pos;
+		seg.ladder = packed.ladder == NO_LADDER ? NULL : m_body->ladders[ packed.ladder ];
+		seg.type = (SegmentType)packed.type;
+		seg.distanceFromStart = packed.distanceFromStart;
+		seg.curvature = packed.curvature / CURVATURE_SCALE;
+		seg.m_portalCenter = packed.portalCenter;
+		seg.m_portalHalfWidth = packed.portalHalfWidth / PORTAL_SCALE;
+
+		if ( index+1 < m_body->count )
+		{
+			seg.forward = segments[ index+1 ].pos - packed.pos;
+			seg.length = seg.forward.NormalizeInPlace();
+		}
+		else
+		{
+			// the last segment keeps the direction it was entered from
+			seg.forward = index > 0 ? packed.pos - segments[ index-1 ].pos : vec3_origin;
+			seg.forward.NormalizeInPlace();
+			seg.length = 0.0f;
+		}
+
+		return true;
+	}
+
+	// rebuild path from the packed segments, same as Path::Copy
+	bool Unpack( INextBot *bot, Path &path ) const
+	{
+		s_synced.erase( &path );
+
+		if ( !IsReadable() || GetSegmentCount() == 0 )
+			return false;
+
+		path.Invalidate();
+
+		for ( int i = 0; i < m_body->count; ++i )
+		{
+			if ( !Unpack( i, path.m_path[ i ] ) )
+			{
+				path.Invalidate();
+				return false;
+			}
+		}
+
+		path.m_segmentCount = m_body->count;
+
+		// exact curvature and lengths, then put back the age PostProcess restarts
+		path.PostProcess();
+		path.m_ageTimer = m_body->ageTimer;
+		path.m_subject = m_body->subject;
+
+		path.OnPathChanged( bot, Path::COMPLETE_PATH );
+		return true;
+	}
+
+	// Unpack unless path still holds this body from the last Sync, returns false if path doesn't hold it
+	bool Sync( INextBot *bot, Path &path ) const
+	{
+		if ( !m_body )
+			return false;
+
+		// the path may have been computed or invalidated since, the end of the route tells
+		std::unordered_map< const Path *, uint64_t >::const_iterator it = s_synced.find( &path );
+		if ( it != s_synced.cend() && it->second == m_body->serial && IsReadable() && path.m_segmentCount == m_body->count &&
+			path.m_path[ m_body->count-1 ].pos == m_body->segments[ m_body->count-1 ].pos )
+			return true;
+
+		if ( !Unpack( bot, path ) )
+			return false;
+
+		s_synced[ &path ] = m_body->serial;
+		return true;
+	}
+
+	// path is being deleted, a new one can get its address
+	static void ForgetPath( const Path *path )
+	{
+		s_synced.erase( path );
+	}
+
+	// scratch copy handed out to Segment natives
+	Segment m_scratch;
+
+private:
+	enum { NO_LADDER = 0xFF };
+
+	static constexpr float PORTAL_SCALE = 4.0f;
+	static constexpr float CURVATURE_SCALE = 127.0f;
+
+	struct packed_segment_t
+	{
+		Vector pos;
+		Vector portalCenter;
+		float distanceFromStart;
+		unsigned int areaID;
+		unsigned short portalHalfWidth;	// in quarter units
+		signed char curvature;			// -1..1 in 127ths
+		unsigned char how;
+		unsigned char type;
+		unsigned char ladder;			// index in ladders or NO_LADDER
+	};
+
+	struct body_t
+	{
+		~body_t()
+		{
+			s_pool.Free( segments, count );
+		}
+
+		packed_segment_t *segments = NULL;
+		int count = 0;
+		std::vector< const CNavLadder * > ladders;
+		IntervalTimer ageTimer;
+		CHandle< CBaseCombatCharacter > subject;
+		unsigned int generation = 0;
+		uint64_t serial = 0;
+	};
+
+	static PackedPathPool< packed_segment_t > s_pool;
+	static uint64_t s_serial;
+
+	// body serial each path got from its last Sync
+	static std::unordered_map< const Path *, uint64_t > s_synced;
+
+	std::shared_ptr< const body_t > m_body;
+};
+
+PackedPathPool< PackedPath::packed_segment_t > PackedPath::s_pool;
+uint64_t PackedPath::s_serial = 0;
+std::unordered_map< const Path *, uint64_t > PackedPath::s_synced;
+
+DETOUR_DECL_MEMBER1(PathOptimize, void, INextBot *, bot)
+{
+	((Path *)this)->Optimize(bot);
+}
+
+class NextBotTraceFilterOnlyActors : public CTraceFilterSimple
+{
+public:
+	NextBotTraceFilterOnlyActors( const IHandleEntity *passentity, int collisionGroup )
+		: CTraceFilterSimple( passentity, collisionGroup )
+	{
+	}
+
+	virtual TraceType_t	GetTraceType() const override
+	{
+		return TRACE_ENTITIES_ONLY;
+	}
+
+	virtual bool ShouldHitEntity( IHandleEntity *pServerEntity, int contentsMask ) override
+	{
+		if ( CTraceFilterSimple::ShouldHitEntity( pServerEntity, contentsMask ) )
+		{
+			CBaseEntity *entity = EntityFromEntityHandle( pServerEntity );
+
+#if SOURCE_ENGINE == SE_LEFT4DEAD2
+			CBasePlayer *player = entity->GetPlayer();
+			if ( player && player->IsGhost() )
+				return false;
+#endif
+
+			return ( entity->MyNextBotPointer() || entity->IsPlayer() );
+		}
+		return false;
+	}
+};
+
+bool CGameTrace::DidHitWorld() const
+{
+	return m_pEnt && gamehelpers->EntityToBCompatRef(m_pEnt) == 0;
+}
+
+bool CGameTrace::DidHitNonWorldEntity() const
+{
+	return m_pEnt != NULL && !DidHitWorld();
+}
+
+struct pathfollower_vars_t
+{
+	virtual ~pathfollower_vars_t() {}
+
+	virtual void dtor(PathFollower *bytes)
+	{
+		for(int id : hookids) {
+			SH_REMOVE_HOOK_ID(id);
+		}
+	}
+
+	bool allowfacing = true;
+
+	std::vector<int> hookids{};
+};
+
+using pathfollower_var_map_t = std::unordered_map<PathFollower *, unsigned char *>;
+pathfollower_var_map_t pathfollower_var_map{};
+
+class PathFollower : public Path
+{
+public:
+	virtual void Update( INextBot *bot ) = 0;			// move bot along path
+	virtual void SetMinLookAheadDistance( float value ) = 0;		// minimum range movement goal must be along path
+	virtual CBaseEntity *GetHindrance( void ) const = 0;			// returns entity that is hindering our progress along the path
+	virtual bool IsDiscontinuityAhead( INextBot *bot, Path::SegmentType type, float range = -1.0f ) const = 0;	// return true if there is a the given discontinuity ahead in the path within the given range (-1 = entire remaining path)
+
+	const Path::Segment *m_goal;					// our current goal along the path
+	float m_minLookAheadRange;
+
+	//bool IsOnStairs( INextBot *bot ) const;		// return true if bot is standing on a stairway
+	bool m_isOnStairs;
+
+	CountdownTimer m_avoidTimer;					// do avoid check more often if we recently avoided
+
+	CountdownTimer m_waitTimer;						// for waiting for a blocker to move off our path
+	CHandle< CBaseEntity > m_hindrance;
+	
+	// debug display data for avoid volumes
+	bool m_didAvoidCheck;
+	Vector m_leftFrom;
+	Vector m_leftTo;
+	bool m_isLeftClear;
+	Vector m_rightFrom;
+	Vector m_rightTo;
+	bool m_isRightClear;
+	Vector m_hullMin, m_hullMax;
+
+#if SOURCE_ENGINE == SE_TF2
+	float m_goalTolerance;
+#elif SOURCE_ENGINE == SE_LEFT4DEAD2
+	char pad1[16];
+#endif
+
+	using vars_t = pathfollower_vars_t;
+
+	template <typename T = PathFollower>
+	static unsigned char *vars_ptr(PathFollower *ptr)
+	{ return (((unsigned char *)ptr) + sizeof(T)); }
+	template <typename C = PathFollower, typename T = vars_t>
+	static T &getvars(PathFollower *ptr)
+	{ return *(T *)vars_ptr<C>(ptr); }
+
+	unsigned char *vars_ptr()
+	{
+		pathfollower_var_map_t::iterator it{pathfollower_var_map.find(this)};
+		if(it == pathfollower_var_map.end()) {
+			return nullptr;
+		}
+		return it->second;
+	}
+
+	vars_t &getvars()
+	{ return *(vars_t *)vars_ptr(); }
+
+	template <typename T>
+	static void call_dtor()
+	{
+		PathFollower *base = META_IFACEPTR(PathFollower);
+		T *bytes{(T *)base};
+
+		typename T::vars_t &vars{PathFollower::getvars<T, typename T::vars_t>(bytes)};
+
+		vars.dtor(bytes);
+
+		vars.~vars_t();
+
+		pathfollower_var_map_t::iterator it{pathfollower_var_map.find(base)};
+		if(it != pathfollower_var_map.end()) {
+			pathfollower_var_map.erase(it);
+		}
+
+		RETURN_META(MRES_HANDLED);
+	}
+
+	template <typename C = PathFollower, typename T = vars_t>
+	static C *create(void *ctor)
+	{
+		C *bytes = (C *)calloc(1, sizeof(C) + sizeof(T));
+		call_mfunc<void>(bytes, ctor);
+		pathfollower_var_map.emplace(bytes, PathFollower::vars_ptr<C>(bytes));
+		new (PathFollower::vars_ptr<C>(bytes)) T{};
+		PathFollower::getvars<C, T>(bytes).hookids.emplace_back(SH_ADD_MANUALHOOK(GenericDtor, bytes, SH_STATIC(PathFollower::call_dtor<C>), false));
+		return bytes;
+	}
+
+	template <typename C = PathFollower, typename T = vars_t>
+	static C *create()
+	{
+		return create<C, T>(PathFollowerCTOR);
+	}
+
+	void CallUpdate(INextBot *bot)
+	{
+		g_bInPathFollowerFaceTowards = true;
+		ILocomotion *loc{bot->GetLocomotionInterface()};
+		bool disable_facing = !getvars().allowfacing;
+		if(disable_facing) {
+			g_bFaceTowardsDisabled = true;
+		}
+		Update(bot);
+		if(disable_facing) {
+			g_bFaceTowardsDisabled = false;
+		}
+		g_bInPathFollowerFaceTowards = false;
+	}
+
+#if SOURCE_ENGINE == SE_TF2
+	void SetGoalTolerance(float val)
+	{
+		m_goalTolerance = val;
+	}
+	
+	float GetGoalTolerance()
+	{
+		return m_goalTolerance;
+	}
+#endif
+	
+	float GetMinLookAheadDistance()
+	{
+		return m_minLookAheadRange;
+	}
+	
+	bool IsAtGoal( INextBot *bot ) const
+	{
+		ILocomotion *mover = bot->GetLocomotionInterface();
+		IBody *body = bot->GetBodyInterface();
+
+		//
+		// m_goal is the node we are moving toward along the path
+		// current is the node just behind us
+		//
+		const Segment *current = PriorSegment( m_goal );
+		Vector toGoal = m_goal->pos - mover->GetFeet();
+
+	// 	if ( m_goal->type == JUMP_OVER_GAP && !mover->IsOnGround() )
+	// 	{
+	// 		// jumping over a gap, don't skip ahead until we land
+	// 		return false;
+	// 	}
+
+		if ( current == NULL )
+		{
+			// passed goal
+			return true;
+		}
+		else if ( m_goal->type == DROP_DOWN )
+		{
+			// m_goal is the top of the drop-down, and the following segment is the landing point
+			const Segment *landing = NextSegment( m_goal );
+
+			if ( landing == NULL )
+			{
+				// passed goal or corrupt path
+				return true;
+			}		
+			else
+			{
+				// did we reach the ground
+				if ( mover->GetFeet().z - landing->pos.z < mover->GetStepHeight() )
+				{
+					// reached goal
+					return true;
+				}
+			}
+					
+			/// @todo: it is possible to fall into a bad place and get stuck - should move back onto the path
+			
+		}
+		else if ( m_goal->type == CLIMB_UP )
+		{
+			// once jump is started, assume it is successful, since
+			// nav mesh may be substantially off from actual ground height at landing
+			const Segment *landing = NextSegment( m_goal );
+
+			if ( landing == NULL )
+			{
+				// passed goal or corrupt path
+				return true;
+			}		
+			else if ( /*!mover->IsOnGround() && */ mover->GetFeet().z > m_goal->pos.z + mover->GetStepHeight() )
+			{
+				// we're off the ground, presumably climbing - assume we reached the goal
+				return true;
+			}
+			/* This breaks infected climbing up holes in the ceiling - they can get within 2D range of m_goal before finding a ledge to climb up to
+			else if ( mover->IsOnGround() )
+			{
+				// proximity check
+				// Z delta can be anything, since we may be climbing over a tall fence, a physics prop, etc.
+				const float rangeTolerance = 10.0f;
+				if ( toGoal.AsVector2D().IsLengthLessThan( rangeTolerance ) )
+				{
+					// reached goal
+					return true;
+				}
+			}
+			*/
+		}
+		else
+		{
+			const Segment *next = NextSegment( m_goal );
+
+			if ( next )
+			{
+				// because mover may be off the path, check if it crossed the plane of the goal
+				// check against average of current and next forward vectors
+				Vector2D dividingPlane;
+
+				if ( current->ladder )
+				{
+					dividingPlane = m_goal->forward.AsVector2D();
+				}
+				else
+				{
+					dividingPlane = current->forward.AsVector2D() + m_goal->forward.AsVector2D();
+				}
+
+				if ( DotProduct2D( toGoal.AsVector2D(), dividingPlane ) < 0.0001f &&
+					abs( toGoal.z ) < body->GetStandHullHeight() )
+				{	
+					// only skip higher Z goal if next goal is directly reachable
+					// can't use this for positions below us because we need to be able
+					// to climb over random objects along our path that we can't actually
+					// move *through*
+					if ( toGoal.z < mover->GetStepHeight() && ( mover->IsPotentiallyTraversable( mover->GetFeet(), next->pos ) && !mover->HasPotentialGap( mover->GetFeet(), next->pos ) ) )
+					{
+						// passed goal
+						return true;
+					}
+				}
+			}
+
+#if SOURCE_ENGINE == SE_TF2
+			// proximity check
+			// Z delta can be anything, since we may be climbing over a tall fence, a physics prop, etc.
+			if ( toGoal.AsVector2D().IsLengthLessThan( m_goalTolerance ) )
+			{
+				// reached goal
+				return true;
+			}
+#endif
+		}
+
+		return false;	
+	}
+
+	void AdjustSpeed( INextBot *bot )
+	{
+		ILocomotion *mover = bot->GetLocomotionInterface();
+
+		// if we're coming up on a gap jump, or we're in the air, use maximum speed
+		if ( ( m_goal && m_goal->type == JUMP_OVER_GAP ) || !mover->IsOnGround() )
+		{
+			mover->SetDesiredSpeed( mover->GetRunSpeed() );
+			return;
+		}
+
+		MoveCursorToClosestPosition( bot->GetPosition() );
+		const Path::Data &data = GetCursorData();
+		
+		// speed based on curvature
+		mover->SetDesiredSpeed( mover->GetRunSpeed() + fabs( data.curvature ) * ( mover->GetWalkSpeed() - mover->GetRunSpeed() ) );
+	}
+};
+
+DETOUR_DECL_MEMBER1(AdjustSpeed, void, INextBot *, bot)
+{
+	((PathFollower *)this)->AdjustSpeed(bot);
+}
+
+void PathFollower::Update( INextBot *bot )
+{
+	static int vtableindex = -1;
+	if(vtableindex == -1) {
+		vtableindex = vfunc_index(&PathFollower::Update);
+	}
+
+	g_bInPathFollowerFaceTowards = true;
+	call_vfunc<void, PathFollower, INextBot *>(this, vtableindex, bot);
+	g_bInPathFollowerFaceTowards = false;
+}
+
+SH_DECL_HOOK0_void(Path, Invalidate, SH_NOATTRIB, 0);
+
+class DirectChasePath;
+
+class ChasePath : public PathFollower
+{
+public:
+	enum SubjectChaseType
+	{
+		LEAD_SUBJECT,
+		DONT_LEAD_SUBJECT
+	};
+	
+	CountdownTimer m_failTimer;							// throttle re-pathing if last path attempt failed
+	CountdownTimer m_throttleTimer;						// require a minimum time between re-paths
+	CountdownTimer m_lifetimeTimer;
+	EHANDLE m_lastPathSubject;							// the subject used to compute the current/last path
+	SubjectChaseType m_chaseHow;
+
+	struct vars_t;
+
+	using IsRepathNeeded_t = bool (ChasePath::*)( vars_t &, INextBot *, CBaseEntity * );
+	using Update_t = void (ChasePath::*)( vars_t &, INextBot *, CBaseEntity *, const IPathCost &, Vector * );
+	
+	struct vars_t : public PathFollower::vars_t
+	{
+		float radius = 500.0f;
+		float maxlen = 0.0f;
+		float life = 0.0f;
+		float tolerancerate = 0.33f;
+		float mintolerance = 0.0f;
+		float repathtime = 0.5f;
+		PathSearchMode searchmode = PATH_SEARCH_FULL;
+		
+		//created on the first repath, subject changes don't matter since the tree is rooted at the bot
+		std::unique_ptr<NavIncrementalSearch> incremental;
+		
+		IsRepathNeeded_t pIsRepathNeeded = nullptr;
+		Update_t pUpdate = nullptr;
+		
+		NavIncrementalSearch *GetIncrementalSearch()
+		{
+			if(path_incremental_max_age.GetFloat() <= 0.0f) {
+				incremental.reset();
+				return nullptr;
+			}
+			
+			if(!incremental) {
+				incremental.reset(new NavIncrementalSearch());
+			}
+			
+			return incremental.get();
+		}
+
+		void dtor(PathFollower *base) override
+		{
+			PathFollower::vars_t::dtor(base);
+
+			ChasePath *bytes{(ChasePath *)base};
+			bytes->dtor();
+		}
+	};
+
+	vars_t &getvars()
+	{ return *(vars_t *)vars_ptr(); }
+	
+	void ctor(SubjectChaseType chaseHow)
+	{
+		new (&m_failTimer) CountdownTimer();
+		new (&m_throttleTimer) CountdownTimer();
+		new (&m_lifetimeTimer) CountdownTimer();
+		new (&m_lastPathSubject) EHANDLE();
+		
+		m_failTimer.Invalidate();
+		m_throttleTimer.Invalidate();
+		m_lifetimeTimer.Invalidate();
+		m_lastPathSubject = NULL;
+		m_chaseHow = chaseHow;
+	}
+
+	void dtor()
+	{
+		m_failTimer.~CountdownTimer();
+		m_throttleTimer.~CountdownTimer();
+		m_lifetimeTimer.~CountdownTimer();
+		m_lastPathSubject.~EHANDLE();
+	}
+
+	template <typename C = ChasePath, typename T = vars_t>
+	static C *create(SubjectChaseType chaseHow)
+	{
+		static_assert(std::is_base_of<ChasePath, C>::value, "");
+		C *bytes = (C *)PathFollower::create<C, T>();
+		bytes->ctor(chaseHow);
+		T &vars{PathFollower::getvars<C, T>(bytes)};
+		vars.hookids.emplace_back(SH_ADD_HOOK(Path, Invalidate, bytes, SH_MEMBER(bytes, &C::HookInvalidate), true));
+		vars.pIsRepathNeeded = static_cast<IsRepathNeeded_t>(&C::IsRepathNeeded);
+		vars.pUpdate = static_cast<Update_t>(&C::Update);
+		return bytes;
+	}
+
+	void HookInvalidate()
+	{
+		m_throttleTimer.Invalidate();
+		m_lifetimeTimer.Invalidate();
+		
+		RETURN_META(MRES_HANDLED);
+	}
+
+	Vector PredictSubjectPosition( vars_t &vars, INextBot *bot, CBaseEntity *subject )
+	{
+		ILocomotion *mover = bot->GetLocomotionInterface();
+
+		const Vector &subjectPos = subject->GetAbsOrigin();
+
+		Vector to = subjectPos - bot->GetPosition();
+		to.z = 0.0f;
+		float flRangeSq = to.LengthSqr();
+
+		// don't lead if subject is very far away
+		float flLeadRadiusSq = vars.radius;
+		flLeadRadiusSq *= flLeadRadiusSq;
+		if ( flRangeSq > flLeadRadiusSq )
+			return subjectPos;
+
+		// Normalize in place
+		float range = sqrt( flRangeSq );
+		to /= ( range + 0.0001f );	// avoid divide by zero
+
+		// estimate time to reach subject, assuming maximum speed
+		float leadTime = 0.5f + ( range / ( mover->GetRunSpeed() + 0.0001f ) );
+		
+		// estimate amount to lead the subject	
+		Vector lead = leadTime * subject->GetAbsVelocity();
+		lead.z = 0.0f;
+
+		if ( DotProduct( to, lead ) < 0.0f )
+		{
+			// the subject is moving towards us - only pay attention 
+			// to his perpendicular velocity for leading
+			Vector2D to2D = to.AsVector2D();
+			to2D.NormalizeInPlace();
+
+			Vector2D perp( -to2D.y, to2D.x );
+
+			float enemyGroundSpeed = lead.x * perp.x + lead.y * perp.y;
+
+			lead.x = enemyGroundSpeed * perp.x;
+			lead.y = enemyGroundSpeed * perp.y;
+		}
+
+		// compute our desired destination
+		Vector pathTarget = subjectPos + lead;
+
+		// validate this destination
+
+		// don't lead through walls
+		if ( lead.LengthSqr() > 36.0f )
+		{
+			float fraction;
+			if ( !mover->IsPotentiallyTraversable( subjectPos, pathTarget, ILocomotion::TraverseWhenType::IMMEDIATELY, &fraction ) )
+			{
+				// tried to lead through an unwalkable area - clip to walkable space
+				pathTarget = subjectPos + fraction * ( pathTarget - subjectPos );
+			}
+		}
+
+		// don't lead over cliffs
+		CNavArea *leadArea = NULL;
+
+	#if 0
+		CBaseCombatCharacter *pBCC = subject->MyCombatCharacterPointer();
+		if ( pBCC && CloseEnough( pathTarget, subjectPos, 3.0 ) )
+		{
+			pathTarget = subjectPos;
+			leadArea = pBCC->GetLastKnownArea(); // can return null?
+		}
+		else
+		{
+			struct CacheEntry_t
+			{
+				CacheEntry_t() : pArea(NULL) {}
+				Vector target;
+				CNavArea *pArea;
+			};
+
+			static int iServer;
+			static CacheEntry_t cache[4];
+			static int iNext;
+			int i;
+
+			bool bFound = false;
+			if ( iServer != gpGlobals->serverCount )
+			{
+				for ( i = 0; i < ARRAYSIZE(cache); i++ )
+				{
+					cache[i].pArea = NULL;
+				}
+				iServer = gpGlobals->serverCount;
+			}
+			else
+			{
+				for ( i = 0; i < ARRAYSIZE(cache); i++ )
+				{
+					if ( cache[i].pArea && CloseEnough( cache[i].target, pathTarget, 2.0 ) )
+					{
+						pathTarget = cache[i].target;
+						leadArea = cache[i].pArea;
+						bFound = true;
+						break;
+					}
+				}
+			}
+
+			if ( !bFound )
+			{
+				leadArea = TheNavMesh->GetNearestNavArea( pathTarget, GETNAVAREA_CHECK_GROUND, 10000.0f );
+				if ( leadArea )
+				{
+					cache[iNext].target = pathTarget;
+					cache[iNext].pArea = leadArea;
+					iNext = ( iNext + 1 ) % ARRAYSIZE( cache );
+				}
+			}
+		}
+	#else
+		leadArea = TheNavMesh->GetNearestNavArea( pathTarget, GETNAVAREA_CHECK_GROUND, 10000.0f );
+	#endif
+
+
+		if ( !leadArea || leadArea->GetZ( pathTarget.x, pathTarget.y ) < pathTarget.z - mover->GetMaxJumpHeight() )
+		{
+			// would fall off a cliff
+			return subjectPos;		
+		}
+		
+		/** This needs more thought - it is preventing bots from using dropdowns
+		if ( mover->HasPotentialGap( subjectPos, pathTarget, &fraction ) )
+		{
+			// tried to lead over a cliff - clip to safe region
+			pathTarget = subjectPos + fraction * ( pathTarget - subjectPos );
+		}
+		*/
+		
+		return pathTarget;
+	}
+
+	bool IsRepathNeeded( vars_t &vars, INextBot *bot, CBaseEntity *subject )
+	{
+		// the closer we get, the more accurate our path needs to be
+		Vector to = subject->GetAbsOrigin() - bot->GetPosition();
+
+		float tolerance = vars.mintolerance + vars.tolerancerate * to.Length();
+
+		return ( subject->GetAbsOrigin() - GetEndPosition() ).IsLengthGreaterThan( tolerance );
+	}
+
+	void RefreshPath( vars_t &vars, INextBot *bot, CBaseEntity *subject, const IPathCost &cost, Vector *pPredictedSubjectPos )
+	{
+		ILocomotion *mover = bot->GetLocomotionInterface();
+
+		// don't change our path if we're on a ladder
+		if ( IsValid() && mover->IsUsingLadder() )
+		{
+			if ( bot->IsDebugging( NEXTBOT_PATH ) )
+			{
+				static float lastprint = 0.0f;
+				if(lastprint <= gpGlobals->curtime) {
+					DevMsg( "%3.2f: bot(#%d) ChasePath::RefreshPath failed. Bot is on a ladder.\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
+					lastprint = gpGlobals->curtime + 2.0f;
+				}
+			}
+
+			// don't allow repath until a moment AFTER we have left the ladder
+			m_throttleTimer.Start( 1.0f );
+
+			return;
+		}
+
+		if ( subject == NULL )
+		{
+			if ( bot->IsDebugging( NEXTBOT_PATH ) )
+			{
+				static float lastprint = 0.0f;
+				if(lastprint <= gpGlobals->curtime) {
+					DevMsg( "%3.2f: bot(#%d) CasePath::RefreshPath failed. No subject.\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
+					lastprint = gpGlobals->curtime + 2.0f;
+				}
+			}
+			return;
+		}
+
+		if ( !m_failTimer.IsElapsed() )
+		{
+	 		if ( bot->IsDebugging( NEXTBOT_PATH ) )
+	 		{
+				static float lastprint = 0.0f;
+				if(lastprint <= gpGlobals->curtime) {
+					DevMsg( "%3.2f: bot(#%d) ChasePath::RefreshPath failed. Fail timer not elapsed.\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
+					lastprint = gpGlobals->curtime + 2.0f;
+				}
+	 		}
+			return;
+		}
+
+		// if our path subject changed, repath immediately
+		if ( subject != m_lastPathSubject )
+		{
+			if ( bot->IsDebugging( NEXTBOT_PATH ) )
+			{
+				static float lastprint = 0.0f;
+				if(lastprint <= gpGlobals->curtime) {
+					DevMsg( "%3.2f: bot(#%d) Chase path subject changed (from %p (#%d) to %p (#%d)).\n", gpGlobals->curtime, bot->GetEntity()->entindex(), m_lastPathSubject.Get(), m_lastPathSubject.Get() ? m_lastPathSubject.Get()->entindex() : -1, subject, subject ? subject->entindex() : -1 );
+					lastprint = gpGlobals->curtime + 2.0f;
+				}
+			}
+
+			Invalidate();
+
+			// new subject, fresh attempt
+			m_failTimer.Invalidate();
+		}
+
+		if ( IsValid() && !m_throttleTimer.IsElapsed() )
+		{
+			// require a minimum time between repaths, as long as we have a path to follow
+	 		if ( bot->IsDebugging( NEXTBOT_PATH ) )
+	 		{
+				static float lastprint = 0.0f;
+				if(lastprint <= gpGlobals->curtime) {
+					DevMsg( "%3.2f: bot(#%d) ChasePath::RefreshPath failed. Rate throttled.\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
+					lastprint = gpGlobals->curtime + 2.0f;
+				}
+	 		}
+			return;
+		}
+
+		if ( IsValid() && m_lifetimeTimer.HasStarted() && m_lifetimeTimer.IsElapsed() )
+		{
+			// this path's lifetime has elapsed
+			Invalidate();
+		}
+
+		if ( !IsValid() || (this->*vars.pIsRepathNeeded)( vars, bot, subject ) )
+		{
+			// the situation has changed - try a new path
+			bool isPath;
+			Vector pathTarget = subject->GetAbsOrigin();
+
+			NavIncrementalSearch *incremental = vars.GetIncrementalSearch();
+
+			if ( m_chaseHow == LEAD_SUBJECT )
+			{
+				pathTarget = pPredictedSubjectPos ? *pPredictedSubjectPos : PredictSubjectPosition( vars, bot, subject );
+				isPath = Compute( bot, pathTarget, cost, vars.maxlen, true, vars.searchmode, incremental );
+			}
+			else if ( subject->MyCombatCharacterPointer() && subject->MyCombatCharacterPointer()->GetLastKnownArea() )
+			{
+				isPath = Compute( bot, subject->MyCombatCharacterPointer(), cost, vars.maxlen, true, vars.searchmode, incremental );
+			}
+			else
+			{
+				isPath = Compute( bot, pathTarget, cost, vars.maxlen, true, vars.searchmode, incremental );
+			}
+
+			if ( isPath )
+			{
+				if ( bot->IsDebugging( NEXTBOT_PATH ) )
+				{
+					const float size = 20.0f;			
+					NDebugOverlay::VertArrow( bot->GetPosition() + Vector( 0, 0, size ), bot->GetPosition(), size, 255, RandomInt( 0, 200 ), 255, 255, true, 30.0f );
+
+					static float lastprint = 0.0f;
+					if(lastprint <= gpGlobals->curtime) {
+						DevMsg( "%3.2f: bot(#%d) REPATH\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
+						lastprint = gpGlobals->curtime + 2.0f;
+					}
+				}
+
+				m_lastPathSubject = subject;
+
+				m_throttleTimer.Start( vars.repathtime );
+
+				// track the lifetime of this new path
+				float lifetime = vars.life;
+				if ( lifetime > 0.0f )
+				{
+					m_lifetimeTimer.Start( lifetime );
+				}
+				else
+				{
+					m_lifetimeTimer.Invalidate();
+				}
+			}
+			else
+			{
+				// can't reach subject - throttle retry based on range to subject
+				float failtime = 0.005f * ( bot->GetRangeTo( subject ) );
+				
+				m_failTimer.Start( failtime );
+				
+				// allow bot to react to path failure
+				bot->OnMoveToFailure( this, FAIL_NO_PATH_EXISTS );
+
+				if ( bot->IsDebugging( NEXTBOT_PATH ) )
+				{
+					const float size = 20.0f;	
+					const float dT = 90.0f;		
+					int c = RandomInt( 0, 100 );
+					NDebugOverlay::VertArrow( bot->GetPosition() + Vector( 0, 0, size ), bot->GetPosition(), size, 255, c, c, 255, true, dT );
+					NDebugOverlay::HorzArrow( bot->GetPosition(), pathTarget, 5.0f, 255, c, c, 255, true, dT );
+
+					static float lastprint = 0.0f;
+					if(lastprint <= gpGlobals->curtime) {
+						DevMsg( "%3.2f: bot(#%d) REPATH FAILED %f\n", gpGlobals->curtime, bot->GetEntity()->entindex(), failtime );
+						lastprint = gpGlobals->curtime + 2.0f;
+					}
+				}
+
+				Invalidate();
+			}
+		}
+	}
+	
+	float GetLeadRadius( void ) 
+	{ 
+		return getvars().radius; // 1000.0f; 
+	}
+
+	float GetMaxPathLength( void )
+	{
+		// no limit
+		return getvars().maxlen;
+	}
+
+	float GetLifetime( void )
+	{
+		// infinite duration
+		return getvars().life;
+	}
+
+	void Update( vars_t &vars, INextBot *bot, CBaseEntity *subject, const IPathCost &cost, Vector *pPredictedSubjectPos )
+	{
+		// maintain the path to the subject
+		RefreshPath( vars, bot, subject, cost, pPredictedSubjectPos );
+
+		// move along the path towards the subject
+		PathFollower::CallUpdate( bot );
+	}
+};
+
+SH_DECL_HOOK6_void(Path, ComputeAreaCrossing, SH_NOATTRIB, 0, INextBot *, const CNavArea *, const Vector &, const CNavArea *, NavDirType, Vector *);
+
+class DirectChasePath : public ChasePath
+{
+public:
+	using ComputeAreaCrossing_t = void (DirectChasePath::*)( INextBot *bot, const CNavArea *, const Vector &, const CNavArea *, NavDirType, Vector * );
+
+	struct vars_t : public ChasePath::vars_t
+	{
+		ComputeAreaCrossing_t pComputeAreaCrossing = nullptr;
+
+		void dtor(PathFollower *base) override
+		{
+			ChasePath::vars_t::dtor(base);
+
+			DirectChasePath *bytes{(DirectChasePath *)base};
+			bytes->dtor();
+		}
+	};
+
+	vars_t &getvars()
+	{ return *(vars_t *)vars_ptr(); }
+
+	void dtor()
+	{
+		
+	}
+
+	template <typename C = DirectChasePath, typename T = vars_t>
+	static C *create(SubjectChaseType chaseHow)
+	{
+		C *bytes = (C *)ChasePath::create<C, T>(chaseHow);
+		T &vars{PathFollower::getvars<C, T>(bytes)};
+		vars.hookids.emplace_back(SH_ADD_HOOK(Path, ComputeAreaCrossing, bytes, SH_MEMBER(bytes, &C::HookComputeAreaCrossing), false));
+		vars.pComputeAreaCrossing = func_to_func<ComputeAreaCrossing_t>(&C::DoComputeAreaCrossing);
+		return bytes;
+	}
+
+	void Update( ChasePath::vars_t &vars, INextBot *me, CBaseEntity *victim, const IPathCost &pathCost, Vector *pPredictedSubjectPos = NULL )	// update path to chase target and move bot along path
+	{
+		Assert( !pPredictedSubjectPos );
+		bool bComputedPredictedPosition;
+		Vector vecPredictedPosition;
+		if ( !DirectChase( vars, &bComputedPredictedPosition, &vecPredictedPosition, me, victim ) )
+		{
+			// path around obstacles to reach our victim
+			ChasePath::Update( vars, me, victim, pathCost, bComputedPredictedPosition ? &vecPredictedPosition : NULL );
+		}
+		NotifyVictim( me, victim );
+	}
+
+	bool IsRepathNeeded( ChasePath::vars_t &vars, INextBot *bot, CBaseEntity *subject )			// return true if situation has changed enough to warrant recomputing the current path
+	{
+		if ( ChasePath::IsRepathNeeded( vars, bot, subject ) )
+		{
+			return true;
+		}
+
+		return bot->GetLocomotionInterface()->IsStuck() && bot->GetLocomotionInterface()->GetStuckDuration() > 2.0f;
+	}
+	
+	void NotifyVictim( INextBot *me, CBaseEntity *victim )
+	{
+		CBaseCombatCharacter *pBCCVictim = victim->MyCombatCharacterPointer();
+		if ( !pBCCVictim )
+			return;
+		
+		pBCCVictim->OnPursuedBy( me );
+	}
+	
+	bool DirectChase( ChasePath::vars_t &vars, bool *pPredictedPositionComputed, Vector *pPredictedPos, INextBot *me, CBaseEntity *victim )		// if there is nothing between us and our victim, run directly at them
+	{
+		*pPredictedPositionComputed = false;
+
+		ILocomotion *mover = me->GetLocomotionInterface();
+
+		if ( me->IsImmobile() || mover->IsScrambling() )
+		{
+			return false;
+		}
+
+		if ( IsDiscontinuityAhead( me, CLIMB_UP ) )
+		{
+			return false;
+		}
+
+		if ( IsDiscontinuityAhead( me, JUMP_OVER_GAP ) )
+		{
+			return false;
+		}
+
+		Vector leadVictimPos = PredictSubjectPosition( vars, me, victim );
+
+		// Don't want to have to compute the predicted position twice.
+		*pPredictedPositionComputed = true;
+		*pPredictedPos = leadVictimPos;
+
+		if ( !mover->IsPotentiallyTraversable( mover->GetFeet(), leadVictimPos  ) )
+		{
+			return false;
+		}
+
+		// the way is clear - move directly towards our victim
+		g_bInPathFollowerFaceTowards = true;
+		bool disable_facing = !vars.allowfacing;
+		if(!disable_facing) {
+			mover->FaceTowards( leadVictimPos );
+		}
+		g_bInPathFollowerFaceTowards = false;
+
+		mover->Approach( leadVictimPos );
+
+		me->GetBodyInterface()->AimHeadTowards( victim );
+
+		// old path is no longer useful since we've moved off of it
+		Invalidate();
+
+		return true;
+	}
+	
+	void DoComputeAreaCrossing( INextBot *bot, const CNavArea *from, const Vector &fromPos, const CNavArea *to, NavDirType dir, Vector *crossPos )
+	{
+		Vector center;
+		float halfWidth;
+		from->ComputePortal( to, dir, &center, &halfWidth );
+
+		*crossPos = center;
+	}
+	
+	void HookComputeAreaCrossing( INextBot *bot, const CNavArea *from, const Vector &fromPos, const CNavArea *to, NavDirType dir, Vector *crossPos )
+	{
+		(this->*getvars().pComputeAreaCrossing)(bot, from, fromPos, to, dir, crossPos);
+		RETURN_META(MRES_SUPERCEDE);
+	}
+};
+
+#if SOURCE_ENGINE == SE_LEFT4DEAD2
+class InfectedChasePath : public DirectChasePath
+{
+public:
+	template <typename C = InfectedChasePath, typename T = vars_t>
+	static C *create(SubjectChaseType chaseHow)
+	{
+		C *bytes = (C *)DirectChasePath::create<C, T>(chaseHow);
+		return bytes;
+	}
+	
+	void DoComputeAreaCrossing( INextBot *bot, const CNavArea *from, const Vector &fromPos, const CNavArea *to, NavDirType dir, Vector *crossPos )
+	{
+		call_mfunc<void, InfectedChasePath, INextBot *, const CNavArea *, const Vector &, const CNavArea *, NavDirType, Vector *>(this, InfectedChasePathComputeAreaCrossing, bot, from, fromPos, to, dir, crossPos);
+	}
+};
+#endif
+
+class RetreatPathBuilder
+{
+public:
+	RetreatPathBuilder( INextBot *me, CBaseEntity *threat, float retreatRange = 500.0f, NavSearchContext &ctx = g_NavSearchContext )
+		: m_ctx( ctx )
+	{
+		m_me = me;
+		m_mover = me->GetLocomotionInterface();
+		
+		m_threat = threat;
+		m_retreatRange = retreatRange;
+	}
+
+	CNavArea *ComputePath( void )
+	{
+		if ( m_mover == NULL )
+			return NULL;
+		
+		CNavArea *startArea = m_me->GetEntity()->GetLastKnownArea();
+
+		if ( startArea == NULL )
+			return NULL;
+
+		CNavArea *retreatFromArea = TheNavMesh->GetNearestNavArea( m_threat, GETNAVAREA_CHECK_GROUND, 10000.0f );
+		if ( retreatFromArea == NULL )
+			return NULL;
+
+		// start search
+		m_ctx.Reset();
+
+		m_ctx.SetParent( startArea, NULL );
+
+		float initCost = Cost( startArea, NULL, NULL );
+		if ( initCost < 0.0f )
+			return NULL;
+
+		int teamID = m_me->GetEntity()->GetTeamNumber();
+
+		m_ctx.SetTotalCost( startArea, initCost );
+
+		m_ctx.AddToOpenList( startArea );
+		
+		// keep track of the area farthest away from the threat
+		CNavArea *farthestArea = NULL;
+		float farthestRange = 0.0f;
+
+		//
+		// Dijkstra's algorithm (since we don't know our goal).
+		// Build a path as far away from the retreat area as possible.
+		// Minimize total path length and danger.
+		// Maximize distance to threat of end of path.
+		//
+		while( !m_ctx.IsOpenListEmpty() )
+		{
+			// get next area to check
+			CNavArea *area = m_ctx.PopOpenList();
+
+			m_ctx.AddToClosedList( area );
+
+			// don't consider blocked areas
+			if ( area->IsBlocked( teamID ) )
+				continue;
+
+			// build adjacent area array
+			CollectAdjacentAreas( area );
+			
+			// search adjacent areas
+			for( int i=0; i<m_adjAreaIndex; ++i )
+			{
+				CNavArea *newArea = m_adjAreaVector[ i ].area;
+				
+				// only visit each area once
+				if ( m_ctx.IsClosed( newArea ) )
+					continue;
+				
+				// don't consider blocked areas
+				if ( newArea->IsBlocked( teamID ) )
+					continue;
+
+				// don't use this area if it is out of range
+				if ( ( newArea->GetCenter() - m_me->GetPosition() ).IsLengthGreaterThan( m_retreatRange ) )
+					continue;
+				
+				// determine cost of traversing this area
+				float newCost = Cost( newArea, area, m_adjAreaVector[ i ].ladder );
+				
+				// don't use adjacent area if cost functor says it is a dead-end
+				if ( newCost < 0.0f )
+					continue;
+					
+				if ( m_ctx.IsOpen( newArea ) && m_ctx.GetTotalCost( newArea ) <= newCost )
+				{
+					// we have already visited this area, and it has a better path
+					continue;
+				}
+				else
+				{
+					// whether this area has been visited or not, we now have a better path
+					m_ctx.SetParent( newArea, area, m_adjAreaVector[ i ].how );
+					m_ctx.SetTotalCost( newArea, newCost );
+
+					// use 'cost so far' to hold cumulative cost
+					m_ctx.SetCostSoFar( newArea, newCost );
+
+					// tricky bit here - relying on OpenList being sorted by cost
+					if ( m_ctx.IsOpen( newArea ) )
+					{
+						// area already on open list, update the list order to keep costs sorted
+						m_ctx.UpdateOnOpenList( newArea );
+					}
+					else
+					{
+						m_ctx.AddToOpenList( newArea );
+					}
+
+					// keep track of area farthest from threat
+					float threatRange = ( newArea->GetCenter() - m_threat->GetAbsOrigin() ).Length();
+					if ( threatRange > farthestRange )
+					{
+						farthestArea = newArea;
+						farthestRange = threatRange;
+					}
+				}
+			}
+		}
+
+		return farthestArea;
+	}
+
+	const NavSearchContext &GetContext( void ) const
+	{
+		return m_ctx;
+	}
+
+
+	/**
+	 * Build a vector of adjacent areas reachable from the given area
+	 */
+	void CollectAdjacentAreas( CNavArea *area )
+	{
+		m_adjAreaIndex = 0;			
+
+		const NavConnectVector &adjNorth = *area->GetAdjacentAreas( NORTH );		
+		FOR_EACH_VEC( adjNorth, it )
+		{
+			if ( m_adjAreaIndex >= MAX_ADJ_AREAS )
+				break;
+
+			m_adjAreaVector[ m_adjAreaIndex ].area = adjNorth[ it ].area;
+			m_adjAreaVector[ m_adjAreaIndex ].how = GO_NORTH;
+			m_adjAreaVector[ m_adjAreaIndex ].ladder = NULL;
+			++m_adjAreaIndex;
+		}
+
+		const NavConnectVector &adjSouth = *area->GetAdjacentAreas( SOUTH );		
+		FOR_EACH_VEC( adjSouth, it )
+		{
+			if ( m_adjAreaIndex >= MAX_ADJ_AREAS )
+				break;
+
+			m_adjAreaVector[ m_adjAreaIndex ].area = adjSouth[ it ].area;
+			m_adjAreaVector[ m_adjAreaIndex ].how = GO_SOUTH;
+			m_adjAreaVector[ m_adjAreaIndex ].ladder = NULL;
+			++m_adjAreaIndex;
+		}
+
+		const NavConnectVector &adjWest = *area->GetAdjacentAreas( WEST );		
+		FOR_EACH_VEC( adjWest, it )
+		{
+			if ( m_adjAreaIndex >= MAX_ADJ_AREAS )
+				break;
+
+			m_adjAreaVector[ m_adjAreaIndex ].area = adjWest[ it ].area;
+			m_adjAreaVector[ m_adjAreaIndex ].how = GO_WEST;
+			m_adjAreaVector[ m_adjAreaIndex ].ladder = NULL;
+			++m_adjAreaIndex;
+		}
+
+		const NavConnectVector &adjEast = *area->GetAdjacentAreas( EAST );	
+		FOR_EACH_VEC( adjEast, it )
+		{
+			if ( m_adjAreaIndex >= MAX_ADJ_AREAS )
+				break;
+
+			m_adjAreaVector[ m_adjAreaIndex ].area = adjEast[ it ].area;
+			m_adjAreaVector[ m_adjAreaIndex ].how = GO_EAST;
+			m_adjAreaVector[ m_adjAreaIndex ].ladder = NULL;
+			++m_adjAreaIndex;
+		}
+
+		const NavLadderConnectVector &adjUpLadder = *area->GetLadders( CNavLadder::LADDER_UP );
+		FOR_EACH_VEC( adjUpLadder, it )
+		{
+			CNavLadder *ladder = adjUpLadder[ it ].ladder;
+
+			if ( ladder->m_topForwardArea && m_adjAreaIndex < MAX_ADJ_AREAS )
+			{
+				m_adjAreaVector[ m_adjAreaIndex ].area = ladder->m_topForwardArea;
+				m_adjAreaVector[ m_adjAreaIndex ].how = GO_LADDER_UP;
+				m_adjAreaVector[ m_adjAreaIndex ].ladder = ladder;
+				++m_adjAreaIndex;
+			}
+
+			if ( ladder->m_topLeftArea && m_adjAreaIndex < MAX_ADJ_AREAS )
+			{
+				m_adjAreaVector[ m_adjAreaIndex ].area = ladder->m_topLeftArea;
+				m_adjAreaVector[ m_adjAreaIndex ].how = GO_LADDER_UP;
+				m_adjAreaVector[ m_adjAreaIndex ].ladder = ladder;
+				++m_adjAreaIndex;
+			}
+
+			if ( ladder->m_topRightArea && m_adjAreaIndex < MAX_ADJ_AREAS )
+			{
+				m_adjAreaVector[ m_adjAreaIndex ].area = ladder->m_topRightArea;
+				m_adjAreaVector[ m_adjAreaIndex ].how = GO_LADDER_UP;
+				m_adjAreaVector[ m_adjAreaIndex ].ladder = ladder;
+				++m_adjAreaIndex;
+			}
+		}
+
+		const NavLadderConnectVector &adjDownLadder = *area->GetLadders( CNavLadder::LADDER_DOWN );
+		FOR_EACH_VEC( adjDownLadder, it )
+		{
+			CNavLadder *ladder = adjDownLadder[ it ].ladder;
+
+			if ( m_adjAreaIndex >= MAX_ADJ_AREAS )
+				break;
+
+			if ( ladder->m_bottomArea )
+			{
+				m_adjAreaVector[ m_adjAreaIndex ].area = ladder->m_bottomArea;
+				m_adjAreaVector[ m_adjAreaIndex ].how = GO_LADDER_DOWN;
+				m_adjAreaVector[ m_adjAreaIndex ].ladder = ladder;
+				++m_adjAreaIndex;
+			}
+		}
+	}
+	
+	/**
+	 * Cost minimizes path length traveled thus far and "danger" (proximity to threat(s))
+	 */
+	float Cost( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder )
+	{
+		// check if we can use this area
+		if ( !m_mover->IsAreaTraversable( area ) )
+		{
+			return -1.0f;
+		}
+
+		int teamID = m_me->GetEntity()->GetTeamNumber();
+		if ( area->IsBlocked( teamID ) )
+		{
+			return -1.0f;
+		}
+		
+		const float debugDeltaT = 3.0f;
+
+		float cost;
+
+		const float maxThreatRange = 500.0f;
+		const float dangerDensity = 1000.0f;
+
+		if ( fromArea == NULL )
+		{
+			cost = 0.0f;
+		
+			/*if ( area->Contains( m_threat->GetAbsOrigin() ) )
+			{
+				// maximum danger - threat is in the area with us
+				cost += 10.0f * dangerDensity;
+				
+				if ( m_me->IsDebugging( NEXTBOT_PATH ) )
+				{
+					area->DrawFilled( 255, 0, 0, 128 );
+				}
+			}
+			else*/
+			{
+				// danger proportional to range to us
+				float rangeToThreat = ( m_threat->GetAbsOrigin() - m_me->GetPosition() ).Length();
+
+				if ( rangeToThreat < maxThreatRange )
+				{
+					cost += dangerDensity * ( 1.0f - ( rangeToThreat / maxThreatRange ) );
+
+					if ( m_me->IsDebugging( NEXTBOT_PATH ) )
+					{
+						NDebugOverlay::Line( m_me->GetPosition(), m_threat->GetAbsOrigin(), 255, 0, 0, true, debugDeltaT );
+					}
+				}				
+			}
+		}
+		else
+		{
+			// compute distance traveled along path so far
+			float dist;
+
+			if ( ladder )
+			{
+				const float ladderCostFactor = 100.0f;
+				dist = ladderCostFactor * ladder->m_length;
+			}
+			else
+			{
+				Vector to = area->GetCenter() - fromArea->GetCenter();
+
+				dist = to.Length();
+
+				// check for vertical discontinuities
+				Vector closeFrom, closeTo;
+				area->GetClosestPointOnArea( fromArea->GetCenter(), &closeTo );
+				fromArea->GetClosestPointOnArea( area->GetCenter(), &closeFrom );
+				
+				float deltaZ = closeTo.z - closeFrom.z;
+
+				if ( deltaZ > m_mover->GetMaxJumpHeight() )
+				{
+					// too high to jump
+					return -1.0f;
+				}
+				else if ( -deltaZ > m_mover->GetDeathDropHeight() )
+				{
+					// too far down to drop
+					return -1.0f;
+				}
+
+				// prefer to maintain our level
+				const float climbCost = 10.0f;
+				dist += climbCost * fabs( deltaZ );
+			}
+
+			cost = dist + m_ctx.GetTotalCost( fromArea );
+
+			
+			// Add in danger cost due to threat
+			// Assume straight line between areas and find closest point
+			// to the threat along that line segment. The distance between
+			// the threat and closest point on the line is the danger cost.		
+			
+			// path danger is CUMULATIVE
+			float dangerCost = m_ctx.GetCostSoFar( fromArea );
+			
+			Vector close;
+			float t;
+			CalcClosestPointOnLineSegment( m_threat->GetAbsOrigin(), area->GetCenter(), fromArea->GetCenter(), close, &t );
+			if ( t < 0.0f )
+			{
+				close = area->GetCenter();
+			}
+			else if ( t > 1.0f )
+			{
+				close = fromArea->GetCenter();
+			}
+
+			float rangeToThreat = ( m_threat->GetAbsOrigin() - close ).Length();
+
+			if ( rangeToThreat < maxThreatRange )
+			{
+				float dangerFactor = 1.0f - ( rangeToThreat / maxThreatRange );
+				dangerCost = dangerDensity * dangerFactor;
+
+				if ( m_me->IsDebugging( NEXTBOT_PATH ) )
+				{
+					NDebugOverlay::HorzArrow( fromArea->GetCenter(), area->GetCenter(), 5, 255 * dangerFactor, 0, 0, 255, true, debugDeltaT );
+
+					Vector to = close - m_threat->GetAbsOrigin();
+					to.NormalizeInPlace();
+
+					NDebugOverlay::Line( close, close - 50.0f * to, 255, 0, 0, true, debugDeltaT );
+				}
+			}
+			
+			cost += dangerCost;
+		}
+
+		return cost;
+	}
+	
+private:	
+	INextBot *m_me;
+	ILocomotion *m_mover;
+	
+	CBaseEntity *m_threat;
+	float m_retreatRange;
+
+	NavSearchContext &m_ctx;
+
+	enum { MAX_ADJ_AREAS = 64 };
+	
+	struct AdjInfo
+	{
+		CNavArea *area;
+		CNavLadder *ladder;
+		NavTraverseType how;		
+	};
+	
+	AdjInfo m_adjAreaVector[ MAX_ADJ_AREAS ];
+	int m_adjAreaIndex;
+	
+};
+
+class RetreatPath : public PathFollower
+{
+public:
+	CountdownTimer m_throttleTimer;						// require a minimum time between re-paths
+	EHANDLE m_pathThreat;								// the threat of our existing path
+	Vector m_pathThreatPos;								// where the threat was when the path was built
+	
+	struct vars_t : public PathFollower::vars_t
+	{
+		void dtor(PathFollower *base) override
+		{
+			PathFollower::vars_t::dtor(base);
+
+			RetreatPath *bytes{(RetreatPath *)base};
+			bytes->dtor();
+		}
+
+		float maxlen = 1000.0f;
+		float tolerancerate = 0.33f;
+		float mintolerance = 0.0f;
+		float repathtime = 0.5f;
+	};
+
+	vars_t &getvars()
+	{ return *(vars_t *)vars_ptr(); }
+	
+	void HookInvalidate()
+	{
+		m_throttleTimer.Invalidate();
+		m_pathThreat = NULL;
+		
+		RETURN_META(MRES_HANDLED);
+	}
+	
+	void ctor()
+	{
+		new (&m_throttleTimer) CountdownTimer();
+		new (&m_pathThreat) EHANDLE();
+		new (&m_pathThreatPos) Vector();
+		
+		m_throttleTimer.Invalidate();
+		m_pathThreat = NULL;
+		m_pathThreatPos = vec3_origin;
+	}
+
+	void dtor()
+	{
+		m_throttleTimer.~CountdownTimer();
+		m_pathThreat.~EHANDLE();
+		m_pathThreatPos.~Vector();
+	}
+
+	template <typename C = RetreatPath, typename T = vars_t>
+	static C *create()
+	{
+		C *bytes = (C *)PathFollower::create<C, T>();
+		bytes->ctor();
+		T &vars{PathFollower::getvars<C, T>(bytes)};
+		vars.hookids.emplace_back(SH_ADD_HOOK(Path, Invalidate, bytes, SH_MEMBER(bytes, &RetreatPath::HookInvalidate), true));
+		return bytes;
+	}
+
+	void Update( INextBot *bot, CBaseEntity *threat )
+	{
+		if ( threat == NULL )
+		{
+			return;
+		}
+
+		// if our path threat changed, repath immediately
+		if ( threat != m_pathThreat )
+		{
+			if ( bot->IsDebugging( NEXTBOT_PATH ) )
+			{
+				DevMsg( "%3.2f: bot(#%d) Chase path threat changed (from %X to %X).\n", gpGlobals->curtime, bot->GetEntity()->entindex(), m_pathThreat.Get(), threat );
+			}
+
+			Invalidate();
+		}
+
+		vars_t &vars{getvars()};
+
+		// maintain the path away from the threat
+		RefreshPath( vars, bot, threat );
+
+		// move along the path towards the threat
+		PathFollower::CallUpdate( bot );
+	}
+	
+	void RefreshPath( vars_t &vars, INextBot *bot, CBaseEntity *threat )
+	{
+		if ( threat == NULL )
+		{
+			if ( bot->IsDebugging( NEXTBOT_PATH ) )
+			{
+				DevMsg( "%3.2f: bot(#%d) CasePath::RefreshPath failed. No threat.\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
+			}
+			return;
+		}
+
+		// don't change our path if we're on a ladder
+		ILocomotion *mover = bot->GetLocomotionInterface();
+		if ( IsValid() && mover && mover->IsUsingLadder() )
+		{
+			if ( bot->IsDebugging( NEXTBOT_PATH ) )
+			{
+				DevMsg( "%3.2f: bot(#%d) RetreatPath::RefreshPath failed. Bot is on a ladder.\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
+			}
+			return;
+		}
+
+		// the closer we get, the more accurate our path needs to be
+		Vector to = threat->GetAbsOrigin() - bot->GetPosition();
+		
+		const float minTolerance = vars.mintolerance;
+		const float toleranceRate = vars.tolerancerate;
+		
+		float tolerance = minTolerance + toleranceRate * to.Length();
+
+		if ( !IsValid() || ( threat->GetAbsOrigin() - m_pathThreatPos ).IsLengthGreaterThan( tolerance ) )
+		{
+			if ( !m_throttleTimer.IsElapsed() )
+			{
+				// require a minimum time between repaths, as long as we have a path to follow
+				if ( bot->IsDebugging( NEXTBOT_PATH ) )
+				{
+					DevMsg( "%3.2f: bot(#%d) RetreatPath::RefreshPath failed. Rate throttled.\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
+				}
+				return;
+			}
+
+			// remember our path threat
+			m_pathThreat = threat;
+			m_pathThreatPos = threat->GetAbsOrigin();
+
+			RetreatPathBuilder retreat( bot, threat, vars.maxlen );
+
+			CNavArea *goalArea = retreat.ComputePath();
+
+			if ( goalArea )
+			{
+				AssemblePrecomputedPath( bot, goalArea->GetCenter(), goalArea, retreat.GetContext() );
+			}	
+			else
+			{
+				// all adjacent areas are too far away - just move directly away from threat
+				Vector to = threat->GetAbsOrigin() - bot->GetPosition();
+
+				BuildTrivialPath( bot, bot->GetPosition() - to );
+			}
+				
+			const float minRepathInterval = vars.repathtime;
+			m_throttleTimer.Start( minRepathInterval );
+		}
+	}
+	
+	float GetMaxPathLength( void )
+	{
+		return getvars().maxlen;
+	}
+};
+
+#if SOURCE_ENGINE == SE_TF2
+class CTFPathFollower : public PathFollower
+{
+public:
+	const Path::Segment *m_goal;					// our current goal along the path
+	float m_minLookAheadRange;
+
+	void ctor()
+	{
+		m_goal = NULL;
+		m_minLookAheadRange = 300.0f;
+	}
+
+	template <typename C = CTFPathFollower, typename T = vars_t>
+	static C *create()
+	{
+		C *bytes = (C *)PathFollower::create<C, T>(CTFPathFollowerCTOR);
+		bytes->ctor();
+		return bytes;
+	}
+	
+	float GetMinLookAheadDistance()
+	{
+		return m_minLookAheadRange;
+	}
+};
+#endif
+
+HandleType_t PathHandleType = 0;
+HandleType_t PackedPathHandleType = 0;
+HandleType_t PathCostProfileHandleType = 0;
+HandleType_t PathFollowerHandleType = 0;
+#if SOURCE_ENGINE == SE_TF2
+HandleType_t CTFPathFollowerHandleType = 0;
+#endif
+HandleType_t ChasePathHandleType = 0;
+HandleType_t DirectChasePathHandleType = 0;
+HandleType_t RetreatPathHandleType = 0;
+#if SOURCE_ENGINE == SE_LEFT4DEAD2
+HandleType_t InfectedChasePathHandleType = 0;
+#endif
+
+using pathfollower_hndl_map_t = std::unordered_map<PathFollower *, Handle_t>;
+static pathfollower_hndl_map_t pathfollower_hndl_map;
+
+template <typename T>
+class SPPathFollower : public T
+{
+public:
+	static_assert(std::is_base_of<PathFollower, T>::value, "");
+
+	struct vars_t : T::vars_t
+	{
+		Handle_t hndl{BAD_HANDLE};
+	};
+
+	vars_t &getvars()
+	{ return *(vars_t *)this->vars_ptr(); }
+
+	template <typename ...Args>
+	static SPPathFollower<T> *create(Args &&... args)
+	{
+		SPPathFollower<T> *bytes = reinterpret_cast<SPPathFollower<T> *>(T::template create<SPPathFollower<T>, vars_t>(args...));
+		return bytes;
+	}
+
+	void set_handle(Handle_t hndl)
+	{
+		pathfollower_hndl_map.emplace(static_cast<PathFollower *>(this), hndl);
+		getvars().hndl = hndl;
+	}
+
+	void handle_destroyed()
+	{
+		pathfollower_hndl_map_t::iterator it{pathfollower_hndl_map.find(static_cast<PathFollower *>(this))};
+		if(it != pathfollower_hndl_map.cend()) {
+			pathfollower_hndl_map.erase(it);
+		}
+	}
+};
+
+cell_t PathCTORNative(IPluginContext *pContext, const cell_t *params)
+{
+	Path *obj = Path::create();
+	Handle_t hndl = handlesys->CreateHandle(PathHandleType, obj, pContext->GetIdentity(), myself->GetIdentity(), nullptr);
+	return hndl;
+}
+
+cell_t PathFollowerCTORNative(IPluginContext *pContext, const cell_t *params)
+{
+	SPPathFollower<PathFollower> *obj = SPPathFollower<PathFollower>::create();
+	Handle_t hndl = handlesys->CreateHandle(PathFollowerHandleType, obj, pContext->GetIdentity(), myself->GetIdentity(), nullptr);
+	obj->set_handle(hndl);
+	return hndl;
+}
+
+class SPPathCost : public IPathCost
+{
+public:
+	SPPathCost(INextBot *entity_, IPluginFunction *callback_, cell_t data_)
+		: entity(entity_), callback(callback_), data(data_)
+	{
+		
+	}
+	
+	float operator()( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length ) const
+	{
+		cell_t res;
+		callback->PushCell((cell_t)entity);
+		callback->PushCell((cell_t)area);
+		callback->PushCell((cell_t)fromArea);
+		callback->PushCell((cell_t)ladder);
+		callback->PushCell((cell_t)elevator);
+		callback->PushCell(sp_ftoc(length));
+		callback->PushCell(data);
+		callback->Execute(&res);
+		return sp_ctof(res);
+	}
+	
+	IPluginFunction *callback;
+	INextBot *entity;
+	cell_t data;
+};
+
+#if SOURCE_ENGINE == SE_TF2
+bool TFGameRulesIsMannVsMachineMode()
+{
+	if(m_bPlayingMannVsMachineOffset == -1) {
+		return false;
+	}
+
+	void *gamerules = g_pSDKTools->GetGameRules();
+	if(!gamerules) {
+		return false;
+	}
+
+	return *(bool *)((unsigned char *)gamerules + m_bPlayingMannVsMachineOffset);
+}
+
+bool TFGameRulesIsTruceActive()
+{
+	if(m_bTruceActiveOffset == -1) {
+		return false;
+	}
+
+	void *gamerules = g_pSDKTools->GetGameRules();
+	if(!gamerules) {
+		return false;
+	}
+
+	return *(bool *)((unsigned char *)gamerules + m_bTruceActiveOffset);
+}
+#endif
+
+enum baseline_cost_flags_t : unsigned int
+{
+	cost_flags_none =         0,
+	cost_flags_mod_heavy =    (1 << 0),
+	cost_flags_safest =       (1 << 1),
+	cost_flags_discrete =     (1 << 2),
+	cost_flags_nojumping =    (1 << 3),
+	cost_flags_noladders =    (1 << 4),
+	cost_flags_nocrouch =     (1 << 5),
+	cost_flags_noenemyspawn = (1 << 6),
+	cost_flags_nowater =      (1 << 7),
+	cost_flags_fastest =      (1 << 8),
+	cost_flags_mod_small =    (1 << 9),
+};
+
+#define NB_PATHCOST_MOD_PERIOD 10.0f
+
+/**
+ * Native implementation of baseline_path_cost from nextbot.inc
+ * everything that doesn't change during a search is fetched once in the constructor, func_nav_cost multipliers included
+ *
+ * with gameThread false the cost can be evaluated on a worker thread:
+ * IsAreaTraversable is left to the caller
+ */
+class BaselinePathCost : public NativePathCost
+{
+public:
+	BaselinePathCost(INextBot *bot_, unsigned int flags_, bool gameThread_ = true)
+		: flags(flags_), gameThread(gameThread_)
+	{
+		mover = bot_->GetLocomotionInterface();
+		entity = bot_->GetEntity();
+		entindex = gamehelpers->EntityToBCompatRef(entity);
+		team = entity->GetTeamNumber();
+		stepHeight = mover->GetStepHeight();
+		maxJumpHeight = mover->GetMaxJumpHeight();
+		deathDropHeight = mover->GetDeathDropHeight();
+		timeMod = (int)floorf(gpGlobals->curtime / NB_PATHCOST_MOD_PERIOD) + 1;
+		g_NavConnectionGraph.EnsureBuilt();
+		graph = g_NavConnectionGraph.Snapshot();
+	#if SOURCE_ENGINE == SE_TF2
+		mvm = TFGameRulesIsMannVsMachineMode();
+		truce = TFGameRulesIsTruceActive();
+		
+		//tags and teams make func_nav_cost multipliers per bot, the ones that apply also go in the cache profile
+		funcNavProfile = 0;
+		for(CNavArea *area : g_NavFuncCostAreas.Areas()) {
+			float multiplier = area->ComputeFuncNavCost(entity);
+			if(multiplier != 1.0f) {
+				unsigned int id = area->GetID();
+				funcNavCosts.emplace(id, multiplier);
+				funcNavProfile = NavDerivedCache::Hash(&id, sizeof(id), funcNavProfile);
+				funcNavProfile = NavDerivedCache::Hash(&multiplier, sizeof(multiplier), funcNavProfile);
+			}
+		}
+	#endif
+	}
+	
+	bool GetCacheProfile( uint64_t &profile ) const override
+	{
+		//the mod costs are randomized per bot
+		if(flags & (cost_flags_mod_heavy|cost_flags_mod_small)) {
+			return false;
+		}
+		
+		const float heights[3]{stepHeight, maxJumpHeight, deathDropHeight};
+		unsigned int bits[3];
+		memcpy(bits, heights, sizeof(bits));
+		
+		profile = flags;
+		for(unsigned int value : bits) {
+			profile = profile * 31 + value;
+		}
+	#if SOURCE_ENGINE == SE_TF2
+		profile = profile * 31 + ((mvm ? 1 : 0) | (truce ? 2 : 0));
+		profile = profile * 31 + funcNavProfile;
+	#endif
+		return true;
+	}
+	
+	float GetMinCostScale() const override
+	{
+		//mod_small ignores the distance, combat intensity can scale it below 1
+		if(flags & cost_flags_mod_small) {
+			return 0.0f;
+		}
+		
+	#if SOURCE_ENGINE == SE_TF2
+		if(flags & cost_flags_safest) {
+			return 0.0f;
+		}
+	#endif
+		
+		//every other penalty multiplies by at least 1, func_nav_prefer is left to NavLandmarks
+		return 1.0f;
+	}
+	
+	float EdgeCost( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length ) const override
+	{
+		if(!fromArea) {
+			return 0.0f;
+		}
+		
+		if(gameThread && !mover->IsAreaTraversable(area)) {
+			return -1.0f;
+		}
+		
+	#if SOURCE_ENGINE == SE_TF2
+		CTFNavArea *tfarea = (CTFNavArea *)area;
+		
+		if(flags & cost_flags_noenemyspawn) {
+			switch(team) {
+				case TF_TEAM_RED: {
+					if(tfarea->HasAttributeTF(TF_NAV_SPAWN_ROOM_BLUE)) {
+						return -1.0f;
+					}
+					break;
+				}
+				case TF_TEAM_BLUE: {
+					if(tfarea->HasAttributeTF(TF_NAV_SPAWN_ROOM_RED)) {
+						return -1.0f;
+					}
+					break;
+				}
+				case TEAM_UNASSIGNED:
+				case TF_TEAM_HALLOWEEN: {
+					if(tfarea->HasAttributeTF(TF_NAV_SPAWN_ROOM_RED) ||
+						tfarea->HasAttributeTF(TF_NAV_SPAWN_ROOM_BLUE)) {
+						return -1.0f;
+					}
+					break;
+				}
+				case TF_TEAM_PVE_INVADERS_GIANTS: {
+					if(mvm && tfarea->HasAttributeTF(TF_NAV_SPAWN_ROOM_RED)) {
+						return -1.0f;
+					}
+					break;
+				}
+			}
+		}
+	#endif
+		
+		float dist = 0.0f;
+		if(ladder) {
+			if(flags & cost_flags_noladders) {
+				return -1.0f;
+			}
+			
+			const float ladderPenalty = 1.0f;
+			dist = ladder->m_length * ladderPenalty;
+		} else if(length > 0.0f) {
+			dist = length;
+		} else {
+			dist = (area->GetCenter() - fromArea->GetCenter()).Length();
+		}
+		
+		float deltaZ = graph->GetHeightChange(fromArea, area);
+		if(deltaZ >= stepHeight || area->HasAttributes(NAV_MESH_JUMP)) {
+			if((flags & cost_flags_nojumping) || deltaZ >= maxJumpHeight) {
+				return -1.0f;
+			}
+			
+			const float jumpPenalty = 2.0f;
+			dist *= jumpPenalty;
+		} else if(deltaZ < -deathDropHeight) {
+			return -1.0f;
+		}
+		
+		if(area->IsUnderwater()) {
+			if(flags & cost_flags_nowater) {
+				return -1.0f;
+			}
+			
+			const float underwaterPenalty = 20.0f;
+			dist *= underwaterPenalty;
+		}
+		
+		if(area->HasAttributes(NAV_MESH_CROUCH)) {
+			if(flags & cost_flags_nocrouch) {
+				return -1.0f;
+			}
+			
+			const float crouchPenalty = (flags & cost_flags_fastest) ? 20.0f : 5.0f;
+			dist *= crouchPenalty;
+		}
+		
+		if(area->HasAttributes(NAV_MESH_WALK)) {
+			const float walkPenalty = (flags & cost_flags_fastest) ? 20.0f : 5.0f;
+			dist *= walkPenalty;
+		}
+		
+		if(area->HasAttributes(NAV_MESH_AVOID)) {
+			const float avoidPenalty = 20.0f;
+			dist *= avoidPenalty;
+		}
+		
+		if(area->IsDamaging()) {
+			const float damagingPenalty = 100.0f;
+			dist *= damagingPenalty;
+		}
+		
+	#if SOURCE_ENGINE == SE_TF2
+		if(flags & cost_flags_safest) {
+			if(tfarea->IsInCombat()) {
+				const float combatDangerCost = 4.0f;
+				dist *= (combatDangerCost * tfarea->GetCombatIntensity());
+			}
+			
+			if(!truce) {
+				const float enemySentryDangerCost = 5.0f;
+				
+				switch(team) {
+					case TF_TEAM_RED: {
+						if(tfarea->HasAttributeTF(TF_NAV_BLUE_SENTRY_DANGER)) {
+							dist *= enemySentryDangerCost;
+						}
+						break;
+					}
+					case TF_TEAM_BLUE: {
+						if(tfarea->HasAttributeTF(TF_NAV_RED_SENTRY_DANGER)) {
+							dist *= enemySentryDangerCost;
+						}
+						break;
+					}
+					case TEAM_UNASSIGNED:
+					case TF_TEAM_HALLOWEEN: {
+						if(tfarea->HasAttributeTF(TF_NAV_RED_SENTRY_DANGER) ||
+							tfarea->HasAttributeTF(TF_NAV_BLUE_SENTRY_DANGER)) {
+							dist *= enemySentryDangerCost;
+						}
+						break;
+					}
+					case TF_TEAM_PVE_INVADERS_GIANTS: {
+						if(mvm && tfarea->HasAttributeTF(TF_NAV_RED_SENTRY_DANGER)) {
+							dist *= enemySentryDangerCost;
+						}
+						break;
+					}
+				}
+			}
+		}
+		
+		if(flags & cost_flags_discrete) {
+			const float friendlySentryDangerCost = 2.5f;
+			
+			if(!truce) {
+				switch(team) {
+					case TF_TEAM_BLUE: {
+						if(tfarea->HasAttributeTF(TF_NAV_BLUE_SENTRY_DANGER)) {
+							dist *= friendlySentryDangerCost;
+						}
+						break;
+					}
+					case TF_TEAM_RED: {
+						if(tfarea->HasAttributeTF(TF_NAV_RED_SENTRY_DANGER)) {
+							dist *= friendlySentryDangerCost;
+						}
+						break;
+					}
+					case TF_TEAM_PVE_INVADERS_GIANTS: {
+						if(mvm && tfarea->HasAttributeTF(TF_NAV_BLUE_SENTRY_DANGER)) {
+							dist *= friendlySentryDangerCost;
+						}
+						break;
+					}
+				}
+			} else {
+				if(tfarea->HasAttributeTF(TF_NAV_BLUE_SENTRY_DANGER)) {
+					dist *= friendlySentryDangerCost;
+				}
+				
+				if(tfarea->HasAttributeTF(TF_NAV_RED_SENTRY_DANGER)) {
+					dist *= friendlySentryDangerCost;
+				}
+			}
+		}
+	#endif
+		
+		float cost = -1.0f;
+		
+		//same 32-bit wrapping as the sourcepawn version
+		if(flags & cost_flags_mod_small) {
+			int uniqueID = (int)((uintptr_t)area >> 7);
+			int nRandomCost = ((int)((unsigned int)entindex * (unsigned int)uniqueID * (unsigned int)timeMod) % 293);
+			cost += (1.0f + (float)nRandomCost);
+		} else if(flags & cost_flags_mod_heavy) {
+			int seed = (int)((unsigned int)entindex * (unsigned int)area->GetID() * (unsigned int)timeMod);
+			float preference = 1.0f + 50.0f * ( 1.0f + cosf( (float)seed ) );
+			cost = (dist * preference);
+		} else {
+			cost = dist;
+		}
+		
+	#if SOURCE_ENGINE == SE_TF2
+		if(area->HasAttributes(NAV_MESH_FUNC_COST)) {
+			std::unordered_map<unsigned int, float>::const_iterator it{funcNavCosts.find(area->GetID())};
+			if(it != funcNavCosts.cend()) {
+				cost *= it->second;
+			}
+		}
+	#endif
+		
+		return cost;
+	}
+	
+	ILocomotion *mover;
+	CBaseCombatCharacter *entity;
+	int entindex;
+	int team;
+	float stepHeight;
+	float maxJumpHeight;
+	float deathDropHeight;
+	int timeMod;
+	NavConnectionGraph::snapshot_t graph;
+#if SOURCE_ENGINE == SE_TF2
+	bool mvm;
+	bool truce;
+	std::unordered_map<unsigned int, float> funcNavCosts;
+	uint64_t funcNavProfile;
+#endif
+	unsigned int flags;
+	bool gameThread;
+};
+
+/**
+ * Cost description compiled from a KeyValues section, see PathCostProfile in nextbot.inc
+ * a negative multiplier forbids the areas it applies to, an empty section costs the same as cost_flags_none
+ */
+class PathCostProfile
+{
+public:
+	typedef std::vector<std::pair<unsigned int, float>> scale_list_t;
+
+	// false with error set if kv names something that isn't known
+	bool Compile(KeyValues *kv, std::string &error);
+
+	float ladderScale = 1.0f;
+	float jumpScale = 2.0f;
+	float underwaterScale = 20.0f;
+	float damagingScale = 100.0f;
+	//negative uses the bot's locomotion
+	float maxJumpHeight = -1.0f;
+	float deathDropHeight = -1.0f;
+	unsigned int forbiddenAttributes = 0;
+	scale_list_t attributeScales;
+#if SOURCE_ENGINE == SE_TF2
+	unsigned int forbiddenAttributesTF = 0;
+	scale_list_t attributeScalesTF;
+	//team rules, resolved against the bot's team by ProfilePathCost
+	float enemySpawnScale = 1.0f;
+	float ownSpawnScale = 1.0f;
+	float enemySentryScale = 1.0f;
+	float ownSentryScale = 1.0f;
+	float combatScale = 0.0f;
+	bool funcNavCost = true;
+#endif
+	float minCostScale = 1.0f;
+	uint64_t hash = 0;
+
+private:
+	static void SplitScales(scale_list_t &list, unsigned int &forbidden);
+	void ApplyMinScale(float scale);
+	void HashBytes(const void *data, size_t size);
+};
+
+struct path_cost_attribute_name_t
+{
+	const char *name;
+	unsigned int bits;
+};
+
+//jump has its own key since it also covers step ups
+static const path_cost_attribute_name_t g_PathCostAttributeNames[] = {
+	{"crouch", NAV_MESH_CROUCH},
+	{"precise", NAV_MESH_PRECISE},
+	{"no_jump", NAV_MESH_NO_JUMP},
+	{"stop", NAV_MESH_STOP},
+	{"run", NAV_MESH_RUN},
+	{"walk", NAV_MESH_WALK},
+	{"avoid", NAV_MESH_AVOID},
+	{"transient", NAV_MESH_TRANSIENT},
+	{"dont_hide", NAV_MESH_DONT_HIDE},
+	{"stand", NAV_MESH_STAND},
+	{"no_hostages", NAV_MESH_NO_HOSTAGES},
+	{"stairs", NAV_MESH_STAIRS},
+	{"no_merge", NAV_MESH_NO_MERGE},
+	{"obstacle_top", NAV_MESH_OBSTACLE_TOP},
+	{"cliff", NAV_MESH_CLIFF},
+	{"has_elevator", NAV_MESH_HAS_ELEVATOR},
+};
+
+#if SOURCE_ENGINE == SE_TF2
+static const path_cost_attribute_name_t g_PathCostAttributeNamesTF[] = {
+	{"blocked", TF_NAV_BLOCKED},
+	{"spawn_room_red", TF_NAV_SPAWN_ROOM_RED},
+	{"spawn_room_blue", TF_NAV_SPAWN_ROOM_BLUE},
+	{"spawn_room_exit", TF_NAV_SPAWN_ROOM_EXIT},
+	{"has_ammo", TF_NAV_HAS_AMMO},
+	{"has_health", TF_NAV_HAS_HEALTH},
+	{"control_point", TF_NAV_CONTROL_POINT},
+	{"blue_sentry_danger", TF_NAV_BLUE_SENTRY_DANGER},
+	{"red_sentry_danger", TF_NAV_RED_SENTRY_DANGER},
+	{"blue_setup_gate", TF_NAV_BLUE_SETUP_GATE},
+	{"red_setup_gate", TF_NAV_RED_SETUP_GATE},
+	{"blocked_after_point_capture", TF_NAV_BLOCKED_AFTER_POINT_CAPTURE},
+	{"blocked_until_point_capture", TF_NAV_BLOCKED_UNTIL_POINT_CAPTURE},
+	{"blue_one_way_door", TF_NAV_BLUE_ONE_WAY_DOOR},
+	{"red_one_way_door", TF_NAV_RED_ONE_WAY_DOOR},
+	{"sniper_spot", TF_NAV_SNIPER_SPOT},
+	{"sentry_spot", TF_NAV_SENTRY_SPOT},
+	{"escape_route", TF_NAV_ESCAPE_ROUTE},
+	{"escape_route_visible", TF_NAV_ESCAPE_ROUTE_VISIBLE},
+	{"no_spawning", TF_NAV_NO_SPAWNING},
+	{"rescue_closet", TF_NAV_RESCUE_CLOSET},
+	{"bomb_can_drop_here", TF_NAV_BOMB_CAN_DROP_HERE},
+	{"door_never_blocks", TF_NAV_DOOR_NEVER_BLOCKS},
+	{"door_always_blocks", TF_NAV_DOOR_ALWAYS_BLOCKS},
+	{"unblockable", TF_NAV_UNBLOCKABLE},
+};
+#endif
+
+template <size_t N>
+static bool PathCostCompileSection(KeyValues *section, const path_cost_attribute_name_t (&names)[N], PathCostProfile::scale_list_t &list, std::string &error)
+{
+	for(KeyValues *sub = section->GetFirstSubKey(); sub; sub = sub->GetNextKey()) {
+		const char *name = sub->GetName();
+		
+		size_t i = 0;
+		for(; i < N; ++i) {
+			if(strcmp(names[i].name, name) == 0) {
+				break;
+			}
+		}
+		
+		if(i == N) {
+			error = "unknown attribute \"";
+			error += name;
+			error += "\" in \"";
+			error += section->GetName();
+			error += "\"";
+			return false;
+		}
+		
+		PathCostProfile::scale_list_t::iterator it = std::find_if(list.begin(), list.end(),
+			[&names, i](const std::pair<unsigned int, float> &rule) { return rule.first == names[i].bits; });
+		if(it != list.end()) {
+			it->second = sub->GetFloat();
+		} else {
+			list.emplace_back(names[i].bits, sub->GetFloat());
+		}
+	}
+	
+	return true;
+}
+
+void PathCostProfile::SplitScales(scale_list_t &list, unsigned int &forbidden)
+{
+	scale_list_t kept;
+	for(const std::pair<unsigned int, float> &rule : list) {
+		if(rule.second < 0.0f) {
+			forbidden |= rule.first;
+		} else if(rule.second != 1.0f) {
+			kept.emplace_back(rule);
+		}
+	}
+	
+	list.swap(kept);
+}
+
+void PathCostProfile::ApplyMinScale(float scale)
+{
+	//every multiplier below 1 can apply to the same edge
+	if(scale >= 0.0f && scale < 1.0f) {
+		minCostScale *= scale;
+	}
+}
+
+void PathCostProfile::HashBytes(const void *data, size_t size)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	for(size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+}
+
+bool PathCostProfile::Compile(KeyValues *kv, std::string &error)
+{
+	ladderScale = kv->GetFloat("ladder", 1.0f);
+	jumpScale = kv->GetFloat("jump", 2.0f);
+	underwaterScale = kv->GetFloat("underwater", 20.0f);
+	damagingScale = kv->GetFloat("damaging", 100.0f);
+	maxJumpHeight = kv->GetFloat("max_jump_height", -1.0f);
+	deathDropHeight = kv->GetFloat("death_drop_height", -1.0f);
+	
+	//same penalties as baseline_path_cost
+	attributeScales.clear();
+	attributeScales.emplace_back(NAV_MESH_CROUCH, 5.0f);
+	attributeScales.emplace_back(NAV_MESH_WALK, 5.0f);
+	attributeScales.emplace_back(NAV_MESH_AVOID, 20.0f);
+	
+	KeyValues *section = kv->FindKey("attributes");
+	if(section && !PathCostCompileSection(section, g_PathCostAttributeNames, attributeScales, error)) {
+		return false;
+	}
+	
+	forbiddenAttributes = 0;
+	SplitScales(attributeScales, forbiddenAttributes);
+	
+#if SOURCE_ENGINE == SE_TF2
+	attributeScalesTF.clear();
+	section = kv->FindKey("tf_attributes");
+	if(section && !PathCostCompileSection(section, g_PathCostAttributeNamesTF, attributeScalesTF, error)) {
+		return false;
+	}
+	
+	forbiddenAttributesTF = 0;
+	SplitScales(attributeScalesTF, forbiddenAttributesTF);
+	
+	section = kv->FindKey("team");
+	if(section) {
+		for(KeyValues *sub = section->GetFirstSubKey(); sub; sub = sub->GetNextKey()) {
+			const char *name = sub->GetName();
+			if(strcmp(name, "enemy_spawn") == 0) {
+				enemySpawnScale = sub->GetFloat();
+			} else if(strcmp(name, "own_spawn") == 0) {
+				ownSpawnScale = sub->GetFloat();
+			} else if(strcmp(name, "enemy_sentry") == 0) {
+				enemySentryScale = sub->GetFloat();
+			} else if(strcmp(name, "own_sentry") == 0) {
+				ownSentryScale = sub->GetFloat();
+			} else {
+				error = "unknown rule \"";
+				error += name;
+				error += "\" in \"team\"";
+				return false;
+			}
+		}
+	}
+	
+	combatScale = kv->GetFloat("combat", 0.0f);
+	funcNavCost = kv->GetInt("func_nav_cost", 1) != 0;
+#endif
+	
+	minCostScale = 1.0f;
+	ApplyMinScale(ladderScale);
+	ApplyMinScale(jumpScale);
+	ApplyMinScale(underwaterScale);
+	ApplyMinScale(damagingScale);
+	for(const std::pair<unsigned int, float> &rule : attributeScales) {
+		ApplyMinScale(rule.second);
+	}
+	
+#if SOURCE_ENGINE == SE_TF2
+	for(const std::pair<unsigned int, float> &rule : attributeScalesTF) {
+		ApplyMinScale(rule.second);
+	}
+	
+	ApplyMinScale(enemySpawnScale);
+	ApplyMinScale(ownSpawnScale);
+	ApplyMinScale(enemySentryScale);
+	ApplyMinScale(ownSentryScale);
+	
+	//combat intensity goes down to 0
+	if(combatScale > 0.0f) {
+		minCostScale = 0.0f;
+	}
+#endif
+	
+	hash = 0xcbf29ce484222325ull;
+	HashBytes(&ladderScale, sizeof(ladderScale));
+	HashBytes(&jumpScale, sizeof(jumpScale));
+	HashBytes(&underwaterScale, sizeof(underwaterScale));
+	HashBytes(&damagingScale, sizeof(damagingScale));
+	HashBytes(&maxJumpHeight, sizeof(maxJumpHeight));
+	HashBytes(&deathDropHeight, sizeof(deathDropHeight));
+	HashBytes(&forbiddenAttributes, sizeof(forbiddenAttributes));
+	HashBytes(attributeScales.data(), attributeScales.size() * sizeof(attributeScales[0]));
+#if SOURCE_ENGINE == SE_TF2
+	HashBytes(&forbiddenAttributesTF, sizeof(forbiddenAttributesTF));
+	HashBytes(attributeScalesTF.data(), attributeScalesTF.size() * sizeof(attributeScalesTF[0]));
+	HashBytes(&enemySpawnScale, sizeof(enemySpawnScale));
+	HashBytes(&ownSpawnScale, sizeof(ownSpawnScale));
+	HashBytes(&enemySentryScale, sizeof(enemySentryScale));
+	HashBytes(&ownSentryScale, sizeof(ownSentryScale));
+	HashBytes(&combatScale, sizeof(combatScale));
+	HashBytes(&funcNavCost, sizeof(funcNavCost));
+#endif
+	
+	return true;
+}
+
+/**
+ * Evaluates a PathCostProfile for one bot
+ * the team rules are turned into TF attribute rules here so EdgeCost only tests bits
+ */
+class ProfilePathCost : public NativePathCost
+{
+public:
+	ProfilePathCost(INextBot *bot_, const PathCostProfile &profile_)
+		: profile(profile_)
+	{
+		mover = bot_->GetLocomotionInterface();
+		entity = bot_->GetEntity();
+		team = entity->GetTeamNumber();
+		stepHeight = mover->GetStepHeight();
+		maxJumpHeight = (profile.maxJumpHeight >= 0.0f) ? profile.maxJumpHeight : mover->GetMaxJumpHeight();
+		deathDropHeight = (profile.deathDropHeight >= 0.0f) ? profile.deathDropHeight : mover->GetDeathDropHeight();
+		g_NavConnectionGraph.EnsureBuilt();
+		graph = g_NavConnectionGraph.Snapshot();
+	#if SOURCE_ENGINE == SE_TF2
+		mvm = TFGameRulesIsMannVsMachineMode();
+		truce = TFGameRulesIsTruceActive();
+		
+		forbiddenAttributesTF = profile.forbiddenAttributesTF;
+		attributeScalesTF = profile.attributeScalesTF;
+		
+		int enemySpawn = 0;
+		int ownSpawn = 0;
+		int enemySentry = 0;
+		int ownSentry = 0;
+		
+		switch(team) {
+			case TF_TEAM_RED: {
+				enemySpawn = TF_NAV_SPAWN_ROOM_BLUE;
+				ownSpawn = TF_NAV_SPAWN_ROOM_RED;
+				enemySentry = TF_NAV_BLUE_SENTRY_DANGER;
+				ownSentry = TF_NAV_RED_SENTRY_DANGER;
+				break;
+			}
+			case TF_TEAM_BLUE: {
+				enemySpawn = TF_NAV_SPAWN_ROOM_RED;
+				ownSpawn = TF_NAV_SPAWN_ROOM_BLUE;
+				enemySentry = TF_NAV_RED_SENTRY_DANGER;
+				ownSentry = TF_NAV_BLUE_SENTRY_DANGER;
+				break;
+			}
+			case TEAM_UNASSIGNED:
+			case TF_TEAM_HALLOWEEN: {
+				enemySpawn = TF_NAV_SPAWN_ROOM_RED|TF_NAV_SPAWN_ROOM_BLUE;
+				enemySentry = TF_NAV_RED_SENTRY_DANGER|TF_NAV_BLUE_SENTRY_DANGER;
+				break;
+			}
+			case TF_TEAM_PVE_INVADERS_GIANTS: {
+				if(mvm) {
+					enemySpawn = TF_NAV_SPAWN_ROOM_RED;
+					enemySentry = TF_NAV_RED_SENTRY_DANGER;
+					ownSentry = TF_NAV_BLUE_SENTRY_DANGER;
+				}
+				break;
+			}
+		}
+		
+		//nobody shoots during a truce
+		if(truce) {
+			ownSentry |= enemySentry;
+			enemySentry = 0;
+		}
+		
+		AddTeamRule(enemySpawn, profile.enemySpawnScale);
+		AddTeamRule(ownSpawn, profile.ownSpawnScale);
+		AddTeamRule(enemySentry, profile.enemySentryScale);
+		AddTeamRule(ownSentry, profile.ownSentryScale);
+		
+		//same as BaselinePathCost, the multipliers that apply to this bot go in the cache profile
+		funcNavProfile = 0;
+		if(profile.funcNavCost) {
+			for(CNavArea *area : g_NavFuncCostAreas.Areas()) {
+				float multiplier = area->ComputeFuncNavCost(entity);
+				if(multiplier != 1.0f) {
+					unsigned int id = area->GetID();
+					funcNavCosts.emplace(id, multiplier);
+					funcNavProfile = NavDerivedCache::Hash(&id, sizeof(id), funcNavProfile);
+					funcNavProfile = NavDerivedCache::Hash(&multiplier, sizeof(multiplier), funcNavProfile);
+				}
+			}
+		}
+	#endif
+	}
+	
+	bool GetCacheProfile( uint64_t &profile_ ) const override
+	{
+	#if SOURCE_ENGINE == SE_TF2
+		//combat intensity changes while the cached route is reused
+		if(profile.combatScale > 0.0f) {
+			return false;
+		}
+	#endif
+		
+		const float heights[3]{stepHeight, maxJumpHeight, deathDropHeight};
+		unsigned int bits[3];
+		memcpy(bits, heights, sizeof(bits));
+		
+		profile_ = profile.hash;
+		profile_ = profile_ * 31 + (unsigned int)team;
+		for(unsigned int value : bits) {
+			profile_ = profile_ * 31 + value;
+		}
+	#if SOURCE_ENGINE == SE_TF2
+		profile_ = profile_ * 31 + ((mvm ? 1 : 0) | (truce ? 2 : 0));
+		profile_ = profile_ * 31 + funcNavProfile;
+	#endif
+		return true;
+	}
+	
+	float GetMinCostScale() const override
+	{
+		//func_nav_prefer is left to NavLandmarks like the baseline cost
+		return profile.minCostScale;
+	}
+	
+	float EdgeCost( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length ) const override
+	{
+		if(!fromArea) {
+			return 0.0f;
+		}
+		
+		if(!mover->IsAreaTraversable(area)) {
+			return -1.0f;
+		}
+		
+		if(area->HasAttributes(profile.forbiddenAttributes)) {
+			return -1.0f;
+		}
+		
+	#if SOURCE_ENGINE == SE_TF2
+		CTFNavArea *tfarea = (CTFNavArea *)area;
+		
+		if(tfarea->HasAttributeTF(forbiddenAttributesTF)) {
+			return -1.0f;
+		}
+	#endif
+		
+		float dist = 0.0f;
+		if(ladder) {
+			if(profile.ladderScale < 0.0f) {
+				return -1.0f;
+			}
+			
+			dist = ladder->m_length * profile.ladderScale;
+		} else if(length > 0.0f) {
+			dist = length;
+		} else {
+			dist = (area->GetCenter() - fromArea->GetCenter()).Length();
+		}
+		
+		float deltaZ = graph->GetHeightChange(fromArea, area);
+		if(deltaZ >= stepHeight || area->HasAttributes(NAV_MESH_JUMP)) {
+			if(profile.jumpScale < 0.0f || deltaZ >= maxJumpHeight) {
+				return -1.0f;
+			}
+			
+			dist *= profile.jumpScale;
+		} else if(deltaZ < -deathDropHeight) {
+			return -1.0f;
+		}
+		
+		if(area->IsUnderwater()) {
+			if(profile.underwaterScale < 0.0f) {
+				return -1.0f;
+			}
+			
+			dist *= profile.underwaterScale;
+		}
+		
+		if(area->IsDamaging()) {
+			if(profile.damagingScale < 0.0f) {
+				return -1.0f;
+			}
+			
+			dist *= profile.damagingScale;
+		}
+		
+		for(const std::pair<unsigned int, float> &rule : profile.attributeScales) {
+			if(area->HasAttributes(rule.first)) {
+				dist *= rule.second;
+			}
+		}
+		
+	#if SOURCE_ENGINE == SE_TF2
+		for(const std::pair<unsigned int, float> &rule : attributeScalesTF) {
+			if(tfarea->HasAttributeTF(rule.first)) {
+				dist *= rule.second;
+			}
+		}
+		
+		if(profile.combatScale > 0.0f && tfarea->IsInCombat()) {
+			dist *= (profile.combatScale * tfarea->GetCombatIntensity());
+		}
+		
+		if(area->HasAttributes(NAV_MESH_FUNC_COST)) {
+			std::unordered_map<unsigned int, float>::const_iterator it{funcNavCosts.find(area->GetID())};
+			if(it != funcNavCosts.cend()) {
+				dist *= it->second;
+			}
+		}
+	#endif
+		
+		return dist;
+	}
+	
+#if SOURCE_ENGINE == SE_TF2
+	void AddTeamRule(int bits, float scale)
+	{
+		if(bits == 0 || scale == 1.0f) {
+			return;
+		}
+		
+		if(scale < 0.0f) {
+			forbiddenAttributesTF |= bits;
+		} else {
+			attributeScalesTF.emplace_back(bits, scale);
+		}
+	}
+#endif
+	
+	const PathCostProfile &profile;
+	ILocomotion *mover;
+	CBaseCombatCharacter *entity;
+	int team;
+	float stepHeight;
+	float maxJumpHeight;
+	float deathDropHeight;
+	NavConnectionGraph::snapshot_t graph;
+#if SOURCE_ENGINE == SE_TF2
+	bool mvm;
+	bool truce;
+	unsigned int forbiddenAttributesTF;
+	PathCostProfile::scale_list_t attributeScalesTF;
+	std::unordered_map<unsigned int, float> funcNavCosts;
+	uint64_t funcNavProfile;
+#endif
+};
+
+cell_t PathComputeVectorNative(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	Path *obj = nullptr;
+	HandleError err = handlesys->ReadHandle(params[1], PathHandleType, &security, (void **)&obj);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+	}
+	
+	INextBot *bot = (INextBot *)params[2];
+	
+	cell_t *value = nullptr;
+	pContext->LocalToPhysAddr(params[3], &value);
+	Vector goal = Vector(sp_ctof(value[0]), sp_ctof(value[1]), sp_ctof(value[2]));
+	
+	float maxPathLength = sp_ctof(params[6]);
+	
+	bool includeGoalIfPathFails = params[7];
+	
+	PathSearchMode mode = (params[0] >= 8) ? (PathSearchMode)params[8] : PATH_SEARCH_FULL;
+	
+	int computeFlags = (params[0] >= 9) ? params[9] : 0;
+	
+	IPluginFunction *callback = pContext->GetFunctionById(params[4]);
+	if(!callback) {
+		BaselinePathCost cost(bot, params[5]);
+		return obj->Compute(bot, goal, cost, maxPathLength, includeGoalIfPathFails, mode, NULL, computeFlags);
+	}
+	
+	SPPathCost cost(bot, callback, params[5]);
+	return obj->Compute(bot, goal, cost, maxPathLength, includeGoalIfPathFails, mode, NULL, computeFlags);
+}
+
+cell_t PathComputeEntityNative(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	Path *obj = nullptr;
+	HandleError err = handlesys->ReadHandle(params[1], PathHandleType, &security, (void **)&obj);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+	}
+	
+	CBaseEntity *pSubject = gamehelpers->ReferenceToEntity(params[3]);
+	if(!pSubject)
+	{
+		return pContext->ThrowNativeError("Invalid Entity Reference/Index %i", params[3]);
+	}
+	
+	CBaseCombatCharacter *pCombat = pSubject->MyCombatCharacterPointer();
+	if(!pCombat)
+	{
+		return pContext->ThrowNativeError("Invalid Entity Reference/Index %i", params[3]);
+	}
+	
+	INextBot *bot = (INextBot *)params[2];
+	
+	float maxPathLength = sp_ctof(params[6]);
+	
+	bool includeGoalIfPathFails = params[7];
+	
+	PathSearchMode mode = (params[0] >= 8) ? (PathSearchMode)params[8] : PATH_SEARCH_FULL;
+	
+	int computeFlags = (params[0] >= 9) ? params[9] : 0;
+	
+	IPluginFunction *callback = pContext->GetFunctionById(params[4]);
+	if(!callback) {
+		BaselinePathCost cost(bot, params[5]);
+		return obj->Compute(bot, pCombat, cost, maxPathLength, includeGoalIfPathFails, mode, NULL, computeFlags);
+	}
+	
+	SPPathCost cost(bot, callback, params[5]);
+	return obj->Compute(bot, pCombat, cost, maxPathLength, includeGoalIfPathFails, mode, NULL, computeFlags);
+}
+
+cell_t PathCostProfileCTORNative(IPluginContext *pContext, const cell_t *params)
+{
+	HandleError err = HandleError_None;
+	KeyValues *kv = smutils->ReadKeyValuesHandle(params[1], &err);
+	if(!kv)
+	{
+		return pContext->ThrowNativeError("Invalid KeyValues Handle %x (error: %d)", params[1], err);
+	}
+	
+	PathCostProfile *obj = new PathCostProfile();
+	
+	std::string error;
+	if(!obj->Compile(kv, error)) {
+		delete obj;
+		return pContext->ThrowNativeError("Invalid path cost profile: %s", error.c_str());
+	}
+	
+	Handle_t hndl = handlesys->CreateHandle(PathCostProfileHandleType, obj, pContext->GetIdentity(), myself->GetIdentity(), nullptr);
+	return hndl;
+}
+
+cell_t PathComputeVectorProfileNative(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	Path *obj = nullptr;
+	HandleError err = handlesys->ReadHandle(params[1], PathHandleType, &security, (void **)&obj);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+	}
+	
+	PathCostProfile *profile = nullptr;
+	err = handlesys->ReadHandle(params[4], PathCostProfileHandleType, &security, (void **)&profile);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[4], err);
+	}
+	
+	INextBot *bot = (INextBot *)params[2];
+	
+	cell_t *value = nullptr;
+	pContext->LocalToPhysAddr(params[3], &value);
+	Vector goal = Vector(sp_ctof(value[0]), sp_ctof(value[1]), sp_ctof(value[2]));
+	
+	float maxPathLength = sp_ctof(params[5]);
+	
+	bool includeGoalIfPathFails = params[6];
+	
+	PathSearchMode mode = (PathSearchMode)params[7];
+	
+	int computeFlags = params[8];
+	
+	ProfilePathCost cost(bot, *profile);
+	return obj->Compute(bot, goal, cost, maxPathLength, includeGoalIfPathFails, mode, NULL, computeFlags);
+}
+
+cell_t PathComputeEntityProfileNative(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	Path *obj = nullptr;
+	HandleError err = handlesys->ReadHandle(params[1], PathHandleType, &security, (void **)&obj);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+	}
+	
+	PathCostProfile *profile = nullptr;
+	err = handlesys->ReadHandle(params[4], PathCostProfileHandleType, &security, (void **)&profile);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[4], err);
+	}
+	
+	CBaseEntity *pSubject = gamehelpers->ReferenceToEntity(params[3]);
+	if(!pSubject)
+	{
+		return pContext->ThrowNativeError("Invalid Entity Reference/Index %i", params[3]);
+	}
+	
+	CBaseCombatCharacter *pCombat = pSubject->MyCombatCharacterPointer();
+	if(!pCombat)
+	{
+		return pContext->ThrowNativeError("Invalid Entity Reference/Index %i", params[3]);
+	}
+	
+	INextBot *bot = (INextBot *)params[2];
+	
+	float maxPathLength = sp_ctof(params[5]);
+	
+	bool includeGoalIfPathFails = params[6];
+	
+	PathSearchMode mode = (PathSearchMode)params[7];
+	
+	int computeFlags = params[8];
+	
+	ProfilePathCost cost(bot, *profile);
+	return obj->Compute(bot, pCombat, cost, maxPathLength, includeGoalIfPathFails, mode, NULL, computeFlags);
+}
+
+enum PathOpenGoalType
+{
+	OPEN_GOAL_ATTRIBUTE,
+	OPEN_GOAL_TF_ATTRIBUTE,
+	OPEN_GOAL_AWAY_FROM_THREAT,
+	OPEN_GOAL_COMBAT,
+	OPEN_GOAL_ENTITY_CLASS,
+};
+
+/**
+ * Built-in goal selectors for Path::ComputeWithOpenGoal
+ * they're called for every area the search reaches so they only read the area and what the constructor fetched
+ */
+class NearestAttributeGoalSelector : public IPathOpenGoalSelector
+{
+public:
+	NearestAttributeGoalSelector(int attributes_)
+		: attributes(attributes_)
+	{
+	}
+	
+	CNavArea *operator()(CNavArea *currentGoal, CNavArea *newArea) const override
+	{
+		if(!newArea->HasAttributes(attributes)) {
+			return currentGoal;
+		}
+		
+		if(!currentGoal || newArea->GetCostSoFar() < currentGoal->GetCostSoFar()) {
+			return newArea;
+		}
+		
+		return currentGoal;
+	}
+	
+	int attributes;
+};
+
+#if SOURCE_ENGINE == SE_TF2
+class NearestTFAttributeGoalSelector : public IPathOpenGoalSelector
+{
+public:
+	NearestTFAttributeGoalSelector(int attributes_)
+		: attributes(attributes_)
+	{
+	}
+	
+	CNavArea *operator()(CNavArea *currentGoal, CNavArea *newArea) const override
+	{
+		if(!((CTFNavArea *)newArea)->HasAttributeTF(attributes)) {
+			return currentGoal;
+		}
+		
+		if(!currentGoal || newArea->GetCostSoFar() < currentGoal->GetCostSoFar()) {
+			return newArea;
+		}
+		
+		return currentGoal;
+	}
+	
+	int attributes;
+};
+
+class CombatGoalSelector : public IPathOpenGoalSelector
+{
+public:
+	CNavArea *operator()(CNavArea *currentGoal, CNavArea *newArea) const override
+	{
+		CTFNavArea *tfarea = (CTFNavArea *)newArea;
+		if(!tfarea->IsInCombat()) {
+			return currentGoal;
+		}
+		
+		if(!currentGoal || tfarea->GetCombatIntensity() > ((CTFNavArea *)currentGoal)->GetCombatIntensity()) {
+			return newArea;
+		}
+		
+		return currentGoal;
+	}
+};
+#endif
+
+class AwayFromThreatGoalSelector : public IPathOpenGoalSelector
+{
+public:
+	AwayFromThreatGoalSelector(const Vector &threat_)
+		: threat(threat_)
+	{
+	}
+	
+	CNavArea *operator()(CNavArea *currentGoal, CNavArea *newArea) const override
+	{
+		if(!currentGoal) {
+			return newArea;
+		}
+		
+		float newDist = (newArea->GetCenter() - threat).LengthSqr();
+		float currentDist = (currentGoal->GetCenter() - threat).LengthSqr();
+		if(newDist > currentDist) {
+			return newArea;
+		}
+		
+		return currentGoal;
+	}
+	
+	Vector threat;
+};
+
+class NearestEntityClassGoalSelector : public IPathOpenGoalSelector
+{
+public:
+	NearestEntityClassGoalSelector(const char *classname)
+	{
+		CBaseEntity *pEntity = nullptr;
+		while((pEntity = FindEntityByClassname(pEntity, classname)) != nullptr) {
+			CNavArea *area = TheNavMesh->GetNearestNavArea(pEntity, GETNAVAREA_CHECK_GROUND, 120.0f);
+			if(area) {
+				areas.emplace_back(area);
+			}
+		}
+		
+		std::sort(areas.begin(), areas.end());
+	}
+	
+	CNavArea *operator()(CNavArea *currentGoal, CNavArea *newArea) const override
+	{
+		if(!std::binary_search(areas.cbegin(), areas.cend(), newArea)) {
+			return currentGoal;
+		}
+		
+		if(!currentGoal || newArea->GetCostSoFar() < currentGoal->GetCostSoFar()) {
+			return newArea;
+		}
+		
+		return currentGoal;
+	}
+	
+	std::vector<CNavArea *> areas;
+};
+
+cell_t PathComputeOpenGoalNative(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	Path *obj = nullptr;
+	HandleError err = handlesys->ReadHandle(params[1], PathHandleType, &security, (void **)&obj);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+	}
+	
+	INextBot *bot = (INextBot *)params[2];
+	
+	float maxSearchRadius = sp_ctof(params[7]);
+	
+	BaselinePathCost cost(bot, params[6]);
+	
+	switch(params[3]) {
+		case OPEN_GOAL_ATTRIBUTE: {
+			NearestAttributeGoalSelector selector(params[4]);
+			return obj->ComputeWithOpenGoal(bot, cost, selector, maxSearchRadius);
+		}
+	#if SOURCE_ENGINE == SE_TF2
+		case OPEN_GOAL_TF_ATTRIBUTE: {
+			NearestTFAttributeGoalSelector selector(params[4]);
+			return obj->ComputeWithOpenGoal(bot, cost, selector, maxSearchRadius);
+		}
+		case OPEN_GOAL_COMBAT: {
+			CombatGoalSelector selector;
+			return obj->ComputeWithOpenGoal(bot, cost, selector, maxSearchRadius);
+		}
+	#endif
+		case OPEN_GOAL_AWAY_FROM_THREAT: {
+			Vector threat;
+			if(params[4] == -1) {
+				IVision *vision = bot->GetVisionInterface();
+				const CKnownEntity *known = vision ? vision->GetPrimaryKnownThreat() : nullptr;
+				if(!known) {
+					return 0;
+				}
+				
+				threat = known->GetLastKnownPosition();
+			} else {
+				CBaseEntity *pThreat = gamehelpers->ReferenceToEntity(params[4]);
+				if(!pThreat)
+				{
+					return pContext->ThrowNativeError("Invalid Entity Reference/Index %i", params[4]);
+				}
+				
+				threat = pThreat->GetAbsOrigin();
+			}
+			
+			AwayFromThreatGoalSelector selector(threat);
+			return obj->ComputeWithOpenGoal(bot, cost, selector, maxSearchRadius);
+		}
+		case OPEN_GOAL_ENTITY_CLASS: {
+			char *classname = nullptr;
+			pContext->LocalToString(params[5], &classname);
+			
+			NearestEntityClassGoalSelector selector(classname);
+			if(selector.areas.empty()) {
+				return 0;
+			}
+			
+			return obj->ComputeWithOpenGoal(bot, cost, selector, maxSearchRadius);
+		}
+	}
+	
+	return pContext->ThrowNativeError("Invalid open goal type %i", params[3]);
+}
+
+ConVar path_async_threads("path_async_threads", "2", FCVAR_NONE, "worker threads for Path.Compute*Async, read when the first job is queued. 0 runs the searches on the game thread at the start of the next frame");
+ConVar path_budget_ms("path_budget_ms", "0", FCVAR_NONE, "milliseconds per frame the game thread spends on Path.Compute*Async (searches with path_async_threads 0, assembling finished paths), 0 for no limit. Work over the limit carries on next frame");
+
+/**
+ * One Path.Compute*Async request.
+ * The game thread fills everything up to the search inputs, a worker runs Search and fills chain,
+ * then the game thread validates the result and assembles the path a frame later.
+ * Workers only touch the search inputs and outputs, everything else belongs to the game thread.
+ */
+struct PathAsyncJob
+{
+	PathAsyncJob(Path *path_, Handle_t hndl_, INextBot *bot_, unsigned int flags_, IPluginFunction *callback_, cell_t data_, float maxPathLength_, bool includeGoalIfPathFails_)
+		: path(path_), hndl(hndl_), bot(bot_), callback(callback_), data(data_),
+		cost(bot_, flags_, false), flags(flags_), maxPathLength(maxPathLength_), includeGoalIfPathFails(includeGoalIfPathFails_)
+	{
+		botref = gamehelpers->EntityToReference(bot->GetEntity());
+		teamID = bot->GetEntity()->GetTeamNumber();
+		generation = g_NavMeshGeneration;
+	}
+
+	// same setup as Path::Compute, returns false when no search is needed and Compute was run right away
+	bool PrepareVector(const Vector &goal_)
+	{
+		goal = goal_;
+
+		startArea = bot->GetEntity()->GetLastKnownArea();
+		if(!startArea) {
+			BaselinePathCost gamecost(bot, flags);
+			result = path->Compute(bot, goal, gamecost, maxPathLength, includeGoalIfPathFails);
+			return false;
+		}
+
+		// check line-of-sight to the goal position when finding it's nav area
+		const float maxDistanceToArea = 200.0f;
+		goalArea = TheNavMesh->GetNearestNavArea( goal, true, maxDistanceToArea, true, false, teamID );
+
+		if(startArea == goalArea) {
+			BaselinePathCost gamecost(bot, flags);
+			result = path->Compute(bot, goal, gamecost, maxPathLength, includeGoalIfPathFails);
+			return false;
+		}
+
+		// make sure path end position is on the ground
+		pathEndPosition = goal;
+		if ( goalArea )
+		{
+			pathEndPosition.z = goalArea->GetZ( pathEndPosition );
+		}
+		else
+		{
+			TheNavMesh->GetGroundHeight( pathEndPosition, &pathEndPosition.z );
+		}
+
+		return !UseCachedChain(nullptr);
+	}
+
+	bool PrepareEntity(CBaseCombatCharacter *subject)
+	{
+		subjectref = gamehelpers->EntityToReference(subject);
+		hasSubject = true;
+
+		startArea = bot->GetEntity()->GetLastKnownArea();
+		goalArea = subject->GetLastKnownArea();
+		goal = subject->GetAbsOrigin();
+		pathEndPosition = goal;
+
+		if(!startArea || !goalArea || startArea == goalArea) {
+			BaselinePathCost gamecost(bot, flags);
+			result = path->Compute(bot, subject, gamecost, maxPathLength, includeGoalIfPathFails);
+			return false;
+		}
+
+		return !UseCachedChain(subject);
+	}
+
+	// NavPathCache is game thread only, a hit is assembled right away and no search is queued
+	bool UseCachedChain(CBaseCombatCharacter *subject)
+	{
+		if(!goalArea) {
+			return false;
+		}
+
+		cacheable = g_NavPathCache.MakeKey(cost, startArea, goalArea, teamID, maxPathLength, cacheKey);
+		if(!cacheable || !g_NavPathCache.Lookup(cacheKey, bot->GetLocomotionInterface(), chain, result)) {
+			return false;
+		}
+
+		path->Invalidate();
+		path->m_subject = subject;
+		result = path->AssembleAreaChain(bot, chain, pathEndPosition, result, includeGoalIfPathFails);
+		return true;
+	}
+
+	// worker side, only reads the nav mesh
+	void Search(NavSearchContext &ctx)
+	{
+		SearchSlice(ctx, false, 0.0);
+	}
+
+	/**
+	 * Search until deadline (0 for no limit), false if it ran out of time.
+	 * A paused search is carried on with resume set, on the same context with nothing else run on it in between.
+	 */
+	bool SearchSlice(NavSearchContext &ctx, bool resume, double deadline)
+	{
+		if ( resume )
+		{
+			result = ctx.ResumeSlicedPath( slice, cost, deadline );
+		}
+		else
+		{
+			result = ctx.BeginSlicedPath( slice, startArea, goalArea, &goal, cost, maxPathLength, teamID, false, deadline );
+		}
+
+		if ( ctx.IsPaused() )
+			return false;
+
+		chain.clear();
+
+		if ( slice.closestArea == NULL )
+			return true;
+
+		ctx.CollectChain( startArea, slice.closestArea, Path::MAX_PATH_SEGMENTS-1, chain ); // save room for endpoint
+		return true;
+	}
+
+	// lower is searched first: distance to the closest human player, a quarter of it while the bot has a threat,
+	// plus a bit for every tick it was queued later so bots far from everyone still get their turn
+	void ComputePriority()
+	{
+		const Vector &origin = bot->GetPosition();
+		float closest = 0.0f;
+		bool found = false;
+
+		int num = playerhelpers->GetMaxClients();
+		for(int i = 1; i <= num; ++i) {
+			IGamePlayer *gameplayer{playerhelpers->GetGamePlayer(i)};
+			if(!gameplayer ||
+				!gameplayer->IsInGame() ||
+				gameplayer->IsFakeClient()) {
+				continue;
+			}
+
+			CBaseEntity *player = gamehelpers->ReferenceToEntity(gameplayer->GetIndex());
+			if(!player) {
+				continue;
 			}
-		}
-		else
-		{
-			// compute distance traveled along path so far
-			float dist;
 
-			if ( ladder )
-			{
-				const float ladderCostFactor = 100.0f;
-				dist = ladderCostFactor * ladder->m_length;
+			float dist = (player->GetAbsOrigin() - origin).Length();
+			if(!found || dist < closest) {
+				closest = dist;
+				found = true;
 			}
-			else
-			{
-				Vector to = area->GetCenter() - fromArea->GetCenter();
+		}
 
-				dist = to.Length();
+		IVision *vision = bot->GetVisionInterface();
+		if(vision && vision->GetPrimaryKnownThreat()) {
+			closest *= 0.25f;
+		}
 
-				// check for vertical discontinuities
-				Vector closeFrom, closeTo;
-				area->GetClosestPointOnArea( fromArea->GetCenter(), &closeTo );
-				fromArea->GetClosestPointOnArea( area->GetCenter(), &closeFrom );
-				
-				float deltaZ = closeTo.z - closeFrom.z;
+		const double agingPerTick = 32.0;
+		priority = closest + gpGlobals->tickcount * agingPerTick;
+	}
 
-				if ( deltaZ > m_mover->GetMaxJumpHeight() )
-				{
-					// too high to jump
-					return -1.0f;
-				}
-				else if ( -deltaZ > m_mover->GetDeathDropHeight() )
-				{
-					// too far down to drop
-					return -1.0f;
-				}
+	INextBot *ResolveBot() const
+	{
+		CBaseEntity *pEntity = gamehelpers->ReferenceToEntity(botref);
+		if(!pEntity || pEntity->MyNextBotPointer() != bot) {
+			return nullptr;
+		}
 
-				// prefer to maintain our level
-				const float climbCost = 10.0f;
-				dist += climbCost * fabs( deltaZ );
-			}
+		return bot;
+	}
 
-			cost = dist + fromArea->GetTotalCost();
+	CBaseCombatCharacter *ResolveSubject() const
+	{
+		CBaseEntity *pEntity = gamehelpers->ReferenceToEntity(subjectref);
+		if(!pEntity) {
+			return nullptr;
+		}
 
-			
-			// Add in danger cost due to threat
-			// Assume straight line between areas and find closest point
-			// to the threat along that line segment. The distance between
-			// the threat and closest point on the line is the danger cost.		
-			
-			// path danger is CUMULATIVE
-			float dangerCost = fromArea->GetCostSoFar();
-			
-			Vector close;
-			float t;
-			CalcClosestPointOnLineSegment( m_threat->GetAbsOrigin(), area->GetCenter(), fromArea->GetCenter(), close, &t );
-			if ( t < 0.0f )
-			{
-				close = area->GetCenter();
+		return pEntity->MyCombatCharacterPointer();
+	}
+
+	// the mesh can change while the search is in flight, make sure every area is still there and usable
+	bool IsResultValid() const
+	{
+		if(generation != g_NavMeshGeneration) {
+			return false;
+		}
+
+		ILocomotion *mover = bot->GetLocomotionInterface();
+
+		for(const NavAreaChainLink &link : chain) {
+			if(TheNavMesh->GetNavAreaByID(link.id) != link.area) {
+				return false;
 			}
-			else if ( t > 1.0f )
-			{
-				close = fromArea->GetCenter();
+
+			if(link.area->IsBlocked(teamID)) {
+				return false;
 			}
 
-			float rangeToThreat = ( m_threat->GetAbsOrigin() - close ).Length();
+			if(!mover->IsAreaTraversable(link.area)) {
+				return false;
+			}
+		}
 
-			if ( rangeToThreat < maxThreatRange )
-			{
-				float dangerFactor = 1.0f - ( rangeToThreat / maxThreatRange );
-				dangerCost = dangerDensity * dangerFactor;
+		return true;
+	}
 
-				if ( m_me->IsDebugging( NEXTBOT_PATH ) )
-				{
-					NDebugOverlay::HorzArrow( fromArea->GetCenter(), area->GetCenter(), 5, 255 * dangerFactor, 0, 0, 255, true, debugDeltaT );
+	// game thread, a frame after the job was queued
+	void Finish()
+	{
+		if(!path) {
+			return;
+		}
 
-					Vector to = close - m_threat->GetAbsOrigin();
-					to.NormalizeInPlace();
+		INextBot *livebot = ResolveBot();
+		CBaseCombatCharacter *subject = nullptr;
+		if(hasSubject) {
+			subject = ResolveSubject();
+		}
 
-					NDebugOverlay::Line( close, close - 50.0f * to, 255, 0, 0, true, debugDeltaT );
+		if(!livebot || (hasSubject && !subject)) {
+			path->Invalidate();
+			result = false;
+		} else if(searched) {
+			if(IsResultValid()) {
+				if(cacheable && !chain.empty()) {
+					g_NavPathCache.Store(cacheKey, chain, result);
+				}
+
+				path->Invalidate();
+				path->m_subject = subject;
+				result = path->AssembleAreaChain(livebot, chain, pathEndPosition, result, includeGoalIfPathFails);
+			} else {
+				// stale, redo it here so the plugin still gets an answer this frame
+				BaselinePathCost gamecost(livebot, flags);
+				if(subject) {
+					result = path->Compute(livebot, subject, gamecost, maxPathLength, includeGoalIfPathFails);
+				} else {
+					result = path->Compute(livebot, goal, gamecost, maxPathLength, includeGoalIfPathFails);
 				}
 			}
-			
-			cost += dangerCost;
 		}
 
-		return cost;
+		if(callback) {
+			callback->PushCell(hndl);
+			callback->PushCell(livebot ? (cell_t)livebot : 0);
+			callback->PushCell(result);
+			callback->PushCell(data);
+			callback->Execute(nullptr);
+		}
 	}
-	
-private:	
-	INextBot *m_me;
-	ILocomotion *m_mover;
-	
-	CBaseEntity *m_threat;
-	float m_retreatRange;
 
-	enum { MAX_ADJ_AREAS = 64 };
-	
-	struct AdjInfo
-	{
-		CNavArea *area;
-		CNavLadder *ladder;
-		NavTraverseType how;		
-	};
-	
-	AdjInfo m_adjAreaVector[ MAX_ADJ_AREAS ];
-	int m_adjAreaIndex;
-	
+	Path *path;
+	Handle_t hndl;
+	INextBot *bot;
+	cell_t botref;
+	cell_t subjectref = 0;
+	bool hasSubject = false;
+	IPluginFunction *callback;
+	cell_t data;
+	unsigned int generation;
+	bool searched = false;
+	bool cacheable = false;
+	NavPathCache::key_t cacheKey;
+	double priority = 0.0;
+
+	// search inputs
+	BaselinePathCost cost;
+	unsigned int flags;
+	CNavArea *startArea = nullptr;
+	CNavArea *goalArea = nullptr;
+	Vector goal;
+	Vector pathEndPosition;
+	float maxPathLength;
+	int teamID;
+	bool includeGoalIfPathFails;
+
+	// search outputs
+	bool result = false;
+	std::vector<NavAreaChainLink> chain;
+	NavSearchContext::slice_t slice;
 };
 
-class RetreatPath : public PathFollower
+/**
+ * Worker pool for PathAsyncJob.
+ * Every worker owns a NavSearchContext, finished jobs are handed back in RunFrame on the game thread.
+ * Pending jobs are taken by PathAsyncJob::priority. Game thread work is capped by path_budget_ms:
+ * without workers one search at a time is sliced across frames on m_gameContext, and finished jobs
+ * past the budget wait for the next frame.
+ */
+class PathAsyncQueue
 {
 public:
-	CountdownTimer m_throttleTimer;						// require a minimum time between re-paths
-	EHANDLE m_pathThreat;								// the threat of our existing path
-	Vector m_pathThreatPos;								// where the threat was when the path was built
-	
-	struct vars_t : public PathFollower::vars_t
+	void Submit(PathAsyncJob *job)
 	{
-		void dtor(PathFollower *base) override
-		{
-			PathFollower::vars_t::dtor(base);
-
-			RetreatPath *bytes{(RetreatPath *)base};
-			bytes->dtor();
+		if(!job->searched) {
+			std::lock_guard<std::mutex> lock{m_mutex};
+			m_finished.emplace_back(job);
+			return;
 		}
 
-		float maxlen = 1000.0f;
-		float tolerancerate = 0.33f;
-		float mintolerance = 0.0f;
-		float repathtime = 0.5f;
-	};
+		//workers can't build them themselves
+		g_NavConnectionGraph.EnsureBuilt();
+		g_NavLandmarks.EnsureBuilt();
 
-	vars_t &getvars()
-	{ return *(vars_t *)vars_ptr(); }
-	
-	void HookInvalidate()
-	{
-		m_throttleTimer.Invalidate();
-		m_pathThreat = NULL;
-		
-		RETURN_META(MRES_HANDLED);
-	}
-	
-	void ctor()
-	{
-		new (&m_throttleTimer) CountdownTimer();
-		new (&m_pathThreat) EHANDLE();
-		new (&m_pathThreatPos) Vector();
+		job->ComputePriority();
 		
-		m_throttleTimer.Invalidate();
-		m_pathThreat = NULL;
-		m_pathThreatPos = vec3_origin;
-	}
+		if(m_threads.empty()) {
+			int count = path_async_threads.GetInt();
 
-	void dtor()
-	{
-		m_throttleTimer.~CountdownTimer();
-		m_pathThreat.~EHANDLE();
-		m_pathThreatPos.~Vector();
-	}
+			//RunFrame stops slicing once there are workers, start the paused search over on one of them
+			if(count > 0 && m_slicing) {
+				m_pending.emplace_back(m_slicing);
+				m_slicing = nullptr;
+			}
 
-	template <typename C = RetreatPath, typename T = vars_t>
-	static C *create()
-	{
-		C *bytes = (C *)PathFollower::create<C, T>();
-		bytes->ctor();
-		T &vars{PathFollower::getvars<C, T>(bytes)};
-		vars.hookids.emplace_back(SH_ADD_HOOK(Path, Invalidate, bytes, SH_MEMBER(bytes, &RetreatPath::HookInvalidate), true));
-		return bytes;
+			for(int i = 0; i < count; ++i) {
+				m_threads.emplace_back(&PathAsyncQueue::WorkerMain, this);
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock{m_mutex};
+			m_pending.emplace_back(job);
+		}
+
+		m_wake.notify_one();
 	}
 
-	void Update( INextBot *bot, CBaseEntity *threat )
+	void RunFrame()
 	{
-		if ( threat == NULL )
-		{
-			return;
+		float budget = path_budget_ms.GetFloat();
+		double deadline = (budget > 0.0f) ? Plat_FloatTime() + budget / 1000.0 : 0.0;
+
+		if(m_threads.empty()) {
+			RunSearches(deadline);
 		}
 
-		// if our path threat changed, repath immediately
-		if ( threat != m_pathThreat )
 		{
-			if ( bot->IsDebugging( NEXTBOT_PATH ) )
-			{
-				DevMsg( "%3.2f: bot(#%d) Chase path threat changed (from %X to %X).\n", gpGlobals->curtime, bot->GetEntity()->entindex(), m_pathThreat.Get(), threat );
-			}
-
-			Invalidate();
+			std::lock_guard<std::mutex> lock{m_mutex};
+			m_completing.insert(m_completing.end(), m_finished.begin(), m_finished.end());
+			m_finished.clear();
 		}
 
-		vars_t &vars{getvars()};
+		// callbacks can close handles, which cancels the jobs still waiting here
+		// one is always finished so a tiny budget can't stall the queue
+		size_t done = 0;
+		while(done < m_completing.size()) {
+			if(done > 0 && deadline > 0.0 && Plat_FloatTime() >= deadline) {
+				break;
+			}
 
-		// maintain the path away from the threat
-		RefreshPath( vars, bot, threat );
+			m_completing[done++]->Finish();
+		}
 
-		// move along the path towards the threat
-		PathFollower::CallUpdate( bot );
+		for(size_t i = 0; i < done; ++i) {
+			delete m_completing[i];
+		}
+		m_completing.erase(m_completing.begin(), m_completing.begin() + done);
 	}
-	
-	void RefreshPath( vars_t &vars, INextBot *bot, CBaseEntity *threat )
+
+	// the path is going away, drop its jobs without calling back
+	void Cancel(const void *path)
 	{
-		if ( threat == NULL )
-		{
-			if ( bot->IsDebugging( NEXTBOT_PATH ) )
-			{
-				DevMsg( "%3.2f: bot(#%d) CasePath::RefreshPath failed. No threat.\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
+		std::lock_guard<std::mutex> lock{m_mutex};
+
+		for(PathAsyncJob *job : m_pending) {
+			if(job->path == path) {
+				job->path = nullptr;
 			}
-			return;
 		}
 
-		// don't change our path if we're on a ladder
-		ILocomotion *mover = bot->GetLocomotionInterface();
-		if ( IsValid() && mover && mover->IsUsingLadder() )
-		{
-			if ( bot->IsDebugging( NEXTBOT_PATH ) )
-			{
-				DevMsg( "%3.2f: bot(#%d) RetreatPath::RefreshPath failed. Bot is on a ladder.\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
+		for(PathAsyncJob *job : m_running) {
+			if(job->path == path) {
+				job->path = nullptr;
 			}
-			return;
 		}
 
-		// the closer we get, the more accurate our path needs to be
-		Vector to = threat->GetAbsOrigin() - bot->GetPosition();
-		
-		const float minTolerance = vars.mintolerance;
-		const float toleranceRate = vars.tolerancerate;
-		
-		float tolerance = minTolerance + toleranceRate * to.Length();
+		for(PathAsyncJob *job : m_finished) {
+			if(job->path == path) {
+				job->path = nullptr;
+			}
+		}
 
-		if ( !IsValid() || ( threat->GetAbsOrigin() - m_pathThreatPos ).IsLengthGreaterThan( tolerance ) )
-		{
-			if ( !m_throttleTimer.IsElapsed() )
-			{
-				// require a minimum time between repaths, as long as we have a path to follow
-				if ( bot->IsDebugging( NEXTBOT_PATH ) )
-				{
-					DevMsg( "%3.2f: bot(#%d) RetreatPath::RefreshPath failed. Rate throttled.\n", gpGlobals->curtime, bot->GetEntity()->entindex() );
-				}
-				return;
+		for(PathAsyncJob *job : m_completing) {
+			if(job->path == path) {
+				job->path = nullptr;
 			}
+		}
 
-			// remember our path threat
-			m_pathThreat = threat;
-			m_pathThreatPos = threat->GetAbsOrigin();
+		if(m_slicing && m_slicing->path == path) {
+			m_slicing->path = nullptr;
+		}
+	}
+
+	void Cancel(IPluginRuntime *runtime)
+	{
+		std::lock_guard<std::mutex> lock{m_mutex};
+
+		auto drop = [runtime](PathAsyncJob *job) {
+			if(job->callback && job->callback->GetParentRuntime() == runtime) {
+				job->path = nullptr;
+			}
+		};
+
+		std::for_each(m_pending.begin(), m_pending.end(), drop);
+		std::for_each(m_running.begin(), m_running.end(), drop);
+		std::for_each(m_finished.begin(), m_finished.end(), drop);
+		std::for_each(m_completing.begin(), m_completing.end(), drop);
+
+		if(m_slicing) {
+			drop(m_slicing);
+		}
+	}
+
+	// throw away everything and wait for in flight searches, the nav mesh is about to go away
+	void Flush()
+	{
+		std::unique_lock<std::mutex> lock{m_mutex};
 
-			RetreatPathBuilder retreat( bot, threat, vars.maxlen );
+		for(PathAsyncJob *job : m_pending) {
+			delete job;
+		}
+		m_pending.clear();
 
-			CNavArea *goalArea = retreat.ComputePath();
+		m_idle.wait(lock, [this]() { return m_running.empty(); });
 
-			if ( goalArea )
-			{
-				AssemblePrecomputedPath( bot, goalArea->GetCenter(), goalArea );
-			}	
-			else
-			{
-				// all adjacent areas are too far away - just move directly away from threat
-				Vector to = threat->GetAbsOrigin() - bot->GetPosition();
+		for(PathAsyncJob *job : m_finished) {
+			delete job;
+		}
+		m_finished.clear();
 
-				BuildTrivialPath( bot, bot->GetPosition() - to );
-			}
-				
-			const float minRepathInterval = vars.repathtime;
-			m_throttleTimer.Start( minRepathInterval );
+		for(PathAsyncJob *job : m_completing) {
+			delete job;
 		}
+		m_completing.clear();
+
+		delete m_slicing;
+		m_slicing = nullptr;
 	}
-	
-	float GetMaxPathLength( void )
+
+	void Shutdown()
 	{
-		return getvars().maxlen;
-	}
-};
+		Flush();
 
-#if SOURCE_ENGINE == SE_TF2
-class CTFPathFollower : public PathFollower
-{
-public:
-	const Path::Segment *m_goal;					// our current goal along the path
-	float m_minLookAheadRange;
+		{
+			std::lock_guard<std::mutex> lock{m_mutex};
+			m_quit = true;
+		}
 
-	void ctor()
-	{
-		m_goal = NULL;
-		m_minLookAheadRange = 300.0f;
+		m_wake.notify_all();
+
+		for(std::thread &thread : m_threads) {
+			thread.join();
+		}
+
+		m_threads.clear();
+		m_quit = false;
 	}
 
-	template <typename C = CTFPathFollower, typename T = vars_t>
-	static C *create()
+private:
+	// lowest priority first, the caller holds the lock if there are workers
+	PathAsyncJob *PopBest()
 	{
-		C *bytes = (C *)PathFollower::create<C, T>(CTFPathFollowerCTOR);
-		bytes->ctor();
-		return bytes;
+		std::deque<PathAsyncJob *>::iterator best = std::min_element(m_pending.begin(), m_pending.end(),
+			[](const PathAsyncJob *a, const PathAsyncJob *b) -> bool {
+				return a->priority < b->priority;
+			}
+		);
+
+		PathAsyncJob *job = *best;
+		m_pending.erase(best);
+		return job;
 	}
-	
-	float GetMinLookAheadDistance()
+
+	// game thread searches for path_async_threads 0, a search that runs out of budget is carried on next frame
+	void RunSearches(double deadline)
 	{
-		return m_minLookAheadRange;
-	}
-};
-#endif
+		while(true) {
+			if(!m_slicing) {
+				if(m_pending.empty()) {
+					break;
+				}
 
-HandleType_t PathHandleType = 0;
-HandleType_t PathFollowerHandleType = 0;
-#if SOURCE_ENGINE == SE_TF2
-HandleType_t CTFPathFollowerHandleType = 0;
-#endif
-HandleType_t ChasePathHandleType = 0;
-HandleType_t DirectChasePathHandleType = 0;
-HandleType_t RetreatPathHandleType = 0;
-#if SOURCE_ENGINE == SE_LEFT4DEAD2
-HandleType_t InfectedChasePathHandleType = 0;
-#endif
+				m_slicing = PopBest();
 
-using pathfollower_hndl_map_t = std::unordered_map<PathFollower *, Handle_t>;
-static pathfollower_hndl_map_t pathfollower_hndl_map;
+				// cancelled while waiting, nothing to search for
+				if(m_slicing->path && !m_slicing->SearchSlice(m_gameContext, false, deadline)) {
+					break;
+				}
+			} else if(m_slicing->path && !m_slicing->SearchSlice(m_gameContext, true, deadline)) {
+				break;
+			}
 
-template <typename T>
-class SPPathFollower : public T
-{
-public:
-	static_assert(std::is_base_of<PathFollower, T>::value, "");
+			m_finished.emplace_back(m_slicing);
+			m_slicing = nullptr;
 
-	struct vars_t : T::vars_t
+			if(deadline > 0.0 && Plat_FloatTime() >= deadline) {
+				break;
+			}
+		}
+	}
+
+	void WorkerMain()
 	{
-		Handle_t hndl{BAD_HANDLE};
-	};
+		NavSearchContext ctx;
 
-	vars_t &getvars()
-	{ return *(vars_t *)this->vars_ptr(); }
+		std::unique_lock<std::mutex> lock{m_mutex};
 
-	template <typename ...Args>
-	static SPPathFollower<T> *create(Args &&... args)
-	{
-		SPPathFollower<T> *bytes = reinterpret_cast<SPPathFollower<T> *>(T::template create<SPPathFollower<T>, vars_t>(args...));
-		return bytes;
-	}
+		while(true) {
+			m_wake.wait(lock, [this]() { return m_quit || !m_pending.empty(); });
+			if(m_quit) {
+				break;
+			}
 
-	void set_handle(Handle_t hndl)
-	{
-		pathfollower_hndl_map.emplace(static_cast<PathFollower *>(this), hndl);
-		getvars().hndl = hndl;
-	}
+			PathAsyncJob *job = PopBest();
+			m_running.emplace_back(job);
 
-	void handle_destroyed()
-	{
-		pathfollower_hndl_map_t::iterator it{pathfollower_hndl_map.find(static_cast<PathFollower *>(this))};
-		if(it != pathfollower_hndl_map.cend()) {
-			pathfollower_hndl_map.erase(it);
+			lock.unlock();
+			job->Search(ctx);
+			lock.lock();
+
+			m_running.erase(std::find(m_running.begin(), m_running.end(), job));
+			m_finished.emplace_back(job);
+
+			if(m_running.empty()) {
+				m_idle.notify_all();
+			}
 		}
 	}
+
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_idle;
+	std::deque<PathAsyncJob *> m_pending;
+	std::vector<PathAsyncJob *> m_running;
+	std::vector<PathAsyncJob *> m_finished;
+	std::vector<PathAsyncJob *> m_completing;
+	std::vector<std::thread> m_threads;
+	NavSearchContext m_gameContext;
+	PathAsyncJob *m_slicing = nullptr;
+	bool m_quit = false;
 };
 
-cell_t PathCTORNative(IPluginContext *pContext, const cell_t *params)
-{
-	Path *obj = Path::create();
-	Handle_t hndl = handlesys->CreateHandle(PathHandleType, obj, pContext->GetIdentity(), myself->GetIdentity(), nullptr);
-	return hndl;
-}
+PathAsyncQueue g_PathAsyncQueue;
 
-cell_t PathFollowerCTORNative(IPluginContext *pContext, const cell_t *params)
+void PathAsyncGameFrame(bool simulating)
 {
-	SPPathFollower<PathFollower> *obj = SPPathFollower<PathFollower>::create();
-	Handle_t hndl = handlesys->CreateHandle(PathFollowerHandleType, obj, pContext->GetIdentity(), myself->GetIdentity(), nullptr);
-	obj->set_handle(hndl);
-	return hndl;
+	g_PathAsyncQueue.RunFrame();
 }
 
-class SPPathCost : public IPathCost
-{
-public:
-	SPPathCost(INextBot *entity_, IPluginFunction *callback_, cell_t data_)
-		: entity(entity_), callback(callback_), data(data_)
-	{
-		
-	}
-	
-	float operator()( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length ) const
-	{
-		cell_t res;
-		callback->PushCell((cell_t)entity);
-		callback->PushCell((cell_t)area);
-		callback->PushCell((cell_t)fromArea);
-		callback->PushCell((cell_t)ladder);
-		callback->PushCell((cell_t)elevator);
-		callback->PushCell(sp_ftoc(length));
-		callback->PushCell(data);
-		callback->Execute(&res);
-		return sp_ctof(res);
-	}
-	
-	IPluginFunction *callback;
-	INextBot *entity;
-	cell_t data;
-};
-
-cell_t PathComputeVectorNative(IPluginContext *pContext, const cell_t *params)
+cell_t PathComputeVectorAsyncNative(IPluginContext *pContext, const cell_t *params)
 {
 	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
 	
@@ -13885,17 +21311,15 @@ cell_t PathComputeVectorNative(IPluginContext *pContext, const cell_t *params)
 	pContext->LocalToPhysAddr(params[3], &value);
 	Vector goal = Vector(sp_ctof(value[0]), sp_ctof(value[1]), sp_ctof(value[2]));
 	
-	IPluginFunction *callback = pContext->GetFunctionById(params[4]);
-	SPPathCost cost(bot, callback, params[5]);
-	
-	float maxPathLength = sp_ctof(params[6]);
-	
-	bool includeGoalIfPathFails = params[7];
+	IPluginFunction *callback = pContext->GetFunctionById(params[5]);
 	
-	return obj->Compute(bot, goal, cost, maxPathLength, includeGoalIfPathFails);
+	PathAsyncJob *job = new PathAsyncJob(obj, params[1], bot, params[4], callback, params[6], sp_ctof(params[7]), params[8]);
+	job->searched = job->PrepareVector(goal);
+	g_PathAsyncQueue.Submit(job);
+	return 0;
 }
 
-cell_t PathComputeEntityNative(IPluginContext *pContext, const cell_t *params)
+cell_t PathComputeEntityAsyncNative(IPluginContext *pContext, const cell_t *params)
 {
 	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
 	
@@ -13920,14 +21344,35 @@ cell_t PathComputeEntityNative(IPluginContext *pContext, const cell_t *params)
 	
 	INextBot *bot = (INextBot *)params[2];
 	
-	IPluginFunction *callback = pContext->GetFunctionById(params[4]);
-	SPPathCost cost(bot, callback, params[5]);
-	
-	float maxPathLength = sp_ctof(params[6]);
-	
-	bool includeGoalIfPathFails = params[7];
+	IPluginFunction *callback = pContext->GetFunctionById(params[5]);
 	
-	return obj->Compute(bot, pCombat, cost, maxPathLength, includeGoalIfPathFails);
+	PathAsyncJob *job = new PathAsyncJob(obj, params[1], bot, params[4], callback, params[6], sp_ctof(params[7]), params[8]);
+	job->searched = job->PrepareEntity(pCombat);
+	g_PathAsyncQueue.Submit(job);
+	return 0;
+}
+
+cell_t PathCacheClearNative(IPluginContext *pContext, const cell_t *params)
+{
+	g_NavPathCache.Clear();
+	if(params[1]) {
+		g_NavPathCache.ResetStats();
+	}
+	return 0;
+}
+
+cell_t PathCacheGetStatsNative(IPluginContext *pContext, const cell_t *params)
+{
+	cell_t *addr = nullptr;
+	pContext->LocalToPhysAddr(params[1], &addr);
+	*addr = g_NavPathCache.GetHits();
+	pContext->LocalToPhysAddr(params[2], &addr);
+	*addr = g_NavPathCache.GetMisses();
+	pContext->LocalToPhysAddr(params[3], &addr);
+	*addr = g_NavPathCache.GetStale();
+	pContext->LocalToPhysAddr(params[4], &addr);
+	*addr = g_NavPathCache.GetCount();
+	return 0;
 }
 
 cell_t PathFollowerUpdateNative(IPluginContext *pContext, const cell_t *params)
@@ -13962,9 +21407,6 @@ cell_t ChasePathUpdateNative(IPluginContext *pContext, const cell_t *params)
 	
 	INextBot *bot = (INextBot *)params[2];
 	
-	IPluginFunction *callback = pContext->GetFunctionById(params[4]);
-	SPPathCost cost(bot, callback, params[5]);
-	
 	Vector PredictedSubjectPos;
 	Vector *pPredictedSubjectPos = nullptr;
 	
@@ -13980,6 +21422,14 @@ cell_t ChasePathUpdateNative(IPluginContext *pContext, const cell_t *params)
 		pPredictedSubjectPos = &PredictedSubjectPos;
 	}
 	
+	IPluginFunction *callback = pContext->GetFunctionById(params[4]);
+	if(!callback) {
+		BaselinePathCost cost(bot, params[5]);
+		(obj->*obj->getvars().pUpdate)(obj->getvars(), bot, pSubject, cost, pPredictedSubjectPos);
+		return 0;
+	}
+	
+	SPPathCost cost(bot, callback, params[5]);
 	(obj->*obj->getvars().pUpdate)(obj->getvars(), bot, pSubject, cost, pPredictedSubjectPos);
 	
 	return 0;
@@ -14066,6 +21516,35 @@ cell_t ChasePathLeadRadiusget(IPluginContext *pContext, const cell_t *params)
 	return sp_ftoc(obj->getvars().radius);
 }
 
+cell_t ChasePathSearchModeset(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	ChasePath *obj = nullptr;
+	HandleError err = handlesys->ReadHandle(params[1], ChasePathHandleType, &security, (void **)&obj);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+	}
+
+	obj->getvars().searchmode = (PathSearchMode)params[2];
+	return 0;
+}
+
+cell_t ChasePathSearchModeget(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	ChasePath *obj = nullptr;
+	HandleError err = handlesys->ReadHandle(params[1], ChasePathHandleType, &security, (void **)&obj);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+	}
+
+	return obj->getvars().searchmode;
+}
+
 cell_t RetreatPathUpdateNative(IPluginContext *pContext, const cell_t *params)
 {
 	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
@@ -14319,6 +21798,27 @@ cell_t CNavMeshGetNearestNavAreaVector(IPluginContext *pContext, const cell_t *p
 	return (cell_t)TheNavMesh->GetNearestNavArea(pos, params[2], sp_ctof(params[3]), params[4], params[5], params[6]);
 }
 
+cell_t CNavMeshGetNearestNavAreaBatch(IPluginContext *pContext, const cell_t *params)
+{
+	cell_t *positions = nullptr;
+	pContext->LocalToPhysAddr(params[1], &positions);
+	
+	cell_t *areas = nullptr;
+	pContext->LocalToPhysAddr(params[2], &areas);
+	
+	int count = params[3];
+	if(count < 0) {
+		return pContext->ThrowNativeError("Invalid count %i", count);
+	}
+	
+	for(int i = 0; i < count; ++i) {
+		Vector pos(sp_ctof(positions[i*3]), sp_ctof(positions[i*3+1]), sp_ctof(positions[i*3+2]));
+		areas[i] = (cell_t)TheNavMesh->GetNearestNavArea(pos, params[4], sp_ctof(params[5]), params[6], params[7], params[8]);
+	}
+	
+	return 0;
+}
+
 cell_t CNavMeshGetGroundHeightNative(IPluginContext *pContext, const cell_t *params)
 {
 	cell_t *addr = nullptr;
@@ -14326,7 +21826,7 @@ cell_t CNavMeshGetGroundHeightNative(IPluginContext *pContext, const cell_t *par
 	Vector pos(sp_ctof(addr[0]), sp_ctof(addr[1]), sp_ctof(addr[2]));
 	
 	cell_t *heightaddr = nullptr;
-	pContext->LocalToPhysAddr(params[2], &addr);
+	pContext->LocalToPhysAddr(params[2], &heightaddr);
 	
 	Vector normal{};
 	
@@ -14356,7 +21856,7 @@ cell_t CNavMeshGetSimpleGroundHeightNative(IPluginContext *pContext, const cell_
 	Vector pos(sp_ctof(addr[0]), sp_ctof(addr[1]), sp_ctof(addr[2]));
 	
 	cell_t *heightaddr = nullptr;
-	pContext->LocalToPhysAddr(params[2], &addr);
+	pContext->LocalToPhysAddr(params[2], &heightaddr);
 	
 	Vector normal{};
 	
@@ -14393,6 +21893,44 @@ cell_t CNavMeshGetPlace(IPluginContext *pContext, const cell_t *params)
 	return TheNavMesh->GetPlace(pos);
 }
 
+cell_t CNavMeshGetRandomPoint(IPluginContext *pContext, const cell_t *params)
+{
+	NavAreaSampleFilter filter{};
+	filter.requiredAttributes = params[2];
+	filter.forbiddenAttributes = params[3];
+	filter.requiredGameAttributes = params[4];
+	filter.forbiddenGameAttributes = params[5];
+	filter.place = params[7];
+	filter.radius = sp_ctof(params[9]);
+	
+	cell_t *pNullVec = pContext->GetNullRef(SP_NULL_VECTOR);
+	
+	cell_t *addr = nullptr;
+	pContext->LocalToPhysAddr(params[8], &addr);
+	
+	if(addr != pNullVec) {
+		filter.center.x = sp_ctof(addr[0]);
+		filter.center.y = sp_ctof(addr[1]);
+		filter.center.z = sp_ctof(addr[2]);
+	} else {
+		filter.radius = 0.0f;
+	}
+	
+	Vector pos{};
+	CNavArea *area = g_NavAreaSampler.GetRandomPoint(filter, params[6], &pos);
+	if(!area) {
+		return 0;
+	}
+	
+	addr = nullptr;
+	pContext->LocalToPhysAddr(params[1], &addr);
+	addr[0] = sp_ftoc(pos.x);
+	addr[1] = sp_ftoc(pos.y);
+	addr[2] = sp_ftoc(pos.z);
+	
+	return (cell_t)area;
+}
+
 cell_t CNavMeshPlaceToName(IPluginContext *pContext, const cell_t *params)
 {
 	const char *name = TheNavMesh->PlaceToName(params[1]);
@@ -14537,24 +22075,40 @@ cell_t CNavAreaIsPartiallyVisible(IPluginContext *pContext, const cell_t *params
 cell_t CNavAreaIsPotentiallyVisible(IPluginContext *pContext, const cell_t *params)
 {
 	CNavArea *area = (CNavArea *)params[1];
+	if(nav_visibility_matrix.GetBool()) {
+		return g_NavVisibilityMatrix.IsVisible(area, (CNavArea *)params[2], false);
+	}
+
 	return area->IsPotentiallyVisible((CNavArea *)params[2]);
 }
 
 cell_t CNavAreaIsPotentiallyVisibleToTeam(IPluginContext *pContext, const cell_t *params)
 {
 	CNavArea *area = (CNavArea *)params[1];
+	if(nav_visibility_matrix.GetBool()) {
+		return g_NavVisibilityMatrix.IsVisibleToTeam(area, params[2], false);
+	}
+
 	return area->IsPotentiallyVisibleToTeam(params[2]);
 }
 
 cell_t CNavAreaIsCompletelyVisible(IPluginContext *pContext, const cell_t *params)
 {
 	CNavArea *area = (CNavArea *)params[1];
+	if(nav_visibility_matrix.GetBool()) {
+		return g_NavVisibilityMatrix.IsVisible(area, (CNavArea *)params[2], true);
+	}
+
 	return area->IsCompletelyVisible((CNavArea *)params[2]);
 }
 
 cell_t CNavAreaIsCompletelyVisibleToTeam(IPluginContext *pContext, const cell_t *params)
 {
 	CNavArea *area = (CNavArea *)params[1];
+	if(nav_visibility_matrix.GetBool()) {
+		return g_NavVisibilityMatrix.IsVisibleToTeam(area, params[2], true);
+	}
+
 	return area->IsCompletelyVisibleToTeam(params[2]);
 }
 
@@ -14587,7 +22141,14 @@ cell_t CNavAreaGetClosestPointOnArea(IPluginContext *pContext, const cell_t *par
 cell_t CNavAreaIsBlocked(IPluginContext *pContext, const cell_t *params)
 {
 	CNavArea *area = (CNavArea *)params[1];
-	return area->IsBlocked(params[2], params[3]);
+	return area->IsBlocked(params[2], params[3]);
+}
+
+cell_t CNavAreaCanReach(IPluginContext *pContext, const cell_t *params)
+{
+	CNavArea *area = (CNavArea *)params[1];
+	CNavArea *other = (CNavArea *)params[2];
+	return g_NavReachability.CanReach(area, other, params[3]);
 }
 
 cell_t ILocomotionIsAreaTraversable(IPluginContext *pContext, const cell_t *params)
@@ -15850,6 +23411,202 @@ cell_t PathInvalidate(IPluginContext *pContext, const cell_t *params)
 	return 0;
 }
 
+cell_t PackedPathCTORNative(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	Path *path = nullptr;
+	if(params[1] != BAD_HANDLE) {
+		HandleError err = handlesys->ReadHandle(params[1], PathHandleType, &security, (void **)&path);
+		if(err != HandleError_None)
+		{
+			return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+		}
+	}
+	
+	PackedPath *obj = new PackedPath();
+	if(path) {
+		obj->Pack(*path);
+	}
+	
+	Handle_t hndl = handlesys->CreateHandle(PackedPathHandleType, obj, pContext->GetIdentity(), myself->GetIdentity(), nullptr);
+	return hndl;
+}
+
+cell_t PackedPathPack(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	PackedPath *obj = nullptr;
+	HandleError err = handlesys->ReadHandle(params[1], PackedPathHandleType, &security, (void **)&obj);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+	}
+	
+	Path *path = nullptr;
+	err = handlesys->ReadHandle(params[2], PathHandleType, &security, (void **)&path);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[2], err);
+	}
+	
+	obj->Pack(*path);
+	
+	return 0;
+}
+
+cell_t PackedPathUnpack(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	PackedPath *obj = nullptr;
+	HandleError err = handlesys->ReadHandle(params[1], PackedPathHandleType, &security, (void **)&obj);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+	}
+	
+	Path *path = nullptr;
+	err = handlesys->ReadHandle(params[2], PathHandleType, &security, (void **)&path);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[2], err);
+	}
+	
+	INextBot *bot = (INextBot *)params[3];
+	
+	return obj->Unpack(bot, *path);
+}
+
+cell_t PackedPathShare(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	PackedPath *obj = nullptr;
+	HandleError err = handlesys->ReadHandle(params[1], PackedPathHandleType, &security, (void **)&obj);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+	}
+	
+	PackedPath *other = nullptr;
+	err = handlesys->ReadHandle(params[2], PackedPathHandleType, &security, (void **)&other);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[2], err);
+	}
+	
+	obj->Share(*other);
+	
+	return 0;
+}
+
+cell_t PackedPathSync(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	PackedPath *obj = nullptr;
+	HandleError err = handlesys->ReadHandle(params[1], PackedPathHandleType, &security, (void **)&obj);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+	}
+	
+	Path *path = nullptr;
+	err = handlesys->ReadHandle(params[2], PathHandleType, &security, (void **)&path);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[2], err);
+	}
+	
+	INextBot *bot = (INextBot *)params[3];
+	
+	return obj->Sync(bot, *path);
+}
+
+cell_t PackedPathClear(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	PackedPath *obj = nullptr;
+	HandleError err = handlesys->ReadHandle(params[1], PackedPathHandleType, &security, (void **)&obj);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+	}
+	
+	obj->Clear();
+	
+	return 0;
+}
+
+cell_t PackedPathSegmentCountget(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	PackedPath *obj = nullptr;
+	HandleError err = handlesys->ReadHandle(params[1], PackedPathHandleType, &security, (void **)&obj);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+	}
+	
+	return obj->GetSegmentCount();
+}
+
+cell_t PackedPathLengthget(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	PackedPath *obj = nullptr;
+	HandleError err = handlesys->ReadHandle(params[1], PackedPathHandleType, &security, (void **)&obj);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+	}
+	
+	return sp_ftoc(obj->GetLength());
+}
+
+cell_t PackedPathReadableget(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	PackedPath *obj = nullptr;
+	HandleError err = handlesys->ReadHandle(params[1], PackedPathHandleType, &security, (void **)&obj);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+	}
+	
+	return obj->IsReadable();
+}
+
+cell_t PackedPathGetSegment(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	PackedPath *obj = nullptr;
+	HandleError err = handlesys->ReadHandle(params[1], PackedPathHandleType, &security, (void **)&obj);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+	}
+	
+	int index = params[2];
+	if(index < 0 || index >= obj->GetSegmentCount())
+	{
+		return pContext->ThrowNativeError("Invalid segment index %i (count: %i)", index, obj->GetSegmentCount());
+	}
+	
+	if(!obj->IsReadable() || !obj->Unpack(index, obj->m_scratch)) {
+		return 0;
+	}
+	
+	return (cell_t)&obj->m_scratch;
+}
+
 cell_t PathFollowerMinLookAheadDistanceget(IPluginContext *pContext, const cell_t *params)
 {
 	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
@@ -18692,10 +26449,10 @@ cell_t GetNavAreaFromVector(IPluginContext *pContext, const cell_t *params)
 	return (cell_t)(*TheNavAreas)[idx];
 }
 
-class SPSearchSurroundingAreasFunctor : public ISearchSurroundingAreasFunctor
+class SPSearchSurroundingAreasFunctor : public INavSearchSurroundingAreasFunctor
 {
 public:
-	bool operator() ( CNavArea *area, CNavArea *priorArea, float travelDistanceSoFar ) override
+	bool operator() ( NavSearchContext &ctx, CNavArea *area, CNavArea *priorArea, float travelDistanceSoFar ) override
 	{
 		if(execute) {
 			execute->PushCell((cell_t)area);
@@ -18710,7 +26467,7 @@ public:
 		return false;
 	}
 
-	bool ShouldSearch( CNavArea *adjArea, CNavArea *currentArea, float travelDistanceSoFar ) override
+	bool ShouldSearch( NavSearchContext &ctx, CNavArea *adjArea, CNavArea *currentArea, float travelDistanceSoFar ) override
 	{
 		if(should) {
 			should->PushCell((cell_t)adjArea);
@@ -18722,22 +26479,22 @@ public:
 			return res;
 		}
 
-		return ISearchSurroundingAreasFunctor::ShouldSearch(adjArea, currentArea, travelDistanceSoFar);
+		return INavSearchSurroundingAreasFunctor::ShouldSearch(ctx, adjArea, currentArea, travelDistanceSoFar);
 	}
 
-	void IterateAdjacentAreas( CNavArea *area, CNavArea *priorArea, float travelDistanceSoFar ) override
+	void IterateAdjacentAreas( NavSearchContext &ctx, CNavArea *area, CNavArea *priorArea, float travelDistanceSoFar ) override
 	{
-		ISearchSurroundingAreasFunctor::IterateAdjacentAreas(area, priorArea, travelDistanceSoFar);
+		INavSearchSurroundingAreasFunctor::IterateAdjacentAreas(ctx, area, priorArea, travelDistanceSoFar);
 	}
 
-	void PostSearch( void ) override
+	void PostSearch( NavSearchContext &ctx ) override
 	{
 		if(post) {
 			post->PushCell(data);
 			post->Execute(nullptr);
 		}
 
-		ISearchSurroundingAreasFunctor::PostSearch();
+		INavSearchSurroundingAreasFunctor::PostSearch(ctx);
 	}
 
 	IPluginFunction *execute{nullptr};
@@ -18766,7 +26523,7 @@ cell_t SearchSurroundingAreasNative(IPluginContext *pContext, const cell_t *para
 
 	func.data = params[4];
 
-	SearchSurroundingAreas(startArea, func, sp_ctof(params[3]));
+	NavSearchSurroundingAreas(g_NavSearchContext, startArea, func, sp_ctof(params[3]));
 	return 0;
 }
 
@@ -18786,7 +26543,9 @@ cell_t CTFNavMeshGetSpawnRoomExitAreas(IPluginContext *pContext, const cell_t *p
 #endif
 
 cell_t CollectSurroundingAreasNative(IPluginContext *pContext, const cell_t *params);
+cell_t FilterSurroundingAreasNative(IPluginContext *pContext, const cell_t *params);
 cell_t CollectAllBots(IPluginContext *pContext, const cell_t *params);
+cell_t PathComputeBatchNative(IPluginContext *pContext, const cell_t *params);
 
 cell_t DirectionBetweenEntityVector(IPluginContext *pContext, const cell_t *params)
 {
@@ -19162,6 +26921,14 @@ sp_nativeinfo_t natives[] =
 	{"Path.Path", PathCTORNative},
 	{"Path.ComputeVector", PathComputeVectorNative},
 	{"Path.ComputeEntity", PathComputeEntityNative},
+	{"Path.ComputeVectorProfile", PathComputeVectorProfileNative},
+	{"Path.ComputeEntityProfile", PathComputeEntityProfileNative},
+	{"Path.ComputeOpenGoal", PathComputeOpenGoalNative},
+	{"Path.ComputeVectorAsync", PathComputeVectorAsyncNative},
+	{"Path.ComputeEntityAsync", PathComputeEntityAsyncNative},
+	{"Path.ComputeBatch", PathComputeBatchNative},
+	{"PathCache.Clear", PathCacheClearNative},
+	{"PathCache.GetStats", PathCacheGetStatsNative},
 	{"Path.Memory.get", PathMemoryget},
 	{"Path.Length.get", PathLengthget},
 	{"Path.Age.get", PathAgeget},
@@ -19180,6 +26947,17 @@ sp_nativeinfo_t natives[] =
 #endif
 	{"Path.CurrentGoal.get", PathCurrentGoalget},
 	{"Path.Invalidate", PathInvalidate},
+	{"PackedPath.PackedPath", PackedPathCTORNative},
+	{"PackedPath.Pack", PackedPathPack},
+	{"PackedPath.Unpack", PackedPathUnpack},
+	{"PackedPath.Share", PackedPathShare},
+	{"PackedPath.Sync", PackedPathSync},
+	{"PackedPath.Clear", PackedPathClear},
+	{"PackedPath.SegmentCount.get", PackedPathSegmentCountget},
+	{"PackedPath.Length.get", PackedPathLengthget},
+	{"PackedPath.Readable.get", PackedPathReadableget},
+	{"PackedPath.GetSegment", PackedPathGetSegment},
+	{"PathCostProfile.PathCostProfile", PathCostProfileCTORNative},
 	{"Segment.Area.get", SegmentAreaget},
 	{"Segment.Ladder.get", SegmentLadderget},
 	{"Segment.Type.get", SegmentTypeget},
@@ -19198,6 +26976,8 @@ sp_nativeinfo_t natives[] =
 	{"ChasePath.IsRepathNeeded", ChasePathIsRepathNeeded},
 	{"ChasePath.LeadRadius.set", ChasePathLeadRadiusset},
 	{"ChasePath.LeadRadius.get", ChasePathLeadRadiusget},
+	{"ChasePath.SearchMode.set", ChasePathSearchModeset},
+	{"ChasePath.SearchMode.get", ChasePathSearchModeget},
 	{"RetreatPath.Update", RetreatPathUpdateNative},
 	{"PathFollower.MinLookAheadDistance.get", PathFollowerMinLookAheadDistanceget},
 	{"PathFollower.MinLookAheadDistance.set", PathFollowerMinLookAheadDistanceset},
@@ -19245,10 +27025,12 @@ sp_nativeinfo_t natives[] =
 	{"TerrorNavArea.GetSpawnAttributes", TerrorNavAreaGetSpawnAttributes},
 #endif
 	{"CNavMesh.GetNearestNavAreaVector", CNavMeshGetNearestNavAreaVector},
+	{"CNavMesh.GetNearestNavAreaBatch", CNavMeshGetNearestNavAreaBatch},
 	{"CNavMesh.GetGroundHeight", CNavMeshGetGroundHeightNative},
 	{"CNavMesh.GetSimpleGroundHeight", CNavMeshGetSimpleGroundHeightNative},
 	{"CNavMesh.GetNavAreaCount", CNavMeshNavAreaCountget},
 	{"CNavMesh.GetPlace", CNavMeshGetPlace},
+	{"CNavMesh.GetRandomPoint", CNavMeshGetRandomPoint},
 	{"CNavMesh.PlaceToName", CNavMeshPlaceToName},
 	{"CNavMesh.NameToPlace", CNavMeshNameToPlace},
 	{"CNavMesh.GetNavAreaByID", CNavMeshGetNavAreaByID},
@@ -19269,6 +27051,7 @@ sp_nativeinfo_t natives[] =
 	{"CNavArea.GetZ", CNavAreaGetZ},
 	{"CNavArea.GetClosestPointOnArea", CNavAreaGetClosestPointOnArea},
 	{"CNavArea.IsBlocked", CNavAreaIsBlocked},
+	{"CNavArea.CanReach", CNavAreaCanReach},
 	{"CNavArea.IsEntirelyVisible", CNavAreaIsEntirelyVisible},
 	{"CNavArea.IsPartiallyVisible", CNavAreaIsPartiallyVisible},
 	{"CNavArea.IsPotentiallyVisible", CNavAreaIsPotentiallyVisible},
@@ -19660,6 +27443,7 @@ sp_nativeinfo_t natives[] =
 	{"GetNavAreaFromVector", GetNavAreaFromVector},
 	{"DirectionBetweenEntityVector", DirectionBetweenEntityVector},
 	{"CollectSurroundingAreas", CollectSurroundingAreasNative},
+	{"FilterSurroundingAreas", FilterSurroundingAreasNative},
 	{"SearchSurroundingAreas", SearchSurroundingAreasNative},
 	{"EntityVisibleEnt", EntityVisibleEnt},
 	{"EntityVisibleVec", EntityVisibleVec},
@@ -19734,9 +27518,20 @@ bool Sample::SDK_OnMetamodLoad(ISmmAPI *ismm, char *error, size_t maxlen, bool l
 
 void Sample::OnHandleDestroy(HandleType_t type, void *object)
 {
+	if(type != BehaviorEntryHandleType) {
+		g_PathAsyncQueue.Cancel(object);
+		PackedPath::ForgetPath((const Path *)object);
+	}
+
 	if(type == PathHandleType) {
 		Path *obj = (Path *)object;
 		delete obj;
+	} else if(type == PackedPathHandleType) {
+		PackedPath *obj = (PackedPath *)object;
+		delete obj;
+	} else if(type == PathCostProfileHandleType) {
+		PathCostProfile *obj = (PathCostProfile *)object;
+		delete obj;
 	} else if(type == PathFollowerHandleType) {
 		SPPathFollower<PathFollower> *obj = (SPPathFollower<PathFollower> *)object;
 		obj->handle_destroyed();
@@ -20079,7 +27874,6 @@ public:
 #if SOURCE_ENGINE == SE_TF2
 #define TF_TEAM_RED 2
 #define TF_TEAM_BLUE 3
-#define TF_TEAM_HALLOWEEN 5
 #endif
 
 unsigned int team_contents(int team)
@@ -20621,6 +28415,18 @@ void Sample::OnEntityCreated(CBaseEntity *pEntity, const char *classname_ptr)
 		return;
 	}
 
+	//func_nav_blocker/avoid/prefer change costs and blocked state of areas cached routes go through
+	if(classname.compare(0, 9, "func_nav_"s) == 0) {
+		g_NavPathCache.Clear();
+		g_NavFlowFields.Clear();
+		return;
+	}
+
+	//brushes and props that can move or go away between the ground heightfield's samples and the floor
+	if(classname.compare(0, 5, "func_"s) == 0 || classname.compare(0, 5, "prop_"s) == 0 || classname.compare(0, 4, "obj_"s) == 0) {
+		g_NavGroundHeightfield.Track(pEntity);
+	}
+
 #if SOURCE_ENGINE == SE_TF2
 	if(classname.compare(0, 14, "tf_projectile_"s) == 0) {
 		pEntity->AddIEFlags(EFL_DONTWALKON);
@@ -21238,8 +29044,27 @@ DETOUR_DECL_MEMBER0(NextBotCombatCharacterSpawn, void)
 	}
 }
 
+void Sample::OnEntityDestroyed(CBaseEntity *pEntity)
+{
+	g_NavGroundHeightfield.Untrack(pEntity);
+
+	if(strncmp(pEntity->GetClassname(), "func_nav_", 9) == 0) {
+		g_NavPathCache.Clear();
+		g_NavFlowFields.Clear();
+	}
+}
+
 void Sample::OnCoreMapStart(edict_t *pEdictList, int edictCount, int clientMax)
 {
+	++g_NavMeshGeneration;
+	g_NavPathCache.Clear();
+	g_NavPathCache.ResetStats();
+	g_NavConnectionGraph.EnsureBuilt();
+	g_NavHierarchy.EnsureBuilt();
+	g_NavLandmarks.EnsureBuilt();
+	g_NavVisibilityMatrix.EnsureBuilt();
+	g_NavAreaSampler.EnsureBuilt();
+
 	if(!gamerules_vtable_assigned) {
 		CGameRules *gamerules{(CGameRules *)g_pSDKTools->GetGameRules()};
 		if(gamerules) {
@@ -21328,6 +29153,28 @@ void Sample::OnCoreMapStart(edict_t *pEdictList, int edictCount, int clientMax)
 	}
 }
 
+void Sample::OnCoreMapEnd()
+{
+	// in flight searches still point into the nav mesh that is about to be destroyed
+	g_PathAsyncQueue.Flush();
+	++g_NavMeshGeneration;
+	g_NavPathCache.Clear();
+	g_NavFlowFields.Clear();
+	g_NavReachability.Clear();
+	g_NavIncrementalContexts.Clear();
+	g_NavAreaTree.Invalidate();
+	g_NavVisibilityMatrix.Invalidate();
+	g_NavGroundHeightfield.Clear();
+#if SOURCE_ENGINE == SE_TF2
+	g_NavFuncCostAreas.Clear();
+#endif
+	g_NavAreaSampler.Clear();
+	g_NavConnectionGraph.Invalidate();
+	g_NavHierarchy.Invalidate();
+	g_NavLandmarks.Invalidate();
+	g_NavDerivedCache.Invalidate();
+}
+
 #include "funnyfile.h"
 
 #if SOURCE_ENGINE == SE_TF2
@@ -21508,7 +29355,7 @@ cell_t CollectSurroundingAreasNative(IPluginContext *pContext, const cell_t *par
 	}
 
 	CUtlVector<CNavArea *> nearbyAreaVector{};
-	CollectSurroundingAreas(&nearbyAreaVector, (CNavArea *)params[2], sp_ctof(params[3]), sp_ctof(params[4]), sp_ctof(params[5]));
+	NavCollectSurroundingAreas(g_NavSearchContext, &nearbyAreaVector, (CNavArea *)params[2], sp_ctof(params[3]), sp_ctof(params[4]), sp_ctof(params[5]));
 
 	size_t len = nearbyAreaVector.Count();
 	obj->resize(len);
@@ -21520,6 +29367,46 @@ cell_t CollectSurroundingAreasNative(IPluginContext *pContext, const cell_t *par
 	return 0;
 }
 
+cell_t FilterSurroundingAreasNative(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	ICellArray *obj = nullptr;
+	HandleError err = ((HandleSystemHack *)handlesys)->ReadCoreHandle(params[1], arraylist_handle, &security, (void **)&obj);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+	}
+
+	if(params[10] < SURROUNDING_BLOCKED_SKIP || params[10] > SURROUNDING_BLOCKED_INCLUDE) {
+		return pContext->ThrowNativeError("invalid blocked type %i", params[10]);
+	}
+
+	NavSurroundingFilter filter{};
+	filter.travelDistanceLimit = sp_ctof(params[3]);
+	filter.maxCount = params[4];
+	filter.requiredAttributes = params[5];
+	filter.forbiddenAttributes = params[6];
+	filter.requiredGameAttributes = params[7];
+	filter.forbiddenGameAttributes = params[8];
+	filter.teamID = params[9];
+	filter.blocked = (NavSurroundingBlockedType)params[10];
+	filter.maxStepUpLimit = sp_ctof(params[11]);
+	filter.maxDropDownLimit = sp_ctof(params[12]);
+
+	CUtlVector<CNavArea *> nearbyAreaVector{};
+	NavFilterSurroundingAreas(g_NavSearchContext, &nearbyAreaVector, (CNavArea *)params[2], filter);
+
+	size_t len = nearbyAreaVector.Count();
+	obj->resize(len);
+
+	for(size_t i{0}; i < len; ++i) {
+		*obj->at(i) = (cell_t)nearbyAreaVector[i];
+	}
+
+	return (cell_t)len;
+}
+
 cell_t CollectAllBots(IPluginContext *pContext, const cell_t *params)
 {
 	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
@@ -21550,6 +29437,161 @@ cell_t CollectAllBots(IPluginContext *pContext, const cell_t *params)
 	return 0;
 }
 
+//layout of PathBatchQuery in nextbot.inc
+enum PathBatchField : size_t
+{
+	PathBatch_Path,
+	PathBatch_Bot,
+	PathBatch_Subject,
+	PathBatch_Goal,
+	PathBatch_Success = PathBatch_Goal + 3,
+	PathBatch_Size,
+};
+
+template <typename CostFunctor>
+bool PathComputeBatchQuery(Path *path, INextBot *bot, CBaseCombatCharacter *subject, const Vector &goal, CostFunctor &cost, float maxPathLength, bool includeGoalIfPathFails, PathSearchMode mode, int computeFlags)
+{
+	if(subject) {
+		return path->Compute(bot, subject, cost, maxPathLength, includeGoalIfPathFails, mode, NULL, computeFlags);
+	}
+	
+	return path->Compute(bot, goal, cost, maxPathLength, includeGoalIfPathFails, mode, NULL, computeFlags);
+}
+
+cell_t PathComputeBatchNative(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity security(pContext->GetIdentity(), myself->GetIdentity());
+	
+	ICellArray *obj = nullptr;
+	HandleError err = ((HandleSystemHack *)handlesys)->ReadCoreHandle(params[1], arraylist_handle, &security, (void **)&obj);
+	if(err != HandleError_None)
+	{
+		return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", params[1], err);
+	}
+	
+	if(obj->blocksize() < PathBatch_Size)
+	{
+		return pContext->ThrowNativeError("ArrayList blocksize %i is smaller than PathBatchQuery (%i)", (int)obj->blocksize(), (int)PathBatch_Size);
+	}
+	
+	//optional, the batch uses the native baseline cost without one
+	cell_t profileHandle = (params[0] >= 7) ? params[7] : BAD_HANDLE;
+	PathCostProfile *profile = nullptr;
+	if(profileHandle != BAD_HANDLE)
+	{
+		err = handlesys->ReadHandle(profileHandle, PathCostProfileHandleType, &security, (void **)&profile);
+		if(err != HandleError_None)
+		{
+			return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", profileHandle, err);
+		}
+	}
+	
+	struct query_t
+	{
+		Handle_t pathHandle;
+		Path *path;
+		INextBot *bot;
+		CBaseCombatCharacter *subject;
+		Vector goal;
+		CNavArea *startArea;
+		size_t index;
+	};
+	
+	size_t len = obj->size();
+	
+	std::vector<query_t> queries{};
+	queries.reserve(len);
+	
+	//validate and copy everything up front so a bad entry doesn't leave the batch half computed,
+	//OnPathChanged callbacks run during the batch and can change the list
+	for(size_t i{0}; i < len; ++i) {
+		cell_t *blk = obj->at(i);
+		
+		query_t query{};
+		query.index = i;
+		query.pathHandle = blk[PathBatch_Path];
+		
+		err = handlesys->ReadHandle(blk[PathBatch_Path], PathHandleType, &security, (void **)&query.path);
+		if(err != HandleError_None)
+		{
+			return pContext->ThrowNativeError("Invalid Handle %x at index %i (error: %d)", blk[PathBatch_Path], (int)i, err);
+		}
+		
+		query.bot = (INextBot *)blk[PathBatch_Bot];
+		if(!query.bot)
+		{
+			return pContext->ThrowNativeError("Invalid INextBot at index %i", (int)i);
+		}
+		
+		if(blk[PathBatch_Subject] != -1)
+		{
+			CBaseEntity *pSubject = gamehelpers->ReferenceToEntity(blk[PathBatch_Subject]);
+			query.subject = pSubject ? pSubject->MyCombatCharacterPointer() : nullptr;
+			if(!query.subject)
+			{
+				return pContext->ThrowNativeError("Invalid Entity Reference/Index %i at index %i", blk[PathBatch_Subject], (int)i);
+			}
+		}
+		
+		query.goal = Vector(sp_ctof(blk[PathBatch_Goal]), sp_ctof(blk[PathBatch_Goal+1]), sp_ctof(blk[PathBatch_Goal+2]));
+		query.startArea = query.bot->GetEntity()->GetLastKnownArea();
+		
+		blk[PathBatch_Success] = 0;
+		
+		queries.emplace_back(query);
+	}
+	
+	//bots starting in the same area run back to back so the search context and
+	//the path cache/flow fields stay warm for the goals they share
+	std::stable_sort(queries.begin(), queries.end(),
+		[](const query_t &a, const query_t &b) -> bool {
+			return a.startArea < b.startArea;
+		}
+	);
+	
+	unsigned int flags = params[2];
+	float maxPathLength = sp_ctof(params[3]);
+	bool includeGoalIfPathFails = params[4];
+	PathSearchMode mode = (PathSearchMode)params[5];
+	int computeFlags = (params[0] >= 6) ? params[6] : 0;
+	
+	cell_t found = 0;
+	
+	for(const query_t &query : queries) {
+		//a callback may have closed handles the batch still uses
+		Path *path = nullptr;
+		if(handlesys->ReadHandle(query.pathHandle, PathHandleType, &security, (void **)&path) != HandleError_None || path != query.path) {
+			continue;
+		}
+		
+		bool success = false;
+		if(profile) {
+			err = handlesys->ReadHandle(profileHandle, PathCostProfileHandleType, &security, (void **)&profile);
+			if(err != HandleError_None)
+			{
+				return pContext->ThrowNativeError("Invalid Handle %x (error: %d)", profileHandle, err);
+			}
+			
+			ProfilePathCost cost(query.bot, *profile);
+			success = PathComputeBatchQuery(query.path, query.bot, query.subject, query.goal, cost, maxPathLength, includeGoalIfPathFails, mode, computeFlags);
+		} else {
+			BaselinePathCost cost(query.bot, flags);
+			success = PathComputeBatchQuery(query.path, query.bot, query.subject, query.goal, cost, maxPathLength, includeGoalIfPathFails, mode, computeFlags);
+		}
+		
+		//the list can be shorter now, entries that are gone just don't get their result
+		if(query.index < obj->size()) {
+			*(obj->at(query.index) + PathBatch_Success) = success;
+		}
+		
+		if(success) {
+			++found;
+		}
+	}
+	
+	return found;
+}
+
 #if SOURCE_ENGINE == SE_TF2
 cell_t CTFNavAreaGetEnemyInvasionAreaVector(IPluginContext *pContext, const cell_t *params)
 {
@@ -22477,11 +30519,23 @@ bool Sample::SDK_OnLoad(char *error, size_t maxlen, bool late)
 	m_isGhostOffset = info.actual_offset;
 #endif
 
+#if SOURCE_ENGINE == SE_TF2
+	if(gamehelpers->FindSendPropInfo("CTFGameRulesProxy", "m_bPlayingMannVsMachine", &info)) {
+		m_bPlayingMannVsMachineOffset = info.actual_offset;
+	}
+
+	if(gamehelpers->FindSendPropInfo("CTFGameRulesProxy", "m_bTruceActive", &info)) {
+		m_bTruceActiveOffset = info.actual_offset;
+	}
+#endif
+
 	g_pEntityList = reinterpret_cast<CBaseEntityList *>(gamehelpers->GetGlobalEntityList());
 
 	HandleSystemHack::init();
 
 	PathHandleType = handlesys->CreateType("Path", this, 0, nullptr, nullptr, myself->GetIdentity(), nullptr);
+	PackedPathHandleType = handlesys->CreateType("PackedPath", this, 0, nullptr, nullptr, myself->GetIdentity(), nullptr);
+	PathCostProfileHandleType = handlesys->CreateType("PathCostProfile", this, 0, nullptr, nullptr, myself->GetIdentity(), nullptr);
 	PathFollowerHandleType = handlesys->CreateType("PathFollower", this, PathHandleType, nullptr, nullptr, myself->GetIdentity(), nullptr);
 
 #if SOURCE_ENGINE == SE_TF2
@@ -22499,6 +30553,7 @@ bool Sample::SDK_OnLoad(char *error, size_t maxlen, bool late)
 	BehaviorEntryHandleType = handlesys->CreateType("BehaviorActionEntry", this, 0, nullptr, nullptr, myself->GetIdentity(), nullptr);
 
 	plsys->AddPluginsListener(this);
+	smutils->AddGameFrameHook(PathAsyncGameFrame);
 
 #ifdef __HAS_DAMAGERULES
 	sharesys->AddDependency(myself, "damagerules.ext", false, true);
@@ -22521,6 +30576,8 @@ void Sample::OnPluginLoaded(IPlugin *plugin)
 
 void Sample::OnPluginUnloaded(IPlugin *plugin)
 {
+	g_PathAsyncQueue.Cancel(plugin->GetRuntime());
+
 	IdentityToken_t *pId{plugin->GetIdentity()};
 
 	auto it = spnbcomponents.find(pId);
@@ -22602,6 +30659,8 @@ void Sample::NotifyInterfaceDrop(SMInterface *pInterface)
 
 void Sample::SDK_OnUnload()
 {
+	smutils->RemoveGameFrameHook(PathAsyncGameFrame);
+	g_PathAsyncQueue.Shutdown();
 	forwards->ReleaseForward(nbspawn_fwd);
 	pPathOptimize->Destroy();
 	pAdjustSpeed->Destroy();
@@ -22622,6 +30681,8 @@ void Sample::SDK_OnUnload()
 	plsys->RemovePluginsListener(this);
 	g_pSDKHooks->RemoveEntityListener(this);
 	handlesys->RemoveType(PathHandleType, myself->GetIdentity());
+	handlesys->RemoveType(PackedPathHandleType, myself->GetIdentity());
+	handlesys->RemoveType(PathCostProfileHandleType, myself->GetIdentity());
 	handlesys->RemoveType(PathFollowerHandleType, myself->GetIdentity());
 #if SOURCE_ENGINE == SE_TF2
 	handlesys->RemoveType(CTFPathFollowerHandleType, myself->GetIdentity());
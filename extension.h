@@ -51,6 +51,7 @@ public:
 	virtual npc_type entity_to_npc_type(CBaseEntity *pEntity, const char *classname);
 
 	virtual void OnEntityCreated(CBaseEntity *pEntity, const char *classname);
+	virtual void OnEntityDestroyed(CBaseEntity *pEntity);
 
 	virtual void OnHandleDestroy(HandleType_t type, void *object);
 	virtual void OnPluginLoaded(IPlugin *plugin);
@@ -59,6 +60,7 @@ public:
 	virtual bool RegisterConCommandBase(ConCommandBase *pCommand);
 	
 	virtual void OnCoreMapStart(edict_t *pEdictList, int edictCount, int clientMax);
+	virtual void OnCoreMapEnd();
 	
 	bool QueryInterfaceDrop(SMInterface *pInterface);
 	virtual void NotifyInterfaceDrop(SMInterface *pInterface);